@@ -0,0 +1,110 @@
+#include "appstyle.h"
+
+const QString& AppStyle::styleSheet()
+{
+    static const QString sheet = QStringLiteral(
+        // Panels of the main window
+        "QFrame[role=\"panel\"] {"
+        "    background-color: white;"
+        "    border: 1px solid #bdc3c7;"
+        "    border-radius: 4px;"
+        "    padding: 5px;"
+        "}"
+        "QScrollArea[role=\"rules\"] {"
+        "    border: 1px solid #ecf0f1;"
+        "    border-radius: 4px;"
+        "    background-color: #fafafa;"
+        "}"
+        "ReplacementRowWidget {"
+        "    background-color: white;"
+        "    border: 1px solid #ecf0f1;"
+        "    border-radius: 4px;"
+        "    margin: 2px;"
+        "}"
+        "ReplacementRowWidget[issue=\"true\"] {"
+        "    background-color: #fdf2e9;"
+        "    border: 1px solid #e67e22;"
+        "}"
+        
+        // Text fields
+        "QLineEdit {"
+        "    border: 1px solid #bdc3c7;"
+        "    border-radius: 4px;"
+        "    padding: 5px;"
+        "    font-size: 12px;"
+        "}"
+        "QLineEdit:focus {"
+        "    border: 2px solid #3498db;"
+        "}"
+        "QPlainTextEdit[role=\"preview\"] {"
+        "    background-color: #2c3e50;"
+        "    color: #ecf0f1;"
+        "    font-family: 'Courier New', monospace;"
+        "    font-size: 11px;"
+        "    border: 1px solid #34495e;"
+        "    border-radius: 4px;"
+        "    padding: 10px;"
+        "}"
+        
+        // Labels
+        "QLabel[role=\"caution\"] {"
+        "    color: #e74c3c;"
+        "    font-weight: bold;"
+        "    background-color: #ffeaa7;"
+        "    padding: 8px;"
+        "    border-radius: 4px;"
+        "    border-left: 4px solid #e74c3c;"
+        "}"
+        "QLabel[role=\"heading\"] {"
+        "    font-size: 14px;"
+        "    font-weight: bold;"
+        "    color: #2c3e50;"
+        "}"
+        "QLabel[role=\"title\"] {"
+        "    font-size: 18px;"
+        "    font-weight: bold;"
+        "    color: #2c3e50;"
+        "    margin-bottom: 10px;"
+        "}"
+        "QLabel[role=\"hint\"] {"
+        "    font-size: 12px;"
+        "    color: #7f8c8d;"
+        "    margin-bottom: 10px;"
+        "}"
+        "QLabel[role=\"summary\"] {"
+        "    font-size: 12px;"
+        "    color: #2c3e50;"
+        "}"
+        "QLabel[role=\"arrow\"] {"
+        "    font-weight: bold;"
+        "    font-size: 14px;"
+        "    color: #7f8c8d;"
+        "}"
+        
+        // Buttons
+        "QPushButton[role=\"primary\"], QPushButton[role=\"execute\"],"
+        "QPushButton[role=\"danger\"], QPushButton[role=\"secondary\"] {"
+        "    color: white;"
+        "    border: none;"
+        "    border-radius: 4px;"
+        "    font-size: 12px;"
+        "    font-weight: bold;"
+        "}"
+        "QPushButton[role=\"primary\"] { background-color: #3498db; }"
+        "QPushButton[role=\"primary\"]:hover { background-color: #2980b9; }"
+        "QPushButton[role=\"primary\"]:pressed { background-color: #21618c; }"
+        "QPushButton[role=\"execute\"] { background-color: #27ae60; }"
+        "QPushButton[role=\"execute\"]:hover:enabled { background-color: #229954; }"
+        "QPushButton[role=\"execute\"]:pressed:enabled { background-color: #1e8449; }"
+        "QPushButton[role=\"danger\"] { background-color: #e74c3c; }"
+        "QPushButton[role=\"danger\"]:hover:enabled { background-color: #c0392b; }"
+        "QPushButton[role=\"danger\"]:pressed:enabled { background-color: #a93226; }"
+        "QPushButton[role=\"secondary\"] { background-color: #95a5a6; }"
+        "QPushButton[role=\"secondary\"]:hover { background-color: #7f8c8d; }"
+        "QPushButton[role=\"secondary\"]:pressed { background-color: #6c7b7d; }"
+        "QPushButton[role=\"execute\"]:disabled, QPushButton[role=\"danger\"]:disabled {"
+        "    background-color: #bdc3c7;"
+        "}"
+    );
+    return sheet;
+}
@@ -0,0 +1,18 @@
+#ifndef APPSTYLE_H
+#define APPSTYLE_H
+
+#include <QString>
+
+/**
+ * AppStyle holds the one stylesheet of the application. It is set once on
+ * the QApplication, so Qt parses it a single time instead of once per
+ * widget; widgets select their look through the "role" dynamic property
+ * (e.g. setProperty("role", "primary")) rather than carrying CSS of their own.
+ */
+class AppStyle
+{
+public:
+    static const QString& styleSheet();
+};
+
+#endif // APPSTYLE_H
@@ -0,0 +1,440 @@
+/**
+ * Headless batch tests
+ * BatchJob::replaceFiles() is run over small trees of random files and
+ * the files it leaves are compared with the pipeline's output for their
+ * original content: on io_uring against the thread pool, and restarted
+ * from the BatchJournal of an earlier run, which must pass over exactly
+ * the files that still hold their output.
+ *
+ * Usage: batch_tests [seed]
+ */
+
+#include "batchjob.h"
+#include "batchjournal.h"
+#include "contenthash.h"
+#include "uringbatch.h"
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QTemporaryDir>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+int g_failures = 0;
+int g_checks = 0;
+
+#define CHECK(condition, ...) \
+    do { \
+        ++g_checks; \
+        if (!(condition)) { \
+            ++g_failures; \
+            std::printf("FAIL %s:%d: %s: ", __FILE__, __LINE__, #condition); \
+            std::printf(__VA_ARGS__); \
+            std::printf("\n"); \
+        } \
+    } while (0)
+
+// Two stages, so a file's output depends on the first stage's output
+QJsonObject ruleSpec()
+{
+    QJsonArray rules;
+    rules.append(QJsonObject{{"find", "ab"}, {"replace", "xyz"}});
+    rules.append(QJsonObject{{"find", "abc"}, {"replace", "c"}});
+    rules.append(QJsonObject{{"find", "\xE3\x81\x82"}, {"replace", "a"}});
+    rules.append(QJsonObject{{"find", "zc"}, {"replace", "\xC3\xA9\xC3\xA9"}, {"stage", "second"}});
+    return QJsonObject{{"encoding", "UTF-8"}, {"rules", rules}};
+}
+
+// Random UTF-8 text of the rules' characters; without 'a' nothing matches
+std::string randomText(std::mt19937& rng, size_t length, bool matches)
+{
+    static const char *const pieces[] = {"b", "c", "z", "\n", "\xC3\xA9", "a", "\xE3\x81\x82"};
+    const size_t pieceCount = matches ? 7 : 5;
+    std::string text;
+    while (text.size() < length) {
+        text += pieces[rng() % pieceCount];
+    }
+    return text;
+}
+
+uint64_t hashOf(const std::string& content)
+{
+    return ContentHash::hash64(content.data(), content.size());
+}
+
+bool writeFile(const QString& path, const std::string& content)
+{
+    QFile file(path);
+    return file.open(QIODevice::WriteOnly)
+        && file.write(content.data(), static_cast<qint64>(content.size())) == static_cast<qint64>(content.size());
+}
+
+std::string readFile(const QString& path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return std::string();
+    }
+    const QByteArray bytes = file.readAll();
+    return std::string(bytes.constData(), static_cast<size_t>(bytes.size()));
+}
+
+// Compiled pipeline of ruleSpec()
+bool buildPipeline(RulePipeline& pipeline)
+{
+    TextEncoding encoding;
+    QString error;
+    if (!BatchJob::parseRules(ruleSpec(), pipeline, encoding, &error)) {
+        std::printf("rules: %s\n", qPrintable(error));
+        return false;
+    }
+    pipeline.compile(encoding);
+    return true;
+}
+
+// Output of the pipeline for input and its number of matches
+std::string replaced(const RulePipeline& pipeline, const std::string& input, quint64 *matches = nullptr)
+{
+    RuleStats stats;
+    stats.reset(pipeline.ruleCount());
+    std::string output;
+    pipeline.replaceInto(input.data(), input.size(), output, &stats);
+    if (matches) {
+        *matches = stats.totalHits();
+    }
+    return output;
+}
+
+// Move a file's modification time away from the one journaled for it
+bool touch(const QString& path, qint64 seconds)
+{
+    QFile file(path);
+    return file.open(QIODevice::ReadWrite)
+        && file.setFileTime(QDateTime::currentDateTime().addSecs(seconds), QFileDevice::FileModificationTime);
+}
+
+// Files of a tree, as written by makeTree()
+struct Tree {
+    QStringList paths;
+    std::vector<std::string> contents;
+};
+
+// The same random files under root for every rng in the same state: small
+// ones the ring takes, files without matches, an empty one, one in a
+// subdirectory and one above the ring's file limit, which the ring hands
+// back to the regular path
+Tree makeTree(std::mt19937& rng, const QString& root)
+{
+    Tree tree;
+    QDir(root).mkpath("sub");
+    for (int i = 0; i < 48; ++i) {
+        size_t length = rng() % 4096;
+        if (i == 0) {
+            length = 0;
+        } else if (i == 1) {
+            length = UringBatch::kDefaultFileLimit + 1000;
+        }
+        const QString name = QString(i % 7 == 3 ? "sub/%1.txt" : "%1.txt").arg(i);
+        tree.paths.append(QDir(root).filePath(name));
+        tree.contents.push_back(randomText(rng, length, i % 5 != 2));
+        CHECK(writeFile(tree.paths.last(), tree.contents.back()), "write %s", qPrintable(name));
+    }
+    return tree;
+}
+
+void testUringMatchesThreads(std::mt19937& rng)
+{
+    if (!UringBatch().isReady()) {
+        std::printf("io_uring is not available here, skipped\n");
+        return;
+    }
+    RulePipeline pipeline;
+    if (!buildPipeline(pipeline)) {
+        CHECK(false, "pipeline");
+        return;
+    }
+
+    QTemporaryDir root;
+    CHECK(root.isValid(), "temporary directory");
+    std::mt19937 uringRng = rng;
+    const Tree threadTree = makeTree(rng, root.filePath("threads"));
+    const Tree uringTree = makeTree(uringRng, root.filePath("uring"));
+
+    RuleStats threadStats;
+    RuleStats uringStats;
+    threadStats.reset(pipeline.ruleCount());
+    uringStats.reset(pipeline.ruleCount());
+    const QVector<BatchResult> threads =
+        BatchJob::replaceFiles(pipeline, threadTree.paths, 3, &threadStats, nullptr, nullptr, BatchIo::Threads);
+    const QVector<BatchResult> uring =
+        BatchJob::replaceFiles(pipeline, uringTree.paths, 3, &uringStats, nullptr, nullptr, BatchIo::Uring);
+
+    CHECK(threads.size() == threadTree.paths.size() && uring.size() == uringTree.paths.size(), "result count");
+    for (qsizetype i = 0; i < threads.size() && i < uring.size(); ++i) {
+        const BatchResult& t = threads[i];
+        const BatchResult& u = uring[i];
+        const QByteArray fileName = QFileInfo(u.path).fileName().toUtf8();
+        const char *name = fileName.constData();
+        CHECK(u.path == uringTree.paths[i] && t.path == threadTree.paths[i], "%s: order", name);
+        CHECK(t.ok && u.ok, "%s: %s / %s", name, qPrintable(t.error), qPrintable(u.error));
+        CHECK(u.matches == t.matches, "%s: %llu matches, %llu on threads", name,
+              static_cast<unsigned long long>(u.matches), static_cast<unsigned long long>(t.matches));
+        CHECK(u.bytesIn == t.bytesIn && u.bytesOut == t.bytesOut, "%s: %lld -> %lld bytes, %lld -> %lld on threads",
+              name, static_cast<long long>(u.bytesIn), static_cast<long long>(u.bytesOut),
+              static_cast<long long>(t.bytesIn), static_cast<long long>(t.bytesOut));
+        CHECK(u.written == t.written, "%s: written %d, %d on threads", name, u.written, t.written);
+
+        std::string expected;
+        pipeline.replaceInto(uringTree.contents[static_cast<size_t>(i)].data(),
+                             uringTree.contents[static_cast<size_t>(i)].size(), expected);
+        const std::string uringOutput = readFile(u.path);
+        CHECK(uringOutput == expected, "%s: uring output differs from the pipeline's", name);
+        CHECK(readFile(t.path) == uringOutput, "%s: thread output differs from uring's", name);
+    }
+    CHECK(uringStats.totalHits() == threadStats.totalHits(), "%llu hits, %llu on threads",
+          static_cast<unsigned long long>(uringStats.totalHits()),
+          static_cast<unsigned long long>(threadStats.totalHits()));
+    CHECK(uringStats.sizeDelta() == threadStats.sizeDelta(), "size delta");
+}
+
+
+// A line cut short by a killed run is dropped, and the next record is
+// appended after the last complete line instead of to the cut one
+void testJournalTruncatedLine(std::mt19937& rng)
+{
+    QTemporaryDir root;
+    CHECK(root.isValid(), "temporary directory");
+    const uint64_t ruleSet = 0x5eed;
+    QStringList files;
+    for (const char *name : {"done.txt", "pending.txt", "cut.txt", "later.txt"}) {
+        files.append(root.filePath(name));
+        CHECK(writeFile(files.last(), randomText(rng, 100, true)), "write %s", name);
+    }
+
+    // The cut line is a complete record of cut.txt without its newline
+    QString error;
+    QByteArray cutLine;
+    {
+        BatchJournal scratch;
+        CHECK(scratch.open(root.filePath("scratch.journal"), ruleSet, &error), "%s", qPrintable(error));
+        scratch.done(files[2], 1, 1, 0);
+        scratch.close();
+        QFile file(root.filePath("scratch.journal"));
+        CHECK(file.open(QIODevice::ReadOnly), "read scratch journal");
+        const QByteArray contents = file.readAll();
+        cutLine = contents.mid(contents.lastIndexOf('\n', contents.size() - 2) + 1);
+        cutLine.chop(1);
+    }
+
+    const QString path = root.filePath("run.journal");
+    {
+        BatchJournal journal;
+        CHECK(journal.open(path, ruleSet, &error), "%s", qPrintable(error));
+        journal.done(files[0], 1, 2, 3);
+        journal.pending(files[1], 4, 5, 100, 6);
+        journal.close();
+    }
+    const qint64 complete = QFileInfo(path).size();
+    {
+        QFile file(path);
+        CHECK(file.open(QIODevice::Append) && file.write(cutLine) == cutLine.size(), "append the cut line");
+    }
+
+    BatchJournal journal;
+    CHECK(journal.open(path, ruleSet, &error), "%s", qPrintable(error));
+    CHECK(journal.loadedCount() == 2, "%d records loaded", journal.loadedCount());
+    CHECK(QFileInfo(path).size() == complete, "cut line not removed");
+    BatchJournal::Record record;
+    CHECK(!journal.finished(files[2], &record), "the cut record counts");
+    CHECK(journal.finished(files[0], &record) && record.done && record.matches == 3, "done record lost");
+    journal.done(files[3], 7, 8, 9);
+    journal.close();
+
+    CHECK(journal.open(path, ruleSet, &error), "%s", qPrintable(error));
+    CHECK(journal.loadedCount() == 3, "%d records after appending", journal.loadedCount());
+    CHECK(journal.finished(files[3], &record) && record.matches == 9, "appended record lost");
+}
+
+// A save that went through before the run was killed leaves a pending
+// record and the output on disk: the restart counts the file as done. A
+// pending file that still holds its input is replaced.
+void testJournalPendingSave(std::mt19937& rng)
+{
+    RulePipeline pipeline;
+    if (!buildPipeline(pipeline)) {
+        CHECK(false, "pipeline");
+        return;
+    }
+    QTemporaryDir root;
+    CHECK(root.isValid(), "temporary directory");
+    const uint64_t ruleSet = pipeline.ruleSetHash(pipeline.encoding());
+    const QString path = root.filePath("run.journal");
+    const QStringList files = {root.filePath("saved.txt"), root.filePath("unsaved.txt")};
+
+    std::string input;
+    std::string output;
+    quint64 matches = 0;
+    while (matches == 0) {
+        input = randomText(rng, 2000, true);
+        output = replaced(pipeline, input, &matches);
+    }
+    CHECK(writeFile(files[0], output) && writeFile(files[1], input), "write files");
+
+    QString error;
+    BatchJournal journal;
+    CHECK(journal.open(path, ruleSet, &error), "%s", qPrintable(error));
+    for (const QString& file : files) {
+        journal.pending(file, hashOf(input), hashOf(output), static_cast<qint64>(output.size()), matches);
+    }
+    journal.close();
+
+    CHECK(journal.open(path, ruleSet, &error), "%s", qPrintable(error));
+    const QVector<BatchResult> results =
+        BatchJob::replaceFiles(pipeline, files, 1, nullptr, nullptr, nullptr, BatchIo::Threads, &journal);
+    CHECK(results.size() == 2, "result count");
+    if (results.size() == 2) {
+        CHECK(results[0].ok && results[0].resumed && !results[0].written, "saved file not passed over");
+        CHECK(results[0].matches == matches, "%llu matches resumed, %llu journaled",
+              static_cast<unsigned long long>(results[0].matches), static_cast<unsigned long long>(matches));
+        CHECK(results[1].ok && !results[1].resumed && results[1].written, "unsaved file not replaced");
+        CHECK(results[1].matches == matches, "unsaved file: %llu matches",
+              static_cast<unsigned long long>(results[1].matches));
+    }
+    CHECK(readFile(files[0]) == output && readFile(files[1]) == output, "outputs");
+
+    // Both are journaled as done now, so the next restart only stats them
+    journal.close();
+    CHECK(journal.open(path, ruleSet, &error), "%s", qPrintable(error));
+    BatchJournal::Record record;
+    CHECK(journal.finished(files[0], &record) && record.done, "saved file not journaled as done");
+    CHECK(journal.finished(files[1], &record) && record.done, "unsaved file not journaled as done");
+}
+
+// Records of another rule set are kept but never count as done, even
+// for a file that has not changed since
+void testJournalOtherRuleSet(std::mt19937& rng)
+{
+    RulePipeline pipeline;
+    if (!buildPipeline(pipeline)) {
+        CHECK(false, "pipeline");
+        return;
+    }
+    QTemporaryDir root;
+    CHECK(root.isValid(), "temporary directory");
+    const uint64_t ruleSet = pipeline.ruleSetHash(pipeline.encoding());
+    const uint64_t otherRuleSet = ruleSet ^ 1;
+    const QString path = root.filePath("run.journal");
+    const QStringList files = {root.filePath("file.txt")};
+    const std::string input = randomText(rng, 2000, true);
+    CHECK(writeFile(files[0], input), "write file");
+
+    QString error;
+    BatchJournal journal;
+    CHECK(journal.open(path, otherRuleSet, &error), "%s", qPrintable(error));
+    BatchJob::replaceFiles(pipeline, files, 1, nullptr, nullptr, nullptr, BatchIo::Threads, &journal);
+    journal.close();
+    const std::string firstOutput = readFile(files[0]);
+
+    // Done under the rule set that wrote it
+    BatchJournal::Record record;
+    CHECK(journal.open(path, otherRuleSet, &error), "%s", qPrintable(error));
+    CHECK(journal.finished(files[0], &record) && record.done, "not done for its own rule set");
+    journal.close();
+
+    CHECK(journal.open(path, ruleSet, &error), "%s", qPrintable(error));
+    CHECK(journal.loadedCount() > 0, "records of the other rule set dropped");
+    CHECK(!journal.finished(files[0], &record), "done for another rule set");
+    const QVector<BatchResult> results =
+        BatchJob::replaceFiles(pipeline, files, 1, nullptr, nullptr, nullptr, BatchIo::Threads, &journal);
+    CHECK(results.size() == 1 && results[0].ok && !results[0].resumed, "passed over for another rule set");
+    CHECK(readFile(files[0]) == replaced(pipeline, firstOutput), "output");
+}
+
+// A file changed since the run is replaced again; one that was only
+// touched still holds the output and is passed over after a read
+void testJournalTouchedFile(std::mt19937& rng)
+{
+    RulePipeline pipeline;
+    if (!buildPipeline(pipeline)) {
+        CHECK(false, "pipeline");
+        return;
+    }
+    QTemporaryDir root;
+    CHECK(root.isValid(), "temporary directory");
+    const uint64_t ruleSet = pipeline.ruleSetHash(pipeline.encoding());
+    const QString path = root.filePath("run.journal");
+    const Tree tree = makeTree(rng, root.filePath("tree"));
+
+    QString error;
+    BatchJournal journal;
+    CHECK(journal.open(path, ruleSet, &error), "%s", qPrintable(error));
+    const QVector<BatchResult> first =
+        BatchJob::replaceFiles(pipeline, tree.paths, 3, nullptr, nullptr, nullptr, BatchIo::Threads, &journal);
+    journal.close();
+    for (const BatchResult& result : first) {
+        CHECK(result.ok && !result.resumed, "%s: %s", qPrintable(result.path), qPrintable(result.error));
+    }
+
+    // Same size, other content: only the hash tells it apart
+    const qsizetype changed = 5;
+    const qsizetype touched = 6;
+    const std::string before = readFile(tree.paths[changed]);
+    std::string edited = before;
+    for (char& c : edited) {
+        c = c == 'b' ? 'a' : c == 'a' ? 'b' : c;
+    }
+    CHECK(edited != before, "edit changes nothing");
+    CHECK(writeFile(tree.paths[changed], edited) && touch(tree.paths[changed], 3600), "edit");
+    CHECK(touch(tree.paths[touched], 3600), "touch");
+
+    CHECK(journal.open(path, ruleSet, &error), "%s", qPrintable(error));
+    const QVector<BatchResult> second =
+        BatchJob::replaceFiles(pipeline, tree.paths, 3, nullptr, nullptr, nullptr, BatchIo::Threads, &journal);
+    CHECK(second.size() == tree.paths.size(), "result count");
+    for (qsizetype i = 0; i < second.size(); ++i) {
+        const BatchResult& result = second[i];
+        const QByteArray fileName = QFileInfo(result.path).fileName().toUtf8();
+        CHECK(result.ok, "%s: %s", fileName.constData(), qPrintable(result.error));
+        CHECK(result.resumed == (i != changed), "%s: resumed %d", fileName.constData(), result.resumed);
+        if (i != changed) {
+            CHECK(result.matches == first[i].matches, "%s: %llu matches resumed, %llu replaced", fileName.constData(),
+                  static_cast<unsigned long long>(result.matches),
+                  static_cast<unsigned long long>(first[i].matches));
+        }
+    }
+    CHECK(readFile(tree.paths[changed]) == replaced(pipeline, edited), "changed file's output");
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    const unsigned seed = argc > 1 ? static_cast<unsigned>(std::strtoul(argv[1], nullptr, 10)) : 20240601u;
+    std::mt19937 rng(seed);
+    std::printf("seed %u\n", seed);
+
+    const struct {
+        const char *name;
+        void (*run)(std::mt19937& rng);
+    } tests[] = {
+        {"uring vs threads", testUringMatchesThreads},
+        {"journal cut line", testJournalTruncatedLine},
+        {"journal pending save", testJournalPendingSave},
+        {"journal rule sets", testJournalOtherRuleSet},
+        {"journal touched file", testJournalTouchedFile},
+    };
+    for (const auto& test : tests) {
+        const int failuresBefore = g_failures;
+        test.run(rng);
+        std::printf("%-20s %s\n", test.name, g_failures == failuresBefore ? "ok" : "FAILED");
+    }
+    std::printf("%d checks, %d failed\n", g_checks, g_failures);
+    return g_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,651 @@
+#include "batchjob.h"
+#include "tracer.h"
+#include "ruleanalyzer.h"
+#include "uringbatch.h"
+#include <QFile>
+#include <QSaveFile>
+#include <QJsonArray>
+#include <QThread>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+// Result cache lookup of one file's content
+struct CacheLookup {
+    ResultCache *cache = nullptr;
+    ResultCache::Key key;
+    std::shared_ptr<const ResultCache::Entry> entry;
+};
+
+// Whether data has matches. Content the rule set has seen before is
+// answered from the cache without a scan.
+bool findMatches(const RulePipeline& pipeline, const char *data, size_t size, CacheLookup& lookup)
+{
+    if (lookup.cache) {
+        lookup.key = ResultCache::key(pipeline, data, size);
+        lookup.entry = lookup.cache->find(lookup.key);
+    }
+    const bool hasMatch = lookup.entry ? lookup.entry->matches > 0 : pipeline.containsMatch(data, size);
+    if (lookup.cache && !lookup.entry && !hasMatch) {
+        lookup.cache->insert(lookup.key, ResultCache::Entry());
+    }
+    return hasMatch;
+}
+
+// Append the output for data with matches to output (QByteArray,
+// std::string), rebuilt from a cached match index when there is one.
+// fromCache is cleared when the rules had to run.
+template <typename Output>
+void buildOutput(const RulePipeline& pipeline, const char *data, size_t size, const CacheLookup& lookup,
+                 Output& output, RuleStats& fileStats, bool *fromCache)
+{
+    const int64_t length = static_cast<int64_t>(size);
+    if (lookup.entry && ResultCache::hasUsableIndex(*lookup.entry, pipeline)) {
+        const ReplaceEngine& engine = pipeline.pass(0);
+        output.reserve(length + lookup.entry->sizeDelta);
+        ResultCache::apply(engine, *lookup.entry, data, size, output);
+        for (const ReplaceMatch& m : lookup.entry->index) {
+            fileStats.recordHit(m.rule, m.length, engine.replacement(m.rule).size());
+        }
+        return;
+    }
+    *fromCache = false;
+    if (lookup.cache && pipeline.passCount() == 1) {
+        // One pass: the scan yields the index, which builds the output
+        ResultCache::Entry entry = ResultCache::scan(pipeline, data, size, &fileStats);
+        output.reserve(length + entry.sizeDelta);
+        ResultCache::apply(pipeline.pass(0), entry, data, size, output);
+        lookup.cache->insert(lookup.key, std::move(entry));
+        return;
+    }
+    output.reserve(length);
+    pipeline.replaceInto(data, size, output, &fileStats);
+    if (lookup.cache) {
+        ResultCache::Entry entry;
+        entry.matches = fileStats.totalHits();
+        entry.sizeDelta = static_cast<int64_t>(output.size()) - length;
+        lookup.cache->insert(lookup.key, std::move(entry));
+    }
+}
+
+// Fill result for a file that journal has as finished by an earlier run
+bool resumeFile(BatchJournal *journal, const QString& path, BatchResult& result)
+{
+    BatchJournal::Record record;
+    if (!journal || !journal->finished(path, &record)) {
+        return false;
+    }
+    result = BatchResult();
+    result.path = path;
+    result.ok = true;
+    result.resumed = true;
+    result.matches = record.matches;
+    result.bytesIn = record.size;
+    result.bytesOut = record.size;
+    return true;
+}
+
+} // namespace
+
+QJsonObject BatchResult::toJson() const
+{
+    QJsonObject object;
+    object["path"] = path;
+    object["ok"] = ok;
+    if (!ok) {
+        object["error"] = error;
+    }
+    object["matches"] = static_cast<qint64>(matches);
+    object["bytesIn"] = bytesIn;
+    object["bytesOut"] = bytesOut;
+    object["written"] = written;
+    if (streamed) {
+        object["streamed"] = true;
+    }
+    if (cached) {
+        object["cached"] = true;
+    }
+    if (resumed) {
+        object["resumed"] = true;
+    }
+    if (compression != Compression::None) {
+        object["compression"] = CompressedIO::name(compression);
+    }
+    return object;
+}
+
+bool BatchJob::parseRules(const QJsonObject& spec, RulePipeline& pipeline, TextEncoding& encoding,
+                          QString *error, size_t *dropped)
+{
+    encoding = TextEncoding::Utf8;
+    const QString encodingName = spec.value("encoding").toString();
+    if (!encodingName.isEmpty() && !TextCodec::fromName(encodingName.toLatin1().constData(), encoding)) {
+        *error = QString("unknown encoding: %1").arg(encodingName);
+        return false;
+    }
+
+    const QJsonValue rules = spec.value("rules");
+    if (!rules.isArray()) {
+        *error = "rules must be an array";
+        return false;
+    }
+
+    RuleAnalyzer analyzer;
+    std::string before;
+    std::string after;
+    for (const QJsonValue& value : rules.toArray()) {
+        const QJsonObject rule = value.toObject();
+        const QString find = rule.value("find").toString();
+        if (find.isEmpty()) {
+            continue;
+        }
+        if (!TextCodec::fromQString(find, encoding, before)
+            || !TextCodec::fromQString(rule.value("replace").toString(), encoding, after)) {
+            *error = QString("rule not representable in %1: %2").arg(TextCodec::name(encoding), find);
+            return false;
+        }
+        analyzer.add(rule.value("stage").toString().toStdString(), before, after);
+    }
+    const size_t droppedRules = analyzer.build(pipeline, encoding);
+    if (dropped) {
+        *dropped = droppedRules;
+    }
+    if (pipeline.isEmpty()) {
+        *error = droppedRules > 0 ? "no rule changes the text" : "no rules";
+        return false;
+    }
+    return true;
+}
+
+BatchResult BatchJob::replaceFile(const RulePipeline& pipeline, const QString& path, const QString& outputPath,
+                                  RuleStats *stats, MemoryMeter *memory, ResultCache *cache,
+                                  BatchJournal *journal)
+{
+    TRACE_SCOPE("batchFile");
+
+    BatchResult result;
+    result.path = path;
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        result.error = file.errorString();
+        return result;
+    }
+
+    // Map the input so files without matches are never copied; the save
+    // renames over the file and leaves the mapped inode intact. Windows
+    // cannot replace a mapped file, so there it is read.
+    const qint64 size = file.size();
+    const QString target = outputPath.isEmpty() ? path : outputPath;
+    if (target != path) {
+        journal = nullptr;
+    }
+    QByteArray buffer;
+    MemoryHold inputHold(memory, MemoryMeter::Category::Input);
+    const char *data = nullptr;
+#ifndef Q_OS_WIN
+    if (size > 0) {
+        data = reinterpret_cast<const char *>(file.map(0, size));
+    }
+#endif
+    if (!data) {
+        // A file that cannot be mapped and does not fit the budget is
+        // read in chunks as it is replaced
+        if (!inputHold.tryResize(static_cast<size_t>(size))) {
+            const QByteArray head = file.peek(8);
+            const Compression compression = CompressedIO::detect(head.constData(), static_cast<size_t>(head.size()));
+            QString readError;
+            auto source = [&file, &readError](const StreamReplacer::Writer& feed) {
+                QByteArray chunk;
+                for (;;) {
+                    chunk = file.read(STREAM_CHUNK_SIZE);
+                    if (chunk.isEmpty()) {
+                        if (!file.atEnd()) {
+                            readError = file.errorString();
+                        }
+                        return;
+                    }
+                    feed(chunk.constData(), static_cast<size_t>(chunk.size()));
+                }
+            };
+            if (compression != Compression::None) {
+                return replaceCompressed(pipeline, compression, source, size, path, target, stats, &readError,
+                                         journal);
+            }
+            return replaceStreamed(pipeline, source, size, path, target, stats, &readError, journal);
+        }
+        buffer = file.readAll();
+        data = buffer.constData();
+    }
+    result.bytesIn = size;
+
+    const Compression compression = CompressedIO::detect(data, static_cast<size_t>(size));
+    if (compression != Compression::None) {
+        auto source = [data, size](const StreamReplacer::Writer& feed) { feed(data, static_cast<size_t>(size)); };
+        return replaceCompressed(pipeline, compression, source, size, path, target, stats, nullptr, journal);
+    }
+    
+    CacheLookup lookup;
+    lookup.cache = cache;
+    const bool hasMatch = findMatches(pipeline, data, static_cast<size_t>(size), lookup);
+    result.cached = lookup.entry != nullptr;
+    uint64_t inputHash = 0;
+    if (journal) {
+        inputHash = cache ? lookup.key.content : ContentHash::hash64(data, static_cast<size_t>(size));
+    }
+    if (!hasMatch && target == path) {
+        result.ok = true;
+        result.bytesOut = size;
+        if (journal) {
+            journal->done(path, inputHash, inputHash, 0);
+        }
+        return result;
+    }
+
+    // An output buffer beyond the budget is replaced by writing the
+    // output to the file as it is produced
+    MemoryHold outputHold(memory, MemoryMeter::Category::Output);
+    if (hasMatch && !outputHold.tryResize(static_cast<size_t>(size))) {
+        auto source = [data, size](const StreamReplacer::Writer& feed) { feed(data, static_cast<size_t>(size)); };
+        return replaceStreamed(pipeline, source, size, path, target, stats, nullptr, journal);
+    }
+
+    QByteArray output;
+    if (hasMatch) {
+        RuleStats fileStats;
+        fileStats.reset(pipeline.ruleCount());
+        buildOutput(pipeline, data, static_cast<size_t>(size), lookup, output, fileStats, &result.cached);
+        outputHold.resize(static_cast<size_t>(output.capacity()));
+        result.matches = fileStats.totalHits();
+        if (stats) {
+            stats->merge(fileStats);
+        }
+    } else {
+        output = QByteArray::fromRawData(data, size);
+    }
+
+    QSaveFile save(target);
+    if (!save.open(QIODevice::WriteOnly) || save.write(output) != output.size()) {
+        result.error = save.errorString();
+        return result;
+    }
+    uint64_t outputHash = 0;
+    if (journal) {
+        outputHash = ContentHash::hash64(output.constData(), static_cast<size_t>(output.size()));
+        journal->pending(path, inputHash, outputHash, output.size(), result.matches);
+    }
+    if (!save.commit()) {
+        result.error = save.errorString();
+        return result;
+    }
+    result.ok = true;
+    result.written = true;
+    result.bytesOut = output.size();
+    if (journal) {
+        journal->done(path, inputHash, outputHash, result.matches);
+    }
+    return result;
+}
+
+BatchResult BatchJob::replaceCompressed(const RulePipeline& pipeline, Compression compression,
+                                        const Source& source, qint64 size, const QString& path,
+                                        const QString& target, RuleStats *stats, const QString *readError,
+                                        BatchJournal *journal)
+{
+    BatchResult result;
+    result.path = path;
+    result.bytesIn = size;
+    result.compression = compression;
+
+    // Whether anything matches is only known at the end of the stream, so
+    // the output is always produced and discarded when nothing changed
+    QSaveFile save(target);
+    if (!save.open(QIODevice::WriteOnly)) {
+        result.error = save.errorString();
+        return result;
+    }
+    bool writeFailed = false;
+    RuleStats fileStats;
+    fileStats.reset(pipeline.ruleCount());
+    ContentHash inputHash;
+    ContentHash outputHash;
+    const CompressedReplacer::Result run = CompressedReplacer::run(
+        pipeline, compression, journal ? hashing(source, &inputHash) : source,
+        [&](const char *bytes, size_t length) {
+            writeFailed = writeFailed || save.write(bytes, static_cast<qint64>(length)) != static_cast<qint64>(length);
+            if (journal) {
+                outputHash.update(bytes, length);
+            }
+        },
+        &fileStats);
+    if (readError && !readError->isEmpty()) {
+        save.cancelWriting();
+        result.error = *readError;
+        return result;
+    }
+    if (!run.ok || writeFailed) {
+        save.cancelWriting();
+        result.error = run.ok ? save.errorString() : QString::fromStdString(run.error);
+        return result;
+    }
+
+    result.matches = run.matches;
+    if (stats) {
+        stats->merge(fileStats);
+    }
+    if (run.matches == 0 && target == path) {
+        save.cancelWriting();
+        result.ok = true;
+        result.bytesOut = size;
+        if (journal) {
+            journal->done(path, inputHash.digest(), inputHash.digest(), 0);
+        }
+        return result;
+    }
+    if (journal) {
+        journal->pending(path, inputHash.digest(), outputHash.digest(), static_cast<qint64>(run.bytesOut),
+                         run.matches);
+    }
+    if (!save.commit()) {
+        result.error = save.errorString();
+        return result;
+    }
+    result.ok = true;
+    result.written = true;
+    result.bytesOut = static_cast<qint64>(run.bytesOut);
+    if (journal) {
+        journal->done(path, inputHash.digest(), outputHash.digest(), run.matches);
+    }
+    return result;
+}
+
+BatchResult BatchJob::replaceStreamed(const RulePipeline& pipeline, const Source& source, qint64 size,
+                                      const QString& path, const QString& target, RuleStats *stats,
+                                      const QString *readError, BatchJournal *journal)
+{
+    TRACE_SCOPE("batchStreamed");
+
+    BatchResult result;
+    result.path = path;
+    result.bytesIn = size;
+    result.streamed = true;
+
+    // As with compressed files, the output is produced before it is known
+    // whether anything matched
+    QSaveFile save(target);
+    if (!save.open(QIODevice::WriteOnly)) {
+        result.error = save.errorString();
+        return result;
+    }
+    bool writeFailed = false;
+    quint64 bytesOut = 0;
+    RuleStats fileStats;
+    fileStats.reset(pipeline.ruleCount());
+    ContentHash inputHash;
+    ContentHash outputHash;
+    const uint64_t matches = pipeline.stream(
+        journal ? hashing(source, &inputHash) : source,
+        [&](const char *bytes, size_t length) {
+            writeFailed = writeFailed || save.write(bytes, static_cast<qint64>(length)) != static_cast<qint64>(length);
+            bytesOut += length;
+            if (journal) {
+                outputHash.update(bytes, length);
+            }
+        },
+        &fileStats);
+    if (writeFailed || (readError && !readError->isEmpty())) {
+        save.cancelWriting();
+        result.error = writeFailed ? save.errorString() : *readError;
+        return result;
+    }
+
+    result.matches = matches;
+    if (stats) {
+        stats->merge(fileStats);
+    }
+    if (matches == 0 && target == path) {
+        save.cancelWriting();
+        result.ok = true;
+        result.bytesOut = size;
+        if (journal) {
+            journal->done(path, inputHash.digest(), inputHash.digest(), 0);
+        }
+        return result;
+    }
+    if (journal) {
+        journal->pending(path, inputHash.digest(), outputHash.digest(), static_cast<qint64>(bytesOut), matches);
+    }
+    if (!save.commit()) {
+        result.error = save.errorString();
+        return result;
+    }
+    result.ok = true;
+    result.written = true;
+    result.bytesOut = static_cast<qint64>(bytesOut);
+    if (journal) {
+        journal->done(path, inputHash.digest(), outputHash.digest(), matches);
+    }
+    return result;
+}
+
+BatchJob::Source BatchJob::hashing(const Source& source, ContentHash *hash)
+{
+    return [source, hash](const StreamReplacer::Writer& feed) {
+        source([&feed, hash](const char *data, size_t length) {
+            hash->update(data, length);
+            feed(data, length);
+        });
+    };
+}
+
+std::string BatchJob::sampleInput(const QStringList& files)
+{
+    TRACE_SCOPE("sampleInput");
+
+    // Each file contributes blocks spread over its length, as a mapped
+    // file would to EngineTuner::sample(); compressed bytes say nothing
+    // about the text and are passed over
+    const qint64 block = static_cast<qint64>(EngineTuner::kSampleBlockSize);
+    const size_t limit = EngineTuner::kSampleBlocks * EngineTuner::kSampleBlockSize;
+    std::string sample;
+    for (const QString& path : files) {
+        QFile file(path);
+        if (sample.size() >= limit || !file.open(QIODevice::ReadOnly)) {
+            continue;
+        }
+        const QByteArray head = file.peek(8);
+        if (CompressedIO::detect(head.constData(), static_cast<size_t>(head.size())) != Compression::None) {
+            continue;
+        }
+        const qint64 size = file.size();
+        const qint64 room = static_cast<qint64>((limit - sample.size()) / EngineTuner::kSampleBlockSize);
+        const qint64 blocks = std::max<qint64>(1, std::min(room, size / block));
+        for (qint64 i = 0; i < blocks && sample.size() < limit; ++i) {
+            const qint64 offset = blocks > 1 ? i * ((size - block) / (blocks - 1)) : 0;
+            if (!file.seek(offset)) {
+                break;
+            }
+            const QByteArray bytes = file.read(std::min<qint64>(block, static_cast<qint64>(limit - sample.size())));
+            sample.append(bytes.constData(), static_cast<size_t>(bytes.size()));
+        }
+    }
+    return sample;
+}
+
+BatchIo BatchJob::resolveIo(BatchIo requested)
+{
+    if (requested == BatchIo::Threads) {
+        return BatchIo::Threads;
+    }
+    static const bool available = UringBatch(1, 4096).isReady();
+    return available ? BatchIo::Uring : BatchIo::Threads;
+}
+
+const char *BatchJob::ioName(BatchIo io)
+{
+    switch (io) {
+    case BatchIo::Auto: return "auto";
+    case BatchIo::Threads: return "threads";
+    case BatchIo::Uring: return "io_uring";
+    }
+    return "threads";
+}
+
+void BatchJob::replaceUring(const RulePipeline& pipeline, const QStringList& files, std::atomic<qsizetype>& next,
+                            BatchResult *output, RuleStats& stats, MemoryMeter *memory, ResultCache *cache,
+                            BatchJournal *journal, std::vector<qsizetype>& handedBack)
+{
+    UringBatch batch;
+    MemoryHold bufferHold(memory, MemoryMeter::Category::Input);
+    if (!batch.isReady() || !bufferHold.tryResize(batch.bufferBytes())) {
+        return;
+    }
+
+    // Stats of a file count once its write went through; a file handed
+    // back is counted by the regular path
+    struct Pending {
+        RuleStats stats;
+        uint64_t inputHash = 0;
+        uint64_t outputHash = 0;
+    };
+    std::unordered_map<size_t, Pending> pendingFiles;
+    auto nextFile = [&](size_t *index, std::string *path) {
+        qsizetype i = next++;
+        while (i < files.size() && resumeFile(journal, files[i], output[i])) {
+            i = next++;
+        }
+        if (i >= files.size()) {
+            return false;
+        }
+        *index = static_cast<size_t>(i);
+        *path = QFile::encodeName(files[i]).toStdString();
+        return true;
+    };
+    auto process = [&](size_t index, const char *data, size_t length, std::string& out) -> int64_t {
+        // Compressed files take the streaming codec path
+        if (CompressedIO::detect(data, length) != Compression::None) {
+            return -1;
+        }
+        BatchResult& result = output[index];
+        CacheLookup lookup;
+        lookup.cache = cache;
+        const bool hasMatch = findMatches(pipeline, data, length, lookup);
+        result.cached = lookup.entry != nullptr;
+        Pending& file = pendingFiles[index];
+        if (journal) {
+            file.inputHash = cache ? lookup.key.content : ContentHash::hash64(data, length);
+            file.outputHash = file.inputHash;
+        }
+        if (!hasMatch) {
+            return 0;
+        }
+        file.stats.reset(pipeline.ruleCount());
+        buildOutput(pipeline, data, length, lookup, out, file.stats, &result.cached);
+        const uint64_t matches = file.stats.totalHits();
+        if (journal) {
+            // Journaled before the ring writes and renames the output
+            file.outputHash = ContentHash::hash64(out.data(), out.size());
+            journal->pending(files[static_cast<qsizetype>(index)], file.inputHash, file.outputHash,
+                             static_cast<qint64>(out.size()), matches);
+        }
+        return static_cast<int64_t>(matches);
+    };
+    auto done = [&](size_t index, const UringBatch::Result& ring) {
+        BatchResult& result = output[index];
+        auto pending = pendingFiles.find(index);
+        switch (ring.status) {
+        case UringBatch::Status::Unchanged:
+        case UringBatch::Status::Written:
+            result.path = files[static_cast<qsizetype>(index)];
+            result.ok = true;
+            result.written = ring.status == UringBatch::Status::Written;
+            result.matches = ring.matches;
+            result.bytesIn = static_cast<qint64>(ring.bytesIn);
+            result.bytesOut = static_cast<qint64>(ring.bytesOut);
+            if (pending != pendingFiles.end()) {
+                if (result.written) {
+                    stats.merge(pending->second.stats);
+                }
+                if (journal) {
+                    journal->done(result.path, pending->second.inputHash, pending->second.outputHash, result.matches);
+                }
+            }
+            break;
+        case UringBatch::Status::Declined:
+        case UringBatch::Status::Failed:
+            result = BatchResult();
+            handedBack.push_back(static_cast<qsizetype>(index));
+            break;
+        case UringBatch::Status::Abandoned:
+            // Its write may still land, so no other path may touch it; the
+            // journal keeps it pending for the next run to check
+            result = BatchResult();
+            result.path = files[static_cast<qsizetype>(index)];
+            result.error = QString::fromStdString("io_uring stopped while writing: " + batch.error());
+            break;
+        }
+        if (pending != pendingFiles.end()) {
+            pendingFiles.erase(pending);
+        }
+    };
+    batch.run(nextFile, process, done);
+}
+
+QVector<BatchResult> BatchJob::replaceFiles(const RulePipeline& pipeline, const QStringList& files, int threads,
+                                            RuleStats *stats, MemoryMeter *memory, ResultCache *cache,
+                                            BatchIo io, BatchJournal *journal)
+{
+    TRACE_SCOPE("batchFiles");
+
+    QVector<BatchResult> results(files.size());
+    if (threads <= 0) {
+        threads = QThread::idealThreadCount();
+    }
+    threads = std::max(1, std::min(threads, static_cast<int>(files.size())));
+    if (io == BatchIo::Auto) {
+        io = resolveIo(io);
+    }
+
+    // Workers take the next file from a shared counter; the compiled
+    // pipeline is immutable and shared, the stats are per worker. With
+    // io_uring every worker keeps a batch of files in flight on its own
+    // ring and replaces what the ring hands back on the regular path.
+    BatchResult *output = results.data();
+    std::atomic<qsizetype> next(0);
+    std::vector<RuleStats> workerStats(static_cast<size_t>(threads));
+    auto work = [&](int worker) {
+        RuleStats& own = workerStats[static_cast<size_t>(worker)];
+        own.reset(pipeline.ruleCount());
+        std::vector<qsizetype> handedBack;
+        if (io == BatchIo::Uring) {
+            replaceUring(pipeline, files, next, output, own, memory, cache, journal, handedBack);
+        }
+        for (qsizetype i : handedBack) {
+            output[i] = replaceFile(pipeline, files[i], QString(), &own, memory, cache, journal);
+        }
+        for (qsizetype i = next++; i < files.size(); i = next++) {
+            if (!resumeFile(journal, files[i], output[i])) {
+                output[i] = replaceFile(pipeline, files[i], QString(), &own, memory, cache, journal);
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (int t = 1; t < threads; ++t) {
+        workers.emplace_back(work, t);
+    }
+    work(0);
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+
+    if (stats) {
+        for (const RuleStats& own : workerStats) {
+            stats->merge(own);
+        }
+    }
+    return results;
+}
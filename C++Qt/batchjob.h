@@ -0,0 +1,127 @@
+#ifndef BATCHJOB_H
+#define BATCHJOB_H
+
+#include <QString>
+#include <QStringList>
+#include <QJsonObject>
+#include <QVector>
+#include <atomic>
+#include <functional>
+#include <vector>
+#include "rulepipeline.h"
+#include "contenthash.h"
+#include "compressedio.h"
+#include "memorymeter.h"
+#include "resultcache.h"
+#include "batchjournal.h"
+
+/**
+ * Outcome of replacing one file in a headless job.
+ */
+struct BatchResult {
+    QString path;
+    bool ok = false;
+    QString error;
+    quint64 matches = 0;
+    qint64 bytesIn = 0;
+    qint64 bytesOut = 0;
+    bool written = false;  // false when the file had no matches and was left alone
+    bool streamed = false; // the output went to disk in chunks to stay within the memory budget
+    bool cached = false;   // the result came from the result cache instead of a scan
+    bool resumed = false;  // an earlier run finished the file, see BatchJournal
+    Compression compression = Compression::None;  // kept for the output
+
+    QJsonObject toJson() const;
+};
+
+/**
+ * How replaceFiles() reads and writes the files. Uring keeps a batch of
+ * small files in flight on an io_uring per worker (see UringBatch); Auto
+ * takes it where the kernel supports it and the thread pool otherwise.
+ */
+enum class BatchIo {
+    Auto,
+    Threads,
+    Uring
+};
+
+/**
+ * BatchJob holds the headless job code shared by the --batch command line
+ * and the daemon: reading a rule set from JSON and running files through a
+ * compiled RulePipeline without any widgets.
+ *
+ * A rule set is an object {"encoding": "UTF-8", "rules": [{"find": ...,
+ * "replace": ..., "stage": ...}, ...]}; encoding and stage are optional.
+ */
+class BatchJob
+{
+public:
+    // Fill pipeline with the rules of spec, encoded for the rule set's
+    // encoding. Rules that cannot change the output (see RuleAnalyzer) are
+    // left out and counted in dropped. Returns false with a message for
+    // malformed specs.
+    static bool parseRules(const QJsonObject& spec, RulePipeline& pipeline, TextEncoding& encoding,
+                           QString *error, size_t *dropped = nullptr);
+
+    // Replace one file, writing to outputPath or, when it is empty, back to
+    // path. Files without matches are not rewritten. Gzip and zstd files are
+    // replaced in a streaming decompress-replace-compress pipeline and keep
+    // their codec. Stats, if given, must be reset(pipeline.ruleCount()) and
+    // are added to. Buffers are accounted in memory, if given; a read input
+    // or an output buffer that would exceed its budget is streamed in
+    // chunks instead. Uncompressed files that are held whole are looked up
+    // in and added to cache, if given. Files replaced in place are
+    // journaled in journal, if given: as pending before the save commits
+    // and as done after it.
+    static BatchResult replaceFile(const RulePipeline& pipeline, const QString& path,
+                                   const QString& outputPath = QString(), RuleStats *stats = nullptr,
+                                   MemoryMeter *memory = nullptr, ResultCache *cache = nullptr,
+                                   BatchJournal *journal = nullptr);
+
+    // Input to tune the pipeline's kernels on (RulePipeline::compile()):
+    // blocks of the first uncompressed files, up to EngineTuner's sample size
+    static std::string sampleInput(const QStringList& files);
+
+    // Replace many files in place on the given number of worker threads
+    // (0 for one per core). Results keep the order of files. With
+    // BatchIo::Uring, files the ring does not take (large, compressed or
+    // failed ones) are replaced by replaceFile() on the same worker.
+    // Files that journal has as finished are passed over (resumed) and
+    // all others are journaled as they are done.
+    static QVector<BatchResult> replaceFiles(const RulePipeline& pipeline, const QStringList& files,
+                                             int threads = 0, RuleStats *stats = nullptr,
+                                             MemoryMeter *memory = nullptr, ResultCache *cache = nullptr,
+                                             BatchIo io = BatchIo::Threads, BatchJournal *journal = nullptr);
+
+    // Uring for Auto when io_uring works here, Threads otherwise
+    static BatchIo resolveIo(BatchIo requested);
+    static const char *ioName(BatchIo io);
+
+private:
+    using Source = std::function<void(const StreamReplacer::Writer& feed)>;
+
+    // Both stream source through the pipeline into target, chunk by
+    // chunk. A readError that is not empty after the run fails the file.
+    static BatchResult replaceCompressed(const RulePipeline& pipeline, Compression compression,
+                                         const Source& source, qint64 size, const QString& path,
+                                         const QString& target, RuleStats *stats,
+                                         const QString *readError = nullptr, BatchJournal *journal = nullptr);
+    static BatchResult replaceStreamed(const RulePipeline& pipeline, const Source& source, qint64 size,
+                                       const QString& path, const QString& target, RuleStats *stats,
+                                       const QString *readError = nullptr, BatchJournal *journal = nullptr);
+
+    // Source that adds what source feeds to hash
+    static Source hashing(const Source& source, ContentHash *hash);
+
+    // One worker's share of replaceFiles() on an io_uring, taking files
+    // from next; files to replace on the regular path go to handedBack
+    static void replaceUring(const RulePipeline& pipeline, const QStringList& files,
+                             std::atomic<qsizetype>& next, BatchResult *output, RuleStats& stats,
+                             MemoryMeter *memory, ResultCache *cache, BatchJournal *journal,
+                             std::vector<qsizetype>& handedBack);
+
+    // Chunk read from files that are streamed
+    static const qint64 STREAM_CHUNK_SIZE = 1024 * 1024;
+};
+
+#endif // BATCHJOB_H
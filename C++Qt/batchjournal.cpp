@@ -0,0 +1,259 @@
+#include "batchjournal.h"
+#include "contenthash.h"
+#include "tracer.h"
+#include <QDateTime>
+#include <QFileInfo>
+#include <QList>
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#endif
+
+namespace {
+
+const QByteArray kHeader = "# multreplacer journal 1\n";
+const qint64 kHashChunk = 1024 * 1024;
+
+} // namespace
+
+BatchJournal::BatchJournal()
+    : m_ruleSet(0)
+    , m_loaded(0)
+    , m_unsynced(0)
+{
+}
+
+BatchJournal::~BatchJournal()
+{
+    close();
+}
+
+bool BatchJournal::open(const QString& path, uint64_t ruleSet, QString *error)
+{
+    TRACE_SCOPE("openJournal");
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_records.clear();
+    m_ruleSet = ruleSet;
+    m_loaded = 0;
+    m_file.setFileName(path);
+    if (!m_file.open(QIODevice::ReadWrite)) {
+        *error = m_file.errorString();
+        return false;
+    }
+
+    // Later lines of a path replace earlier ones; a line cut short by an
+    // interrupted run has no newline and is dropped
+    const QByteArray contents = m_file.readAll();
+    const bool fresh = kHeader.startsWith(contents);
+    if (!fresh && !contents.startsWith(kHeader)) {
+        *error = "not a journal";
+        m_file.close();
+        return false;
+    }
+    qsizetype end = kHeader.size();
+    for (qsizetype start = end, newline = contents.indexOf('\n', start); !fresh && newline >= 0;
+         start = newline + 1, newline = contents.indexOf('\n', start)) {
+        QString file;
+        Record record;
+        if (parse(contents.mid(start, newline - start), &file, &record)) {
+            m_records.insert(file, record);
+            ++m_loaded;
+        }
+        end = newline + 1;
+    }
+
+    // Append after the last complete line
+    if (fresh && (!m_file.resize(0) || !m_file.seek(0) || m_file.write(kHeader) != kHeader.size())) {
+        *error = m_file.errorString();
+        m_file.close();
+        return false;
+    }
+    if (!m_file.resize(end) || !m_file.seek(end)) {
+        *error = m_file.errorString();
+        m_file.close();
+        return false;
+    }
+    m_file.flush();
+    return true;
+}
+
+void BatchJournal::close()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_file.isOpen()) {
+        return;
+    }
+    m_file.flush();
+#ifdef Q_OS_UNIX
+    ::fsync(m_file.handle());
+#endif
+    m_file.close();
+}
+
+bool BatchJournal::finished(const QString& path, Record *record)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_records.constFind(path);
+        if (it == m_records.constEnd() || it->ruleSet != m_ruleSet) {
+            return false;
+        }
+        *record = *it;
+    }
+
+    const QFileInfo info(path);
+    if (!info.exists() || info.size() != record->size) {
+        return false;
+    }
+    const qint64 modified = info.lastModified().toMSecsSinceEpoch();
+    if (record->done && modified == record->modified) {
+        return true;
+    }
+
+    // Pending, or touched since: only the content tells whether the save
+    // went through. Journal it as done so the next restart only stats it.
+    uint64_t hash = 0;
+    if (!hashFile(path, &hash) || hash != record->outputHash) {
+        return false;
+    }
+    record->done = true;
+    record->modified = modified;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    append(path, *record);
+    return true;
+}
+
+void BatchJournal::pending(const QString& path, uint64_t inputHash, uint64_t outputHash, qint64 outputSize,
+                           quint64 matches)
+{
+    Record record;
+    record.ruleSet = m_ruleSet;
+    record.size = outputSize;
+    record.inputHash = inputHash;
+    record.outputHash = outputHash;
+    record.matches = matches;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    append(path, record);
+}
+
+void BatchJournal::done(const QString& path, uint64_t inputHash, uint64_t outputHash, quint64 matches)
+{
+    const QFileInfo info(path);
+    Record record;
+    record.done = true;
+    record.ruleSet = m_ruleSet;
+    record.size = info.size();
+    record.modified = info.lastModified().toMSecsSinceEpoch();
+    record.inputHash = inputHash;
+    record.outputHash = outputHash;
+    record.matches = matches;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    append(path, record);
+}
+
+void BatchJournal::append(const QString& path, const Record& record)
+{
+    if (!m_file.isOpen()) {
+        return;
+    }
+    m_records.insert(path, record);
+
+    QByteArray line;
+    line.reserve(128 + path.size());
+    line += record.done ? "d\t" : "p\t";
+    line += QByteArray::number(static_cast<qulonglong>(record.ruleSet), 16) + '\t';
+    line += QByteArray::number(record.size) + '\t';
+    line += QByteArray::number(record.modified) + '\t';
+    line += QByteArray::number(static_cast<qulonglong>(record.inputHash), 16) + '\t';
+    line += QByteArray::number(static_cast<qulonglong>(record.outputHash), 16) + '\t';
+    line += QByteArray::number(record.matches) + '\t';
+    line += escape(path);
+    line += '\n';
+    m_file.write(line);
+    m_file.flush();
+#ifdef Q_OS_UNIX
+    if (++m_unsynced >= SYNC_INTERVAL) {
+        ::fsync(m_file.handle());
+        m_unsynced = 0;
+    }
+#endif
+}
+
+QByteArray BatchJournal::escape(const QString& path)
+{
+    const QByteArray bytes = path.toUtf8();
+    QByteArray escaped;
+    escaped.reserve(bytes.size());
+    for (char c : bytes) {
+        switch (c) {
+        case '\\': escaped += "\\\\"; break;
+        case '\t': escaped += "\\t"; break;
+        case '\n': escaped += "\\n"; break;
+        case '\r': escaped += "\\r"; break;
+        default: escaped += c; break;
+        }
+    }
+    return escaped;
+}
+
+QString BatchJournal::unescape(const QByteArray& field)
+{
+    QByteArray bytes;
+    bytes.reserve(field.size());
+    for (qsizetype i = 0; i < field.size(); ++i) {
+        if (field[i] != '\\' || i + 1 == field.size()) {
+            bytes += field[i];
+            continue;
+        }
+        const char c = field[++i];
+        bytes += c == 't' ? '\t' : c == 'n' ? '\n' : c == 'r' ? '\r' : c;
+    }
+    return QString::fromUtf8(bytes);
+}
+
+bool BatchJournal::parse(const QByteArray& line, QString *path, Record *record)
+{
+    const QList<QByteArray> fields = line.split('\t');
+    if (fields.size() != 8 || (fields[0] != "d" && fields[0] != "p") || fields[7].isEmpty()) {
+        return false;
+    }
+    bool ok[6];
+    record->done = fields[0] == "d";
+    record->ruleSet = fields[1].toULongLong(&ok[0], 16);
+    record->size = fields[2].toLongLong(&ok[1]);
+    record->modified = fields[3].toLongLong(&ok[2]);
+    record->inputHash = fields[4].toULongLong(&ok[3], 16);
+    record->outputHash = fields[5].toULongLong(&ok[4], 16);
+    record->matches = fields[6].toULongLong(&ok[5]);
+    for (bool fieldOk : ok) {
+        if (!fieldOk) {
+            return false;
+        }
+    }
+    *path = unescape(fields[7]);
+    return true;
+}
+
+bool BatchJournal::hashFile(const QString& path, uint64_t *hash)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    const qint64 size = file.size();
+    if (size > 0) {
+        if (const uchar *data = file.map(0, size)) {
+            *hash = ContentHash::hash64(data, static_cast<size_t>(size));
+            return true;
+        }
+    }
+    ContentHash content;
+    for (;;) {
+        const QByteArray chunk = file.read(kHashChunk);
+        if (chunk.isEmpty()) {
+            *hash = content.digest();
+            return file.atEnd();
+        }
+        content.update(chunk.constData(), static_cast<size_t>(chunk.size()));
+    }
+}
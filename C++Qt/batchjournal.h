@@ -0,0 +1,86 @@
+#ifndef BATCHJOURNAL_H
+#define BATCHJOURNAL_H
+
+#include <QFile>
+#include <QHash>
+#include <QString>
+#include <cstdint>
+#include <mutex>
+
+/**
+ * BatchJournal is the append-only record of the files a batch run has
+ * finished, so an interrupted run can be started again and pass over the
+ * work that is done instead of replacing those files a second time.
+ *
+ * Every line holds one file: its path, the rule set, the size and
+ * modification time of the finished file, the hashes (ContentHash) of its
+ * input and output and the number of matches. A file that is rewritten is
+ * first journaled as pending, with the hash of the output that is about
+ * to be saved, and as done once the save has renamed the new content over
+ * it. Together with the atomic saves a file is always either the old or
+ * the new content, and a restart recognizes both: a done file whose size
+ * and time have not changed is skipped after a stat, any other journaled
+ * file whose content hashes to the recorded output is skipped after a
+ * read, and everything else is replaced again.
+ *
+ * Lines are flushed as they are written, so killing the process loses at
+ * most a line being written, which load() drops. The journal is synced
+ * to disk every few hundred lines and on close(). Members are thread-safe.
+ */
+class BatchJournal
+{
+public:
+    struct Record {
+        bool done = false;       // false while the save is pending
+        uint64_t ruleSet = 0;    // RulePipeline::ruleSetHash()
+        qint64 size = -1;        // of the finished file
+        qint64 modified = -1;    // ms since the epoch, -1 while pending
+        uint64_t inputHash = 0;
+        uint64_t outputHash = 0;
+        quint64 matches = 0;
+    };
+
+    BatchJournal();
+    ~BatchJournal();
+
+    BatchJournal(const BatchJournal&) = delete;
+    BatchJournal& operator=(const BatchJournal&) = delete;
+
+    // Read the records of path, if it exists, and append to it from now
+    // on. Records of other rule sets than ruleSet (RulePipeline::
+    // ruleSetHash()) are kept but never count as finished.
+    bool open(const QString& path, uint64_t ruleSet, QString *error);
+    void close();
+    bool isOpen() const { return m_file.isOpen(); }
+
+    // The record of path when the file is finished for the rule set and
+    // still holds the journaled output
+    bool finished(const QString& path, Record *record);
+
+    // Journal path as about to be replaced by output of the given hash
+    void pending(const QString& path, uint64_t inputHash, uint64_t outputHash, qint64 outputSize, quint64 matches);
+    // Journal path as finished; its size and time are read from disk
+    void done(const QString& path, uint64_t inputHash, uint64_t outputHash, quint64 matches);
+
+    // Records read by open()
+    int loadedCount() const { return m_loaded; }
+
+    // Records appended between two fsync() calls
+    static const int SYNC_INTERVAL = 256;
+
+private:
+    void append(const QString& path, const Record& record);
+    static QByteArray escape(const QString& path);
+    static QString unescape(const QByteArray& field);
+    static bool parse(const QByteArray& line, QString *path, Record *record);
+    static bool hashFile(const QString& path, uint64_t *hash);
+
+    std::mutex m_mutex;
+    QFile m_file;
+    QHash<QString, Record> m_records;
+    uint64_t m_ruleSet;
+    int m_loaded;
+    int m_unsynced;
+};
+
+#endif // BATCHJOURNAL_H
@@ -0,0 +1,375 @@
+/*
+ * C interface tests
+ * Links the multreplacer shared library from C, as a service would, and
+ * compares mr_replace_into(), mr_replace_stream(), mr_count_matches() and
+ * mr_find_matches() with a plain reference of the original multiReplace
+ * semantics over random staged rule sets, including the duplicate and
+ * no-op rules the analyzer leaves out of the compiled matcher. Fixed cases
+ * check the analyzer's drops, Shift_JIS character boundaries and the
+ * error statuses.
+ *
+ * Usage: capi_tests [seed]
+ */
+
+#include "multreplacer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int g_failures = 0;
+static int g_checks = 0;
+
+#define CHECK(condition, ...) \
+    do { \
+        ++g_checks; \
+        if (!(condition)) { \
+            ++g_failures; \
+            printf("FAIL %s:%d: %s: ", __FILE__, __LINE__, #condition); \
+            printf(__VA_ARGS__); \
+            printf("\n"); \
+        } \
+    } while (0)
+
+#define MAX_RULES 12
+#define MAX_TEXT 4096
+
+typedef struct buffer {
+    char data[MAX_TEXT * 8];
+    size_t length;
+} buffer;
+
+static const char *const g_alphabet[] = {"a", "b", "c", "\n", "\xE3\x81\x82"};
+static const char *const g_stages[] = {"first", "second", "third"};
+
+static unsigned long g_random;
+
+static unsigned nextRandom(unsigned bound)
+{
+    g_random = g_random * 6364136223846793005ul + 1442695040888963407ul;
+    return (unsigned)((g_random >> 33) % bound);
+}
+
+static void appendBytes(buffer *out, const char *data, size_t length)
+{
+    memcpy(out->data + out->length, data, length);
+    out->length += length;
+}
+
+static void randomString(buffer *out, size_t maxSymbols, int allowEmpty)
+{
+    size_t symbols = nextRandom((unsigned)maxSymbols + 1);
+    size_t i;
+    if (symbols == 0 && !allowEmpty) {
+        symbols = 1;
+    }
+    out->length = 0;
+    for (i = 0; i < symbols; ++i) {
+        const char *symbol = g_alphabet[nextRandom(sizeof(g_alphabet) / sizeof(g_alphabet[0]))];
+        appendBytes(out, symbol, strlen(symbol));
+    }
+}
+
+/* Reference of one stage: the longest pattern at each position wins, a
+ * later rule with the same pattern replaces an earlier one, and replaced
+ * text is not matched again. UTF-8 patterns cannot start inside a
+ * character, so stepping by bytes is the same as stepping by characters. */
+static void referenceStage(const mr_rule *rules, size_t count, const char *stage, const buffer *in, buffer *out)
+{
+    size_t pos = 0;
+    out->length = 0;
+    while (pos < in->length) {
+        const mr_rule *best = NULL;
+        size_t r;
+        for (r = 0; r < count; ++r) {
+            const mr_rule *rule = &rules[r];
+            if (strcmp(rule->stage, stage) != 0 || rule->pattern_length > in->length - pos
+                || memcmp(in->data + pos, rule->pattern, rule->pattern_length) != 0) {
+                continue;
+            }
+            if (!best || rule->pattern_length >= best->pattern_length) {
+                best = rule;
+            }
+        }
+        if (best) {
+            appendBytes(out, best->replacement, best->replacement_length);
+            pos += best->pattern_length;
+        } else {
+            appendBytes(out, in->data + pos, 1);
+            ++pos;
+        }
+    }
+}
+
+/* Stages run in the order of their first rule, each on the previous output */
+static void referenceReplace(const mr_rule *rules, size_t count, const buffer *in, buffer *out)
+{
+    static buffer current;
+    const char *done[MAX_RULES];
+    size_t doneCount = 0;
+    size_t r;
+    current = *in;
+    for (r = 0; r < count; ++r) {
+        size_t d;
+        for (d = 0; d < doneCount && strcmp(done[d], rules[r].stage) != 0; ++d) {
+        }
+        if (d < doneCount) {
+            continue;
+        }
+        done[doneCount++] = rules[r].stage;
+        referenceStage(rules, count, rules[r].stage, &current, out);
+        current = *out;
+    }
+    *out = current;
+}
+
+static int appendToBuffer(void *context, const char *data, size_t length)
+{
+    appendBytes((buffer *)context, data, length);
+    return 0;
+}
+
+static int stopWriting(void *context, const char *data, size_t length)
+{
+    (void)context;
+    (void)data;
+    (void)length;
+    return 1;
+}
+
+static void testRandomRuleSets(void)
+{
+    static buffer patterns[MAX_RULES];
+    static buffer replacements[MAX_RULES];
+    static buffer text;
+    static buffer expected;
+    static buffer output;
+    static buffer streamed;
+    static buffer rebuilt;
+    static mr_match matches[MAX_TEXT];
+    int round;
+
+    for (round = 0; round < 400; ++round) {
+        mr_rule rules[MAX_RULES];
+        const size_t count = 1 + nextRandom(MAX_RULES);
+        const unsigned stageCount = 1 + nextRandom(3);
+        mr_ruleset *ruleset = NULL;
+        mr_status status;
+        size_t r;
+
+        for (r = 0; r < count; ++r) {
+            randomString(&patterns[r], 3, 0);
+            if (nextRandom(6) == 0) {
+                replacements[r] = patterns[r];  /* no-op */
+            } else {
+                randomString(&replacements[r], 3, 1);
+            }
+            if (r > 0 && nextRandom(8) == 0) {
+                patterns[r] = patterns[nextRandom((unsigned)r)];  /* possible duplicate */
+            }
+            rules[r].pattern = patterns[r].data;
+            rules[r].pattern_length = patterns[r].length;
+            rules[r].replacement = replacements[r].data;
+            rules[r].replacement_length = replacements[r].length;
+            rules[r].stage = g_stages[nextRandom(stageCount)];
+        }
+        randomString(&text, 1 + nextRandom(MAX_TEXT / 4), 1);
+        referenceReplace(rules, count, &text, &expected);
+
+        status = mr_ruleset_compile(rules, count, MR_ENCODING_UTF8, &ruleset);
+        if (status == MR_ERROR_NO_RULES) {
+            CHECK(expected.length == text.length && memcmp(expected.data, text.data, text.length) == 0,
+                  "round %d: no rules compiled, but the reference changes the text", round);
+            continue;
+        }
+        CHECK(status == MR_OK, "round %d: compile returned %s", round, mr_status_string(status));
+        if (status != MR_OK) {
+            continue;
+        }
+        CHECK(mr_ruleset_rule_count(ruleset) <= count, "round %d: more compiled rules than given", round);
+
+        {
+            size_t outputLength = 0;
+            uint64_t replaced = 0;
+            uint64_t counted = 0;
+            int64_t delta = 0;
+            status = mr_replace_into(ruleset, text.data, text.length, output.data, sizeof(output.data),
+                                     &outputLength, &replaced);
+            CHECK(status == MR_OK && outputLength == expected.length
+                      && memcmp(output.data, expected.data, expected.length) == 0,
+                  "round %d: mr_replace_into differs from the reference", round);
+
+            streamed.length = 0;
+            status = mr_replace_stream(ruleset, text.data, text.length, appendToBuffer, &streamed, NULL);
+            CHECK(status == MR_OK && streamed.length == expected.length
+                      && memcmp(streamed.data, expected.data, expected.length) == 0,
+                  "round %d: mr_replace_stream differs from the reference", round);
+
+            status = mr_count_matches(ruleset, text.data, text.length, &counted, &delta);
+            CHECK(status == MR_OK && counted == replaced
+                      && delta == (int64_t)expected.length - (int64_t)text.length,
+                  "round %d: mr_count_matches gave %llu / %lld", round, (unsigned long long)counted,
+                  (long long)delta);
+
+            if (expected.length > 0) {
+                size_t required = 0;
+                status = mr_replace_into(ruleset, text.data, text.length, output.data, expected.length - 1,
+                                         &required, NULL);
+                CHECK(status == MR_ERROR_BUFFER_TOO_SMALL && required == expected.length,
+                      "round %d: short buffer returned %s with %zu", round, mr_status_string(status), required);
+            }
+        }
+
+        if (mr_ruleset_pass_count(ruleset) == 1) {
+            size_t found = 0;
+            size_t pos = 0;
+            size_t m;
+            status = mr_find_matches(ruleset, text.data, text.length, matches, MAX_TEXT, &found);
+            CHECK(status == MR_OK, "round %d: mr_find_matches returned %s", round, mr_status_string(status));
+            rebuilt.length = 0;
+            for (m = 0; status == MR_OK && m < found; ++m) {
+                const mr_rule *rule = &rules[matches[m].rule];
+                CHECK(matches[m].rule < count && matches[m].offset >= pos && matches[m].length == rule->pattern_length
+                          && memcmp(text.data + matches[m].offset, rule->pattern, rule->pattern_length) == 0,
+                      "round %d: match %zu does not hold its rule's pattern", round, m);
+                appendBytes(&rebuilt, text.data + pos, (size_t)matches[m].offset - pos);
+                appendBytes(&rebuilt, rule->replacement, rule->replacement_length);
+                pos = (size_t)matches[m].offset + matches[m].length;
+            }
+            appendBytes(&rebuilt, text.data + pos, text.length - pos);
+            CHECK(rebuilt.length == expected.length && memcmp(rebuilt.data, expected.data, expected.length) == 0,
+                  "round %d: output rebuilt from mr_find_matches differs from the reference", round);
+        } else {
+            size_t found = 0;
+            status = mr_find_matches(ruleset, text.data, text.length, matches, MAX_TEXT, &found);
+            CHECK(status == MR_ERROR_UNSUPPORTED, "round %d: multi-pass mr_find_matches returned %s", round,
+                  mr_status_string(status));
+        }
+        mr_ruleset_free(ruleset);
+    }
+}
+
+static mr_rule rule(const char *pattern, const char *replacement, const char *stage)
+{
+    mr_rule result;
+    result.pattern = pattern;
+    result.pattern_length = strlen(pattern);
+    result.replacement = replacement;
+    result.replacement_length = replacement ? strlen(replacement) : 0;
+    result.stage = stage;
+    return result;
+}
+
+static void expectReplace(const mr_ruleset *ruleset, const char *input, const char *expected)
+{
+    char output[256];
+    size_t outputLength = 0;
+    const mr_status status = mr_replace_into(ruleset, input, strlen(input), output, sizeof(output), &outputLength,
+                                             NULL);
+    CHECK(status == MR_OK && outputLength == strlen(expected) && memcmp(output, expected, outputLength) == 0,
+          "\"%s\" became \"%.*s\" instead of \"%s\"", input, (int)outputLength, output, expected);
+}
+
+static void testFixedCases(void)
+{
+    mr_ruleset *ruleset = NULL;
+    mr_status status;
+
+    /* The cases of multi_replace.cpp */
+    {
+        const mr_rule rules[] = {rule("cat", "dog", NULL), rule("caterpillar", "butterfly", NULL),
+                                 rule("a", "b", "chain"), rule("b", "c", "chain")};
+        status = mr_ruleset_compile(rules, 2, MR_ENCODING_UTF8, &ruleset);
+        CHECK(status == MR_OK, "compile returned %s", mr_status_string(status));
+        expectReplace(ruleset, "caterpillar and cat", "butterfly and dog");
+        mr_ruleset_free(ruleset);
+
+        status = mr_ruleset_compile(rules + 2, 2, MR_ENCODING_UTF8, &ruleset);
+        CHECK(status == MR_OK, "compile returned %s", mr_status_string(status));
+        expectReplace(ruleset, "a b c", "b c c");
+        mr_ruleset_free(ruleset);
+    }
+
+    /* A later duplicate wins and a no-op nothing can overlap is dropped */
+    {
+        const mr_rule rules[] = {rule("a", "b", NULL), rule("x", "x", NULL), rule("a", "c", NULL)};
+        status = mr_ruleset_compile(rules, 3, MR_ENCODING_UTF8, &ruleset);
+        CHECK(status == MR_OK && mr_ruleset_rule_count(ruleset) == 1, "duplicate and no-op kept: %zu rules",
+              mr_ruleset_rule_count(ruleset));
+        expectReplace(ruleset, "xax", "xcx");
+        mr_ruleset_free(ruleset);
+    }
+
+    /* A no-op that guards another rule stays */
+    {
+        const mr_rule rules[] = {rule("ab", "ab", NULL), rule("b", "c", NULL)};
+        status = mr_ruleset_compile(rules, 2, MR_ENCODING_UTF8, &ruleset);
+        CHECK(status == MR_OK && mr_ruleset_rule_count(ruleset) == 2, "guarding no-op dropped: %zu rules",
+              mr_ruleset_rule_count(ruleset));
+        expectReplace(ruleset, "abb", "abc");
+        mr_ruleset_free(ruleset);
+    }
+
+    /* A pattern holding a byte an earlier stage removes is unreachable */
+    {
+        const mr_rule rules[] = {rule("q", "", "first"), rule("qq", "z", "second"), rule("a", "b", "second")};
+        status = mr_ruleset_compile(rules, 3, MR_ENCODING_UTF8, &ruleset);
+        CHECK(status == MR_OK && mr_ruleset_rule_count(ruleset) == 2, "unreachable rule kept: %zu rules",
+              mr_ruleset_rule_count(ruleset));
+        expectReplace(ruleset, "qqa", "b");
+        mr_ruleset_free(ruleset);
+    }
+
+    /* Only rules that cannot change anything */
+    {
+        const mr_rule rules[] = {rule("x", "x", NULL)};
+        status = mr_ruleset_compile(rules, 1, MR_ENCODING_UTF8, &ruleset);
+        CHECK(status == MR_ERROR_NO_RULES && ruleset == NULL, "no-op rule set returned %s",
+              mr_status_string(status));
+    }
+
+    /* In Shift_JIS a rule for '\\' must not match the trail byte of 表 */
+    {
+        const mr_rule rules[] = {rule("\\", "/", NULL)};
+        status = mr_ruleset_compile(rules, 1, MR_ENCODING_SHIFT_JIS, &ruleset);
+        CHECK(status == MR_OK, "compile returned %s", mr_status_string(status));
+        expectReplace(ruleset, "\x95\x5C\\", "\x95\x5C/");
+        mr_ruleset_free(ruleset);
+    }
+
+    /* Errors */
+    {
+        const mr_rule empty = rule("", "x", NULL);
+        const mr_rule valid = rule("a", "b", NULL);
+        size_t outputLength = 0;
+        CHECK(mr_ruleset_compile(&empty, 1, MR_ENCODING_UTF8, &ruleset) == MR_ERROR_INVALID_ARGUMENT,
+              "empty pattern accepted");
+        CHECK(mr_ruleset_compile(&valid, 1, (mr_encoding)7, &ruleset) == MR_ERROR_INVALID_ARGUMENT,
+              "unknown encoding accepted");
+        CHECK(mr_replace_into(NULL, "a", 1, NULL, 0, &outputLength, NULL) == MR_ERROR_INVALID_ARGUMENT,
+              "null rule set accepted");
+
+        status = mr_ruleset_compile(&valid, 1, MR_ENCODING_UTF8, &ruleset);
+        CHECK(status == MR_OK, "compile returned %s", mr_status_string(status));
+        CHECK(mr_replace_stream(ruleset, "aaa", 3, stopWriting, NULL, NULL) == MR_ERROR_ABORTED,
+              "a stopping writer did not abort");
+        mr_ruleset_free(ruleset);
+    }
+    CHECK(mr_abi_version() == MR_ABI_VERSION, "library ABI %u, header %d", mr_abi_version(), MR_ABI_VERSION);
+}
+
+int main(int argc, char **argv)
+{
+    const unsigned long seed = argc > 1 ? strtoul(argv[1], NULL, 10) : 20240601ul;
+    g_random = seed;
+    printf("seed %lu\n", seed);
+
+    testFixedCases();
+    printf("%-20s %s\n", "fixed cases", g_failures == 0 ? "ok" : "FAILED");
+    {
+        const int failuresBefore = g_failures;
+        testRandomRuleSets();
+        printf("%-20s %s\n", "random rule sets", g_failures == failuresBefore ? "ok" : "FAILED");
+    }
+    printf("%d checks, %d failed\n", g_checks, g_failures);
+    return g_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,511 @@
+#include "compressedio.h"
+#include "rulepipeline.h"
+#include "tracer.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#ifdef MULTREPLACER_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef MULTREPLACER_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace {
+
+// Output buffer of one codec call
+constexpr size_t kCodecBufferSize = 64 * 1024;
+
+// Default levels: fast enough to keep up with the matcher
+constexpr int kDefaultGzipLevel = 6;
+constexpr int kDefaultZstdLevel = 3;
+
+/**
+ * Queue of chunks between two threads; push() blocks while it is full,
+ * pop() while it is empty. After close() pushes are refused and pop()
+ * drains what is left, then returns false.
+ */
+class ChunkQueue
+{
+public:
+    explicit ChunkQueue(size_t capacity) : m_capacity(capacity), m_closed(false) {}
+
+    bool push(std::string&& chunk)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_notFull.wait(lock, [this] { return m_closed || m_chunks.size() < m_capacity; });
+        if (m_closed) {
+            return false;
+        }
+        m_chunks.push_back(std::move(chunk));
+        m_notEmpty.notify_one();
+        return true;
+    }
+
+    bool pop(std::string& chunk)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_notEmpty.wait(lock, [this] { return m_closed || !m_chunks.empty(); });
+        if (m_chunks.empty()) {
+            return false;
+        }
+        chunk = std::move(m_chunks.front());
+        m_chunks.pop_front();
+        m_notFull.notify_one();
+        return true;
+    }
+
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closed = true;
+        m_notFull.notify_all();
+        m_notEmpty.notify_all();
+    }
+
+private:
+    size_t m_capacity;
+    bool m_closed;
+    std::deque<std::string> m_chunks;
+    std::mutex m_mutex;
+    std::condition_variable m_notFull;
+    std::condition_variable m_notEmpty;
+};
+
+/**
+ * Collects small writes into chunks of about kChunkSize for a queue.
+ */
+class ChunkBuilder
+{
+public:
+    explicit ChunkBuilder(ChunkQueue& queue) : m_queue(queue) { m_chunk.reserve(CompressedReplacer::kChunkSize); }
+
+    void append(const char *data, size_t length)
+    {
+        m_chunk.append(data, length);
+        if (m_chunk.size() >= CompressedReplacer::kChunkSize) {
+            flush();
+        }
+    }
+
+    void flush()
+    {
+        if (!m_chunk.empty()) {
+            m_queue.push(std::move(m_chunk));
+            m_chunk = std::string();
+            m_chunk.reserve(CompressedReplacer::kChunkSize);
+        }
+    }
+
+private:
+    ChunkQueue& m_queue;
+    std::string m_chunk;
+};
+
+} // namespace
+
+Compression CompressedIO::detect(const char *data, size_t length)
+{
+    const unsigned char *bytes = reinterpret_cast<const unsigned char *>(data);
+    if (length >= 2 && bytes[0] == 0x1F && bytes[1] == 0x8B) {
+        return Compression::Gzip;
+    }
+    if (length >= 4 && bytes[0] == 0x28 && bytes[1] == 0xB5 && bytes[2] == 0x2F && bytes[3] == 0xFD) {
+        return Compression::Zstd;
+    }
+    return Compression::None;
+}
+
+const char *CompressedIO::name(Compression compression)
+{
+    switch (compression) {
+    case Compression::None: return "none";
+    case Compression::Gzip: return "gzip";
+    case Compression::Zstd: return "zstd";
+    }
+    return "none";
+}
+
+bool CompressedIO::isSupported(Compression compression)
+{
+    switch (compression) {
+    case Compression::None:
+        return true;
+    case Compression::Gzip:
+#ifdef MULTREPLACER_HAVE_ZLIB
+        return true;
+#else
+        return false;
+#endif
+    case Compression::Zstd:
+#ifdef MULTREPLACER_HAVE_ZSTD
+        return true;
+#else
+        return false;
+#endif
+    }
+    return false;
+}
+
+struct ChunkDecoder::State {
+    Compression compression = Compression::None;
+    bool open = false;  // inside a gzip member or zstd frame
+    bool ready = false;
+    std::string buffer;
+#ifdef MULTREPLACER_HAVE_ZLIB
+    z_stream zlib{};
+#endif
+#ifdef MULTREPLACER_HAVE_ZSTD
+    ZSTD_DStream *zstd = nullptr;
+#endif
+};
+
+ChunkDecoder::ChunkDecoder(Compression compression, StreamReplacer::Writer writer)
+    : m_state(std::make_unique<State>())
+    , m_writer(std::move(writer))
+{
+    m_state->compression = compression;
+    m_state->buffer.resize(kCodecBufferSize);
+    switch (compression) {
+    case Compression::None:
+        m_state->ready = true;
+        break;
+    case Compression::Gzip:
+#ifdef MULTREPLACER_HAVE_ZLIB
+        // 16 + window bits: gzip wrapper only
+        m_state->ready = inflateInit2(&m_state->zlib, 16 + MAX_WBITS) == Z_OK;
+#endif
+        break;
+    case Compression::Zstd:
+#ifdef MULTREPLACER_HAVE_ZSTD
+        m_state->zstd = ZSTD_createDStream();
+        m_state->ready = m_state->zstd && !ZSTD_isError(ZSTD_initDStream(m_state->zstd));
+#endif
+        break;
+    }
+    if (!m_state->ready) {
+        m_error = std::string(CompressedIO::name(compression)) + " is not supported in this build";
+    }
+}
+
+ChunkDecoder::~ChunkDecoder()
+{
+#ifdef MULTREPLACER_HAVE_ZLIB
+    if (m_state->compression == Compression::Gzip && m_state->ready) {
+        inflateEnd(&m_state->zlib);
+    }
+#endif
+#ifdef MULTREPLACER_HAVE_ZSTD
+    if (m_state->zstd) {
+        ZSTD_freeDStream(m_state->zstd);
+    }
+#endif
+}
+
+bool ChunkDecoder::write(const char *data, size_t length)
+{
+    if (!m_state->ready) {
+        return false;
+    }
+    [[maybe_unused]] char *buffer = &m_state->buffer[0];
+    switch (m_state->compression) {
+    case Compression::None:
+        m_writer(data, length);
+        return true;
+    case Compression::Gzip: {
+#ifdef MULTREPLACER_HAVE_ZLIB
+        z_stream& z = m_state->zlib;
+        z.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+        z.avail_in = static_cast<uInt>(length);
+        do {
+            z.next_out = reinterpret_cast<Bytef *>(buffer);
+            z.avail_out = static_cast<uInt>(kCodecBufferSize);
+            const int ret = inflate(&z, Z_NO_FLUSH);
+            if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+                m_error = std::string("gzip: ") + (z.msg ? z.msg : "corrupt input");
+                m_state->ready = false;
+                return false;
+            }
+            const size_t produced = kCodecBufferSize - z.avail_out;
+            if (produced > 0) {
+                m_writer(buffer, produced);
+            }
+            if (ret == Z_STREAM_END) {
+                // Another member may follow
+                m_state->open = false;
+                if (z.avail_in == 0) {
+                    break;
+                }
+                inflateReset(&z);
+                continue;
+            }
+            m_state->open = true;
+        } while (z.avail_in > 0 || z.avail_out == 0);
+        return true;
+#else
+        return false;
+#endif
+    }
+    case Compression::Zstd: {
+#ifdef MULTREPLACER_HAVE_ZSTD
+        ZSTD_inBuffer in{data, length, 0};
+        do {
+            ZSTD_outBuffer out{buffer, kCodecBufferSize, 0};
+            const size_t ret = ZSTD_decompressStream(m_state->zstd, &out, &in);
+            if (ZSTD_isError(ret)) {
+                m_error = std::string("zstd: ") + ZSTD_getErrorName(ret);
+                m_state->ready = false;
+                return false;
+            }
+            if (out.pos > 0) {
+                m_writer(buffer, out.pos);
+            }
+            // 0: a frame ended and everything was flushed
+            m_state->open = ret != 0;
+            if (in.pos == in.size && out.pos < out.size) {
+                break;
+            }
+        } while (true);
+        return true;
+#else
+        return false;
+#endif
+    }
+    }
+    return false;
+}
+
+bool ChunkDecoder::finish()
+{
+    if (!m_state->ready) {
+        return false;
+    }
+    if (m_state->open) {
+        m_error = std::string(CompressedIO::name(m_state->compression)) + ": input is truncated";
+        return false;
+    }
+    return true;
+}
+
+struct ChunkEncoder::State {
+    Compression compression = Compression::None;
+    bool ready = false;
+    std::string buffer;
+#ifdef MULTREPLACER_HAVE_ZLIB
+    z_stream zlib{};
+#endif
+#ifdef MULTREPLACER_HAVE_ZSTD
+    ZSTD_CCtx *zstd = nullptr;
+#endif
+};
+
+ChunkEncoder::ChunkEncoder(Compression compression, StreamReplacer::Writer writer, int level)
+    : m_state(std::make_unique<State>())
+    , m_writer(std::move(writer))
+{
+    m_state->compression = compression;
+    m_state->buffer.resize(kCodecBufferSize);
+    switch (compression) {
+    case Compression::None:
+        m_state->ready = true;
+        break;
+    case Compression::Gzip:
+#ifdef MULTREPLACER_HAVE_ZLIB
+        m_state->ready = deflateInit2(&m_state->zlib, level > 0 ? level : kDefaultGzipLevel, Z_DEFLATED,
+                                      16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+#endif
+        break;
+    case Compression::Zstd:
+#ifdef MULTREPLACER_HAVE_ZSTD
+        m_state->zstd = ZSTD_createCCtx();
+        m_state->ready = m_state->zstd
+            && !ZSTD_isError(ZSTD_CCtx_setParameter(m_state->zstd, ZSTD_c_compressionLevel,
+                                                    level > 0 ? level : kDefaultZstdLevel));
+#endif
+        break;
+    }
+    if (!m_state->ready) {
+        m_error = std::string(CompressedIO::name(compression))
+            + (CompressedIO::isSupported(compression) ? ": cannot start the encoder" : " is not supported in this build");
+    }
+    (void)level;
+}
+
+ChunkEncoder::~ChunkEncoder()
+{
+#ifdef MULTREPLACER_HAVE_ZLIB
+    if (m_state->compression == Compression::Gzip && m_state->ready) {
+        deflateEnd(&m_state->zlib);
+    }
+#endif
+#ifdef MULTREPLACER_HAVE_ZSTD
+    if (m_state->zstd) {
+        ZSTD_freeCCtx(m_state->zstd);
+    }
+#endif
+}
+
+bool ChunkEncoder::write(const char *data, size_t length)
+{
+    return run(data, length, false);
+}
+
+bool ChunkEncoder::finish()
+{
+    return run(nullptr, 0, true);
+}
+
+bool ChunkEncoder::run(const char *data, size_t length, [[maybe_unused]] bool final)
+{
+    if (!m_state->ready) {
+        return false;
+    }
+    [[maybe_unused]] char *buffer = &m_state->buffer[0];
+    switch (m_state->compression) {
+    case Compression::None:
+        if (length > 0) {
+            m_writer(data, length);
+        }
+        return true;
+    case Compression::Gzip: {
+#ifdef MULTREPLACER_HAVE_ZLIB
+        z_stream& z = m_state->zlib;
+        z.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+        z.avail_in = static_cast<uInt>(length);
+        int ret;
+        do {
+            z.next_out = reinterpret_cast<Bytef *>(buffer);
+            z.avail_out = static_cast<uInt>(kCodecBufferSize);
+            ret = deflate(&z, final ? Z_FINISH : Z_NO_FLUSH);
+            if (ret == Z_STREAM_ERROR) {
+                m_error = "gzip: compression failed";
+                m_state->ready = false;
+                return false;
+            }
+            const size_t produced = kCodecBufferSize - z.avail_out;
+            if (produced > 0) {
+                m_writer(buffer, produced);
+            }
+        } while (z.avail_out == 0 || (final && ret != Z_STREAM_END));
+        return true;
+#else
+        return false;
+#endif
+    }
+    case Compression::Zstd: {
+#ifdef MULTREPLACER_HAVE_ZSTD
+        ZSTD_inBuffer in{data, length, 0};
+        size_t remaining;
+        do {
+            ZSTD_outBuffer out{buffer, kCodecBufferSize, 0};
+            remaining = ZSTD_compressStream2(m_state->zstd, &out, &in, final ? ZSTD_e_end : ZSTD_e_continue);
+            if (ZSTD_isError(remaining)) {
+                m_error = std::string("zstd: ") + ZSTD_getErrorName(remaining);
+                m_state->ready = false;
+                return false;
+            }
+            if (out.pos > 0) {
+                m_writer(buffer, out.pos);
+            }
+        } while (final ? remaining != 0 : in.pos < in.size);
+        return true;
+#else
+        return false;
+#endif
+    }
+    }
+    return false;
+}
+
+CompressedReplacer::Result CompressedReplacer::run(const RulePipeline& pipeline, Compression compression,
+                                                   const std::function<void(const StreamReplacer::Writer& feed)>& source,
+                                                   const StreamReplacer::Writer& sink, RuleStats *stats, int level)
+{
+    TRACE_SCOPE("compressedReplace");
+
+    Result result;
+    if (!CompressedIO::isSupported(compression)) {
+        result.error = std::string(CompressedIO::name(compression)) + " is not supported in this build";
+        return result;
+    }
+
+    ChunkQueue plain(kQueueDepth);
+    ChunkQueue packed(kQueueDepth);
+    std::atomic<bool> failed(false);
+    std::mutex errorMutex;
+    auto fail = [&](const std::string& message) {
+        {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            if (result.error.empty()) {
+                result.error = message;
+            }
+        }
+        failed = true;
+        plain.close();
+        packed.close();
+    };
+
+    // Decompression
+    std::thread decoderThread([&]() {
+        ChunkBuilder chunks(plain);
+        ChunkDecoder decoder(compression, [&](const char *data, size_t length) {
+            result.plainIn += length;
+            chunks.append(data, length);
+        });
+        source([&](const char *data, size_t length) {
+            if (!failed && !decoder.write(data, length)) {
+                fail(decoder.error());
+            }
+        });
+        if (!failed && !decoder.finish()) {
+            fail(decoder.error());
+        }
+        chunks.flush();
+        plain.close();
+    });
+
+    // Compression
+    std::thread encoderThread([&]() {
+        ChunkEncoder encoder(compression, [&](const char *data, size_t length) {
+            result.bytesOut += length;
+            sink(data, length);
+        }, level);
+        std::string chunk;
+        while (packed.pop(chunk)) {
+            if (!encoder.write(chunk.data(), chunk.size())) {
+                fail(encoder.error());
+                return;
+            }
+        }
+        if (!failed && !encoder.finish()) {
+            fail(encoder.error());
+        }
+    });
+
+    // Matching on the calling thread, between the two queues
+    {
+        ChunkBuilder chunks(packed);
+        result.matches = pipeline.stream(
+            [&](const StreamReplacer::Writer& feed) {
+                std::string chunk;
+                while (plain.pop(chunk)) {
+                    feed(chunk.data(), chunk.size());
+                }
+            },
+            [&](const char *data, size_t length) {
+                result.plainOut += length;
+                chunks.append(data, length);
+            },
+            stats);
+        chunks.flush();
+        packed.close();
+    }
+
+    decoderThread.join();
+    encoderThread.join();
+    result.ok = !failed;
+    return result;
+}
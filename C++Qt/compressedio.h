@@ -0,0 +1,145 @@
+#ifndef COMPRESSEDIO_H
+#define COMPRESSEDIO_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include "streamreplacer.h"
+
+class RulePipeline;
+
+// Container format of a file; None is plain bytes
+enum class Compression { None, Gzip, Zstd };
+
+/**
+ * CompressedIO recognizes gzip and zstd input by its magic bytes and
+ * provides streaming codecs for them. Codecs are compiled in when zlib
+ * (MULTREPLACER_HAVE_ZLIB) or libzstd (MULTREPLACER_HAVE_ZSTD) is found at
+ * build time; isSupported() tells which ones are available.
+ */
+class CompressedIO
+{
+public:
+    static Compression detect(const char *data, size_t length);
+    static const char *name(Compression compression);
+    static bool isSupported(Compression compression);
+
+    // One-shot helpers for callers that need the whole content anyway,
+    // e.g. the preview. Output is appended to out (std::string, QByteArray,
+    // ...). False on corrupt input.
+    template <typename Output>
+    static bool decompress(Compression compression, const char *data, size_t length, Output& out,
+                           std::string *error = nullptr);
+    template <typename Output>
+    static bool compress(Compression compression, const char *data, size_t length, Output& out,
+                         std::string *error = nullptr);
+};
+
+/**
+ * Streaming decoder: compressed bytes in, plain bytes out through the writer.
+ * Concatenated gzip members and zstd frames are decoded as one stream.
+ */
+class ChunkDecoder
+{
+public:
+    ChunkDecoder(Compression compression, StreamReplacer::Writer writer);
+    ~ChunkDecoder();
+
+    bool write(const char *data, size_t length);
+    // Fails when the input ended inside a member or frame
+    bool finish();
+    const std::string& error() const { return m_error; }
+
+private:
+    struct State;
+    std::unique_ptr<State> m_state;
+    StreamReplacer::Writer m_writer;
+    std::string m_error;
+};
+
+/**
+ * Streaming encoder: plain bytes in, compressed bytes out through the writer.
+ */
+class ChunkEncoder
+{
+public:
+    ChunkEncoder(Compression compression, StreamReplacer::Writer writer, int level = 0);
+    ~ChunkEncoder();
+
+    bool write(const char *data, size_t length);
+    // Write the end of the stream; call once after the last write()
+    bool finish();
+    const std::string& error() const { return m_error; }
+
+private:
+    bool run(const char *data, size_t length, bool final);
+
+    struct State;
+    std::unique_ptr<State> m_state;
+    StreamReplacer::Writer m_writer;
+    std::string m_error;
+};
+
+/**
+ * CompressedReplacer runs a pipeline over a compressed stream and writes it
+ * compressed with the same codec, without the plain text ever existing as a
+ * whole. Decompression, matching and compression run on three threads
+ * connected by bounded queues of chunks, so memory stays at a few chunks
+ * whatever the size of the stream.
+ */
+class CompressedReplacer
+{
+public:
+    struct Result {
+        bool ok = false;
+        std::string error;
+        uint64_t matches = 0;
+        uint64_t plainIn = 0;    // decompressed input size
+        uint64_t plainOut = 0;   // output size before compression
+        uint64_t bytesOut = 0;   // compressed output size
+    };
+
+    // Source is called once, on the decoder thread, and passes the
+    // compressed input to its feed in spans of any size. Sink receives the
+    // compressed output on the encoder thread. Stats, if given, must be
+    // reset(pipeline.ruleCount()). Level 0 is the codec's default.
+    static Result run(const RulePipeline& pipeline, Compression compression,
+                      const std::function<void(const StreamReplacer::Writer& feed)>& source,
+                      const StreamReplacer::Writer& sink, RuleStats *stats = nullptr, int level = 0);
+
+    // Plain chunks passed between the threads
+    static constexpr size_t kChunkSize = 256 * 1024;
+    static constexpr size_t kQueueDepth = 4;
+};
+
+template <typename Output>
+bool CompressedIO::decompress(Compression compression, const char *data, size_t length, Output& out,
+                              std::string *error)
+{
+    ChunkDecoder decoder(compression, [&out](const char *bytes, size_t size) { out.append(bytes, size); });
+    if (!decoder.write(data, length) || !decoder.finish()) {
+        if (error) {
+            *error = decoder.error();
+        }
+        return false;
+    }
+    return true;
+}
+
+template <typename Output>
+bool CompressedIO::compress(Compression compression, const char *data, size_t length, Output& out,
+                            std::string *error)
+{
+    ChunkEncoder encoder(compression, [&out](const char *bytes, size_t size) { out.append(bytes, size); });
+    if (!encoder.write(data, length) || !encoder.finish()) {
+        if (error) {
+            *error = encoder.error();
+        }
+        return false;
+    }
+    return true;
+}
+
+#endif // COMPRESSEDIO_H
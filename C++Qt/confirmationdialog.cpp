@@ -1,7 +1,11 @@
 #include "confirmationdialog.h"
 #include "translations.h"
+#include "tracer.h"
 #include <QApplication>
 #include <QScreen>
+#include <QTextBlock>
+#include <algorithm>
+#include <climits>
 
 ConfirmationDialog::ConfirmationDialog(QWidget *parent)
     : QDialog(parent)
@@ -10,10 +14,17 @@ ConfirmationDialog::ConfirmationDialog(QWidget *parent)
     , m_instructionLabel(nullptr)
     , m_previewText(nullptr)
     , m_buttonLayout(nullptr)
+    , m_lineLabel(nullptr)
+    , m_lineSpin(nullptr)
+    , m_lineCountLabel(nullptr)
     , m_cancelButton(nullptr)
     , m_executeButton(nullptr)
     , m_accepted(false)
+    , m_lineBytes(nullptr)
+    , m_lines(nullptr)
+    , m_lineEncoding(TextEncoding::Utf8)
 {
+    TRACE_SCOPE("ConfirmationDialog::setupUI");
     setupUI();
     setupConnections();
     resizeToOptimalSize();
@@ -21,7 +32,7 @@ ConfirmationDialog::ConfirmationDialog(QWidget *parent)
 
 void ConfirmationDialog::setupUI()
 {
-    setWindowTitle(Translations::tr("confirm"));
+    setWindowTitle(Translations::tr(TrKey::Confirm));
     setModal(true);
     
     // Main layout
@@ -30,87 +41,46 @@ void ConfirmationDialog::setupUI()
     m_mainLayout->setSpacing(15);
     
     // Title label
-    m_titleLabel = new QLabel(Translations::tr("confirm"), this);
-    m_titleLabel->setStyleSheet(
-        "QLabel {"
-        "    font-size: 18px;"
-        "    font-weight: bold;"
-        "    color: #2c3e50;"
-        "    margin-bottom: 10px;"
-        "}"
-    );
+    m_titleLabel = new QLabel(Translations::tr(TrKey::Confirm), this);
+    m_titleLabel->setProperty("role", "title");
     
     // Instruction label
-    m_instructionLabel = new QLabel(Translations::tr("confirm_message"), this);
-    m_instructionLabel->setStyleSheet(
-        "QLabel {"
-        "    font-size: 12px;"
-        "    color: #7f8c8d;"
-        "    margin-bottom: 10px;"
-        "}"
-    );
+    m_instructionLabel = new QLabel(Translations::tr(TrKey::ConfirmMessage), this);
+    m_instructionLabel->setProperty("role", "hint");
     m_instructionLabel->setWordWrap(true);
     
     // Preview text area
     m_previewText = new QPlainTextEdit(this);
     m_previewText->setReadOnly(true);
-    m_previewText->setStyleSheet(
-        "QPlainTextEdit {"
-        "    background-color: #2c3e50;"
-        "    color: #ecf0f1;"
-        "    font-family: 'Courier New', monospace;"
-        "    font-size: 11px;"
-        "    border: 1px solid #34495e;"
-        "    border-radius: 4px;"
-        "    padding: 10px;"
-        "}"
-    );
+    m_previewText->setProperty("role", "preview");
     
     // Button layout
     m_buttonLayout = new QHBoxLayout();
     m_buttonLayout->setSpacing(10);
     
+    // Line navigation, shown in line mode only
+    m_lineLabel = new QLabel(Translations::tr(TrKey::GoToLine), this);
+    m_lineSpin = new QSpinBox(this);
+    m_lineSpin->setMinimum(1);
+    m_lineSpin->setKeyboardTracking(false);
+    m_lineCountLabel = new QLabel(this);
+    m_lineCountLabel->setProperty("role", "hint");
+    setLineNavigationVisible(false);
+    
     // Cancel button
-    m_cancelButton = new QPushButton(Translations::tr("cancel"), this);
+    m_cancelButton = new QPushButton(Translations::tr(TrKey::Cancel), this);
     m_cancelButton->setMinimumSize(100, 35);
-    m_cancelButton->setStyleSheet(
-        "QPushButton {"
-        "    background-color: #95a5a6;"
-        "    color: white;"
-        "    border: none;"
-        "    border-radius: 4px;"
-        "    font-size: 12px;"
-        "    font-weight: bold;"
-        "}"
-        "QPushButton:hover {"
-        "    background-color: #7f8c8d;"
-        "}"
-        "QPushButton:pressed {"
-        "    background-color: #6c7b7d;"
-        "}"
-    );
+    m_cancelButton->setProperty("role", "secondary");
     
     // Execute button
-    m_executeButton = new QPushButton(Translations::tr("execute_save"), this);
+    m_executeButton = new QPushButton(Translations::tr(TrKey::ExecuteSave), this);
     m_executeButton->setMinimumSize(100, 35);
-    m_executeButton->setStyleSheet(
-        "QPushButton {"
-        "    background-color: #27ae60;"
-        "    color: white;"
-        "    border: none;"
-        "    border-radius: 4px;"
-        "    font-size: 12px;"
-        "    font-weight: bold;"
-        "}"
-        "QPushButton:hover {"
-        "    background-color: #229954;"
-        "}"
-        "QPushButton:pressed {"
-        "    background-color: #1e8449;"
-        "}"
-    );
+    m_executeButton->setProperty("role", "execute");
     
     // Add buttons to button layout
+    m_buttonLayout->addWidget(m_lineLabel);
+    m_buttonLayout->addWidget(m_lineSpin);
+    m_buttonLayout->addWidget(m_lineCountLabel);
     m_buttonLayout->addStretch();
     m_buttonLayout->addWidget(m_cancelButton);
     m_buttonLayout->addWidget(m_executeButton);
@@ -128,6 +98,14 @@ void ConfirmationDialog::setupConnections()
 {
     connect(m_cancelButton, &QPushButton::clicked, this, &ConfirmationDialog::onCancelClicked);
     connect(m_executeButton, &QPushButton::clicked, this, &ConfirmationDialog::onExecuteClicked);
+    connect(m_lineSpin, QOverload<int>::of(&QSpinBox::valueChanged), this, &ConfirmationDialog::onLineChanged);
+}
+
+void ConfirmationDialog::setLineNavigationVisible(bool visible)
+{
+    m_lineLabel->setVisible(visible);
+    m_lineSpin->setVisible(visible);
+    m_lineCountLabel->setVisible(visible);
 }
 
 void ConfirmationDialog::resizeToOptimalSize()
@@ -150,6 +128,8 @@ void ConfirmationDialog::setContent(const QString& originalText, const QString&
 {
     m_originalText = originalText;
     m_modifiedText = modifiedText;
+    
+    TRACE_SCOPE("ConfirmationDialog::setContent");
     m_previewText->setPlainText(modifiedText);
 }
 
@@ -158,12 +138,81 @@ bool ConfirmationDialog::wasAccepted() const
     return m_accepted;
 }
 
+bool ConfirmationDialog::confirm(const QString& originalText, const QString& modifiedText)
+{
+    m_accepted = false;
+    setContent(originalText, modifiedText);
+    exec();
+    
+    // Nothing of the run stays alive in a kept dialog
+    m_previewText->clear();
+    m_originalText.clear();
+    m_modifiedText.clear();
+    return m_accepted;
+}
+
+bool ConfirmationDialog::confirmLines(const QByteArray& modified, const LineIndex& lines, TextEncoding encoding)
+{
+    m_accepted = false;
+    m_lineBytes = &modified;
+    m_lines = &lines;
+    m_lineEncoding = encoding;
+    
+    const int lineCount = static_cast<int>(std::min<size_t>(lines.lineCount(), INT_MAX));
+    m_lineCountLabel->setText(QString("/ %1").arg(lineCount));
+    {
+        QSignalBlocker blocker(m_lineSpin);
+        m_lineSpin->setMaximum(lineCount);
+        m_lineSpin->setValue(1);
+    }
+    onLineChanged(1);
+    setLineNavigationVisible(true);
+    exec();
+    
+    setLineNavigationVisible(false);
+    m_previewText->clear();
+    m_lineBytes = nullptr;
+    m_lines = nullptr;
+    return m_accepted;
+}
+
+void ConfirmationDialog::onLineChanged(int line)
+{
+    if (!m_lines) {
+        return;
+    }
+    
+    // The index gives the window's bytes directly; only they are decoded
+    const size_t target = std::min(static_cast<size_t>(std::max(line, 1) - 1), m_lines->lineCount() - 1);
+    const size_t context = static_cast<size_t>(PREVIEW_CONTEXT_LINES);
+    const size_t first = target > context ? target - context : 0;
+    const size_t last = std::min(m_lines->lineCount(), first + static_cast<size_t>(PREVIEW_WINDOW_LINES)) - 1;
+    const size_t begin = m_lines->lineStart(first);
+    const size_t end = m_lines->lineEnd(last);
+    {
+        TRACE_SCOPE("ConfirmationDialog::showLines");
+        m_previewText->setPlainText(TextCodec::toQString(m_lineBytes->constData() + begin, end - begin, m_lineEncoding));
+    }
+    
+    QTextCursor cursor(m_previewText->document()->findBlockByNumber(static_cast<int>(target - first)));
+    m_previewText->setTextCursor(cursor);
+    m_previewText->centerCursor();
+}
+
+void ConfirmationDialog::updateTexts()
+{
+    setWindowTitle(Translations::tr(TrKey::Confirm));
+    m_titleLabel->setText(Translations::tr(TrKey::Confirm));
+    m_instructionLabel->setText(Translations::tr(TrKey::ConfirmMessage));
+    m_cancelButton->setText(Translations::tr(TrKey::Cancel));
+    m_executeButton->setText(Translations::tr(TrKey::ExecuteSave));
+    m_lineLabel->setText(Translations::tr(TrKey::GoToLine));
+}
+
 bool ConfirmationDialog::showConfirmation(QWidget *parent, const QString& originalText, const QString& modifiedText)
 {
     ConfirmationDialog dialog(parent);
-    dialog.setContent(originalText, modifiedText);
-    dialog.exec();
-    return dialog.wasAccepted();
+    return dialog.confirm(originalText, modifiedText);
 }
 
 void ConfirmationDialog::accept()
@@ -9,6 +9,10 @@
 #include <QLabel>
 #include <QString>
 #include <QPushButton>
+#include <QSpinBox>
+#include <QByteArray>
+#include "lineindex.h"
+#include "textcodec.h"
 
 /**
  * ConfirmationDialog displays a preview of the modified text and allows
@@ -27,6 +31,19 @@ public:
     // Get the user's choice (true for execute, false for cancel)
     bool wasAccepted() const;
     
+    // Show the dialog modally with the given content and return the choice.
+    // A dialog kept by its owner is built once and reused; the preview is
+    // released when it closes.
+    bool confirm(const QString& originalText, const QString& modifiedText);
+    
+    // Line mode: the preview shows a window of lines of modified, decoded
+    // through its line index, and can jump to any line without laying out
+    // the whole text. modified and lines must outlive the call.
+    bool confirmLines(const QByteArray& modified, const LineIndex& lines, TextEncoding encoding);
+    
+    // Reload the texts after a language change
+    void updateTexts();
+    
     // Static convenience method to show the dialog and get result
     static bool showConfirmation(QWidget *parent, 
                                 const QString& originalText, 
@@ -39,11 +56,13 @@ public slots:
 private slots:
     void onExecuteClicked();
     void onCancelClicked();
+    void onLineChanged(int line);
 
 private:
     void setupUI();
     void setupConnections();
     void resizeToOptimalSize();
+    void setLineNavigationVisible(bool visible);
     
     // UI components
     QVBoxLayout *m_mainLayout;
@@ -51,6 +70,9 @@ private:
     QLabel *m_instructionLabel;
     QPlainTextEdit *m_previewText;
     QHBoxLayout *m_buttonLayout;
+    QLabel *m_lineLabel;
+    QSpinBox *m_lineSpin;
+    QLabel *m_lineCountLabel;
     QPushButton *m_cancelButton;
     QPushButton *m_executeButton;
     
@@ -58,6 +80,13 @@ private:
     bool m_accepted;
     QString m_originalText;
     QString m_modifiedText;
+    const QByteArray *m_lineBytes;  // set while confirmLines() runs
+    const LineIndex *m_lines;
+    TextEncoding m_lineEncoding;
+    
+    // Lines decoded around the current one in line mode
+    static const int PREVIEW_WINDOW_LINES = 2000;
+    static const int PREVIEW_CONTEXT_LINES = 200;
 };
 
 #endif // CONFIRMATIONDIALOG_H
\ No newline at end of file
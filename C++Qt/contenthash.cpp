@@ -0,0 +1,149 @@
+#include "contenthash.h"
+#include <cstring>
+
+namespace {
+
+const uint64_t kPrime1 = 0x9E3779B185EBCA87ull;
+const uint64_t kPrime2 = 0xC2B2AE3D27D4EB4Full;
+const uint64_t kPrime3 = 0x165667B19E3779F9ull;
+const uint64_t kPrime4 = 0x85EBCA77C2B2AE63ull;
+const uint64_t kPrime5 = 0x27D4EB2F165667C5ull;
+
+inline uint64_t rotl(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+// Unaligned little-endian reads; memcpy compiles to a single load
+inline uint64_t read64(const unsigned char *p)
+{
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+inline uint32_t read32(const unsigned char *p)
+{
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+inline uint64_t round(uint64_t acc, uint64_t input)
+{
+    acc += input * kPrime2;
+    acc = rotl(acc, 31);
+    return acc * kPrime1;
+}
+
+inline uint64_t mergeRound(uint64_t acc, uint64_t value)
+{
+    acc ^= round(0, value);
+    return acc * kPrime1 + kPrime4;
+}
+
+} // namespace
+
+ContentHash::ContentHash(uint64_t seed)
+{
+    reset(seed);
+}
+
+void ContentHash::reset(uint64_t seed)
+{
+    m_seed = seed;
+    m_acc[0] = seed + kPrime1 + kPrime2;
+    m_acc[1] = seed + kPrime2;
+    m_acc[2] = seed;
+    m_acc[3] = seed - kPrime1;
+    m_totalLength = 0;
+    m_buffered = 0;
+}
+
+void ContentHash::update(const void *data, size_t length)
+{
+    const unsigned char *p = static_cast<const unsigned char *>(data);
+    const unsigned char *end = p + length;
+    m_totalLength += length;
+
+    // Complete a stripe left over from the previous call
+    if (m_buffered + length < 32) {
+        std::memcpy(m_buffer + m_buffered, p, length);
+        m_buffered += length;
+        return;
+    }
+    if (m_buffered > 0) {
+        const size_t fill = 32 - m_buffered;
+        std::memcpy(m_buffer + m_buffered, p, fill);
+        for (int lane = 0; lane < 4; ++lane) {
+            m_acc[lane] = round(m_acc[lane], read64(m_buffer + lane * 8));
+        }
+        p += fill;
+        m_buffered = 0;
+    }
+
+    // Whole 32-byte stripes straight from the input
+    uint64_t a0 = m_acc[0], a1 = m_acc[1], a2 = m_acc[2], a3 = m_acc[3];
+    while (end - p >= 32) {
+        a0 = round(a0, read64(p));
+        a1 = round(a1, read64(p + 8));
+        a2 = round(a2, read64(p + 16));
+        a3 = round(a3, read64(p + 24));
+        p += 32;
+    }
+    m_acc[0] = a0; m_acc[1] = a1; m_acc[2] = a2; m_acc[3] = a3;
+
+    m_buffered = static_cast<size_t>(end - p);
+    std::memcpy(m_buffer, p, m_buffered);
+}
+
+uint64_t ContentHash::digest() const
+{
+    uint64_t h;
+    if (m_totalLength >= 32) {
+        h = rotl(m_acc[0], 1) + rotl(m_acc[1], 7) + rotl(m_acc[2], 12) + rotl(m_acc[3], 18);
+        for (int lane = 0; lane < 4; ++lane) {
+            h = mergeRound(h, m_acc[lane]);
+        }
+    } else {
+        h = m_seed + kPrime5;
+    }
+    h += m_totalLength;
+
+    const unsigned char *p = m_buffer;
+    const unsigned char *end = m_buffer + m_buffered;
+    while (end - p >= 8) {
+        h ^= round(0, read64(p));
+        h = rotl(h, 27) * kPrime1 + kPrime4;
+        p += 8;
+    }
+    if (end - p >= 4) {
+        h ^= static_cast<uint64_t>(read32(p)) * kPrime1;
+        h = rotl(h, 23) * kPrime2 + kPrime3;
+        p += 4;
+    }
+    while (p < end) {
+        h ^= (*p++) * kPrime5;
+        h = rotl(h, 11) * kPrime1;
+    }
+
+    h ^= h >> 33;
+    h *= kPrime2;
+    h ^= h >> 29;
+    h *= kPrime3;
+    h ^= h >> 32;
+    return h;
+}
+
+uint64_t ContentHash::hash64(const void *data, size_t length, uint64_t seed)
+{
+    ContentHash hash(seed);
+    hash.update(data, length);
+    return hash.digest();
+}
@@ -0,0 +1,34 @@
+#ifndef CONTENTHASH_H
+#define CONTENTHASH_H
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * ContentHash is XXH64: a fast non-cryptographic 64-bit hash used to
+ * recognize content that was seen before (changed blocks in watch mode,
+ * files whose result is already known). It can be fed in pieces, e.g. as
+ * chunks arrive from disk, and gives the same value as hashing the whole
+ * buffer at once.
+ */
+class ContentHash
+{
+public:
+    explicit ContentHash(uint64_t seed = 0);
+
+    void reset(uint64_t seed = 0);
+    void update(const void *data, size_t length);
+    uint64_t digest() const;
+
+    // One-shot hash of a buffer
+    static uint64_t hash64(const void *data, size_t length, uint64_t seed = 0);
+
+private:
+    uint64_t m_acc[4];
+    uint64_t m_totalLength;
+    unsigned char m_buffer[32];
+    size_t m_buffered;
+    uint64_t m_seed;
+};
+
+#endif // CONTENTHASH_H
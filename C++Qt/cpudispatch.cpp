@@ -0,0 +1,617 @@
+#include "cpudispatch.h"
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CPUDISPATCH_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define CPU_TARGET(features)
+#else
+#define CPU_TARGET(features) __attribute__((target(features)))
+#endif
+#endif
+
+void ByteSet::clear()
+{
+    std::memset(lowNibbleBitsLo, 0, sizeof(lowNibbleBitsLo));
+    std::memset(lowNibbleBitsHi, 0, sizeof(lowNibbleBitsHi));
+    contains.fill(false);
+}
+
+void ByteSet::insert(unsigned char byte)
+{
+    const unsigned high = byte >> 4;
+    const unsigned low = byte & 0x0F;
+    if (high < 8) {
+        lowNibbleBitsLo[low] |= static_cast<uint8_t>(1u << high);
+    } else {
+        lowNibbleBitsHi[low] |= static_cast<uint8_t>(1u << (high - 8));
+    }
+    contains[byte] = true;
+}
+
+bool ByteSet::empty() const
+{
+    for (bool b : contains) {
+        if (b) return false;
+    }
+    return true;
+}
+
+namespace {
+
+inline unsigned countTrailingZeros(uint64_t mask)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, mask);
+    return static_cast<unsigned>(index);
+#else
+    return static_cast<unsigned>(__builtin_ctzll(mask));
+#endif
+}
+
+// Scalar kernels, also used for the tails of the vector kernels
+
+size_t findInSetScalar(const unsigned char *data, size_t length, const ByteSet& set)
+{
+    size_t i = 0;
+    while (i < length && !set.contains[data[i]]) {
+        ++i;
+    }
+    return i;
+}
+
+size_t asciiPrefixScalar(const unsigned char *data, size_t length)
+{
+    size_t i = 0;
+    while (i < length && data[i] < 0x80) {
+        ++i;
+    }
+    return i;
+}
+
+void collectByteScalar(const unsigned char *data, size_t length, unsigned char byte,
+                       size_t base, std::vector<size_t>& positions)
+{
+    const unsigned char *end = data + length;
+    for (const unsigned char *p = data; (p = static_cast<const unsigned char *>(std::memchr(p, byte, end - p))); ++p) {
+        positions.push_back(base + static_cast<size_t>(p - data));
+    }
+}
+
+bool validUtf8Scalar(const unsigned char *data, size_t length)
+{
+    size_t i = 0;
+    while (i < length) {
+        i += asciiPrefixScalar(data + i, length - i);
+        if (i >= length) {
+            break;
+        }
+
+        // Well-formed sequences per the Unicode standard, table 3-7
+        unsigned char b = data[i];
+        size_t need;
+        unsigned char lo = 0x80, hi = 0xBF;
+        if (b >= 0xC2 && b <= 0xDF) {
+            need = 1;
+        } else if (b >= 0xE0 && b <= 0xEF) {
+            need = 2;
+            if (b == 0xE0) lo = 0xA0;
+            if (b == 0xED) hi = 0x9F;
+        } else if (b >= 0xF0 && b <= 0xF4) {
+            need = 3;
+            if (b == 0xF0) lo = 0x90;
+            if (b == 0xF4) hi = 0x8F;
+        } else {
+            return false;
+        }
+        if (i + need >= length) {
+            return false;
+        }
+        if (data[i + 1] < lo || data[i + 1] > hi) {
+            return false;
+        }
+        for (size_t k = 2; k <= need; ++k) {
+            if (data[i + k] < 0x80 || data[i + k] > 0xBF) {
+                return false;
+            }
+        }
+        i += need + 1;
+    }
+    return true;
+}
+
+#ifdef CPUDISPATCH_X86
+
+// Bit (h & 7) for high nibble h, split into the h < 8 and h >= 8 halves
+const uint8_t kHighNibbleBitsLo[16] = {1, 2, 4, 8, 16, 32, 64, 128, 0, 0, 0, 0, 0, 0, 0, 0};
+const uint8_t kHighNibbleBitsHi[16] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 2, 4, 8, 16, 32, 64, 128};
+
+// Start of the character that may run past end, where a vector kernel
+// hands the rest to a lower tier; the bytes before end are well-formed
+// except for a sequence cut at end
+size_t utf8ResumePoint(const unsigned char *data, size_t end)
+{
+    for (size_t k = 1; k <= 3 && k <= end; ++k) {
+        const unsigned char b = data[end - k];
+        if (b < 0x80) {
+            break;
+        }
+        if (b >= 0xC0) {
+            return end - k;
+        }
+    }
+    return end;
+}
+
+// UTF-8 validation by Keiser and Lemire's lookup method ("Validating UTF-8
+// in less than one instruction per byte", 2021). Three nibble lookups on
+// each byte and the one before it flag every malformed pair; the error
+// bits a lookup can report:
+const uint8_t kUtf8TooShort = 1 << 0;     // lead byte or ASCII after a lead byte
+const uint8_t kUtf8TooLong = 1 << 1;      // continuation after ASCII
+const uint8_t kUtf8Overlong3 = 1 << 2;    // E0 80..9F
+const uint8_t kUtf8TooLarge = 1 << 3;     // F4 90..BF, F5..FF
+const uint8_t kUtf8Surrogate = 1 << 4;    // ED A0..BF
+const uint8_t kUtf8Overlong2 = 1 << 5;    // C0, C1
+const uint8_t kUtf8TooLarge1000 = 1 << 6; // F5..FF 80..8F
+const uint8_t kUtf8Overlong4 = 1 << 6;    // F0 80..8F
+const uint8_t kUtf8TwoConts = 1 << 7;     // continuation after continuation
+const uint8_t kUtf8Carry = kUtf8TooShort | kUtf8TooLong | kUtf8TwoConts;
+
+// Indexed by the high nibble of the previous byte
+const uint8_t kUtf8PrevHigh[16] = {
+    kUtf8TooLong, kUtf8TooLong, kUtf8TooLong, kUtf8TooLong,
+    kUtf8TooLong, kUtf8TooLong, kUtf8TooLong, kUtf8TooLong,
+    kUtf8TwoConts, kUtf8TwoConts, kUtf8TwoConts, kUtf8TwoConts,
+    kUtf8TooShort | kUtf8Overlong2,
+    kUtf8TooShort,
+    kUtf8TooShort | kUtf8Overlong3 | kUtf8Surrogate,
+    kUtf8TooShort | kUtf8TooLarge | kUtf8TooLarge1000 | kUtf8Overlong4,
+};
+
+// Indexed by the low nibble of the previous byte
+const uint8_t kUtf8PrevLow[16] = {
+    kUtf8Carry | kUtf8Overlong3 | kUtf8Overlong2 | kUtf8Overlong4,
+    kUtf8Carry | kUtf8Overlong2,
+    kUtf8Carry,
+    kUtf8Carry,
+    kUtf8Carry | kUtf8TooLarge,
+    kUtf8Carry | kUtf8TooLarge | kUtf8TooLarge1000,
+    kUtf8Carry | kUtf8TooLarge | kUtf8TooLarge1000,
+    kUtf8Carry | kUtf8TooLarge | kUtf8TooLarge1000,
+    kUtf8Carry | kUtf8TooLarge | kUtf8TooLarge1000,
+    kUtf8Carry | kUtf8TooLarge | kUtf8TooLarge1000,
+    kUtf8Carry | kUtf8TooLarge | kUtf8TooLarge1000,
+    kUtf8Carry | kUtf8TooLarge | kUtf8TooLarge1000,
+    kUtf8Carry | kUtf8TooLarge | kUtf8TooLarge1000,
+    kUtf8Carry | kUtf8TooLarge | kUtf8TooLarge1000 | kUtf8Surrogate,
+    kUtf8Carry | kUtf8TooLarge | kUtf8TooLarge1000,
+    kUtf8Carry | kUtf8TooLarge | kUtf8TooLarge1000,
+};
+
+// Indexed by the high nibble of the current byte
+const uint8_t kUtf8CurrentHigh[16] = {
+    kUtf8TooShort, kUtf8TooShort, kUtf8TooShort, kUtf8TooShort,
+    kUtf8TooShort, kUtf8TooShort, kUtf8TooShort, kUtf8TooShort,
+    kUtf8TooLong | kUtf8Overlong2 | kUtf8TwoConts | kUtf8Overlong3 | kUtf8TooLarge1000 | kUtf8Overlong4,
+    kUtf8TooLong | kUtf8Overlong2 | kUtf8TwoConts | kUtf8Overlong3 | kUtf8TooLarge,
+    kUtf8TooLong | kUtf8Overlong2 | kUtf8TwoConts | kUtf8Surrogate | kUtf8TooLarge,
+    kUtf8TooLong | kUtf8Overlong2 | kUtf8TwoConts | kUtf8Surrogate | kUtf8TooLarge,
+    kUtf8TooShort, kUtf8TooShort, kUtf8TooShort, kUtf8TooShort,
+};
+
+CPU_TARGET("sse4.2")
+size_t findInSetSse42(const unsigned char *data, size_t length, const ByteSet& set)
+{
+    const __m128i lo = _mm_load_si128(reinterpret_cast<const __m128i *>(set.lowNibbleBitsLo));
+    const __m128i hi = _mm_load_si128(reinterpret_cast<const __m128i *>(set.lowNibbleBitsHi));
+    const __m128i highLo = _mm_loadu_si128(reinterpret_cast<const __m128i *>(kHighNibbleBitsLo));
+    const __m128i highHi = _mm_loadu_si128(reinterpret_cast<const __m128i *>(kHighNibbleBitsHi));
+    const __m128i nibbleMask = _mm_set1_epi8(0x0F);
+    const __m128i zero = _mm_setzero_si128();
+
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        __m128i low = _mm_and_si128(chunk, nibbleMask);
+        __m128i high = _mm_and_si128(_mm_srli_epi16(chunk, 4), nibbleMask);
+        __m128i bits = _mm_or_si128(
+            _mm_and_si128(_mm_shuffle_epi8(lo, low), _mm_shuffle_epi8(highLo, high)),
+            _mm_and_si128(_mm_shuffle_epi8(hi, low), _mm_shuffle_epi8(highHi, high)));
+        unsigned mask = ~static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(bits, zero))) & 0xFFFFu;
+        if (mask) {
+            return i + countTrailingZeros(mask);
+        }
+    }
+    return i + findInSetScalar(data + i, length - i, set);
+}
+
+CPU_TARGET("sse4.2")
+size_t asciiPrefixSse42(const unsigned char *data, size_t length)
+{
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(chunk));
+        if (mask) {
+            return i + countTrailingZeros(mask);
+        }
+    }
+    return i + asciiPrefixScalar(data + i, length - i);
+}
+
+CPU_TARGET("sse4.2")
+void collectByteSse42(const unsigned char *data, size_t length, unsigned char byte,
+                      size_t base, std::vector<size_t>& positions)
+{
+    const __m128i needle = _mm_set1_epi8(static_cast<char>(byte));
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle)));
+        while (mask) {
+            positions.push_back(base + i + countTrailingZeros(mask));
+            mask &= mask - 1;
+        }
+    }
+    collectByteScalar(data + i, length - i, byte, base + i, positions);
+}
+
+CPU_TARGET("sse4.2")
+bool validUtf8Sse42(const unsigned char *data, size_t length)
+{
+    const __m128i prevHigh = _mm_loadu_si128(reinterpret_cast<const __m128i *>(kUtf8PrevHigh));
+    const __m128i prevLow = _mm_loadu_si128(reinterpret_cast<const __m128i *>(kUtf8PrevLow));
+    const __m128i currentHigh = _mm_loadu_si128(reinterpret_cast<const __m128i *>(kUtf8CurrentHigh));
+    const __m128i nibbleMask = _mm_set1_epi8(0x0F);
+    const __m128i thirdByteBias = _mm_set1_epi8(0xE0 - 0x80);   // only 111xxxxx stays >= 0x80
+    const __m128i fourthByteBias = _mm_set1_epi8(0xF0 - 0x80);  // only 1111xxxx stays >= 0x80
+    const __m128i highBit = _mm_set1_epi8(static_cast<char>(0x80));
+    __m128i previous = _mm_setzero_si128();
+
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        // Leaves a block of ASCII when the last one ended on a character
+        if (_mm_movemask_epi8(_mm_or_si128(chunk, previous)) == 0) {
+            continue;
+        }
+        __m128i prev1 = _mm_alignr_epi8(chunk, previous, 15);
+        __m128i prev2 = _mm_alignr_epi8(chunk, previous, 14);
+        __m128i prev3 = _mm_alignr_epi8(chunk, previous, 13);
+        __m128i special = _mm_and_si128(
+            _mm_and_si128(_mm_shuffle_epi8(prevHigh, _mm_and_si128(_mm_srli_epi16(prev1, 4), nibbleMask)),
+                          _mm_shuffle_epi8(prevLow, _mm_and_si128(prev1, nibbleMask))),
+            _mm_shuffle_epi8(currentHigh, _mm_and_si128(_mm_srli_epi16(chunk, 4), nibbleMask)));
+        // The second and third byte after a 3- or 4-byte lead must be
+        // continuations, which the pair lookup marked as two in a row
+        __m128i mustContinue = _mm_and_si128(
+            _mm_or_si128(_mm_subs_epu8(prev2, thirdByteBias), _mm_subs_epu8(prev3, fourthByteBias)), highBit);
+        __m128i error = _mm_xor_si128(mustContinue, special);
+        if (!_mm_testz_si128(error, error)) {
+            return false;
+        }
+        previous = chunk;
+    }
+    const size_t resume = utf8ResumePoint(data, i);
+    return validUtf8Scalar(data + resume, length - resume);
+}
+
+CPU_TARGET("avx2")
+size_t findInSetAvx2(const unsigned char *data, size_t length, const ByteSet& set)
+{
+    // vpshufb works per 128-bit lane, so every table is broadcast to both lanes
+    const __m256i lo = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i *>(set.lowNibbleBitsLo)));
+    const __m256i hi = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i *>(set.lowNibbleBitsHi)));
+    const __m256i highLo = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(kHighNibbleBitsLo)));
+    const __m256i highHi = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(kHighNibbleBitsHi)));
+    const __m256i nibbleMask = _mm256_set1_epi8(0x0F);
+    const __m256i zero = _mm256_setzero_si256();
+
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+        __m256i low = _mm256_and_si256(chunk, nibbleMask);
+        __m256i high = _mm256_and_si256(_mm256_srli_epi16(chunk, 4), nibbleMask);
+        __m256i bits = _mm256_or_si256(
+            _mm256_and_si256(_mm256_shuffle_epi8(lo, low), _mm256_shuffle_epi8(highLo, high)),
+            _mm256_and_si256(_mm256_shuffle_epi8(hi, low), _mm256_shuffle_epi8(highHi, high)));
+        uint32_t mask = ~static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(bits, zero)));
+        if (mask) {
+            return i + countTrailingZeros(mask);
+        }
+    }
+    return i + findInSetSse42(data + i, length - i, set);
+}
+
+CPU_TARGET("avx2")
+size_t asciiPrefixAvx2(const unsigned char *data, size_t length)
+{
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(chunk));
+        if (mask) {
+            return i + countTrailingZeros(mask);
+        }
+    }
+    return i + asciiPrefixSse42(data + i, length - i);
+}
+
+CPU_TARGET("avx2")
+void collectByteAvx2(const unsigned char *data, size_t length, unsigned char byte,
+                     size_t base, std::vector<size_t>& positions)
+{
+    const __m256i needle = _mm256_set1_epi8(static_cast<char>(byte));
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle)));
+        while (mask) {
+            positions.push_back(base + i + countTrailingZeros(mask));
+            mask &= mask - 1;
+        }
+    }
+    collectByteSse42(data + i, length - i, byte, base + i, positions);
+}
+
+CPU_TARGET("avx2")
+bool validUtf8Avx2(const unsigned char *data, size_t length)
+{
+    const __m256i prevHigh = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(kUtf8PrevHigh)));
+    const __m256i prevLow = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(kUtf8PrevLow)));
+    const __m256i currentHigh = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(kUtf8CurrentHigh)));
+    const __m256i nibbleMask = _mm256_set1_epi8(0x0F);
+    const __m256i thirdByteBias = _mm256_set1_epi8(0xE0 - 0x80);
+    const __m256i fourthByteBias = _mm256_set1_epi8(0xF0 - 0x80);
+    const __m256i highBit = _mm256_set1_epi8(static_cast<char>(0x80));
+    __m256i previous = _mm256_setzero_si256();
+
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+        if (_mm256_movemask_epi8(_mm256_or_si256(chunk, previous)) == 0) {
+            continue;
+        }
+        // vpalignr works per 128-bit lane; pair each lane with the one before it
+        __m256i before = _mm256_permute2x128_si256(previous, chunk, 0x21);
+        __m256i prev1 = _mm256_alignr_epi8(chunk, before, 15);
+        __m256i prev2 = _mm256_alignr_epi8(chunk, before, 14);
+        __m256i prev3 = _mm256_alignr_epi8(chunk, before, 13);
+        __m256i special = _mm256_and_si256(
+            _mm256_and_si256(_mm256_shuffle_epi8(prevHigh, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibbleMask)),
+                             _mm256_shuffle_epi8(prevLow, _mm256_and_si256(prev1, nibbleMask))),
+            _mm256_shuffle_epi8(currentHigh, _mm256_and_si256(_mm256_srli_epi16(chunk, 4), nibbleMask)));
+        __m256i mustContinue = _mm256_and_si256(
+            _mm256_or_si256(_mm256_subs_epu8(prev2, thirdByteBias), _mm256_subs_epu8(prev3, fourthByteBias)), highBit);
+        __m256i error = _mm256_xor_si256(mustContinue, special);
+        if (!_mm256_testz_si256(error, error)) {
+            return false;
+        }
+        previous = chunk;
+    }
+    const size_t resume = utf8ResumePoint(data, i);
+    return validUtf8Sse42(data + resume, length - resume);
+}
+
+CPU_TARGET("avx512f,avx512bw")
+inline __m512i broadcastTable512(const uint8_t *table)
+{
+    // Replicated through memory; the broadcast intrinsics trip -Wuninitialized in GCC 12 headers
+    alignas(64) uint8_t lanes[64];
+    for (int lane = 0; lane < 4; ++lane) {
+        std::memcpy(lanes + lane * 16, table, 16);
+    }
+    return _mm512_load_si512(lanes);
+}
+
+CPU_TARGET("avx512f,avx512bw")
+size_t findInSetAvx512(const unsigned char *data, size_t length, const ByteSet& set)
+{
+    const __m512i lo = broadcastTable512(set.lowNibbleBitsLo);
+    const __m512i hi = broadcastTable512(set.lowNibbleBitsHi);
+    const __m512i highLo = broadcastTable512(kHighNibbleBitsLo);
+    const __m512i highHi = broadcastTable512(kHighNibbleBitsHi);
+    const __m512i nibbleMask = _mm512_set1_epi8(0x0F);
+
+    size_t i = 0;
+    for (; i + 64 <= length; i += 64) {
+        __m512i chunk = _mm512_loadu_si512(data + i);
+        __m512i low = _mm512_and_si512(chunk, nibbleMask);
+        __m512i high = _mm512_and_si512(_mm512_srli_epi16(chunk, 4), nibbleMask);
+        __m512i bits = _mm512_or_si512(
+            _mm512_and_si512(_mm512_shuffle_epi8(lo, low), _mm512_shuffle_epi8(highLo, high)),
+            _mm512_and_si512(_mm512_shuffle_epi8(hi, low), _mm512_shuffle_epi8(highHi, high)));
+        uint64_t mask = _mm512_test_epi8_mask(bits, bits);
+        if (mask) {
+            return i + countTrailingZeros(mask);
+        }
+    }
+    return i + findInSetAvx2(data + i, length - i, set);
+}
+
+CPU_TARGET("avx512f,avx512bw")
+size_t asciiPrefixAvx512(const unsigned char *data, size_t length)
+{
+    size_t i = 0;
+    for (; i + 64 <= length; i += 64) {
+        __m512i chunk = _mm512_loadu_si512(data + i);
+        uint64_t mask = _mm512_movepi8_mask(chunk);
+        if (mask) {
+            return i + countTrailingZeros(mask);
+        }
+    }
+    return i + asciiPrefixAvx2(data + i, length - i);
+}
+
+CPU_TARGET("avx512f,avx512bw")
+void collectByteAvx512(const unsigned char *data, size_t length, unsigned char byte,
+                       size_t base, std::vector<size_t>& positions)
+{
+    const __m512i needle = _mm512_set1_epi8(static_cast<char>(byte));
+    size_t i = 0;
+    for (; i + 64 <= length; i += 64) {
+        __m512i chunk = _mm512_loadu_si512(data + i);
+        uint64_t mask = _mm512_cmpeq_epi8_mask(chunk, needle);
+        while (mask) {
+            positions.push_back(base + i + countTrailingZeros(mask));
+            mask &= mask - 1;
+        }
+    }
+    collectByteAvx2(data + i, length - i, byte, base + i, positions);
+}
+
+CPU_TARGET("avx512f,avx512bw")
+bool validUtf8Avx512(const unsigned char *data, size_t length)
+{
+    const __m512i prevHigh = broadcastTable512(kUtf8PrevHigh);
+    const __m512i prevLow = broadcastTable512(kUtf8PrevLow);
+    const __m512i currentHigh = broadcastTable512(kUtf8CurrentHigh);
+    const __m512i nibbleMask = _mm512_set1_epi8(0x0F);
+    const __m512i thirdByteBias = _mm512_set1_epi8(0xE0 - 0x80);
+    const __m512i fourthByteBias = _mm512_set1_epi8(0xF0 - 0x80);
+    const __m512i highBit = _mm512_set1_epi8(static_cast<char>(0x80));
+    // Lane n - 1 of the 128-bit lanes, lane 3 of the previous block first
+    const __m512i lanesBefore = _mm512_set_epi64(13, 12, 11, 10, 9, 8, 7, 6);
+    __m512i previous = _mm512_setzero_si512();
+
+    size_t i = 0;
+    for (; i + 64 <= length; i += 64) {
+        __m512i chunk = _mm512_loadu_si512(data + i);
+        if (_mm512_movepi8_mask(_mm512_or_si512(chunk, previous)) == 0) {
+            continue;
+        }
+        __m512i before = _mm512_permutex2var_epi64(previous, lanesBefore, chunk);
+        __m512i prev1 = _mm512_alignr_epi8(chunk, before, 15);
+        __m512i prev2 = _mm512_alignr_epi8(chunk, before, 14);
+        __m512i prev3 = _mm512_alignr_epi8(chunk, before, 13);
+        __m512i special = _mm512_and_si512(
+            _mm512_and_si512(_mm512_shuffle_epi8(prevHigh, _mm512_and_si512(_mm512_srli_epi16(prev1, 4), nibbleMask)),
+                             _mm512_shuffle_epi8(prevLow, _mm512_and_si512(prev1, nibbleMask))),
+            _mm512_shuffle_epi8(currentHigh, _mm512_and_si512(_mm512_srli_epi16(chunk, 4), nibbleMask)));
+        __m512i mustContinue = _mm512_and_si512(
+            _mm512_or_si512(_mm512_subs_epu8(prev2, thirdByteBias), _mm512_subs_epu8(prev3, fourthByteBias)), highBit);
+        __m512i error = _mm512_xor_si512(mustContinue, special);
+        if (_mm512_test_epi8_mask(error, error)) {
+            return false;
+        }
+        previous = chunk;
+    }
+    const size_t resume = utf8ResumePoint(data, i);
+    return validUtf8Avx2(data + resume, length - resume);
+}
+
+#endif // CPUDISPATCH_X86
+
+const CpuDispatch::Kernels kKernels[] = {
+    {findInSetScalar, asciiPrefixScalar, collectByteScalar, validUtf8Scalar},
+#ifdef CPUDISPATCH_X86
+    {findInSetSse42, asciiPrefixSse42, collectByteSse42, validUtf8Sse42},
+    {findInSetAvx2, asciiPrefixAvx2, collectByteAvx2, validUtf8Avx2},
+    {findInSetAvx512, asciiPrefixAvx512, collectByteAvx512, validUtf8Avx512},
+#endif
+};
+
+CpuTier detectTier()
+{
+#ifdef CPUDISPATCH_X86
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    const int maxLeaf = info[0];
+    __cpuid(info, 1);
+    const bool sse42 = (info[2] & (1 << 20)) != 0;
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    const unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+    const bool avxState = (xcr0 & 0x6) == 0x6;
+    const bool avx512State = (xcr0 & 0xE6) == 0xE6;
+    bool avx2 = false;
+    bool avx512 = false;
+    if (maxLeaf >= 7) {
+        __cpuidex(info, 7, 0);
+        avx2 = avxState && (info[1] & (1 << 5)) != 0;
+        avx512 = avx512State && (info[1] & (1 << 16)) != 0 && (info[1] & (1 << 30)) != 0;
+    }
+#else
+    // libgcc also checks XCR0, so these are false when the OS does not save the registers
+    __builtin_cpu_init();
+    const bool sse42 = __builtin_cpu_supports("sse4.2");
+    const bool avx2 = __builtin_cpu_supports("avx2");
+    const bool avx512 = __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+#endif
+    if (avx512) return CpuTier::Avx512;
+    if (avx2) return CpuTier::Avx2;
+    if (sse42) return CpuTier::Sse42;
+#endif
+    return CpuTier::Scalar;
+}
+
+CpuTier initialTier()
+{
+    CpuTier tier = CpuDispatch::detectedTier();
+    CpuTier forced;
+    const char *override = std::getenv("MULTREPLACER_CPU_TIER");
+    if (override && CpuDispatch::parseTier(override, &forced) && forced < tier) {
+        tier = forced;
+    }
+    return tier;
+}
+
+std::atomic<int>& activeTierStorage()
+{
+    static std::atomic<int> tier{static_cast<int>(initialTier())};
+    return tier;
+}
+
+} // namespace
+
+CpuTier CpuDispatch::detectedTier()
+{
+    static const CpuTier tier = detectTier();
+    return tier;
+}
+
+CpuTier CpuDispatch::activeTier()
+{
+    return static_cast<CpuTier>(activeTierStorage().load(std::memory_order_relaxed));
+}
+
+void CpuDispatch::setActiveTier(CpuTier tier)
+{
+    if (tier > detectedTier()) {
+        tier = detectedTier();
+    }
+    activeTierStorage().store(static_cast<int>(tier), std::memory_order_relaxed);
+}
+
+const CpuDispatch::Kernels& CpuDispatch::kernels()
+{
+    return kKernels[static_cast<int>(activeTier())];
+}
+
+const char *CpuDispatch::tierName(CpuTier tier)
+{
+    switch (tier) {
+    case CpuTier::Scalar: return "scalar";
+    case CpuTier::Sse42: return "sse4.2";
+    case CpuTier::Avx2: return "avx2";
+    case CpuTier::Avx512: return "avx512";
+    }
+    return "scalar";
+}
+
+bool CpuDispatch::parseTier(const char *name, CpuTier *tier)
+{
+    for (CpuTier t : {CpuTier::Scalar, CpuTier::Sse42, CpuTier::Avx2, CpuTier::Avx512}) {
+        if (std::strcmp(name, tierName(t)) == 0) {
+            *tier = t;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,67 @@
+#ifndef CPUDISPATCH_H
+#define CPUDISPATCH_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+enum class CpuTier { Scalar, Sse42, Avx2, Avx512 };
+
+/**
+ * ByteSet is a set of byte values prepared for vector lookup: besides the
+ * plain membership table it keeps nibble tables for the pshufb technique,
+ * which tests 16/32/64 bytes against an arbitrary set with four shuffles.
+ */
+struct ByteSet {
+    alignas(16) uint8_t lowNibbleBitsLo[16];   // bit h set when (h << 4 | n) is in the set, h < 8
+    alignas(16) uint8_t lowNibbleBitsHi[16];   // same for h >= 8, bit h - 8
+    std::array<bool, 256> contains;
+
+    ByteSet() { clear(); }
+    void clear();
+    void insert(unsigned char byte);
+    bool empty() const;
+};
+
+/**
+ * CpuDispatch picks the scanning kernels for the CPU the binary runs on.
+ * Kernels for every tier are compiled into the same binary with per-function
+ * target attributes, so the build needs no -march flag. The best supported
+ * tier is chosen on first use; MULTREPLACER_CPU_TIER=scalar|sse4.2|avx2|avx512
+ * forces a lower tier for testing (requests above the hardware are clamped).
+ *
+ * Copying unmatched spans is left to memcpy, which glibc and the MSVC runtime
+ * already dispatch per CPU.
+ */
+class CpuDispatch
+{
+public:
+    struct Kernels {
+        // Index of the first byte in data that is in set, or length
+        size_t (*findInSet)(const unsigned char *data, size_t length, const ByteSet& set);
+        // Length of the leading run of bytes below 0x80
+        size_t (*asciiPrefix)(const unsigned char *data, size_t length);
+        // Append base + i to positions for every i where data[i] == byte
+        void (*collectByte)(const unsigned char *data, size_t length, unsigned char byte,
+                            size_t base, std::vector<size_t>& positions);
+        // True when data is well-formed UTF-8 (Unicode table 3-7)
+        bool (*validUtf8)(const unsigned char *data, size_t length);
+    };
+
+    // Highest tier the hardware and OS support
+    static CpuTier detectedTier();
+
+    // Tier in use; detectedTier() unless overridden
+    static CpuTier activeTier();
+
+    // Switch kernels, e.g. to benchmark each tier; clamped to detectedTier()
+    static void setActiveTier(CpuTier tier);
+
+    static const Kernels& kernels();
+
+    static const char *tierName(CpuTier tier);
+    static bool parseTier(const char *name, CpuTier *tier);
+};
+
+#endif // CPUDISPATCH_H
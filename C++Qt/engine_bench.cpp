@@ -0,0 +1,145 @@
+/**
+ * Engine micro benchmark
+ * Runs the same workloads once per CPU tier the machine supports, so every
+ * kernel tier shows up as its own variant (e.g. "prose/avx2"), and once per
+ * matching strategy at the best tier (e.g. "prose/shift-or"). The
+ * "count" variant is the dry run, which builds no output, and the "tuned"
+ * variant runs the strategy EngineTuner picks from a sample of the text,
+ * to compare against the fixed choices.
+ *
+ * Usage: engine_bench [megabytes]
+ */
+
+#include "replaceengine.h"
+#include "enginetuner.h"
+#include "cpudispatch.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <random>
+#include <string>
+
+namespace {
+
+struct Workload {
+    const char *name;
+    std::string text;
+    std::map<std::string, std::string> rules;
+};
+
+std::string makeText(size_t size, const char *alphabet, unsigned seed)
+{
+    std::mt19937 rng(seed);
+    const size_t count = std::char_traits<char>::length(alphabet);
+    std::string text(size, ' ');
+    for (char& c : text) {
+        c = alphabet[rng() % count];
+    }
+    return text;
+}
+
+// Best throughput of a few runs in MB/s; run returns the output size
+template <typename Run>
+double measureRun(const std::string& text, Run run, size_t *outputSize)
+{
+    double best = 0.0;
+    for (int attempt = 0; attempt < 5; ++attempt) {
+        auto start = std::chrono::steady_clock::now();
+        *outputSize = run();
+        auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        double mbPerSecond = text.size() / (1024.0 * 1024.0) / elapsed;
+        if (mbPerSecond > best) {
+            best = mbPerSecond;
+        }
+    }
+    return best;
+}
+
+double measure(const ReplaceEngine& engine, const std::string& text, size_t *outputSize)
+{
+    return measureRun(text, [&]() { return engine.replace(text).size(); }, outputSize);
+}
+
+double measureCount(const ReplaceEngine& engine, const std::string& text, size_t *outputSize)
+{
+    return measureRun(text, [&]() {
+        return static_cast<size_t>(static_cast<int64_t>(text.size())
+                                   + engine.countMatches(text.data(), text.size()).sizeDelta);
+    }, outputSize);
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    const size_t megabytes = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 64;
+    const size_t size = megabytes * 1024 * 1024;
+
+    std::vector<Workload> workloads;
+    workloads.push_back({"sparse", makeText(size, "abcdefghijklmnopqrstuvwxyz ", 1),
+                         {{"QX", "qx"}, {"ZZZ", "z"}}});
+    workloads.push_back({"prose", makeText(size, "abcdefghijklmnopqrstuvwxyz     ", 2),
+                         {{"the", "THE"}, {"and", "&"}, {"ing", "ING"}, {"qu", "kw"}, {"zz", "z"}}});
+    workloads.push_back({"dense", makeText(size, "abcd", 3),
+                         {{"ab", "x"}, {"abc", "y"}, {"d", "dd"}}});
+    workloads.push_back({"single", makeText(size, "abcdefghijklmnopqrstuvwxyz ", 4),
+                         {{"needle", "pin"}}});
+    workloads.push_back({"wide", makeText(size, "abcdefghijklmnopqrstuvwxyz ", 5),
+                         {{"ax", "1"}, {"ex", "2"}, {"ix", "3"}, {"ox", "4"},
+                          {"ux", "5"}, {"sx", "6"}, {"tx", "7"}, {"nx", "8"}}});
+    // Many start bytes that the text never contains, and few that it is full of
+    workloads.push_back({"absent", makeText(size, "abcdefghijklmnopqrstuvwxyz ", 6),
+                         {{"AB", "1"}, {"CD", "2"}, {"EF", "3"}, {"GH", "4"}, {"IJ", "5"}}});
+    workloads.push_back({"frequent", makeText(size, "aeeeeiou      bcdfghjklmnpqrstvwxyz", 7),
+                         {{"e q", "1"}, {" zz", "2"}}});
+
+    const CpuTier detected = CpuDispatch::detectedTier();
+    std::printf("detected tier: %s\n", CpuDispatch::tierName(detected));
+    std::printf("%-24s %12s %14s\n", "variant", "MB/s", "output bytes");
+
+    auto report = [](const Workload& workload, const char *variantName, double throughput, size_t outputSize) {
+        std::string variant = std::string(workload.name) + "/" + variantName;
+        std::printf("%-24s %12.1f %14zu\n", variant.c_str(), throughput, outputSize);
+    };
+
+    for (Workload& workload : workloads) {
+        ReplaceEngine engine;
+        engine.compile(workload.rules);
+        std::printf("%s: auto strategy is %s\n", workload.name, ReplaceEngine::strategyName(engine.strategy()));
+        for (int t = 0; t <= static_cast<int>(detected); ++t) {
+            CpuTier tier = static_cast<CpuTier>(t);
+            CpuDispatch::setActiveTier(tier);
+            size_t outputSize = 0;
+            double throughput = measure(engine, workload.text, &outputSize);
+            report(workload, CpuDispatch::tierName(tier), throughput, outputSize);
+        }
+        CpuDispatch::setActiveTier(detected);
+
+        size_t countedSize = 0;
+        double countThroughput = measureCount(engine, workload.text, &countedSize);
+        report(workload, "count", countThroughput, countedSize);
+
+        for (EngineStrategy strategy : {EngineStrategy::Trie, EngineStrategy::SinglePattern,
+                                        EngineStrategy::ShiftOr, EngineStrategy::RollingHash}) {
+            ReplaceEngine forced;
+            forced.compile(workload.rules, TextEncoding::Utf8, strategy);
+            if (forced.strategy() != strategy) {
+                continue; // the rule set does not fit this kernel
+            }
+            size_t outputSize = 0;
+            double throughput = measure(forced, workload.text, &outputSize);
+            report(workload, ReplaceEngine::strategyName(strategy), throughput, outputSize);
+        }
+
+        const std::string sample = EngineTuner::sample(workload.text.data(), workload.text.size());
+        const EngineTuner::Decision decision = EngineTuner::choose(engine, sample.data(), sample.size());
+        std::printf("%s: tuned strategy is %s\n", workload.name, decision.toText().c_str());
+        ReplaceEngine tuned;
+        tuned.compile(workload.rules, TextEncoding::Utf8, decision.strategy);
+        size_t tunedSize = 0;
+        double tunedThroughput = measure(tuned, workload.text, &tunedSize);
+        report(workload, "tuned", tunedThroughput, tunedSize);
+    }
+    return 0;
+}
@@ -0,0 +1,1161 @@
+/**
+ * Engine behavior tests
+ * Every way of running rules is compared against a plain reference of the
+ * original multiReplace semantics (multi_replace.cpp): at each character
+ * the longest pattern that starts there wins, replaced text is never
+ * matched again, and stages run one after the other on the previous
+ * stage's output. Random rule sets and texts cover every kernel at every
+ * CPU tier, stream chunking, stage fusion, rule analysis, the document's
+ * versions and their selected ranges, gzip and zstd streams, incremental
+ * rescans, line batches and the pipe filter, in UTF-8, Shift_JIS and
+ * EUC-JP; the codecs are checked at every tier as well.
+ *
+ * Usage: engine_tests [seed]
+ */
+
+#include "replaceengine.h"
+#include "rulestore.h"
+#include "resultcache.h"
+#include "contenthash.h"
+#include "rulepipeline.h"
+#include "ruleanalyzer.h"
+#include "streamreplacer.h"
+#include "piecetable.h"
+#include "incrementalmatcher.h"
+#include "compressedio.h"
+#include "lineindex.h"
+#include "linebatchreplacer.h"
+#include "pipefilter.h"
+#include "textrange.h"
+#include "cpudispatch.h"
+#include "textcodec.h"
+#include <cstdio>
+#include <array>
+#include <cstdlib>
+#include <initializer_list>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+
+int g_failures = 0;
+int g_checks = 0;
+
+#define CHECK(condition, ...) \
+    do { \
+        ++g_checks; \
+        if (!(condition)) { \
+            ++g_failures; \
+            std::printf("FAIL %s:%d: %s: ", __FILE__, __LINE__, #condition); \
+            std::printf(__VA_ARGS__); \
+            std::printf("\n"); \
+        } \
+    } while (0)
+
+using Rules = std::map<std::string, std::string>;
+using Stages = std::vector<Rules>;
+
+// Characters the random texts and patterns are made of. The legacy sets
+// hold double-byte characters whose trail byte is also a character of its
+// own ('A', '\\') or the lead byte of another one, so a match that starts
+// inside a character would show.
+const std::vector<std::string>& alphabet(TextEncoding encoding)
+{
+    static const std::vector<std::string> utf8 = {"a", "b", "c", "\n", "\xE3\x81\x82", "\xC3\xA9"};
+    static const std::vector<std::string> shiftJis = {"A", "\\", "b", "\n", "\x83\x41", "\x95\x5C", "\x82\xA0", "\x88\x83"};
+    static const std::vector<std::string> eucJp = {"a", "b", "\n", "\xA4\xA2", "\xB0\xA4", "\xA4\xA4", "\x8E\xB1",
+                                                   "\x8F\xB0\xA1"};
+    switch (encoding) {
+    case TextEncoding::ShiftJis:
+        return shiftJis;
+    case TextEncoding::EucJp:
+        return eucJp;
+    case TextEncoding::Utf8:
+        break;
+    }
+    return utf8;
+}
+
+std::string randomText(std::mt19937& rng, TextEncoding encoding, size_t maxChars, bool newlines = true)
+{
+    const std::vector<std::string>& chars = alphabet(encoding);
+    std::string text;
+    const size_t count = rng() % (maxChars + 1);
+    while (text.size() < count) {
+        const std::string& c = chars[rng() % chars.size()];
+        if (newlines || c != "\n") {
+            text += c;
+        }
+    }
+    return text;
+}
+
+Rules randomRules(std::mt19937& rng, TextEncoding encoding, size_t maxRules, size_t maxLength, bool newlines = true)
+{
+    Rules rules;
+    const size_t count = 1 + rng() % maxRules;
+    for (size_t i = 0; i < count; ++i) {
+        std::string pattern = randomText(rng, encoding, maxLength, newlines);
+        if (pattern.empty()) {
+            pattern = alphabet(encoding)[0];
+        }
+        rules[pattern] = randomText(rng, encoding, maxLength, newlines);
+    }
+    return rules;
+}
+
+// The original multiReplace, stepping character by character so that in
+// legacy encodings no match starts inside a character. Hits, if given, is
+// indexed like the rules' order in the map, which is the compiled order.
+std::string referenceReplace(const std::string& source, const Rules& rules, TextEncoding encoding,
+                             uint64_t *matches = nullptr, std::vector<uint64_t> *hits = nullptr)
+{
+    std::string result;
+    size_t pos = 0;
+    if (hits) {
+        hits->assign(rules.size(), 0);
+    }
+    while (pos < source.size()) {
+        const std::pair<const std::string, std::string> *best = nullptr;
+        size_t bestIndex = 0;
+        size_t index = 0;
+        for (const auto& rule : rules) {
+            if (source.compare(pos, rule.first.size(), rule.first) == 0
+                && (!best || rule.first.size() > best->first.size())) {
+                best = &rule;
+                bestIndex = index;
+            }
+            ++index;
+        }
+        if (best) {
+            result += best->second;
+            pos += best->first.size();
+            if (matches) {
+                ++*matches;
+            }
+            if (hits) {
+                ++(*hits)[bestIndex];
+            }
+        } else {
+            const size_t step = std::min<size_t>(TextCodec::charLength(encoding, static_cast<unsigned char>(source[pos])),
+                                                 source.size() - pos);
+            result.append(source, pos, step);
+            pos += step;
+        }
+    }
+    return result;
+}
+
+std::string referencePipeline(const std::string& source, const Stages& stages, TextEncoding encoding,
+                              uint64_t *matches = nullptr)
+{
+    std::string text = source;
+    for (const Rules& rules : stages) {
+        text = referenceReplace(text, rules, encoding, matches);
+    }
+    return text;
+}
+
+void fillPipeline(RulePipeline& pipeline, const Stages& stages)
+{
+    pipeline.clear();
+    for (size_t s = 0; s < stages.size(); ++s) {
+        RuleStore& store = pipeline.stage("stage" + std::to_string(s));
+        for (const auto& [pattern, replacement] : stages[s]) {
+            store.set(pattern, replacement);
+        }
+    }
+}
+
+// Feed text in random pieces, some of a single byte
+void feedChunked(std::mt19937& rng, const std::string& text, const StreamReplacer::Writer& feed)
+{
+    size_t pos = 0;
+    while (pos < text.size()) {
+        const size_t chunk = std::min<size_t>(rng() % 4 == 0 ? 1 : 1 + rng() % 64, text.size() - pos);
+        feed(text.data() + pos, chunk);
+        pos += chunk;
+    }
+}
+
+const TextEncoding kEncodings[] = {TextEncoding::Utf8, TextEncoding::ShiftJis, TextEncoding::EucJp};
+
+// The cases of multi_replace.cpp's testMultiReplace()
+void testOriginalCases()
+{
+    const struct {
+        const char *text;
+        Rules rules;
+        const char *expected;
+    } cases[] = {
+        {"Hello world, hello universe", {{"hello", "hi"}, {"world", "earth"}}, "Hello earth, hi universe"},
+        {"caterpillar and cat", {{"cat", "dog"}, {"caterpillar", "butterfly"}}, "butterfly and dog"},
+        {"a b c", {{"a", "b"}, {"b", "c"}}, "b c c"},
+        {"remove this and this", {{"this", ""}, {" and ", " & "}}, "remove  & "},
+        {"This is a test string with many words to replace in a typical text file.",
+         {{"test", "sample"}, {"string", "text"}, {"many", "several"}, {"words", "terms"}, {"typical", "standard"}},
+         "This is a sample text with several terms to replace in a standard text file."},
+    };
+    for (const auto& c : cases) {
+        ReplaceEngine engine;
+        engine.compile(c.rules);
+        const std::string result = engine.replace(c.text);
+        CHECK(result == c.expected, "\"%s\" gave \"%s\"", c.text, result.c_str());
+    }
+}
+
+// Rules set from the store's own views, while the arena grows under them
+void testRuleStoreAliasing()
+{
+    RuleStore store;
+    store.set("abc", "x");
+    store.set(store.pattern(0), std::string(6000, 'q'));
+    CHECK(store.size() == 1 && store.pattern(0) == "abc" && store.replacement(0) == std::string(6000, 'q'),
+          "existing pattern from the arena: %zu rules", store.size());
+
+    store.set(store.pattern(0).substr(0, 2), std::string(20000, 'r'));
+    CHECK(store.size() == 2 && store.pattern(1) == "ab" && store.replacement(1) == std::string(20000, 'r'),
+          "new pattern from the arena: %zu rules", store.size());
+    CHECK(store.find("ab") == 1 && store.find("abc") == 0, "lookup after growth");
+
+    store.set(store.replacement(1).substr(0, 3), store.replacement(0));
+    CHECK(store.size() == 3 && store.pattern(2) == "rrr" && store.replacement(2) == std::string(6000, 'q'),
+          "pattern and replacement from the arena: %zu rules", store.size());
+}
+
+// Hashing in pieces, as the file loader does, gives the one-shot hash
+void testContentHash(std::mt19937& rng)
+{
+    CHECK(ContentHash::hash64("", 0) == 0xEF46DB3751D8E999ull, "XXH64 of nothing");
+    for (int round = 0; round < 300; ++round) {
+        std::string data(rng() % 2000, '\0');
+        for (char& c : data) {
+            c = static_cast<char>(rng());
+        }
+        ContentHash hash;
+        feedChunked(rng, data, [&hash](const char *bytes, size_t length) { hash.update(bytes, length); });
+        CHECK(hash.digest() == ContentHash::hash64(data.data(), data.size()), "%zu bytes in pieces", data.size());
+    }
+}
+
+// Least recently used entries go first, also after a save and load, and
+// loading keeps an index only where insert() would
+void testResultCache()
+{
+    auto keyOf = [](uint64_t n) {
+        ResultCache::Key key;
+        key.content = n;
+        key.length = 1000;
+        return key;
+    };
+    auto entryOf = [](size_t matches) {
+        ResultCache::Entry entry;
+        entry.hasIndex = true;
+        for (size_t m = 0; m < matches; ++m) {
+            entry.index.push_back({m * 2, 1, 0});
+        }
+        entry.index.shrink_to_fit();
+        entry.matches = matches;
+        return entry;
+    };
+    const ResultCache::Entry probe = entryOf(4);
+    const size_t entrySize = sizeof(ResultCache::Key) + sizeof(ResultCache::Entry) + 4 * sizeof(ReplaceMatch);
+
+    // An index is kept up to an eighth of the capacity
+    ResultCache cache(8 * entrySize);
+    for (uint64_t n = 0; n < 8; ++n) {
+        cache.insert(keyOf(n), probe);
+    }
+    CHECK(cache.find(keyOf(0)) != nullptr, "entry 0 missing before eviction");
+    cache.insert(keyOf(8), probe);
+    CHECK(cache.size() == 8 && cache.find(keyOf(1)) == nullptr && cache.find(keyOf(0)) != nullptr,
+          "the least recently used entry was not the one evicted");
+
+    const std::string path = "engine_tests_cache.tmp";
+    CHECK(cache.save(path), "save failed");
+    ResultCache loaded(8 * entrySize);
+    CHECK(loaded.load(path) && loaded.size() == 8, "load kept %zu entries", loaded.size());
+    loaded.insert(keyOf(9), probe);
+    CHECK(loaded.find(keyOf(2)) == nullptr && loaded.find(keyOf(0)) != nullptr,
+          "loading did not restore the use order");
+
+    ResultCache small(entrySize * 8 - 1);
+    CHECK(small.load(path), "load into a small cache failed");
+    const std::shared_ptr<const ResultCache::Entry> entry = small.find(keyOf(0));
+    CHECK(entry && !entry->hasIndex && entry->matches == 4, "load kept an index insert() would drop");
+    std::remove(path.c_str());
+}
+
+// Per-rule counters of a run, and of runs merged into one set
+void testRuleStats(std::mt19937& rng)
+{
+    for (TextEncoding encoding : kEncodings) {
+        for (int round = 0; round < 300; ++round) {
+            const Rules rules = randomRules(rng, encoding, 6, round % 5 == 0 ? 8 : 3);
+            const std::string text = randomText(rng, encoding, 400);
+            uint64_t expectedMatches = 0;
+            std::vector<uint64_t> expectedHits;
+            const std::string expected = referenceReplace(text, rules, encoding, &expectedMatches, &expectedHits);
+            const char *name = TextCodec::name(encoding);
+
+            ReplaceEngine engine;
+            engine.compile(rules, encoding);
+            RuleStats stats;
+            stats.reset(engine.ruleCount());
+            CHECK(engine.replace(text, &stats) == expected, "%s replace", name);
+            CHECK(stats.ruleCount() == rules.size(), "%s rule count %zu", name, stats.ruleCount());
+            CHECK(stats.totalHits() == expectedMatches, "%s total hits", name);
+            CHECK(stats.sizeDelta() == static_cast<int64_t>(expected.size()) - static_cast<int64_t>(text.size()),
+                  "%s size delta", name);
+
+            std::vector<uint32_t> expectedUnused;
+            size_t rule = 0;
+            for (const auto& [pattern, replacement] : rules) {
+                const RuleStats::Counter& c = stats.counter(rule);
+                CHECK(c.hits == expectedHits[rule], "%s rule %zu: %llu hits instead of %llu", name, rule,
+                      static_cast<unsigned long long>(c.hits), static_cast<unsigned long long>(expectedHits[rule]));
+                CHECK(c.bytesRemoved == c.hits * pattern.size() && c.bytesAdded == c.hits * replacement.size(),
+                      "%s rule %zu bytes", name, rule);
+                if (expectedHits[rule] == 0) {
+                    expectedUnused.push_back(static_cast<uint32_t>(rule));
+                }
+                ++rule;
+            }
+            CHECK(stats.unusedRules() == expectedUnused, "%s unused rules", name);
+
+            // Counters of a second set land after the first set's rules
+            RuleStats combined;
+            combined.reset(1);
+            combined.merge(stats);
+            combined.merge(stats, engine.ruleCount());
+            CHECK(combined.ruleCount() == 2 * engine.ruleCount() && combined.totalHits() == 2 * expectedMatches,
+                  "%s merge", name);
+            CHECK(combined.counter(engine.ruleCount()).hits == stats.counter(0).hits, "%s merge offset", name);
+        }
+    }
+}
+
+// UTF-8 validation by decoding code points, apart from the table 3-7
+// checks of the kernels
+bool referenceValidUtf8(const std::string& text)
+{
+    size_t i = 0;
+    while (i < text.size()) {
+        const unsigned char lead = static_cast<unsigned char>(text[i]);
+        size_t need;
+        uint32_t codePoint;
+        uint32_t minimum;
+        if (lead < 0x80) {
+            ++i;
+            continue;
+        } else if ((lead & 0xE0) == 0xC0) {
+            need = 1, codePoint = lead & 0x1F, minimum = 0x80;
+        } else if ((lead & 0xF0) == 0xE0) {
+            need = 2, codePoint = lead & 0x0F, minimum = 0x800;
+        } else if ((lead & 0xF8) == 0xF0) {
+            need = 3, codePoint = lead & 0x07, minimum = 0x10000;
+        } else {
+            return false;
+        }
+        if (i + need >= text.size()) {
+            return false;
+        }
+        for (size_t k = 1; k <= need; ++k) {
+            const unsigned char b = static_cast<unsigned char>(text[i + k]);
+            if ((b & 0xC0) != 0x80) {
+                return false;
+            }
+            codePoint = (codePoint << 6) | (b & 0x3F);
+        }
+        if (codePoint < minimum || codePoint > 0x10FFFF || (codePoint >= 0xD800 && codePoint <= 0xDFFF)) {
+            return false;
+        }
+        i += need + 1;
+    }
+    return true;
+}
+
+void appendUtf8(std::string& text, uint32_t codePoint)
+{
+    if (codePoint < 0x80) {
+        text += static_cast<char>(codePoint);
+    } else if (codePoint < 0x800) {
+        text += static_cast<char>(0xC0 | (codePoint >> 6));
+        text += static_cast<char>(0x80 | (codePoint & 0x3F));
+    } else if (codePoint < 0x10000) {
+        text += static_cast<char>(0xE0 | (codePoint >> 12));
+        text += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+        text += static_cast<char>(0x80 | (codePoint & 0x3F));
+    } else {
+        text += static_cast<char>(0xF0 | (codePoint >> 18));
+        text += static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F));
+        text += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+        text += static_cast<char>(0x80 | (codePoint & 0x3F));
+    }
+}
+
+// Mostly well-formed UTF-8 with long ASCII runs, code points at and just
+// past the range limits (surrogates, above U+10FFFF) and, in half of the
+// texts, a few bytes overwritten or cut off
+std::string randomUtf8(std::mt19937& rng)
+{
+    static const uint32_t edges[] = {0x7F, 0x80, 0x7FF, 0x800, 0xD7FF, 0xD800, 0xDFFF, 0xE000, 0xFFFD, 0xFFFF,
+                                     0x10000, 0x10FFFF, 0x110000};
+    static const unsigned char badBytes[] = {0x80, 0xBF, 0xC0, 0xC1, 0xC2, 0xDF, 0xE0, 0xED, 0xEF, 0xF0, 0xF4, 0xF5, 0xFF};
+    std::string text;
+    const size_t length = rng() % 300;
+    while (text.size() < length) {
+        switch (rng() % 6) {
+        case 0:
+            text.append(rng() % 80, 'a');
+            break;
+        case 1:
+            appendUtf8(text, edges[rng() % (sizeof(edges) / sizeof(edges[0]))]);
+            break;
+        case 2:
+            appendUtf8(text, 0x80 + rng() % (0x800 - 0x80));
+            break;
+        case 3: {
+            const uint32_t codePoint = 0x800 + rng() % (0x10000 - 0x800);
+            appendUtf8(text, codePoint >= 0xD800 && codePoint <= 0xDFFF ? 0x3042 : codePoint);
+            break;
+        }
+        case 4:
+            appendUtf8(text, 0x10000 + rng() % (0x110000 - 0x10000));
+            break;
+        default:
+            text += static_cast<char>(0x20 + rng() % 0x5F);
+            break;
+        }
+    }
+    if (rng() % 2 == 0 && !text.empty()) {
+        for (unsigned n = 1 + rng() % 3; n > 0; --n) {
+            const unsigned char b = rng() % 2 ? badBytes[rng() % sizeof(badBytes)] : static_cast<unsigned char>(rng());
+            text[rng() % text.size()] = static_cast<char>(b);
+        }
+        if (rng() % 4 == 0) {
+            text.resize(rng() % text.size());
+        }
+    }
+    return text;
+}
+
+// Validation and the legacy codecs at every CPU tier the machine has
+void testCodecs(std::mt19937& rng)
+{
+    const CpuTier detected = CpuDispatch::detectedTier();
+    for (int t = 0; t <= static_cast<int>(detected); ++t) {
+        CpuDispatch::setActiveTier(static_cast<CpuTier>(t));
+        const char *tier = CpuDispatch::tierName(static_cast<CpuTier>(t));
+
+        // Every lead and second byte after an ASCII run, completed with
+        // continuation bytes, ending at and crossing the vector blocks
+        size_t pairErrors = 0;
+        for (size_t offset : {0, 13, 14, 15, 31, 61, 62, 63, 64}) {
+            for (unsigned pair = 0; pair < 0x10000; ++pair) {
+                const unsigned lead = pair >> 8;
+                std::string text(offset, 'a');
+                text += static_cast<char>(lead);
+                text += static_cast<char>(pair & 0xFF);
+                text.append(lead >= 0xF0 ? 2 : lead >= 0xE0 ? 1 : 0, '\x80');
+                text.append(pair % 3 == 0 ? 0 : 70, 'a');
+                if (TextCodec::isValidUtf8(text.data(), text.size()) != referenceValidUtf8(text)) {
+                    ++pairErrors;
+                }
+            }
+        }
+        CHECK(pairErrors == 0, "%s: %zu byte pairs misjudged", tier, pairErrors);
+
+        for (int round = 0; round < 3000; ++round) {
+            const std::string text = randomUtf8(rng);
+            const bool valid = referenceValidUtf8(text);
+            CHECK(TextCodec::isValidUtf8(text.data(), text.size()) == valid, "%s: %zu bytes judged %s", tier,
+                  text.size(), valid ? "invalid" : "valid");
+            CHECK(TextCodec::countErrors(text.data(), text.size(), TextEncoding::Utf8) == (valid ? 0u : 1u),
+                  "%s: UTF-8 error count", tier);
+        }
+
+        for (TextEncoding encoding : {TextEncoding::ShiftJis, TextEncoding::EucJp}) {
+            // The characters that map to Unicode; alphabet() also has an
+            // unmapped Shift_JIS code
+            std::vector<std::string> mapped;
+            for (const std::string& c : alphabet(encoding)) {
+                if (TextCodec::countErrors(c.data(), c.size(), encoding) == 0) {
+                    mapped.push_back(c);
+                }
+            }
+            for (int round = 0; round < 300; ++round) {
+                std::string text;
+                for (size_t n = rng() % (round % 10 == 0 ? 1500 : 100); n > 0; --n) {
+                    text += mapped[rng() % mapped.size()];
+                }
+                const char *name = TextCodec::name(encoding);
+                CHECK(TextCodec::countErrors(text.data(), text.size(), encoding) == 0, "%s/%s errors", tier, name);
+                std::u16string decoded(text.size(), u'\0');
+                decoded.resize(TextCodec::decodeLegacy(text.data(), text.size(), encoding, decoded.data()));
+                std::string encoded;
+                CHECK(TextCodec::encodeLegacy(decoded.data(), decoded.size(), encoding, encoded) && encoded == text,
+                      "%s/%s round trip", tier, name);
+            }
+        }
+    }
+    CpuDispatch::setActiveTier(detected);
+}
+
+// Every strategy at every CPU tier the machine has
+void testKernels(std::mt19937& rng)
+{
+    const CpuTier detected = CpuDispatch::detectedTier();
+    const EngineStrategy strategies[] = {EngineStrategy::Auto, EngineStrategy::Trie, EngineStrategy::SinglePattern,
+                                         EngineStrategy::ShiftOr, EngineStrategy::RollingHash};
+    std::map<EngineStrategy, int> exercised;
+    for (int t = 0; t <= static_cast<int>(detected); ++t) {
+        CpuDispatch::setActiveTier(static_cast<CpuTier>(t));
+        for (TextEncoding encoding : kEncodings) {
+            for (int round = 0; round < 300; ++round) {
+                const Rules rules = randomRules(rng, encoding, round % 3 == 0 ? 1 : 6, round % 5 == 0 ? 12 : 4);
+                const std::string text = randomText(rng, encoding, round % 10 == 0 ? 5000 : 200);
+                uint64_t expectedMatches = 0;
+                const std::string expected = referenceReplace(text, rules, encoding, &expectedMatches);
+                for (EngineStrategy strategy : strategies) {
+                    ReplaceEngine engine;
+                    engine.compile(rules, encoding, strategy);
+                    if (strategy != EngineStrategy::Auto && engine.strategy() != strategy) {
+                        continue; // the rule set does not fit this kernel
+                    }
+                    ++exercised[strategy];
+                    const char *name = ReplaceEngine::strategyName(engine.strategy());
+                    CHECK(engine.replace(text) == expected, "%s/%s/%s", CpuDispatch::tierName(static_cast<CpuTier>(t)),
+                          TextCodec::name(encoding), name);
+                    const MatchSummary summary = engine.countMatches(text.data(), text.size());
+                    CHECK(summary.matches == expectedMatches, "%s count", name);
+                    CHECK(summary.sizeDelta == static_cast<int64_t>(expected.size()) - static_cast<int64_t>(text.size()),
+                          "%s size delta", name);
+                    CHECK(engine.containsMatch(text.data(), text.size()) == (expectedMatches > 0), "%s pre-scan", name);
+                    if (engine.isLengthPreserving()) {
+                        std::string patched = text;
+                        CHECK(engine.replaceInPlace(patched.data(), patched.size()) == expectedMatches,
+                              "%s in place count", name);
+                        CHECK(patched == expected, "%s in place", name);
+                    }
+                }
+            }
+        }
+    }
+    CpuDispatch::setActiveTier(detected);
+    for (EngineStrategy strategy : strategies) {
+        CHECK(exercised[strategy] > 0, "%s never ran", ReplaceEngine::strategyName(strategy));
+    }
+}
+
+// Output must not depend on where the input is cut
+void testStreamChunking(std::mt19937& rng)
+{
+    for (TextEncoding encoding : kEncodings) {
+        for (int round = 0; round < 500; ++round) {
+            const Rules rules = randomRules(rng, encoding, 6, round % 4 == 0 ? 16 : 4);
+            const std::string text = randomText(rng, encoding, 600);
+            uint64_t expectedMatches = 0;
+            const std::string expected = referenceReplace(text, rules, encoding, &expectedMatches);
+
+            ReplaceEngine engine;
+            engine.compile(rules, encoding);
+            std::string output;
+            StreamReplacer stream(engine, [&output](const char *data, size_t length) { output.append(data, length); });
+            feedChunked(rng, text, [&stream](const char *data, size_t length) { stream.write(data, length); });
+            stream.finish();
+            CHECK(output == expected, "%s stream", TextCodec::name(encoding));
+            CHECK(stream.matchCount() == expectedMatches, "%s stream count", TextCodec::name(encoding));
+            CHECK(stream.bytesWritten() == expected.size(), "%s stream size", TextCodec::name(encoding));
+        }
+    }
+}
+
+// Fused or chained, stages give what running them one by one gives
+void testPipeline(std::mt19937& rng)
+{
+    size_t fused = 0;
+    for (TextEncoding encoding : kEncodings) {
+        for (int round = 0; round < 400; ++round) {
+            Stages stages(1 + rng() % 3);
+            for (Rules& rules : stages) {
+                rules = randomRules(rng, encoding, 4, 3);
+            }
+            const std::string text = randomText(rng, encoding, 400);
+            uint64_t expectedMatches = 0;
+            const std::string expected = referencePipeline(text, stages, encoding, &expectedMatches);
+
+            RulePipeline pipeline;
+            fillPipeline(pipeline, stages);
+            pipeline.compile(encoding, text.data(), text.size());
+            fused += pipeline.passCount() < stages.size() ? 1 : 0;
+            const char *name = TextCodec::name(encoding);
+
+            std::string output;
+            pipeline.replaceInto(text.data(), text.size(), output);
+            CHECK(output == expected, "%s pipeline of %zu stages in %zu passes", name, stages.size(), pipeline.passCount());
+
+            std::string streamed;
+            pipeline.stream([&](const StreamReplacer::Writer& feed) { feedChunked(rng, text, feed); },
+                            [&streamed](const char *data, size_t length) { streamed.append(data, length); });
+            CHECK(streamed == expected, "%s pipeline stream", name);
+
+            const MatchSummary summary = pipeline.countMatches(text.data(), text.size());
+            CHECK(summary.sizeDelta == static_cast<int64_t>(expected.size()) - static_cast<int64_t>(text.size()),
+                  "%s pipeline size delta", name);
+            CHECK(pipeline.containsMatch(text.data(), text.size()) == (expectedMatches > 0), "%s pipeline pre-scan", name);
+            if (pipeline.passCount() == stages.size()) {
+                CHECK(summary.matches == expectedMatches, "%s pipeline count", name);
+            }
+            if (pipeline.isLengthPreserving()) {
+                std::string patched = text;
+                pipeline.replaceInPlace(patched.data(), patched.size());
+                CHECK(patched == expected, "%s pipeline in place", name);
+            }
+        }
+    }
+    CHECK(fused > 0, "no pipeline was fused");
+}
+
+// Analysis drops only rules that cannot change the output
+void testRuleAnalyzer(std::mt19937& rng)
+{
+    static const char *const stageNames[] = {"first", "second", "third"};
+    for (TextEncoding encoding : kEncodings) {
+        const std::vector<std::string>& chars = alphabet(encoding);
+        for (int round = 0; round < 400; ++round) {
+            // Entries as typed, with one-character deletions (which make
+            // later patterns unreachable), no-ops and duplicates mixed in
+            RuleAnalyzer analyzer;
+            Stages stages(1 + rng() % 3);
+            for (size_t stage = 0; stage < stages.size(); ++stage) {
+                std::vector<std::string> patterns;
+                for (size_t n = 1 + rng() % 5; n > 0; --n) {
+                    std::string pattern = randomText(rng, encoding, 3);
+                    std::string replacement = randomText(rng, encoding, 3);
+                    switch (rng() % 4) {
+                    case 0:
+                        pattern = chars[rng() % chars.size()];
+                        replacement.clear();
+                        break;
+                    case 1:
+                        replacement = pattern;
+                        break;
+                    case 2:
+                        if (!patterns.empty()) {
+                            pattern = patterns[rng() % patterns.size()];
+                        }
+                        break;
+                    default:
+                        break;
+                    }
+                    if (pattern.empty()) {
+                        pattern = chars[0];
+                    }
+                    analyzer.add(stageNames[stage], pattern, replacement);
+                    stages[stage][pattern] = replacement;
+                    patterns.push_back(pattern);
+                }
+            }
+
+            RulePipeline pipeline;
+            const size_t dropped = analyzer.build(pipeline, encoding);
+            size_t findings = 0;
+            for (size_t i = 0; i < analyzer.entryCount(); ++i) {
+                findings += RuleAnalyzer::isDropped(analyzer.result(i).finding) ? 1 : 0;
+            }
+            CHECK(dropped == findings && pipeline.ruleCount() + dropped == analyzer.entryCount(),
+                  "%zu dropped, %zu rules of %zu entries", dropped, pipeline.ruleCount(), analyzer.entryCount());
+
+            const std::string text = randomText(rng, encoding, 300);
+            std::string output;
+            if (pipeline.isEmpty()) {
+                output = text;
+            } else {
+                pipeline.compile(encoding);
+                pipeline.replaceInto(text.data(), text.size(), output);
+            }
+            CHECK(output == referencePipeline(text, stages, encoding), "%s analyzed pipeline of %zu stages",
+                  TextCodec::name(encoding), stages.size());
+        }
+    }
+
+    // Each finding and the entry it points at
+    auto analyze = [](std::initializer_list<std::array<const char *, 3>> entries, TextEncoding encoding,
+                      RuleAnalyzer& analyzer) {
+        analyzer.clear();
+        for (const auto& entry : entries) {
+            analyzer.add(entry[0], entry[1], entry[2]);
+        }
+        RulePipeline pipeline;
+        return analyzer.build(pipeline, encoding);
+    };
+    using Finding = RuleAnalyzer::Finding;
+    RuleAnalyzer analyzer;
+    CHECK(analyze({{"s", "a", "b"}, {"s", "x", "x"}, {"s", "a", "c"}}, TextEncoding::Utf8, analyzer) == 2
+              && analyzer.result(0).finding == Finding::Duplicate && analyzer.result(0).other == 2
+              && analyzer.result(1).finding == Finding::NoOp && analyzer.result(2).finding == Finding::None,
+          "duplicate and no-op");
+    CHECK(analyze({{"s", "ab", "ab"}, {"s", "b", "c"}}, TextEncoding::Utf8, analyzer) == 0
+              && analyzer.result(0).finding == Finding::GuardNoOp && analyzer.result(0).other == 1,
+          "guarding no-op");
+    CHECK(analyze({{"first", "q", ""}, {"second", "qq", "z"}, {"second", "a", "b"}}, TextEncoding::Utf8, analyzer) == 1
+              && analyzer.result(1).finding == Finding::Unreachable && analyzer.result(1).other == 0,
+          "unreachable");
+    CHECK(analyze({{"first", "q", "q!"}, {"second", "qq", "z"}}, TextEncoding::Utf8, analyzer) == 0,
+          "a byte the removing stage writes again");
+    CHECK(analyze({{"first", "\\", ""}, {"second", "\\a", "z"}}, TextEncoding::ShiftJis, analyzer) == 0,
+          "a Shift_JIS trail byte is never removed");
+}
+
+// Versions of a document against a stack of plain strings
+void testPieceTable(std::mt19937& rng)
+{
+    for (TextEncoding encoding : kEncodings) {
+        for (int round = 0; round < 150; ++round) {
+            const std::string original = randomText(rng, encoding, 800);
+            PieceTable document;
+            document.reset(original.data(), original.size());
+            std::vector<std::string> versions = {original};
+            size_t current = 0;
+
+            for (int step = 0; step < 12; ++step) {
+                const int action = static_cast<int>(rng() % 6);
+                if (action == 0 && current > 0) {
+                    CHECK(document.undo(), "undo");
+                    --current;
+                } else if (action == 1 && current + 1 < versions.size()) {
+                    CHECK(document.redo(), "redo");
+                    ++current;
+                } else {
+                    Stages stages(1 + rng() % 3);
+                    for (Rules& rules : stages) {
+                        rules = randomRules(rng, encoding, 4, 3);
+                    }
+                    const std::string& text = versions[current];
+                    std::string next;
+                    if (action == 2 && !text.empty()) {
+                        // A range that starts and ends on line starts, so on
+                        // character boundaries in every encoding
+                        RulePipeline pipeline;
+                        fillPipeline(pipeline, stages);
+                        pipeline.compile(encoding);
+                        LineIndex lines;
+                        lines.build(text.data(), text.size());
+                        const size_t first = rng() % lines.lineCount();
+                        const size_t last = first + rng() % (lines.lineCount() - first);
+                        const size_t begin = lines.lineStart(first);
+                        const size_t end = last + 1 < lines.lineCount() ? lines.lineStart(last + 1) : text.size();
+                        next = text.substr(0, begin) + referencePipeline(text.substr(begin, end - begin), stages, encoding)
+                            + text.substr(end);
+                        document.applyPipelineRange(pipeline, begin, end);
+                    } else if (stages.size() == 1) {
+                        uint64_t expectedMatches = 0;
+                        next = referencePipeline(text, stages, encoding, &expectedMatches);
+                        ReplaceEngine engine;
+                        engine.compile(stages[0], encoding);
+                        CHECK(document.applyReplacement(engine) == expectedMatches, "%s match count",
+                              TextCodec::name(encoding));
+                    } else {
+                        next = referencePipeline(text, stages, encoding);
+                        RulePipeline pipeline;
+                        fillPipeline(pipeline, stages);
+                        pipeline.compile(encoding);
+                        document.applyPipeline(pipeline);
+                    }
+                    versions.resize(current + 1);
+                    versions.push_back(next);
+                    ++current;
+                }
+                std::string materialized;
+                document.materialize(materialized);
+                CHECK(materialized == versions[current], "%s version %zu", TextCodec::name(encoding), current);
+                CHECK(document.length() == versions[current].size(), "length");
+                CHECK(document.currentVersion() == current, "current version");
+            }
+        }
+    }
+}
+
+// Replacing inside gzip and zstd streams, when the codecs are built in
+void testCompressed(std::mt19937& rng)
+{
+    for (Compression compression : {Compression::Gzip, Compression::Zstd}) {
+        if (!CompressedIO::isSupported(compression)) {
+            std::printf("  %s not built in, skipped\n", CompressedIO::name(compression));
+            continue;
+        }
+        const char *codec = CompressedIO::name(compression);
+        for (int round = 0; round < 24; ++round) {
+            const TextEncoding encoding = kEncodings[round % 3];
+            Stages stages(1 + rng() % 2);
+            for (Rules& rules : stages) {
+                rules = randomRules(rng, encoding, 4, 3);
+            }
+            RulePipeline pipeline;
+            fillPipeline(pipeline, stages);
+            pipeline.compile(encoding);
+
+            // Every few rounds the text spans several plain chunks
+            std::string text;
+            const size_t target = round % 4 == 0 ? 3 * CompressedReplacer::kChunkSize : 2000;
+            while (text.size() < target) {
+                text += randomText(rng, encoding, 2000);
+            }
+            uint64_t expectedMatches = 0;
+            const std::string expected = referencePipeline(text, stages, encoding, &expectedMatches);
+
+            // Two members (gzip) or frames (zstd), cut on a character
+            const size_t cut = text.rfind('\n', rng() % (text.size() + 1));
+            const size_t split = cut == std::string::npos ? 0 : cut + 1;
+            std::string packed;
+            CHECK(CompressedIO::compress(compression, text.data(), split, packed), "%s compress", codec);
+            const size_t firstMember = packed.size();
+            CHECK(CompressedIO::compress(compression, text.data() + split, text.size() - split, packed),
+                  "%s compress", codec);
+
+            std::string output;
+            const CompressedReplacer::Result result = CompressedReplacer::run(
+                pipeline, compression, [&](const StreamReplacer::Writer& feed) { feedChunked(rng, packed, feed); },
+                [&output](const char *data, size_t length) { output.append(data, length); });
+            std::string unpacked;
+            CHECK(result.ok && result.error.empty(), "%s: %s", codec, result.error.c_str());
+            CHECK(CompressedIO::decompress(compression, output.data(), output.size(), unpacked) && unpacked == expected,
+                  "%s round trip of %zu bytes", codec, text.size());
+            CHECK(result.plainIn == text.size() && result.plainOut == expected.size()
+                      && result.bytesOut == output.size(), "%s sizes", codec);
+            if (pipeline.passCount() == stages.size()) {
+                CHECK(result.matches == expectedMatches, "%s match count", codec);
+            }
+
+            // Input that ends inside the last member or frame
+            const size_t kept = firstMember + 1 + rng() % (packed.size() - firstMember - 1);
+            const CompressedReplacer::Result truncated = CompressedReplacer::run(
+                pipeline, compression, [&](const StreamReplacer::Writer& feed) { feed(packed.data(), kept); },
+                [](const char *, size_t) {});
+            CHECK(!truncated.ok && truncated.error.find("input is truncated") != std::string::npos,
+                  "%s cut at %zu of %zu: %s", codec, kept, packed.size(), truncated.error.c_str());
+        }
+    }
+
+    // An encoder that cannot start (gzip has no level 10) fails the run
+    // instead of leaving the other threads waiting
+    if (CompressedIO::isSupported(Compression::Gzip)) {
+        RulePipeline pipeline;
+        fillPipeline(pipeline, {{{"a", "b"}}});
+        pipeline.compile(TextEncoding::Utf8);
+        std::string packed;
+        const std::string text(3 * CompressedReplacer::kChunkSize, 'a');
+        CompressedIO::compress(Compression::Gzip, text.data(), text.size(), packed);
+        size_t written = 0;
+        const CompressedReplacer::Result result = CompressedReplacer::run(
+            pipeline, Compression::Gzip, [&](const StreamReplacer::Writer& feed) { feed(packed.data(), packed.size()); },
+            [&written](const char *, size_t length) { written += length; }, nullptr, 10);
+        CHECK(!result.ok && result.error == "gzip: cannot start the encoder" && written == 0 && result.bytesOut == 0,
+              "encoder failure: %s", result.error.c_str());
+    }
+}
+
+// Edits of a document rescan only around the change
+void testIncrementalMatcher(std::mt19937& rng)
+{
+    for (int round = 0; round < 60; ++round) {
+        const Rules rules = randomRules(rng, TextEncoding::Utf8, 5, 4);
+        ReplaceEngine engine;
+        engine.compile(rules);
+        IncrementalMatcher matcher(engine);
+        std::string text = randomText(rng, TextEncoding::Utf8, 30000);
+        for (int edit = 0; edit < 8; ++edit) {
+            matcher.update(text.data(), text.size());
+            std::string output;
+            matcher.apply(text.data(), text.size(), output);
+            CHECK(output == referenceReplace(text, rules, TextEncoding::Utf8), "incremental edit %d", edit);
+
+            const size_t at = text.empty() ? 0 : rng() % text.size();
+            const size_t removed = std::min<size_t>(rng() % 8, text.size() - at);
+            text.replace(at, removed, randomText(rng, TextEncoding::Utf8, 8));
+        }
+    }
+}
+
+// Parallel line batches join to the single-threaded output
+void testLineBatches(std::mt19937& rng)
+{
+    for (TextEncoding encoding : kEncodings) {
+        for (int round = 0; round < 3; ++round) {
+            Stages stages(1 + rng() % 2);
+            for (Rules& rules : stages) {
+                rules = randomRules(rng, encoding, 5, 3, false);
+            }
+            RulePipeline pipeline;
+            fillPipeline(pipeline, stages);
+            pipeline.compile(encoding);
+            CHECK(LineBatchReplacer::isLineLocal(pipeline), "rules without newlines are line local");
+
+            std::string text;
+            while (text.size() < 3 * LineBatchReplacer::kMinBatchSize) {
+                text += randomText(rng, encoding, 4000);
+            }
+            LineIndex lines;
+            lines.build(text.data(), text.size());
+            std::string output;
+            RuleStats stats;
+            stats.reset(pipeline.ruleCount());
+            const LineBatchReplacer::Result result = LineBatchReplacer::run(
+                pipeline, text.data(), text.size(), lines,
+                [&output](const char *data, size_t length) { output.append(data, length); }, &stats, 4);
+            CHECK(result.batches > 1, "%zu batches", result.batches);
+            CHECK(output == referencePipeline(text, stages, encoding), "%s line batches", TextCodec::name(encoding));
+        }
+    }
+}
+
+// Pipe ends for testPipeFilter(), with the calls pipefilter.cpp makes
+#ifdef _WIN32
+bool openPipe(int fds[2]) { return _pipe(fds, 64 * 1024, _O_BINARY) == 0; }
+void closeFd(int fd) { _close(fd); }
+long long writeFd(int fd, const char *data, size_t length) { return _write(fd, data, static_cast<unsigned>(length)); }
+long long readFd(int fd, char *data, size_t length) { return _read(fd, data, static_cast<unsigned>(length)); }
+#else
+bool openPipe(int fds[2]) { return pipe(fds) == 0; }
+void closeFd(int fd) { close(fd); }
+long long writeFd(int fd, const char *data, size_t length) { return write(fd, data, length); }
+long long readFd(int fd, char *data, size_t length) { return read(fd, data, length); }
+#endif
+
+// The filter between two pipes, fed by a writer that sends the text in
+// uneven chunks, gives replaceInto()'s output with buffers far smaller
+// than the text and under both flush policies
+void testPipeFilter(std::mt19937& rng)
+{
+    for (TextEncoding encoding : kEncodings) {
+        for (int round = 0; round < 8; ++round) {
+            Stages stages(1 + rng() % 3);
+            for (Rules& rules : stages) {
+                rules = randomRules(rng, encoding, 6, round % 4 == 0 ? 12 : 4);
+            }
+            const std::string text = randomText(rng, encoding, 20000 + rng() % 20000);
+            RulePipeline pipeline;
+            fillPipeline(pipeline, stages);
+            pipeline.compile(encoding);
+            RuleStats expectedStats;
+            expectedStats.reset(pipeline.ruleCount());
+            std::string expected;
+            pipeline.replaceInto(text.data(), text.size(), expected, &expectedStats);
+
+            for (PipeFilter::Flush flush : {PipeFilter::Flush::Throughput, PipeFilter::Flush::Latency}) {
+                const char *name = TextCodec::name(encoding);
+                const char *policy = flush == PipeFilter::Flush::Latency ? "latency" : "throughput";
+                int input[2];
+                int output[2];
+                if (!openPipe(input) || !openPipe(output)) {
+                    CHECK(false, "pipe");
+                    return;
+                }
+
+                const unsigned writerSeed = rng();
+                std::thread writer([&text, fd = input[1], writerSeed]() {
+                    std::mt19937 chunks(writerSeed);
+                    for (size_t pos = 0; pos < text.size();) {
+                        const size_t chunk = std::min<size_t>(1 + chunks() % 9000, text.size() - pos);
+                        const long long put = writeFd(fd, text.data() + pos, chunk);
+                        if (put <= 0) {
+                            break;
+                        }
+                        pos += static_cast<size_t>(put);
+                    }
+                    closeFd(fd);
+                });
+                std::string filtered;
+                std::thread reader([&filtered, fd = output[0]]() {
+                    char buffer[4096];
+                    for (long long got; (got = readFd(fd, buffer, sizeof(buffer))) > 0;) {
+                        filtered.append(buffer, static_cast<size_t>(got));
+                    }
+                    closeFd(fd);
+                });
+
+                PipeFilter::Options options;
+                options.flush = flush;
+                options.readSize = 4096;
+                options.outputSize = 4096;
+                PipeFilter filter(pipeline, options);
+                RuleStats stats;
+                stats.reset(pipeline.ruleCount());
+                const PipeFilter::Result result = filter.run(input[0], output[1], &stats);
+                closeFd(input[0]);
+                closeFd(output[1]);
+                writer.join();
+                reader.join();
+
+                CHECK(result.ok, "%s %s filter: %s", name, policy, result.error.c_str());
+                CHECK(filtered == expected, "%s %s filter of %zu stages", name, policy, stages.size());
+                CHECK(result.bytesIn == text.size() && result.bytesOut == expected.size(), "%s %s filter sizes",
+                      name, policy);
+                CHECK(result.matches == expectedStats.totalHits() && stats.totalHits() == expectedStats.totalHits(),
+                      "%s %s filter count", name, policy);
+                CHECK(result.reads > text.size() / 4096, "%s %s filter read more than 4096 bytes at once", name, policy);
+            }
+        }
+    }
+}
+
+// Spans computed over the whole text, character by character
+bool isBoundary(const std::string& text, TextEncoding encoding, size_t offset)
+{
+    size_t pos = 0;
+    while (pos < offset) {
+        pos += TextCodec::charLength(encoding, static_cast<unsigned char>(text[pos]));
+    }
+    return pos == offset;
+}
+
+size_t findAligned(const std::string& text, TextEncoding encoding, const std::string& needle, size_t from)
+{
+    size_t hit = text.find(needle, from);
+    while (hit != std::string::npos && !isBoundary(text, encoding, hit)) {
+        hit = text.find(needle, hit + 1);
+    }
+    return hit;
+}
+
+size_t afterNewlines(const std::string& text, size_t from, size_t count)
+{
+    size_t pos = from;
+    for (size_t i = 0; i < count; ++i) {
+        pos = text.find('\n', pos);
+        if (pos == std::string::npos) {
+            return std::string::npos;
+        }
+        ++pos;
+    }
+    return pos;
+}
+
+void testTextRange(std::mt19937& rng)
+{
+    for (TextEncoding encoding : kEncodings) {
+        for (int round = 0; round < 400; ++round) {
+            // A document of several pieces, so searches cross piece boundaries
+            const std::string original = randomText(rng, encoding, 600);
+            PieceTable document;
+            document.reset(original.data(), original.size());
+            RulePipeline pipeline;
+            fillPipeline(pipeline, {randomRules(rng, encoding, 3, 2)});
+            pipeline.compile(encoding);
+            document.applyPipeline(pipeline);
+            std::string text;
+            document.materialize(text);
+            const size_t length = text.size();
+
+            TextRange range;
+            bool valid = true;
+            TextRange::Span expected;
+            switch (rng() % 3) {
+            case 0: {
+                const size_t begin = rng() % (length + 2);
+                const size_t end = begin + rng() % 50;
+                range = TextRange::bytes(begin, end);
+                valid = begin < length;
+                if (valid) {
+                    expected = {begin, std::min(end, length)};
+                    if (!TextCodec::isSelfSynchronizing(encoding) && expected.end > expected.begin) {
+                        const size_t lineStart = text.rfind('\n', expected.begin == 0 ? 0 : expected.begin - 1);
+                        expected.begin = expected.begin == 0 || lineStart == std::string::npos ? 0 : lineStart + 1;
+                        if (begin > 0 && text[begin - 1] == '\n') {
+                            expected.begin = begin;
+                        }
+                        const size_t newline = text.find('\n', expected.end - 1);
+                        expected.end = newline == std::string::npos ? length : newline + 1;
+                    }
+                }
+                break;
+            }
+            case 1: {
+                const size_t first = 1 + rng() % 6;
+                const size_t last = first + rng() % 4;
+                range = TextRange::lines(first, last);
+                expected.begin = afterNewlines(text, 0, first - 1);
+                valid = expected.begin != std::string::npos;
+                if (valid) {
+                    expected.end = std::min(afterNewlines(text, expected.begin, last - first + 1), length);
+                }
+                break;
+            }
+            default: {
+                const std::string beginMarker = randomText(rng, encoding, 2, false) + alphabet(encoding)[4];
+                const std::string endMarker = alphabet(encoding)[1 + rng() % 3];
+                range = TextRange::markers(beginMarker, endMarker);
+                const size_t hit = findAligned(text, encoding, beginMarker, 0);
+                valid = hit != std::string::npos;
+                if (valid) {
+                    expected.begin = hit + beginMarker.size();
+                    expected.end = findAligned(text, encoding, endMarker, expected.begin);
+                    valid = expected.end != std::string::npos;
+                }
+                break;
+            }
+            }
+            valid = valid && expected.end > expected.begin;
+
+            TextRange::Span span;
+            const TextRange::Failure failure = range.resolve(document, encoding, &span);
+            CHECK((failure == TextRange::Failure::None) == valid, "%s range kind %d", TextCodec::name(encoding),
+                  static_cast<int>(range.kind()));
+            if (failure == TextRange::Failure::None && valid) {
+                CHECK(span.begin == expected.begin && span.end == expected.end,
+                      "%s range kind %d: [%zu, %zu) instead of [%zu, %zu)", TextCodec::name(encoding),
+                      static_cast<int>(range.kind()), span.begin, span.end, expected.begin, expected.end);
+            }
+        }
+    }
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    const unsigned seed = argc > 1 ? static_cast<unsigned>(std::strtoul(argv[1], nullptr, 10)) : 20240601u;
+    std::mt19937 rng(seed);
+    std::printf("seed %u, tier %s\n", seed, CpuDispatch::tierName(CpuDispatch::detectedTier()));
+
+    const struct {
+        const char *name;
+        void (*run)(std::mt19937& rng);
+    } tests[] = {
+        {"original cases", [](std::mt19937&) { testOriginalCases(); }},
+        {"rule store aliasing", [](std::mt19937&) { testRuleStoreAliasing(); }},
+        {"content hash", testContentHash},
+        {"result cache", [](std::mt19937&) { testResultCache(); }},
+        {"rule stats", testRuleStats},
+        {"codecs", testCodecs},
+        {"kernels", testKernels},
+        {"stream chunking", testStreamChunking},
+        {"pipeline fusion", testPipeline},
+        {"rule analyzer", testRuleAnalyzer},
+        {"piece table", testPieceTable},
+        {"compressed streams", testCompressed},
+        {"incremental matcher", testIncrementalMatcher},
+        {"line batches", testLineBatches},
+        {"pipe filter", testPipeFilter},
+        {"text range", testTextRange},
+    };
+    for (const auto& test : tests) {
+        const int failuresBefore = g_failures;
+        test.run(rng);
+        std::printf("%-20s %s\n", test.name, g_failures == failuresBefore ? "ok" : "FAILED");
+    }
+    std::printf("%d checks, %d failed\n", g_checks, g_failures);
+    return g_failures == 0 ? 0 : 1;
+}
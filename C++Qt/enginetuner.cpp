@@ -0,0 +1,210 @@
+#include "enginetuner.h"
+#include "tracer.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+
+namespace {
+
+// Cost model in nanoseconds, measured with engine_bench on x86-64 at the
+// AVX2 and AVX-512 tiers; only their ratios matter for the decision
+constexpr double kTrieSkipCost = 0.15;        // per byte, vector skip over non-candidates
+constexpr double kTrieCandidateCost = 35.0;   // per candidate, restart of the skip plus the trie walk
+constexpr double kSingleScanCost = 0.3;       // per byte, memmem
+constexpr double kSingleCandidateCost = 8.0;  // per occurrence of the pattern's first byte
+constexpr double kShiftOrCost = 1.3;          // per byte
+constexpr double kRollingHashCost = 2.7;      // per byte
+constexpr double kMatchCost = 40.0;           // per match, the same for every kernel
+
+const EngineStrategy kCandidates[] = {EngineStrategy::SinglePattern, EngineStrategy::ShiftOr,
+                                      EngineStrategy::RollingHash, EngineStrategy::Trie};
+
+EngineStrategy initialForcedStrategy()
+{
+    EngineStrategy strategy = EngineStrategy::Auto;
+    const char *override = std::getenv("MULTREPLACER_ENGINE");
+    if (!override || !ReplaceEngine::parseStrategy(override, &strategy)) {
+        strategy = EngineStrategy::Auto;
+    }
+    return strategy;
+}
+
+std::atomic<int>& forcedStrategyStorage()
+{
+    static std::atomic<int> strategy{static_cast<int>(initialForcedStrategy())};
+    return strategy;
+}
+
+double megabytesPerSecond(double nanosPerByte)
+{
+    return 1e9 / nanosPerByte / (1024.0 * 1024.0);
+}
+
+std::string format(const char *pattern, double a, double b = 0.0, double c = 0.0)
+{
+    char buffer[128];
+    std::snprintf(buffer, sizeof(buffer), pattern, a, b, c);
+    return buffer;
+}
+
+} // namespace
+
+EngineStrategy EngineTuner::forcedStrategy()
+{
+    return static_cast<EngineStrategy>(forcedStrategyStorage().load(std::memory_order_relaxed));
+}
+
+void EngineTuner::setForcedStrategy(EngineStrategy strategy)
+{
+    forcedStrategyStorage().store(static_cast<int>(strategy), std::memory_order_relaxed);
+}
+
+std::string EngineTuner::sample(const char *data, size_t length)
+{
+    if (length <= kSampleBlocks * kSampleBlockSize) {
+        return std::string(data, length);
+    }
+    std::string sampled;
+    sampled.reserve(kSampleBlocks * kSampleBlockSize);
+    const size_t stride = (length - kSampleBlockSize) / (kSampleBlocks - 1);
+    for (size_t i = 0; i < kSampleBlocks; ++i) {
+        sampled.append(data + i * stride, kSampleBlockSize);
+    }
+    return sampled;
+}
+
+EngineTuner::Profile EngineTuner::profile(const ReplaceEngine& engine, const char *sample, size_t length)
+{
+    Profile profile;
+    profile.ruleCount = engine.ruleCount();
+    profile.minLength = profile.ruleCount > 0 ? SIZE_MAX : 0;
+    std::array<size_t, 256> firstBytes{};
+    for (size_t r = 0; r < engine.ruleCount(); ++r) {
+        const std::string_view pattern = engine.pattern(r);
+        profile.minLength = std::min(profile.minLength, pattern.size());
+        profile.maxLength = std::max(profile.maxLength, pattern.size());
+        profile.totalLength += pattern.size();
+        ++firstBytes[static_cast<unsigned char>(pattern[0])];
+    }
+    for (size_t count : firstBytes) {
+        if (count == 0) {
+            continue;
+        }
+        ++profile.startByteCount;
+        const double p = static_cast<double>(count) / static_cast<double>(profile.ruleCount);
+        profile.startByteEntropy -= p * std::log2(p);
+    }
+
+    if (sample && length > 0) {
+        const std::array<bool, 256>& starts = engine.startBytes().contains;
+        size_t candidates = 0;
+        for (size_t i = 0; i < length; ++i) {
+            candidates += starts[static_cast<unsigned char>(sample[i])] ? 1 : 0;
+        }
+        profile.sampledBytes = length;
+        profile.candidateDensity = static_cast<double>(candidates) / static_cast<double>(length);
+        profile.matchDensity = static_cast<double>(engine.countMatches(sample, length).matches)
+            / static_cast<double>(length);
+    }
+    return profile;
+}
+
+bool EngineTuner::fits(const Profile& profile, EngineStrategy strategy)
+{
+    switch (strategy) {
+    case EngineStrategy::SinglePattern:
+        return profile.ruleCount == 1;
+    case EngineStrategy::ShiftOr:
+        return profile.ruleCount <= 64 && profile.totalLength <= ShiftOrKernel<char>::kMaxTotalLength;
+    case EngineStrategy::RollingHash:
+        return profile.ruleCount > 1 && profile.minLength == profile.maxLength;
+    default:
+        return true;
+    }
+}
+
+double EngineTuner::estimatedNanosPerByte(const Profile& profile, EngineStrategy strategy)
+{
+    double cost = profile.matchDensity * kMatchCost;
+    switch (strategy) {
+    case EngineStrategy::SinglePattern:
+        return cost + kSingleScanCost + profile.candidateDensity * kSingleCandidateCost;
+    case EngineStrategy::ShiftOr:
+        return cost + kShiftOrCost;
+    case EngineStrategy::RollingHash:
+        return cost + kRollingHashCost;
+    default:
+        return cost + kTrieSkipCost + profile.candidateDensity * kTrieCandidateCost;
+    }
+}
+
+EngineTuner::Decision EngineTuner::choose(const ReplaceEngine& engine, const char *sample, size_t length)
+{
+    TRACE_SCOPE("tuneEngine");
+
+    Decision decision;
+    decision.strategy = engine.strategy();
+    if (engine.isEmpty()) {
+        decision.reason = "no rules";
+        return decision;
+    }
+
+    // The kernels step one code unit at a time; legacy encodings keep the
+    // character-aligned trie scan whatever the input looks like
+    const bool kernelsApply = TextCodec::isSelfSynchronizing(engine.encoding());
+    decision.profile = profile(engine, kernelsApply ? sample : nullptr, kernelsApply ? length : 0);
+    const Profile& p = decision.profile;
+
+    const EngineStrategy forced = forcedStrategy();
+    if (forced != EngineStrategy::Auto) {
+        decision.forced = true;
+        const bool usable = forced == EngineStrategy::Trie || (kernelsApply && fits(p, forced));
+        decision.strategy = usable ? forced : EngineStrategy::Trie;
+        decision.reason = usable ? "forced by override"
+                                 : std::string("override ") + ReplaceEngine::strategyName(forced)
+                                       + " does not apply to these rules, using trie";
+        return decision;
+    }
+    if (!kernelsApply) {
+        decision.reason = std::string("character-aligned scan for ") + TextCodec::name(engine.encoding());
+        return decision;
+    }
+    if (p.sampledBytes == 0) {
+        decision.reason = "no input sample, static choice by rule shape";
+        return decision;
+    }
+
+    // Fastest estimate among the kernels the rules fit
+    std::string estimates;
+    double best = 0.0;
+    for (EngineStrategy candidate : kCandidates) {
+        if (!fits(p, candidate)) {
+            continue;
+        }
+        const double nanos = estimatedNanosPerByte(p, candidate);
+        if (best == 0.0 || nanos < best) {
+            best = nanos;
+            decision.strategy = candidate;
+        }
+        estimates += std::string(estimates.empty() ? "" : ", ") + ReplaceEngine::strategyName(candidate)
+            + format(" ~%.0f MB/s", megabytesPerSecond(nanos));
+    }
+    decision.estimatedMBps = megabytesPerSecond(best);
+    const std::string lengths = p.minLength == p.maxLength
+        ? std::to_string(p.minLength) : std::to_string(p.minLength) + "-" + std::to_string(p.maxLength);
+    decision.reason = std::to_string(p.ruleCount) + (p.ruleCount == 1 ? " rule of " : " rules of ") + lengths
+        + " bytes, " + std::to_string(p.startByteCount) + " start bytes"
+        + format(" (%.1f bits); start bytes at %.1f%% of the sample, %.2f matches/KB; ",
+                 p.startByteEntropy, p.candidateDensity * 100.0, p.matchDensity * 1024.0)
+        + estimates;
+    return decision;
+}
+
+std::string EngineTuner::Decision::toText() const
+{
+    return std::string(ReplaceEngine::strategyName(strategy)) + (forced ? " (forced)" : "") + ": " + reason;
+}
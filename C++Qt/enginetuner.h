@@ -0,0 +1,72 @@
+#ifndef ENGINETUNER_H
+#define ENGINETUNER_H
+
+#include <cstddef>
+#include <string>
+#include "replaceengine.h"
+
+/**
+ * EngineTuner picks the matching strategy of a compiled engine from a
+ * profile of its rules and a sample of the input, so nobody has to choose
+ * kernels by hand.
+ *
+ * The profile holds the rule count, the pattern length distribution, the
+ * entropy of the patterns' first bytes and, measured on the sample, how
+ * often a byte that can start a pattern occurs (candidate density) and
+ * how many matches the rules find (match density). A cost model turns
+ * these into an estimated throughput for every kernel the rule set fits,
+ * and the fastest wins. The trie's vector skip is nearly free but every
+ * candidate costs a restart, while Shift-Or and the rolling hash pay a
+ * fixed price per byte, so the candidate density decides between them.
+ *
+ * Without a sample the static choice of EngineStrategy::Auto stands. The
+ * MULTREPLACER_ENGINE environment variable (auto, trie, single, shift-or,
+ * rolling-hash) or setForcedStrategy() overrides the decision.
+ */
+class EngineTuner
+{
+public:
+    struct Profile {
+        size_t ruleCount = 0;
+        size_t minLength = 0;
+        size_t maxLength = 0;
+        size_t totalLength = 0;
+        size_t startByteCount = 0;
+        double startByteEntropy = 0.0;   // bits, over the patterns' first bytes
+        size_t sampledBytes = 0;
+        double candidateDensity = 0.0;   // sampled bytes that can start a pattern, per byte
+        double matchDensity = 0.0;       // matches per sampled byte
+    };
+
+    struct Decision {
+        EngineStrategy strategy = EngineStrategy::Trie;
+        bool forced = false;
+        double estimatedMBps = 0.0;      // 0 when there was nothing to estimate
+        Profile profile;
+        std::string reason;
+
+        // One line, e.g. "shift-or: start bytes at 16.1% of the sample ..."
+        std::string toText() const;
+    };
+
+    // Choose a strategy for engine, compiled with EngineStrategy::Auto,
+    // from sample (may be null). The engine is only read.
+    static Decision choose(const ReplaceEngine& engine, const char *sample, size_t length);
+
+    // A few blocks spread evenly over data, or all of it when it is small
+    static std::string sample(const char *data, size_t length);
+
+    // Strategy that overrides every decision; Auto when there is none
+    static EngineStrategy forcedStrategy();
+    static void setForcedStrategy(EngineStrategy strategy);
+
+    static constexpr size_t kSampleBlocks = 4;
+    static constexpr size_t kSampleBlockSize = 16 * 1024;
+
+private:
+    static Profile profile(const ReplaceEngine& engine, const char *sample, size_t length);
+    static bool fits(const Profile& profile, EngineStrategy strategy);
+    static double estimatedNanosPerByte(const Profile& profile, EngineStrategy strategy);
+};
+
+#endif // ENGINETUNER_H
@@ -0,0 +1,253 @@
+#include "fileloader.h"
+#include "contenthash.h"
+#include "tracer.h"
+#include <QFile>
+#include <algorithm>
+
+FileLoader::FileLoader(QObject *parent)
+    : QThread(parent)
+    , m_compression(Compression::None)
+    , m_encoding(TextEncoding::Utf8)
+    , m_contentHash(0)
+    , m_detectEncoding(false)
+    , m_countErrors(false)
+    , m_loadBytes(false)
+    , m_errors(0)
+    , m_generation(0)
+    , m_runGeneration(0)
+{
+}
+
+FileLoader::~FileLoader()
+{
+    stop();
+}
+
+void FileLoader::load(const QString& filePath, const QByteArray& mapped, int encoding)
+{
+    stop();
+    m_filePath = filePath;
+    m_bytes = mapped;
+    m_compression = Compression::None;
+    m_detectEncoding = encoding < 0;
+    m_encoding = m_detectEncoding ? TextEncoding::Utf8 : static_cast<TextEncoding>(encoding);
+    m_countErrors = !m_detectEncoding;
+    startJob(true);
+}
+
+void FileLoader::decode(const QByteArray& bytes, TextEncoding encoding, bool countErrors)
+{
+    stop();
+    m_bytes = bytes;
+    m_encoding = encoding;
+    m_detectEncoding = false;
+    m_countErrors = countErrors;
+    startJob(false);
+}
+
+void FileLoader::startJob(bool loadBytes)
+{
+    m_loadBytes = loadBytes;
+    m_text.clear();
+    m_errors = 0;
+    m_runGeneration = m_generation;
+    start();
+}
+
+void FileLoader::stop()
+{
+    // Queued signals of the stopped job no longer match
+    ++m_generation;
+    if (isRunning()) {
+        requestInterruption();
+        wait();
+    }
+}
+
+void FileLoader::cancel()
+{
+    const bool running = isRunning();
+    stop();
+    if (running) {
+        emit cancelled();
+    }
+}
+
+void FileLoader::run()
+{
+    TRACE_SCOPE("FileLoader::run");
+
+    if (m_loadBytes) {
+        // An unmapped file is read here and a mapping paged in; either way
+        // the content hash for the result cache is taken along
+        const bool mapped = !m_bytes.isEmpty();
+        if (!mapped && !readFile()) {
+            return;
+        }
+        m_compression = CompressedIO::detect(m_bytes.constData(), static_cast<size_t>(m_bytes.size()));
+        if (m_compression != Compression::None) {
+            if (!decompress()) {
+                return;
+            }
+        } else if (mapped && !hashMapping()) {
+            return;
+        }
+        if (isInterruptionRequested()) {
+            return;
+        }
+        if (m_detectEncoding) {
+            TRACE_SCOPE("detectEncoding");
+            m_encoding = TextCodec::detect(m_bytes.constData(), static_cast<size_t>(m_bytes.size()));
+        }
+        post([this]() { emit bytesReady(); });
+    }
+    decodeText();
+}
+
+bool FileLoader::readFile()
+{
+    TRACE_SCOPE("readFile");
+
+    QFile file(m_filePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        const QString message = QString("ファイルを開けません: %1").arg(file.errorString());
+        post([this, message]() { emit failed(message); });
+        return false;
+    }
+
+    const qint64 total = file.size();
+    m_bytes.resize(total);
+    ContentHash hash;
+    qint64 done = 0;
+    while (done < total) {
+        if (isInterruptionRequested()) {
+            return false;
+        }
+        const qint64 read = file.read(m_bytes.data() + done, std::min(CHUNK_SIZE, total - done));
+        if (read <= 0) {
+            // The file shrank while it was read, or the read failed
+            if (read < 0) {
+                const QString message = QString("ファイルを読み込めません: %1").arg(file.errorString());
+                post([this, message]() { emit failed(message); });
+                return false;
+            }
+            break;
+        }
+        hash.update(m_bytes.constData() + done, static_cast<size_t>(read));
+        done += read;
+        post([this, done, total]() { emit progress(static_cast<int>(Phase::Reading), done, total); });
+    }
+    m_bytes.truncate(done);
+    m_contentHash = hash.digest();
+    return true;
+}
+
+bool FileLoader::hashMapping()
+{
+    TRACE_SCOPE("hashMapping");
+
+    ContentHash hash;
+    const qint64 total = m_bytes.size();
+    for (qint64 done = 0; done < total;) {
+        if (isInterruptionRequested()) {
+            return false;
+        }
+        const qint64 take = std::min(CHUNK_SIZE, total - done);
+        hash.update(m_bytes.constData() + done, static_cast<size_t>(take));
+        done += take;
+        post([this, done, total]() { emit progress(static_cast<int>(Phase::Reading), done, total); });
+    }
+    m_contentHash = hash.digest();
+    return true;
+}
+
+bool FileLoader::decompress()
+{
+    TRACE_SCOPE("decompress");
+
+    QByteArray plain;
+    ContentHash hash;
+    ChunkDecoder decoder(m_compression, [&plain, &hash](const char *data, size_t length) {
+        plain.append(data, static_cast<qsizetype>(length));
+        hash.update(data, length);
+    });
+
+    const qint64 total = m_bytes.size();
+    for (qint64 done = 0; done < total;) {
+        if (isInterruptionRequested()) {
+            return false;
+        }
+        const qint64 take = std::min(CHUNK_SIZE, total - done);
+        if (!decoder.write(m_bytes.constData() + done, static_cast<size_t>(take))) {
+            break;
+        }
+        done += take;
+        post([this, done, total]() { emit progress(static_cast<int>(Phase::Decompressing), done, total); });
+    }
+    if (!decoder.finish()) {
+        const QString message = QString("ファイルを展開できません: %1").arg(QString::fromStdString(decoder.error()));
+        post([this, message]() { emit failed(message); });
+        return false;
+    }
+    m_bytes = plain;
+    m_contentHash = hash.digest();
+    return true;
+}
+
+size_t FileLoader::chunkEnd(size_t begin, size_t limit) const
+{
+    const size_t length = static_cast<size_t>(m_bytes.size());
+    if (limit >= length) {
+        return length;
+    }
+
+    // '\n' is a whole character in every supported encoding
+    const char *data = m_bytes.constData();
+    for (size_t i = limit; i > begin; --i) {
+        if (data[i - 1] == '\n') {
+            return i;
+        }
+    }
+
+    // A line longer than a chunk is cut at a character boundary
+    if (m_encoding == TextEncoding::Utf8) {
+        size_t end = limit;
+        while (end > begin && (static_cast<unsigned char>(data[end]) & 0xC0) == 0x80) {
+            --end;
+        }
+        return end > begin ? end : limit;
+    }
+    size_t end = begin;
+    while (end < limit) {
+        const size_t next = end + static_cast<size_t>(TextCodec::charLength(m_encoding, static_cast<unsigned char>(data[end])));
+        if (next > limit) {
+            break;
+        }
+        end = next;
+    }
+    return end > begin ? end : limit;
+}
+
+void FileLoader::decodeText()
+{
+    TRACE_SCOPE("decode");
+
+    const char *data = m_bytes.constData();
+    const size_t length = static_cast<size_t>(m_bytes.size());
+    size_t begin = 0;
+    while (begin < length) {
+        if (isInterruptionRequested()) {
+            return;
+        }
+        const size_t end = chunkEnd(begin, begin + static_cast<size_t>(CHUNK_SIZE));
+        if (m_countErrors) {
+            m_errors += TextCodec::countErrors(data + begin, end - begin, m_encoding);
+        }
+        m_text.append(TextCodec::toQString(data + begin, end - begin, m_encoding));
+        begin = end;
+        const qint64 done = static_cast<qint64>(begin);
+        const qint64 total = static_cast<qint64>(length);
+        post([this, done, total]() { emit progress(static_cast<int>(Phase::Decoding), done, total); });
+    }
+    post([this]() { emit textReady(); });
+}
@@ -0,0 +1,114 @@
+#ifndef FILELOADER_H
+#define FILELOADER_H
+
+#include <QThread>
+#include <QString>
+#include <QByteArray>
+#include "compressedio.h"
+#include "textcodec.h"
+
+/**
+ * FileLoader loads a file on a background thread in chunks, so the window
+ * stays responsive, reports progress and can be cancelled.
+ *
+ * Loading has two halves. First the bytes the engine works on are made
+ * ready: read (or taken from a mapping made by the caller), decompressed
+ * and their encoding detected; bytesReady() is emitted and replacing can
+ * start. Then the text is decoded for display, chunk by chunk, ending in
+ * textReady(). decode() runs the second half alone, e.g. after the user
+ * picked another encoding.
+ */
+class FileLoader : public QThread
+{
+    Q_OBJECT
+
+public:
+    enum class Phase { Reading, Decompressing, Decoding };
+
+    explicit FileLoader(QObject *parent = nullptr);
+    ~FileLoader();
+
+    // Load filePath. mapped is the file's content when the caller has
+    // mapped it (it must stay mapped until the loader stops), otherwise
+    // empty and the file is read here. encoding < 0 detects the encoding,
+    // anything else is a TextEncoding whose decoding errors are counted.
+    void load(const QString& filePath, const QByteArray& mapped, int encoding);
+
+    // Decode bytes in encoding only
+    void decode(const QByteArray& bytes, TextEncoding encoding, bool countErrors);
+
+    // Stop the current job, if any, and emit cancelled()
+    void cancel();
+
+    // Stop the current job without a signal; signals it had already
+    // queued are dropped
+    void stop();
+
+    // Valid from bytesReady() on; the bytes are no longer written to
+    const QString& filePath() const { return m_filePath; }
+    const QByteArray& bytes() const { return m_bytes; }
+    Compression compression() const { return m_compression; }
+    TextEncoding encoding() const { return m_encoding; }
+
+    // ContentHash of bytes(), fed chunk by chunk as they were read,
+    // paged in or decompressed; valid from bytesReady() on
+    quint64 contentHash() const { return m_contentHash; }
+
+    // Valid after textReady(); the text is moved out
+    QString takeText() { return std::move(m_text); }
+    size_t decodeErrors() const { return m_errors; }
+
+signals:
+    void progress(int phase, qint64 done, qint64 total);
+    void bytesReady();
+    void textReady();
+    void cancelled();
+    void failed(const QString& message);
+
+protected:
+    void run() override;
+
+private:
+    bool readFile();
+    bool decompress();
+    bool hashMapping();
+    void decodeText();
+
+    // End of the decode chunk starting at begin: after the last '\n' before
+    // limit, or at the last character boundary in a line longer than a chunk
+    size_t chunkEnd(size_t begin, size_t limit) const;
+
+    // Start a job after the previous one has stopped
+    void startJob(bool loadBytes);
+
+    // Emit from the worker through the loader's thread, unless the job has
+    // been stopped or replaced by then
+    template <typename Emit>
+    void post(Emit emitSignal)
+    {
+        const int generation = m_runGeneration;
+        QMetaObject::invokeMethod(this, [this, generation, emitSignal]() {
+            if (generation == m_generation) {
+                emitSignal();
+            }
+        }, Qt::QueuedConnection);
+    }
+
+    QString m_filePath;
+    QByteArray m_bytes;
+    Compression m_compression;
+    TextEncoding m_encoding;
+    quint64 m_contentHash;
+    bool m_detectEncoding;
+    bool m_countErrors;
+    bool m_loadBytes;   // false for decode()
+    QString m_text;
+    size_t m_errors;
+    int m_generation;     // current job, on the loader's thread
+    int m_runGeneration;  // job the worker runs; set before it starts
+
+    // Bytes read, decompressed or decoded between progress reports
+    static const qint64 CHUNK_SIZE = 4 * 1024 * 1024;
+};
+
+#endif // FILELOADER_H
@@ -0,0 +1,148 @@
+#include "filewatchsession.h"
+#include "contenthash.h"
+#include "tracer.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+
+FileWatchSession::FileWatchSession(QObject *parent)
+    : QObject(parent)
+{
+    m_debounce.setSingleShot(true);
+    m_debounce.setInterval(DEBOUNCE_MS);
+    connect(&m_watcher, &QFileSystemWatcher::fileChanged, this, &FileWatchSession::onFileChanged);
+    connect(&m_debounce, &QTimer::timeout, this, &FileWatchSession::processChange);
+}
+
+FileWatchSession::~FileWatchSession()
+{
+    stop();
+}
+
+bool FileWatchSession::start(const QString& filePath, TextEncoding encoding)
+{
+    stop();
+    if (m_pipeline.isEmpty() || !QFileInfo::exists(filePath)) {
+        return false;
+    }
+
+    // The matcher follows one engine; stages that need several passes are
+    // rerun in full on every change
+    m_pipeline.compile(encoding);
+    if (m_pipeline.passCount() == 1) {
+        m_matcher = std::make_unique<IncrementalMatcher>(m_pipeline.pass(0));
+    }
+
+    m_filePath = filePath;
+    m_lastWritten = Signature();
+    m_watcher.addPath(m_filePath);
+
+    // The first pass covers the whole file
+    processChange();
+    return true;
+}
+
+void FileWatchSession::stop()
+{
+    m_debounce.stop();
+    if (!m_watcher.files().isEmpty()) {
+        m_watcher.removePaths(m_watcher.files());
+    }
+    m_matcher.reset();
+    m_filePath.clear();
+}
+
+FileWatchSession::Signature FileWatchSession::signatureOf(const QByteArray& bytes)
+{
+    Signature signature;
+    signature.size = bytes.size();
+    signature.hash = ContentHash::hash64(bytes.constData(), static_cast<size_t>(bytes.size()));
+    return signature;
+}
+
+void FileWatchSession::rewatch()
+{
+    if (!m_filePath.isEmpty() && !m_watcher.files().contains(m_filePath) && QFileInfo::exists(m_filePath)) {
+        m_watcher.addPath(m_filePath);
+    }
+}
+
+void FileWatchSession::onFileChanged(const QString& path)
+{
+    if (path != m_filePath) {
+        return;
+    }
+    // Editors often save in several steps (truncate, write, rename)
+    m_debounce.start();
+}
+
+void FileWatchSession::processChange()
+{
+    if (m_filePath.isEmpty()) {
+        return;
+    }
+    TRACE_SCOPE("watchUpdate");
+    rewatch();
+
+    // Read rather than map: the file may be truncated under the mapping
+    QFile file(m_filePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        emit failed(QString("ファイルを開けません: %1").arg(file.errorString()));
+        return;
+    }
+    const QByteArray bytes = file.readAll();
+    file.close();
+
+    // Our own save coming back
+    if (signatureOf(bytes) == m_lastWritten) {
+        return;
+    }
+
+    quint64 scanned = 0;
+    quint64 matches = 0;
+    QByteArray content = bytes;
+    if (m_matcher) {
+        scanned = m_matcher->update(bytes.constData(), static_cast<size_t>(bytes.size()));
+        if (!m_matcher->matches().empty() && !writeResult(bytes, &content, &matches)) {
+            return;
+        }
+    } else {
+        scanned = static_cast<quint64>(bytes.size());
+        if (m_pipeline.containsMatch(bytes.constData(), static_cast<size_t>(bytes.size()))
+            && !writeResult(bytes, &content, &matches)) {
+            return;
+        }
+    }
+    emit updated(content, matches, scanned);
+}
+
+bool FileWatchSession::writeResult(const QByteArray& bytes, QByteArray *result, quint64 *matches)
+{
+    QByteArray output;
+    output.reserve(bytes.size());
+    if (m_matcher) {
+        m_matcher->apply(bytes.constData(), static_cast<size_t>(bytes.size()), output);
+        *matches = m_matcher->matches().size();
+    } else {
+        RuleStats stats;
+        stats.reset(m_pipeline.ruleCount());
+        m_pipeline.replaceInto(bytes.constData(), static_cast<size_t>(bytes.size()), output, &stats);
+        *matches = stats.totalHits();
+    }
+
+    QSaveFile file(m_filePath);
+    if (!file.open(QIODevice::WriteOnly) || file.write(output) != output.size() || !file.commit()) {
+        emit failed(QString("ファイルを保存できません: %1").arg(file.errorString()));
+        return false;
+    }
+    m_lastWritten = signatureOf(output);
+    rewatch();
+
+    // The saved result is the version the next edit starts from; the
+    // rescan only spans the replaced region
+    if (m_matcher) {
+        m_matcher->update(output.constData(), static_cast<size_t>(output.size()));
+    }
+    *result = output;
+    return true;
+}
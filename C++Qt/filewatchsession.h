@@ -0,0 +1,81 @@
+#ifndef FILEWATCHSESSION_H
+#define FILEWATCHSESSION_H
+
+#include <QObject>
+#include <QFileSystemWatcher>
+#include <QTimer>
+#include <QString>
+#include <QByteArray>
+#include <memory>
+#include "rulepipeline.h"
+#include "incrementalmatcher.h"
+
+/**
+ * FileWatchSession keeps one file replaced while it is edited elsewhere.
+ *
+ * The rules are compiled once when the session starts and stay warm. On
+ * every change (debounced) the file is read and only the changed region is
+ * rescanned by an IncrementalMatcher; when there are matches the result is
+ * saved back. The session remembers the size and hash of what it wrote, so
+ * the change event caused by its own save is recognized and ignored.
+ *
+ * Only the scan follows the size of the change: every change still reads
+ * and hashes the whole file, and a change with matches writes all of it.
+ * updated() passes on the content, so a viewer needs no read of its own.
+ */
+class FileWatchSession : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit FileWatchSession(QObject *parent = nullptr);
+    ~FileWatchSession();
+
+    // Rules to apply; fill the stages before start()
+    RulePipeline& pipeline() { return m_pipeline; }
+
+    // Compile the rules, apply them once and watch filePath
+    bool start(const QString& filePath, TextEncoding encoding);
+    void stop();
+
+    bool isActive() const { return !m_filePath.isEmpty(); }
+    const QString& filePath() const { return m_filePath; }
+
+signals:
+    // A change was processed: the file's content now, matches replaced (0
+    // when nothing was written) and bytes that had to be scanned
+    void updated(const QByteArray& content, quint64 matches, quint64 scannedBytes);
+    void failed(const QString& message);
+
+private slots:
+    void onFileChanged(const QString& path);
+    void processChange();
+
+private:
+    struct Signature {
+        qint64 size = -1;
+        quint64 hash = 0;
+        bool operator==(const Signature& other) const { return size == other.size && hash == other.hash; }
+    };
+
+    static Signature signatureOf(const QByteArray& bytes);
+
+    // Re-add the path after a save replaced the file (the watcher drops it)
+    void rewatch();
+
+    // Replace the current matches in bytes into result and save it; false
+    // on error
+    bool writeResult(const QByteArray& bytes, QByteArray *result, quint64 *matches);
+
+    QFileSystemWatcher m_watcher;
+    QTimer m_debounce;
+    QString m_filePath;
+    RulePipeline m_pipeline;
+    std::unique_ptr<IncrementalMatcher> m_matcher;  // single-pass pipelines only
+    Signature m_lastWritten;
+
+    // Changes closer together than this are handled as one
+    static const int DEBOUNCE_MS = 200;
+};
+
+#endif // FILEWATCHSESSION_H
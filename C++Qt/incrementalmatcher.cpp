@@ -0,0 +1,155 @@
+#include "incrementalmatcher.h"
+#include "contenthash.h"
+#include "cpudispatch.h"
+#include "tracer.h"
+#include <algorithm>
+
+IncrementalMatcher::IncrementalMatcher(const ReplaceEngine& engine)
+    : m_engine(engine)
+    , m_hasVersion(false)
+    , m_length(0)
+{
+}
+
+void IncrementalMatcher::reset()
+{
+    m_hasVersion = false;
+    m_length = 0;
+    m_forward.clear();
+    m_backward.clear();
+    m_matches.clear();
+}
+
+void IncrementalMatcher::hashBlocks(const char *data, size_t length,
+                                    std::vector<uint64_t>& forward, std::vector<uint64_t>& backward) const
+{
+    // Only whole blocks are hashed; a partial block never counts as common
+    const size_t blocks = length / kBlockSize;
+    forward.resize(blocks);
+    backward.resize(blocks);
+    for (size_t i = 0; i < blocks; ++i) {
+        forward[i] = ContentHash::hash64(data + i * kBlockSize, kBlockSize);
+        backward[i] = ContentHash::hash64(data + length - (i + 1) * kBlockSize, kBlockSize);
+    }
+}
+
+bool IncrementalMatcher::oldScanVisited(size_t oldPos, size_t& hint) const
+{
+    // hint only moves forward, as the positions asked about do
+    while (hint < m_matches.size() && m_matches[hint].offset + m_matches[hint].length <= oldPos) {
+        ++hint;
+    }
+    const bool insideMatch = hint < m_matches.size() && m_matches[hint].offset < oldPos;
+    if (TextCodec::isSelfSynchronizing(m_engine.encoding())) {
+        return !insideMatch;
+    }
+    // Character alignment is only known at match boundaries
+    return (hint < m_matches.size() && m_matches[hint].offset == oldPos)
+        || (hint > 0 && m_matches[hint - 1].offset + m_matches[hint - 1].length == oldPos);
+}
+
+size_t IncrementalMatcher::update(const char *data, size_t length)
+{
+    TRACE_SCOPE("incrementalUpdate");
+
+    hashBlocks(data, length, m_nextForward, m_nextBackward);
+
+    if (!m_hasVersion || m_engine.isEmpty()) {
+        m_matches.clear();
+        m_engine.scan(data, length, [this](const ReplaceMatch& m) { m_matches.push_back(m); });
+        m_length = length;
+        m_forward.swap(m_nextForward);
+        m_backward.swap(m_nextBackward);
+        m_hasVersion = true;
+        return length;
+    }
+
+    // Common prefix and suffix, in whole blocks
+    const size_t oldLength = m_length;
+    size_t prefixBlocks = 0;
+    while (prefixBlocks < m_forward.size() && prefixBlocks < m_nextForward.size()
+           && m_forward[prefixBlocks] == m_nextForward[prefixBlocks]) {
+        ++prefixBlocks;
+    }
+    size_t suffixBlocks = 0;
+    while (suffixBlocks < m_backward.size() && suffixBlocks < m_nextBackward.size()
+           && m_backward[suffixBlocks] == m_nextBackward[suffixBlocks]) {
+        ++suffixBlocks;
+    }
+    const size_t changeStart = std::min(prefixBlocks * kBlockSize, std::min(oldLength, length));
+    const size_t suffixLength = std::min(suffixBlocks * kBlockSize, std::min(oldLength, length) - changeStart);
+    const size_t changeEndNew = length - suffixLength;
+    const int64_t delta = static_cast<int64_t>(length) - static_cast<int64_t>(oldLength);
+
+    m_forward.swap(m_nextForward);
+    m_backward.swap(m_nextBackward);
+    m_length = length;
+    if (changeStart == oldLength && oldLength == length) {
+        return 0;
+    }
+
+    // Keep the old matches whose decision window ends before the change
+    const size_t maxLength = m_engine.maxPatternLength();
+    m_nextMatches.clear();
+    size_t kept = 0;
+    while (kept < m_matches.size() && m_matches[kept].offset + maxLength <= changeStart) {
+        m_nextMatches.push_back(m_matches[kept]);
+        ++kept;
+    }
+    const size_t keptEnd = kept > 0 ? m_nextMatches.back().offset + m_nextMatches.back().length : 0;
+    const size_t firstUndecided = changeStart + 1 > maxLength ? changeStart + 1 - maxLength : 0;
+
+    const bool byteAligned = TextCodec::isSelfSynchronizing(m_engine.encoding());
+    size_t pos = std::max(keptEnd, firstUndecided);
+    if (!byteAligned) {
+        // Restart on a character boundary: walk from the last kept match
+        pos = keptEnd;
+        while (pos < firstUndecided) {
+            pos += TextCodec::charLength(m_engine.encoding(), static_cast<unsigned char>(data[pos]));
+        }
+    }
+    const size_t restart = pos;
+
+    // Rescan until the new scan visits a position in the common suffix
+    // that the old scan visited too
+    const CpuDispatch::Kernels& kernels = CpuDispatch::kernels();
+    const ByteSet& startBytes = m_engine.startBytes();
+    const unsigned char *bytes = reinterpret_cast<const unsigned char *>(data);
+    size_t hint = kept;
+    bool synced = false;
+    while (pos < length) {
+        if (pos >= changeEndNew && oldScanVisited(static_cast<size_t>(static_cast<int64_t>(pos) - delta), hint)) {
+            synced = true;
+            break;
+        }
+        uint32_t matchLength = 0;
+        int rule = m_engine.matchAt(data, length, pos, &matchLength);
+        if (rule >= 0) {
+            m_nextMatches.push_back(ReplaceMatch{pos, matchLength, static_cast<uint32_t>(rule)});
+            pos += matchLength;
+        } else if (byteAligned) {
+            // Skip to the next possible start, but not past the suffix boundary
+            // where the sync check has to run again
+            size_t limit = pos < changeEndNew ? changeEndNew : pos + 1;
+            limit = std::min(limit, length);
+            pos += 1 + kernels.findInSet(bytes + pos + 1, limit - pos - 1, startBytes);
+        } else {
+            pos += TextCodec::charLength(m_engine.encoding(), bytes[pos]);
+        }
+    }
+    const size_t scanned = std::min(pos, length) - restart;
+
+    // From the sync point on the old matches apply unchanged, shifted
+    if (synced) {
+        const size_t oldPos = static_cast<size_t>(static_cast<int64_t>(pos) - delta);
+        auto first = std::lower_bound(m_matches.begin() + kept, m_matches.end(), oldPos,
+                                      [](const ReplaceMatch& m, size_t p) { return m.offset < p; });
+        for (auto it = first; it != m_matches.end(); ++it) {
+            ReplaceMatch m = *it;
+            m.offset = static_cast<size_t>(static_cast<int64_t>(m.offset) + delta);
+            m_nextMatches.push_back(m);
+        }
+    }
+    m_matches.swap(m_nextMatches);
+    return scanned;
+}
@@ -0,0 +1,77 @@
+#ifndef INCREMENTALMATCHER_H
+#define INCREMENTALMATCHER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+#include "replaceengine.h"
+
+/**
+ * IncrementalMatcher keeps the matches of one engine over successive
+ * versions of the same content and, for each new version, rescans only
+ * what changed.
+ *
+ * Versions are compared by XXH64 hashes of fixed-size blocks, aligned once
+ * from the start and once from the end so that insertions and deletions
+ * still leave a common suffix. Old matches are reused up to the last
+ * position whose decision cannot see the change (maxPatternLength() bytes
+ * before it). The scan then restarts there and runs until it reaches a
+ * position in the common suffix that the previous scan also stopped at;
+ * from there on both scans coincide, so the remaining old matches are
+ * shifted instead of rescanned.
+ */
+class IncrementalMatcher
+{
+public:
+    static constexpr size_t kBlockSize = 4096;
+
+    // The engine must outlive the matcher
+    explicit IncrementalMatcher(const ReplaceEngine& engine);
+
+    // Forget the previous version; the next update() scans everything
+    void reset();
+
+    // Bring the matches up to date with a new version of the content and
+    // return the number of bytes that had to be scanned
+    size_t update(const char *data, size_t length);
+
+    const std::vector<ReplaceMatch>& matches() const { return m_matches; }
+
+    // Write data with the current matches replaced (data must be the
+    // content passed to the last update())
+    template <typename Output>
+    void apply(const char *data, size_t length, Output& out) const
+    {
+        size_t copied = 0;
+        for (const ReplaceMatch& m : m_matches) {
+            out.append(data + copied, m.offset - copied);
+            const std::string_view replacement = m_engine.replacement(m.rule);
+            out.append(replacement.data(), replacement.size());
+            copied = m.offset + m.length;
+        }
+        out.append(data + copied, length - copied);
+    }
+
+private:
+    void hashBlocks(const char *data, size_t length,
+                    std::vector<uint64_t>& forward, std::vector<uint64_t>& backward) const;
+
+    // True when the previous scan visited oldPos, i.e. did not skip it as
+    // part of a match; in legacy encodings only match starts are known
+    bool oldScanVisited(size_t oldPos, size_t& hint) const;
+
+    const ReplaceEngine& m_engine;
+    bool m_hasVersion;
+    size_t m_length;
+    std::vector<uint64_t> m_forward;   // hashes of blocks from the start
+    std::vector<uint64_t> m_backward;  // hashes of blocks from the end
+    std::vector<ReplaceMatch> m_matches;
+
+    // Scratch for the next version, swapped in by update()
+    std::vector<uint64_t> m_nextForward;
+    std::vector<uint64_t> m_nextBackward;
+    std::vector<ReplaceMatch> m_nextMatches;
+};
+
+#endif // INCREMENTALMATCHER_H
@@ -0,0 +1,17 @@
+#ifndef JISTABLES_H
+#define JISTABLES_H
+
+#include <cstdint>
+
+// Code tables used by TextCodec for Shift_JIS (CP932) and EUC-JP.
+// See jistables.cpp for the index layout.
+
+static const int kCp932TrailCount = 189;     // 0x40-0xFC
+static const int kJisRowCount = 94;          // 0xA1-0xFE
+
+extern const uint16_t kCp932SingleByte[256];
+extern const uint16_t kCp932DoubleByte[60 * kCp932TrailCount];
+extern const uint16_t kEucJp0208[kJisRowCount * kJisRowCount];
+extern const uint16_t kEucJp0212[kJisRowCount * kJisRowCount];
+
+#endif // JISTABLES_H
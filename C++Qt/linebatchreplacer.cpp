@@ -0,0 +1,93 @@
+#include "linebatchreplacer.h"
+#include "tracer.h"
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+bool LineBatchReplacer::isLineLocal(const RulePipeline& pipeline)
+{
+    for (size_t rule = 0; rule < pipeline.ruleCount(); ++rule) {
+        if (pipeline.pattern(rule).find('\n') != std::string_view::npos) {
+            return false;
+        }
+    }
+    return true;
+}
+
+LineBatchReplacer::Result LineBatchReplacer::run(const RulePipeline& pipeline, const char *data, size_t length,
+                                                 const LineIndex& lines, const StreamReplacer::Writer& sink,
+                                                 RuleStats *stats, unsigned threads)
+{
+    TRACE_SCOPE("lineBatches");
+
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // Cut the input after a '\n' roughly every batchSize bytes
+    const size_t batchSize = std::max(kMinBatchSize, length / (threads * kBatchesPerThread) + 1);
+    std::vector<size_t> bounds{0};
+    if (isLineLocal(pipeline)) {
+        while (bounds.back() + batchSize < length) {
+            const size_t cut = lines.nextLineStart(bounds.back() + batchSize);
+            if (cut >= length) {
+                break;
+            }
+            bounds.push_back(cut);
+        }
+    }
+    bounds.push_back(length);
+
+    Result result;
+    result.batches = bounds.size() - 1;
+    if (result.batches == 1) {
+        result.matches = pipeline.stream(
+            [data, length](const StreamReplacer::Writer& feed) { feed(data, length); }, sink, stats);
+        return result;
+    }
+
+    // Workers take the next batch from a shared counter; every batch has
+    // its own output and every worker its own stats
+    std::vector<std::string> outputs(result.batches);
+    std::vector<uint64_t> matches(result.batches, 0);
+    const unsigned workerCount = static_cast<unsigned>(std::min<size_t>(threads, result.batches));
+    std::vector<RuleStats> workerStats(workerCount);
+    std::atomic<size_t> next(0);
+    auto work = [&](unsigned worker) {
+        RuleStats& own = workerStats[worker];
+        own.reset(pipeline.ruleCount());
+        for (size_t i = next++; i < result.batches; i = next++) {
+            const char *begin = data + bounds[i];
+            const size_t size = bounds[i + 1] - bounds[i];
+            std::string& out = outputs[i];
+            out.reserve(size);
+            matches[i] = pipeline.stream(
+                [begin, size](const StreamReplacer::Writer& feed) { feed(begin, size); },
+                [&out](const char *bytes, size_t count) { out.append(bytes, count); },
+                stats ? &own : nullptr);
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned t = 1; t < workerCount; ++t) {
+        workers.emplace_back(work, t);
+    }
+    work(0);
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+
+    for (size_t i = 0; i < result.batches; ++i) {
+        sink(outputs[i].data(), outputs[i].size());
+        result.matches += matches[i];
+        std::string().swap(outputs[i]);
+    }
+    if (stats) {
+        for (const RuleStats& own : workerStats) {
+            stats->merge(own);
+        }
+    }
+    return result;
+}
@@ -0,0 +1,42 @@
+#ifndef LINEBATCHREPLACER_H
+#define LINEBATCHREPLACER_H
+
+#include <cstddef>
+#include <cstdint>
+#include "lineindex.h"
+#include "rulepipeline.h"
+#include "streamreplacer.h"
+
+/**
+ * LineBatchReplacer runs a pipeline over batches of whole lines on several
+ * threads. When no pattern of any stage contains '\n', no match can span a
+ * line break, so every batch is replaced on its own and the outputs are
+ * simply concatenated; nothing has to be reconciled at batch boundaries.
+ * '\n' is never a trail byte in Shift_JIS or EUC-JP, so a batch always
+ * starts on a character boundary too. Other pipelines run in one piece.
+ */
+class LineBatchReplacer
+{
+public:
+    struct Result {
+        uint64_t matches = 0;
+        size_t batches = 0;  // 1 when the run was not split
+    };
+
+    // True when no pattern contains '\n', i.e. matches stay within a line
+    static bool isLineLocal(const RulePipeline& pipeline);
+
+    // Apply pipeline to data, split at the line starts of lines (built over
+    // the same bytes), passing the output to sink in order on the calling
+    // thread. threads 0 uses every core. Stats, if given, must be
+    // reset(pipeline.ruleCount()).
+    static Result run(const RulePipeline& pipeline, const char *data, size_t length, const LineIndex& lines,
+                      const StreamReplacer::Writer& sink, RuleStats *stats = nullptr, unsigned threads = 0);
+
+    // Batches are at least this large, so small inputs stay on one thread
+    static constexpr size_t kMinBatchSize = 1024 * 1024;
+    // Batches per thread, to even out lines of uneven cost
+    static constexpr size_t kBatchesPerThread = 4;
+};
+
+#endif // LINEBATCHREPLACER_H
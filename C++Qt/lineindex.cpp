@@ -0,0 +1,38 @@
+#include "lineindex.h"
+#include "cpudispatch.h"
+#include "tracer.h"
+#include <algorithm>
+
+LineIndex::LineIndex()
+    : m_length(0)
+{
+    clear();
+}
+
+void LineIndex::clear()
+{
+    m_starts.assign(1, 0);
+    m_length = 0;
+}
+
+void LineIndex::build(const char *data, size_t length)
+{
+    TRACE_SCOPE("LineIndex::build");
+
+    // Every '\n' at i starts a line at i + 1
+    clear();
+    m_length = length;
+    CpuDispatch::kernels().collectByte(reinterpret_cast<const unsigned char *>(data), length,
+                                       '\n', 1, m_starts);
+}
+
+size_t LineIndex::lineAt(size_t offset) const
+{
+    return static_cast<size_t>(std::upper_bound(m_starts.begin(), m_starts.end(), offset) - m_starts.begin()) - 1;
+}
+
+size_t LineIndex::nextLineStart(size_t offset) const
+{
+    auto it = std::lower_bound(m_starts.begin(), m_starts.end(), offset);
+    return it == m_starts.end() ? m_length : *it;
+}
@@ -0,0 +1,44 @@
+#ifndef LINEINDEX_H
+#define LINEINDEX_H
+
+#include <cstddef>
+#include <vector>
+
+/**
+ * LineIndex holds the byte offset where each line of a buffer starts, so a
+ * line number maps to its bytes in O(1) and an offset to its line by binary
+ * search. It is built with one vector scan for '\n' (CpuDispatch); lines
+ * are split at '\n' only, so a "\r\n" line ends with its '\r'. As in a
+ * QTextDocument, a buffer ending in '\n' has an empty last line.
+ */
+class LineIndex
+{
+public:
+    LineIndex();
+
+    // Index data, which is not kept
+    void build(const char *data, size_t length);
+    void clear();
+
+    size_t length() const { return m_length; }
+    size_t lineCount() const { return m_starts.size(); }
+
+    // Offsets of line (0-based); lineEnd() excludes the line's '\n'
+    size_t lineStart(size_t line) const { return m_starts[line]; }
+    size_t lineEnd(size_t line) const
+    {
+        return line + 1 < m_starts.size() ? m_starts[line + 1] - 1 : m_length;
+    }
+
+    // Line containing offset; offsets past the end belong to the last line
+    size_t lineAt(size_t offset) const;
+
+    // First line start at or after offset, or length() when there is none
+    size_t nextLineStart(size_t offset) const;
+
+private:
+    std::vector<size_t> m_starts;
+    size_t m_length;
+};
+
+#endif // LINEINDEX_H
@@ -0,0 +1,310 @@
+#include <QApplication>
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QEvent>
+#include <QFile>
+#include <QJsonDocument>
+#include <QTextStream>
+#include <cstdio>
+#include <cstring>
+#include "mainwindow.h"
+#include "translations.h"
+#include "appstyle.h"
+#include "batchjob.h"
+#include "pipefilter.h"
+#include "memorymeter.h"
+#include "resultcache.h"
+#include "replacedaemon.h"
+#include "tracer.h"
+
+namespace {
+
+// Reports the time from the start of main() to the first paint of the window
+class FirstPaintProbe : public QObject
+{
+public:
+    FirstPaintProbe(MainWindow *window, int64_t startMicros)
+        : m_window(window)
+        , m_startMicros(startMicros)
+    {
+        window->installEventFilter(this);
+    }
+
+    bool eventFilter(QObject *watched, QEvent *event) override
+    {
+        if (watched == m_window && event->type() == QEvent::Paint) {
+            m_window->removeEventFilter(this);
+            const int64_t elapsed = Tracer::nowMicros() - m_startMicros;
+            Tracer::record("startupToFirstPaint", m_startMicros, elapsed);
+            m_window->reportStartupTime(elapsed);
+        }
+        return false;
+    }
+
+private:
+    MainWindow *m_window;
+    int64_t m_startMicros;
+};
+
+// Write the trace requested through MULTREPLACER_TRACE
+void writeEnvironmentTrace()
+{
+    if (Tracer::isEnabled() && !Tracer::defaultOutputPath().empty()) {
+        Tracer::writeChromeTrace(Tracer::defaultOutputPath());
+    }
+}
+
+// Headless modes are chosen before any QApplication exists, so they never
+// load widgets, styles or translations
+bool isHeadless(int argc, char **argv)
+{
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--daemon") == 0 || std::strcmp(argv[i], "--batch") == 0
+            || std::strcmp(argv[i], "--filter") == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Read the rule set of --rules and apply --engine; false after reporting
+// what was wrong
+bool loadRules(const QCommandLineParser& parser, RulePipeline& pipeline, TextEncoding& encoding)
+{
+    QFile rulesFile(parser.value("rules"));
+    if (!rulesFile.open(QIODevice::ReadOnly)) {
+        std::fprintf(stderr, "cannot open rules: %s\n", qPrintable(rulesFile.errorString()));
+        return false;
+    }
+    QString error;
+    size_t dropped = 0;
+    if (!BatchJob::parseRules(QJsonDocument::fromJson(rulesFile.readAll()).object(), pipeline, encoding, &error,
+                              &dropped)) {
+        std::fprintf(stderr, "invalid rules: %s\n", qPrintable(error));
+        return false;
+    }
+    if (dropped > 0) {
+        std::fprintf(stderr, "%zu duplicate, no-op or unreachable rules left out\n", dropped);
+    }
+    if (parser.isSet("engine")) {
+        EngineStrategy strategy;
+        if (!ReplaceEngine::parseStrategy(parser.value("engine").toLatin1().constData(), &strategy)) {
+            std::fprintf(stderr, "unknown engine: %s\n", qPrintable(parser.value("engine")));
+            return false;
+        }
+        EngineTuner::setForcedStrategy(strategy);
+    }
+    return true;
+}
+
+int runBatch(const QCommandLineParser& parser)
+{
+    MemoryMeter memory;
+    memory.setBudget(static_cast<size_t>(parser.value("memory-budget").toULongLong()) * 1024 * 1024);
+    memory.beginPhase("compile");
+
+    RulePipeline pipeline;
+    TextEncoding encoding;
+    QString error;
+    if (!loadRules(parser, pipeline, encoding)) {
+        return 2;
+    }
+    const std::string sample = BatchJob::sampleInput(parser.positionalArguments());
+    pipeline.compile(encoding, sample.data(), sample.size());
+    std::fprintf(stderr, "%s", pipeline.tuningReport().c_str());
+    memory.set(MemoryMeter::Category::Rules, pipeline.ruleMemoryBytes());
+    memory.set(MemoryMeter::Category::Automaton, pipeline.engineMemoryBytes());
+
+    // Results of earlier runs let unchanged files skip the scan
+    ResultCache cache;
+    const std::string cachePath = parser.value("cache").toStdString();
+    if (!cachePath.empty()) {
+        cache.load(cachePath);
+    }
+
+    BatchIo io = BatchIo::Auto;
+    const QString ioName = parser.value("io");
+    if (ioName == "threads") {
+        io = BatchIo::Threads;
+    } else if (ioName == "uring") {
+        io = BatchIo::Uring;
+    } else if (ioName != "auto") {
+        std::fprintf(stderr, "unknown io: %s\n", qPrintable(ioName));
+        return 2;
+    }
+    io = BatchJob::resolveIo(io);
+
+    // A journal of an interrupted run lets the files it finished be passed over
+    BatchJournal journal;
+    if (parser.isSet("journal")) {
+        if (!journal.open(parser.value("journal"), pipeline.ruleSetHash(encoding), &error)) {
+            std::fprintf(stderr, "cannot open journal: %s\n", qPrintable(error));
+            return 2;
+        }
+        if (journal.loadedCount() > 0) {
+            std::fprintf(stderr, "journal: %d records of an earlier run\n", journal.loadedCount());
+        }
+    }
+
+    memory.beginPhase("replace");
+    RuleStats stats;
+    stats.reset(pipeline.ruleCount());
+    QElapsedTimer timer;
+    timer.start();
+    const QVector<BatchResult> results = BatchJob::replaceFiles(pipeline, parser.positionalArguments(),
+                                                                parser.value("threads").toInt(), &stats, &memory,
+                                                                cachePath.empty() ? nullptr : &cache, io,
+                                                                journal.isOpen() ? &journal : nullptr);
+    journal.close();
+    const double seconds = static_cast<double>(timer.nsecsElapsed()) / 1e9;
+    if (!cachePath.empty() && !cache.save(cachePath)) {
+        std::fprintf(stderr, "cannot write cache: %s\n", cachePath.c_str());
+    }
+
+    // One JSON line per file, in the order given
+    QTextStream out(stdout);
+    int failed = 0;
+    int streamed = 0;
+    int cached = 0;
+    int resumed = 0;
+    for (const BatchResult& result : results) {
+        out << QJsonDocument(result.toJson()).toJson(QJsonDocument::Compact) << '\n';
+        failed += result.ok ? 0 : 1;
+        streamed += result.streamed ? 1 : 0;
+        cached += result.cached ? 1 : 0;
+        resumed += result.resumed ? 1 : 0;
+    }
+    out.flush();
+    std::fprintf(stderr, "%lld files, %llu matches, %d failed\n",
+                 static_cast<long long>(results.size()),
+                 static_cast<unsigned long long>(stats.totalHits()), failed);
+    std::fprintf(stderr, "%lld files in %.2f s (%.0f files/s, %s)\n", static_cast<long long>(results.size()),
+                 seconds, seconds > 0.0 ? static_cast<double>(results.size()) / seconds : 0.0,
+                 BatchJob::ioName(io));
+    std::fprintf(stderr, "memory: %s\n", memory.summary().c_str());
+    if (streamed > 0) {
+        std::fprintf(stderr, "%d files streamed to stay within the memory budget\n", streamed);
+    }
+    if (cached > 0) {
+        std::fprintf(stderr, "%d files answered from the result cache\n", cached);
+    }
+    if (resumed > 0) {
+        std::fprintf(stderr, "%d files finished by an earlier run were passed over\n", resumed);
+    }
+    return failed > 0 ? 1 : 0;
+}
+
+// stdin to stdout through the rules, in bounded memory whatever the
+// length of the stream; there is no input to tune on beforehand
+int runFilter(const QCommandLineParser& parser)
+{
+    RulePipeline pipeline;
+    TextEncoding encoding;
+    if (!loadRules(parser, pipeline, encoding)) {
+        return 2;
+    }
+    pipeline.compile(encoding);
+
+    PipeFilter::Options options;
+    if (!PipeFilter::parseFlush(parser.value("flush").toLatin1().constData(), &options.flush)) {
+        std::fprintf(stderr, "unknown flush policy: %s\n", qPrintable(parser.value("flush")));
+        return 2;
+    }
+    const size_t bufferBytes = static_cast<size_t>(parser.value("buffer-size").toULongLong()) * 1024;
+    if (bufferBytes > 0) {
+        options.readSize = bufferBytes;
+        options.outputSize = bufferBytes;
+    }
+
+    PipeFilter filter(pipeline, options);
+    const PipeFilter::Result result = filter.run(0, 1);
+    if (!result.ok) {
+        std::fprintf(stderr, "filter failed: %s\n", result.error.c_str());
+        return 1;
+    }
+    if (parser.isSet("verbose")) {
+        std::fprintf(stderr, "%llu bytes in, %llu bytes out, %llu matches, %llu reads, %llu writes\n",
+                     static_cast<unsigned long long>(result.bytesIn), static_cast<unsigned long long>(result.bytesOut),
+                     static_cast<unsigned long long>(result.matches), static_cast<unsigned long long>(result.reads),
+                     static_cast<unsigned long long>(result.writes));
+    }
+    return 0;
+}
+
+int runHeadless(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    parser.addOption({"daemon", "Serve replace jobs on a local socket."});
+    parser.addOption({"server", "Local socket name of the daemon.", "name", ReplaceDaemon::defaultServerName()});
+    parser.addOption({"batch", "Replace the given files in place and exit."});
+    parser.addOption({"filter", "Replace stdin to stdout, for shell pipelines."});
+    parser.addOption({"rules", "Rule set (JSON) for --batch and --filter.", "file"});
+    parser.addOption({"threads", "Worker threads for --batch (0: one per core).", "n", "0"});
+    parser.addOption({"memory-budget", "Memory budget for --batch in MB; larger files are streamed (0: none).",
+                      "mb", "0"});
+    parser.addOption({"engine", "Matching kernel for --batch: auto, trie, single, shift-or or rolling-hash "
+                                "(default: tuned on a sample of the files, or MULTREPLACER_ENGINE).", "name"});
+    parser.addOption({"cache", "Result cache file for --batch; unchanged files reuse earlier results.", "file"});
+    parser.addOption({"journal", "Journal file for --batch; a restarted run passes over the files it has as done.",
+                      "file"});
+    parser.addOption({"io", "File I/O for --batch: auto, threads or uring (io_uring on Linux).", "mode", "auto"});
+    parser.addOption({"flush", "Output flushing of --filter: throughput (full buffers) or latency (every read).",
+                      "policy", "throughput"});
+    parser.addOption({"buffer-size", "Read and output buffer size of --filter in KB (default 1024).", "kb", "0"});
+    parser.addOption({"verbose", "Report byte and syscall counts of --filter on stderr."});
+    parser.addPositionalArgument("files", "Files for --batch.", "[files...]");
+    parser.process(app);
+
+    if (parser.isSet("batch")) {
+        if (!parser.isSet("rules")) {
+            std::fprintf(stderr, "--batch needs --rules\n");
+            return 2;
+        }
+        return runBatch(parser);
+    }
+    if (parser.isSet("filter")) {
+        if (!parser.isSet("rules")) {
+            std::fprintf(stderr, "--filter needs --rules\n");
+            return 2;
+        }
+        return runFilter(parser);
+    }
+
+    ReplaceDaemon daemon;
+    QString error;
+    if (!daemon.listen(parser.value("server"), &error)) {
+        std::fprintf(stderr, "cannot listen on %s: %s\n", qPrintable(parser.value("server")), qPrintable(error));
+        return 2;
+    }
+    QObject::connect(&daemon, &ReplaceDaemon::quitRequested, &app, &QCoreApplication::quit, Qt::QueuedConnection);
+    return app.exec();
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    const int64_t startMicros = Tracer::nowMicros();
+    Tracer::initFromEnvironment();
+    if (isHeadless(argc, argv)) {
+        // Also reached when the daemon quits
+        const int status = runHeadless(argc, argv);
+        writeEnvironmentTrace();
+        return status;
+    }
+
+    QApplication app(argc, argv);
+    Translations::load(Language::JA);
+    app.setStyleSheet(AppStyle::styleSheet());
+
+    MainWindow window;
+    FirstPaintProbe probe(&window, startMicros);
+    window.show();
+    const int status = app.exec();
+    writeEnvironmentTrace();
+    return status;
+}
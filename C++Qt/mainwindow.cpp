@@ -1,15 +1,27 @@
 #include "mainwindow.h"
+#include "tracer.h"
+#include "rulestatsdialog.h"
+#include "linebatchreplacer.h"
+#include "contenthash.h"
 #include <QFile>
+#include <QSaveFile>
 #include <QTextStream>
 #include <QMessageBox>
 #include <QFileDialog>
 #include <QSplitter>
 #include <QMenuBar>
 #include <QStatusBar>
+#include <QThread>
 #include <QApplication>
 #include <QScreen>
-#include <sstream>
+#include <QSet>
+#include <QInputDialog>
 #include <algorithm>
+#include <array>
+#include <cstring>
+#ifdef Q_OS_LINUX
+#include <unistd.h>
+#endif
 
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
@@ -30,8 +42,35 @@ MainWindow::MainWindow(QWidget *parent)
     , m_controlFrame(nullptr)
     , m_controlLayout(nullptr)
     , m_addRowButton(nullptr)
+    , m_rangeCombo(nullptr)
+    , m_rangeFromEdit(nullptr)
+    , m_rangeToEdit(nullptr)
     , m_executeButton(nullptr)
+    , m_encodingCombo(nullptr)
+    , m_cancelLoadAction(nullptr)
+    , m_inPlaceAction(nullptr)
+    , m_watchAction(nullptr)
+    , m_lineModeAction(nullptr)
+    , m_saveAction(nullptr)
+    , m_undoAction(nullptr)
+    , m_redoAction(nullptr)
+    , m_loadProgress(nullptr)
+    , m_confirmationDialog(nullptr)
+    , m_loadedSize(0)
+    , m_savedSinceLoad(false)
+    , m_versionUnsaved(false)
+    , m_compression(Compression::None)
+    , m_currentEncoding(TextEncoding::Utf8)
+    , m_lastLineBatches(0)
+    , m_traceMark(0)
+    , m_watchSession(nullptr)
+    , m_loader(nullptr)
+    , m_originalHash(0)
+    , m_hasOriginalHash(false)
+    , m_lastRunCached(false)
 {
+    m_loader = new FileLoader(this);
+    
     setupUI();
     setupConnections();
     setupMenuBar();
@@ -53,6 +92,9 @@ MainWindow::MainWindow(QWidget *parent)
 
 MainWindow::~MainWindow()
 {
+    // The loader may still read the mapping owned by m_sourceFile
+    m_loader->stop();
+    
     // Clean up replacement rows (though Qt's parent-child system should handle this)
     for (auto* row : m_replacementRows) {
         if (row) {
@@ -76,101 +118,52 @@ void MainWindow::setupUI()
     // File selection section
     m_fileFrame = new QFrame(m_centralWidget);
     m_fileFrame->setFrameStyle(QFrame::StyledPanel);
-    m_fileFrame->setStyleSheet(
-        "QFrame {"
-        "    background-color: white;"
-        "    border: 1px solid #bdc3c7;"
-        "    border-radius: 4px;"
-        "    padding: 5px;"
-        "}"
-    );
+    m_fileFrame->setProperty("role", "panel");
     
     m_fileLayout = new QHBoxLayout(m_fileFrame);
     m_fileLayout->setContentsMargins(10, 10, 10, 10);
     m_fileLayout->setSpacing(10);
     
-    m_fileLabel = new QLabel(Translations::tr("path_label"), m_fileFrame);
+    m_fileLabel = new QLabel(Translations::tr(TrKey::PathLabel), m_fileFrame);
     m_fileLabel->setMinimumWidth(50);
     
     m_filePathEdit = new QLineEdit(m_fileFrame);
     m_filePathEdit->setPlaceholderText("ファイルパスを入力するか、参照ボタンでファイルを選択してください");
-    m_filePathEdit->setStyleSheet(
-        "QLineEdit {"
-        "    border: 1px solid #bdc3c7;"
-        "    border-radius: 4px;"
-        "    padding: 5px;"
-        "    font-size: 12px;"
-        "}"
-        "QLineEdit:focus {"
-        "    border: 2px solid #3498db;"
-        "}"
-    );
     
-    m_browseButton = new QPushButton(Translations::tr("browse"), m_fileFrame);
+    m_browseButton = new QPushButton(Translations::tr(TrKey::Browse), m_fileFrame);
     m_browseButton->setMinimumSize(80, 30);
-    m_browseButton->setStyleSheet(
-        "QPushButton {"
-        "    background-color: #3498db;"
-        "    color: white;"
-        "    border: none;"
-        "    border-radius: 4px;"
-        "    font-size: 12px;"
-        "    font-weight: bold;"
-        "}"
-        "QPushButton:hover {"
-        "    background-color: #2980b9;"
-        "}"
-        "QPushButton:pressed {"
-        "    background-color: #21618c;"
-        "}"
-    );
+    m_browseButton->setProperty("role", "primary");
     
     m_fileLayout->addWidget(m_fileLabel);
     m_fileLayout->addWidget(m_filePathEdit, 1);
     m_fileLayout->addWidget(m_browseButton);
+    m_encodingCombo = new QComboBox(m_fileFrame);
+    m_encodingCombo->addItem("自動判別", -1);
+    m_encodingCombo->addItem("UTF-8", static_cast<int>(TextEncoding::Utf8));
+    m_encodingCombo->addItem("Shift_JIS", static_cast<int>(TextEncoding::ShiftJis));
+    m_encodingCombo->addItem("EUC-JP", static_cast<int>(TextEncoding::EucJp));
+    m_fileLayout->addWidget(m_encodingCombo);
     m_langCombo = new QComboBox(m_fileFrame);
     m_langCombo->addItem("ja", QVariant::fromValue(static_cast<int>(Language::JA)));
     m_langCombo->addItem("en", QVariant::fromValue(static_cast<int>(Language::EN)));
     m_fileLayout->addWidget(m_langCombo);
     
     // Caution label
-    m_cautionLabel = new QLabel(Translations::tr("caution"), m_centralWidget);
-    m_cautionLabel->setStyleSheet(
-        "QLabel {"
-        "    color: #e74c3c;"
-        "    font-weight: bold;"
-        "    background-color: #ffeaa7;"
-        "    padding: 8px;"
-        "    border-radius: 4px;"
-        "    border-left: 4px solid #e74c3c;"
-        "}"
-    );
+    m_cautionLabel = new QLabel(Translations::tr(TrKey::Caution), m_centralWidget);
+    m_cautionLabel->setProperty("role", "caution");
     m_cautionLabel->setWordWrap(true);
     
     // Replacement rules section
     m_rulesFrame = new QFrame(m_centralWidget);
     m_rulesFrame->setFrameStyle(QFrame::StyledPanel);
-    m_rulesFrame->setStyleSheet(
-        "QFrame {"
-        "    background-color: white;"
-        "    border: 1px solid #bdc3c7;"
-        "    border-radius: 4px;"
-        "    padding: 5px;"
-        "}"
-    );
+    m_rulesFrame->setProperty("role", "panel");
     
     m_rulesLayout = new QVBoxLayout(m_rulesFrame);
     m_rulesLayout->setContentsMargins(10, 10, 10, 10);
     m_rulesLayout->setSpacing(10);
     
     m_rulesLabel = new QLabel("置換ルール:", m_rulesFrame);
-    m_rulesLabel->setStyleSheet(
-        "QLabel {"
-        "    font-size: 14px;"
-        "    font-weight: bold;"
-        "    color: #2c3e50;"
-        "}"
-    );
+    m_rulesLabel->setProperty("role", "heading");
     
     // Scrollable area for replacement rows
     m_scrollArea = new QScrollArea(m_rulesFrame);
@@ -178,13 +171,7 @@ void MainWindow::setupUI()
     m_scrollArea->setHorizontalScrollBarPolicy(Qt::ScrollBarAsNeeded);
     m_scrollArea->setVerticalScrollBarPolicy(Qt::ScrollBarAsNeeded);
     m_scrollArea->setMinimumHeight(SCROLL_AREA_HEIGHT);
-    m_scrollArea->setStyleSheet(
-        "QScrollArea {"
-        "    border: 1px solid #ecf0f1;"
-        "    border-radius: 4px;"
-        "    background-color: #fafafa;"
-        "}"
-    );
+    m_scrollArea->setProperty("role", "rules");
     
     m_scrollWidget = new QWidget();
     m_scrollLayout = new QVBoxLayout(m_scrollWidget);
@@ -200,63 +187,37 @@ void MainWindow::setupUI()
     // Control buttons section
     m_controlFrame = new QFrame(m_centralWidget);
     m_controlFrame->setFrameStyle(QFrame::StyledPanel);
-    m_controlFrame->setStyleSheet(
-        "QFrame {"
-        "    background-color: white;"
-        "    border: 1px solid #bdc3c7;"
-        "    border-radius: 4px;"
-        "    padding: 5px;"
-        "}"
-    );
+    m_controlFrame->setProperty("role", "panel");
     
     m_controlLayout = new QHBoxLayout(m_controlFrame);
     m_controlLayout->setContentsMargins(10, 10, 10, 10);
     m_controlLayout->setSpacing(10);
     
-    m_addRowButton = new QPushButton(Translations::tr("add"), m_controlFrame);
+    m_addRowButton = new QPushButton(Translations::tr(TrKey::Add), m_controlFrame);
     m_addRowButton->setMinimumSize(100, 35);
-    m_addRowButton->setStyleSheet(
-        "QPushButton {"
-        "    background-color: #3498db;"
-        "    color: white;"
-        "    border: none;"
-        "    border-radius: 4px;"
-        "    font-size: 12px;"
-        "    font-weight: bold;"
-        "}"
-        "QPushButton:hover {"
-        "    background-color: #2980b9;"
-        "}"
-        "QPushButton:pressed {"
-        "    background-color: #21618c;"
-        "}"
-    );
+    m_addRowButton->setProperty("role", "primary");
     
-    m_executeButton = new QPushButton(Translations::tr("execute"), m_controlFrame);
+    m_executeButton = new QPushButton(Translations::tr(TrKey::Execute), m_controlFrame);
     m_executeButton->setMinimumSize(100, 35);
-    m_executeButton->setStyleSheet(
-        "QPushButton {"
-        "    background-color: #27ae60;"
-        "    color: white;"
-        "    border: none;"
-        "    border-radius: 4px;"
-        "    font-size: 12px;"
-        "    font-weight: bold;"
-        "}"
-        "QPushButton:hover:enabled {"
-        "    background-color: #229954;"
-        "}"
-        "QPushButton:pressed:enabled {"
-        "    background-color: #1e8449;"
-        "}"
-        "QPushButton:disabled {"
-        "    background-color: #bdc3c7;"
-        "}"
-    );
+    m_executeButton->setProperty("role", "execute");
     m_executeButton->setEnabled(false);
     
+    // Range of the file the rules apply to; only that part is scanned
+    m_rangeCombo = new QComboBox(m_controlFrame);
+    m_rangeCombo->addItem("ファイル全体", static_cast<int>(TextRange::Kind::Whole));
+    m_rangeCombo->addItem("バイト範囲", static_cast<int>(TextRange::Kind::Bytes));
+    m_rangeCombo->addItem("行範囲", static_cast<int>(TextRange::Kind::Lines));
+    m_rangeCombo->addItem("マーカー間", static_cast<int>(TextRange::Kind::Markers));
+    m_rangeFromEdit = new QLineEdit(m_controlFrame);
+    m_rangeToEdit = new QLineEdit(m_controlFrame);
+    m_rangeFromEdit->setVisible(false);
+    m_rangeToEdit->setVisible(false);
+    
     m_controlLayout->addWidget(m_addRowButton);
     m_controlLayout->addStretch();
+    m_controlLayout->addWidget(m_rangeCombo);
+    m_controlLayout->addWidget(m_rangeFromEdit);
+    m_controlLayout->addWidget(m_rangeToEdit);
     m_controlLayout->addWidget(m_executeButton);
     
     // Add all frames to main layout
@@ -272,19 +233,29 @@ void MainWindow::setupConnections()
     connect(m_addRowButton, &QPushButton::clicked, this, &MainWindow::onAddRowClicked);
     connect(m_executeButton, &QPushButton::clicked, this, &MainWindow::onExecuteClicked);
     connect(m_filePathEdit, &QLineEdit::textChanged, this, &MainWindow::updateExecuteButtonState);
+    connect(m_encodingCombo, &QComboBox::currentIndexChanged, this, &MainWindow::applyEncoding);
+    connect(m_rangeCombo, &QComboBox::currentIndexChanged, this, &MainWindow::onRangeKindChanged);
+    connect(m_loader, &FileLoader::progress, this, &MainWindow::onLoadProgress);
+    connect(m_loader, &FileLoader::bytesReady, this, &MainWindow::onLoadBytesReady);
+    connect(m_loader, &FileLoader::textReady, this, &MainWindow::onLoadTextReady);
+    connect(m_loader, &FileLoader::cancelled, this, &MainWindow::onLoadCancelled);
+    connect(m_loader, &FileLoader::failed, this, &MainWindow::onLoadFailed);
     connect(m_langCombo, &QComboBox::currentIndexChanged, [this](int index){
         Language lang = static_cast<Language>(m_langCombo->currentData().toInt());
         Translations::load(lang);
         // Update texts
-        setWindowTitle(Translations::tr("title"));
-        m_fileLabel->setText(Translations::tr("path_label"));
-        m_browseButton->setText(Translations::tr("browse"));
-        m_cautionLabel->setText(Translations::tr("caution"));
-        m_addRowButton->setText(Translations::tr("add"));
-        m_executeButton->setText(Translations::tr("execute"));
+        setWindowTitle(Translations::tr(TrKey::Title));
+        m_fileLabel->setText(Translations::tr(TrKey::PathLabel));
+        m_browseButton->setText(Translations::tr(TrKey::Browse));
+        m_cautionLabel->setText(Translations::tr(TrKey::Caution));
+        m_addRowButton->setText(Translations::tr(TrKey::Add));
+        m_executeButton->setText(Translations::tr(TrKey::Execute));
         for (auto* row : m_replacementRows) {
             row->updateTexts();
         }
+        if (m_confirmationDialog) {
+            m_confirmationDialog->updateTexts();
+        }
     });
 }
 
@@ -299,6 +270,17 @@ void MainWindow::setupMenuBar()
     openAction->setShortcut(QKeySequence::Open);
     connect(openAction, &QAction::triggered, this, &MainWindow::onBrowseClicked);
     
+    // Undo and redo only switch versions; the file gets the current one here
+    m_saveAction = fileMenu->addAction("保存(&S)");
+    m_saveAction->setShortcut(QKeySequence::Save);
+    m_saveAction->setEnabled(false);
+    connect(m_saveAction, &QAction::triggered, this, &MainWindow::onSaveClicked);
+    
+    m_cancelLoadAction = fileMenu->addAction("読み込みを中止(&C)");
+    m_cancelLoadAction->setShortcut(QKeySequence(Qt::Key_Escape));
+    m_cancelLoadAction->setEnabled(false);
+    connect(m_cancelLoadAction, &QAction::triggered, m_loader, &FileLoader::cancel);
+    
     fileMenu->addSeparator();
     
     QAction *exitAction = fileMenu->addAction("終了(&X)");
@@ -308,10 +290,70 @@ void MainWindow::setupMenuBar()
     // Edit menu
     QMenu *editMenu = menuBar->addMenu("編集(&E)");
     
+    m_undoAction = editMenu->addAction("元に戻す(&U)");
+    m_undoAction->setShortcut(QKeySequence::Undo);
+    connect(m_undoAction, &QAction::triggered, this, &MainWindow::onUndoClicked);
+    
+    m_redoAction = editMenu->addAction("やり直す(&R)");
+    m_redoAction->setShortcut(QKeySequence::Redo);
+    connect(m_redoAction, &QAction::triggered, this, &MainWindow::onRedoClicked);
+    
+    updateUndoActions();
+    editMenu->addSeparator();
+    
     QAction *addRowAction = editMenu->addAction("ルールを追加(&A)");
     addRowAction->setShortcut(QKeySequence("Ctrl+A"));
     connect(addRowAction, &QAction::triggered, this, &MainWindow::onAddRowClicked);
     
+    // Tools menu
+    QMenu *toolsMenu = menuBar->addMenu("ツール(&T)");
+    
+    QAction *traceAction = toolsMenu->addAction("処理時間を計測(&M)");
+    traceAction->setCheckable(true);
+    traceAction->setChecked(Tracer::isEnabled());
+    connect(traceAction, &QAction::toggled, [](bool checked) {
+        Tracer::setEnabled(checked);
+    });
+    
+    QAction *exportTraceAction = toolsMenu->addAction("トレースを書き出す(&E)...");
+    connect(exportTraceAction, &QAction::triggered, this, &MainWindow::onExportTraceClicked);
+    
+    toolsMenu->addSeparator();
+    
+    QAction *ruleStatsAction = toolsMenu->addAction("ルール統計(&S)...");
+    connect(ruleStatsAction, &QAction::triggered, this, &MainWindow::onRuleStatsClicked);
+    
+    toolsMenu->addSeparator();
+    
+    QAction *dryRunAction = toolsMenu->addAction("ドライラン(&D)");
+    connect(dryRunAction, &QAction::triggered, this, &MainWindow::onDryRunClicked);
+    
+    QAction *prescanAction = toolsMenu->addAction("複数ファイルを事前確認(&P)...");
+    connect(prescanAction, &QAction::triggered, this, &MainWindow::onPrescanFilesClicked);
+    
+    toolsMenu->addSeparator();
+    
+    m_inPlaceAction = toolsMenu->addAction("同じ長さの置換はその場で書き換える(&I)");
+    m_inPlaceAction->setCheckable(true);
+    m_inPlaceAction->setChecked(true);
+    
+    m_watchAction = toolsMenu->addAction("監視モード(&W)");
+    m_watchAction->setCheckable(true);
+    connect(m_watchAction, &QAction::toggled, this, &MainWindow::onWatchToggled);
+    
+    // Line mode: runs whose matches stay within lines are split into line
+    // batches replaced in parallel, and the preview navigates by line
+    m_lineModeAction = toolsMenu->addAction("行モード(&L)");
+    m_lineModeAction->setCheckable(true);
+    
+    toolsMenu->addSeparator();
+    
+    QAction *memoryUsageAction = toolsMenu->addAction("メモリ使用量(&Y)...");
+    connect(memoryUsageAction, &QAction::triggered, this, &MainWindow::onMemoryUsageClicked);
+    
+    QAction *memoryBudgetAction = toolsMenu->addAction("メモリ上限を設定(&B)...");
+    connect(memoryBudgetAction, &QAction::triggered, this, &MainWindow::onMemoryBudgetClicked);
+    
     // Help menu
     QMenu *helpMenu = menuBar->addMenu("ヘルプ(&H)");
     
@@ -327,6 +369,13 @@ void MainWindow::setupMenuBar()
 void MainWindow::setupStatusBar()
 {
     statusBar()->showMessage("ファイルを選択してください");
+    
+    m_loadProgress = new QProgressBar(statusBar());
+    m_loadProgress->setRange(0, 1000);
+    m_loadProgress->setMaximumWidth(200);
+    m_loadProgress->setTextVisible(false);
+    m_loadProgress->hide();
+    statusBar()->addPermanentWidget(m_loadProgress);
 }
 
 void MainWindow::addReplacementRow()
@@ -362,12 +411,47 @@ void MainWindow::onBrowseClicked()
         "テキストファイル (*.txt);;すべてのファイル (*.*)"
     );
     
-    if (!fileName.isEmpty()) {
+    if (!fileName.isEmpty() && confirmUnsavedVersion()) {
         m_filePathEdit->setText(fileName);
         loadFile(fileName);
     }
 }
 
+void MainWindow::onSaveClicked()
+{
+    if (!m_versionUnsaved) {
+        return;
+    }
+    // Streamed piece by piece, so only the saved version is ever written
+    if (saveDocument(m_currentFilePath)) {
+        statusBar()->showMessage("保存しました", 3000);
+    }
+    updateUndoActions();
+}
+
+bool MainWindow::confirmUnsavedVersion()
+{
+    if (!m_versionUnsaved) {
+        return true;
+    }
+    const QMessageBox::StandardButton answer = QMessageBox::question(this, "確認",
+        "元に戻した (やり直した) 内容はまだ保存されていません。保存しますか？",
+        QMessageBox::Save | QMessageBox::Discard | QMessageBox::Cancel);
+    if (answer == QMessageBox::Save) {
+        return saveDocument(m_currentFilePath);
+    }
+    return answer == QMessageBox::Discard;
+}
+
+void MainWindow::closeEvent(QCloseEvent *event)
+{
+    if (confirmUnsavedVersion()) {
+        event->accept();
+    } else {
+        event->ignore();
+    }
+}
+
 void MainWindow::onAddRowClicked()
 {
     addReplacementRow();
@@ -397,38 +481,729 @@ void MainWindow::onDeleteRowRequested()
 
 void MainWindow::onExecuteClicked()
 {
-    if (m_currentFileContent.isEmpty()) {
+    if (m_currentFilePath.isEmpty() || m_document.length() == 0) {
         QMessageBox::warning(this, "エラー", "ファイルが読み込まれていません。");
         return;
     }
     
-    // Collect replacements
-    std::map<std::string, std::string> replacements = collectReplacements();
+    // The status bar summary covers this run only
+    m_traceMark = Tracer::mark();
+    m_memory.resetPeaks();
+    m_memory.beginPhase("compile");
+    if (!prepareRules()) {
+        return;
+    }
+    updateMemoryUsage();
     
-    if (replacements.empty()) {
-        QMessageBox::warning(this, "エラー", "有効な置換ルールがありません。");
+    TextRange range;
+    if (!selectedRange(&range)) {
+        return;
+    }
+    if (!range.isWhole()) {
+        executeInRange(range);
+        return;
+    }
+    
+    // Pre-scan: a file without matches needs no preview or save. Content
+    // the rules ran over before is answered by the result cache; a later
+    // version that does not fit the budget as one buffer goes without.
+    const ResultCache::Key key = documentKey(m_pipeline);
+    const std::shared_ptr<const ResultCache::Entry> known = m_resultCache.find(key);
+    bool hasMatch = !known || known->matches > 0;
+    if (!known && (m_document.isOriginal() || m_memory.fits(m_document.length()))) {
+        const QByteArray bytes = documentBytes();
+        hasMatch = m_pipeline.containsMatch(bytes.constData(), static_cast<size_t>(bytes.size()));
+        if (!hasMatch) {
+            m_resultCache.insert(key, ResultCache::Entry());
+        }
+    }
+    if (!hasMatch) {
+        QMessageBox::information(this, "完了", "一致する箇所はありません。ファイルは変更されません。");
+        return;
+    }
+    
+    // The text still being decoded for display is superseded by the run's result
+    if (m_loader->isRunning()) {
+        m_loader->stop();
+        finishLoading();
+    }
+    
+    try {
+        // Apply the run to the document; the file's own bytes are matched, no whole-file transcoding
+        m_memory.beginPhase("replace");
+        multiReplace(m_pipeline);
+        updateMemoryUsage();
+        
+        // What the preview would hold beyond the document: the result as
+        // bytes, and for the full preview both texts decoded, once as
+        // strings and once in the dialog's text views
+        m_memory.beginPhase("preview");
+        const size_t length = m_document.length();
+        const size_t textBytes = length * sizeof(QChar);
+        const size_t fullPreviewBytes = 2 * (textBytes + static_cast<size_t>(m_currentFileContent.size()) * sizeof(QChar));
+        const bool materialize = m_memory.fits(length);
+        const bool decodeText = materialize && m_memory.fits(length + textBytes);
+        const bool fullPreviewFits = m_memory.fits(length + fullPreviewBytes);
+        const bool fullPreview = !m_lineModeAction->isChecked() && !m_currentFileContent.isEmpty() && fullPreviewFits;
+        const bool limitedByBudget = !decodeText || (!m_lineModeAction->isChecked() && !fullPreviewFits);
+        
+        // Show confirmation dialog; in line mode, or when the full preview
+        // is over the memory budget, it shows the lines around a chosen line
+        // instead of the whole text. A result that does not fit at all is
+        // only summarized and streamed to the file.
+        QByteArray modifiedBytes;
+        QString modifiedQString;
+        MemoryHold outputHold(&m_memory, MemoryMeter::Category::Output);
+        MemoryHold previewHold(&m_memory, MemoryMeter::Category::Preview);
+        bool confirmed = false;
+        if (materialize) {
+            modifiedBytes = documentBytes();
+            outputHold.resize(m_document.isOriginal() ? 0 : length);
+        }
+        if (decodeText) {
+            // A run repeated after a rejected preview shows the text decoded then
+            if (!m_previewText.isEmpty() && m_previewKey == key) {
+                modifiedQString = m_previewText;
+            } else {
+                TRACE_SCOPE("decodePreview");
+                modifiedQString = TextCodec::toQString(modifiedBytes.constData(), modifiedBytes.size(), m_currentEncoding);
+                m_previewKey = key;
+                m_previewText = modifiedQString;
+            }
+            previewHold.resize(static_cast<size_t>(modifiedQString.capacity()) * sizeof(QChar));
+        }
+        if (fullPreview && decodeText) {
+            previewHold.resize(fullPreviewBytes);
+            confirmed = confirmationDialog()->confirm(m_currentFileContent, modifiedQString);
+        } else if (materialize) {
+            LineIndex lines;
+            lines.build(modifiedBytes.constData(), static_cast<size_t>(modifiedBytes.size()));
+            confirmed = confirmationDialog()->confirmLines(modifiedBytes, lines, m_currentEncoding);
+        } else {
+            const qint64 before = static_cast<qint64>(m_currentFileBytes.size());
+            confirmed = QMessageBox::question(this, "確認",
+                QString("結果がメモリ上限 (%1) を超えるため、プレビューを省略します。\n"
+                        "%2 件を置換し、%3 → %4 バイトで保存しますか？")
+                    .arg(QString::fromStdString(MemoryMeter::formatBytes(m_memory.budget())))
+                    .arg(m_lastRuleStats.totalHits())
+                    .arg(before)
+                    .arg(static_cast<qint64>(length))) == QMessageBox::Yes;
+        }
+        
+        // Same-length runs patch only the matches in the file; anything else
+        // saves the file in its original encoding. A rejected run is dropped
+        // from the history. A patched file that is not mapped is reloaded
+        // from the result, so without the result it is saved instead.
+        m_memory.beginPhase("save");
+        bool patchedInPlace = false;
+        bool saved = false;
+        if (confirmed) {
+            patchedInPlace = canPatchInPlace() && (materialize || m_sourceFile.isOpen()) && patchFileInPlace(m_pipeline);
+            saved = patchedInPlace
+                || (materialize ? saveFile(m_currentFilePath, modifiedBytes) : saveDocument(m_currentFilePath));
+        }
+        
+        if (saved) {
+            if (patchedInPlace) {
+                // The patched file is the new original; earlier versions referred to its old bytes
+                if (!m_sourceFile.isOpen()) {
+                    m_currentFileBytes = modifiedBytes;
+                }
+                m_document.reset(m_currentFileBytes.constData(), static_cast<size_t>(m_currentFileBytes.size()));
+                m_hasOriginalHash = false;
+            }
+            m_currentFileContent = modifiedQString;
+            m_previewText.clear();
+            QMessageBox::information(this, "完了", "置換が完了しました。");
+            if (Tracer::isEnabled()) {
+                statusBar()->showMessage(QString::fromStdString(Tracer::summary(m_traceMark)));
+            } else {
+                QString message = QString("置換が完了しました (%1 件)").arg(m_lastRuleStats.totalHits());
+                if (m_pipeline.stageCount() > 1) {
+                    message += QString(" - %1 段階を %2 パスで実行").arg(m_pipeline.stageCount()).arg(m_pipeline.passCount());
+                }
+                if (m_lastLineBatches > 1) {
+                    message += QString(" - 行モード: %1 バッチを並列処理").arg(m_lastLineBatches);
+                }
+                if (m_lastRunCached) {
+                    message += " - 前回の結果を再利用しました";
+                }
+                if (patchedInPlace) {
+                    message += " - その場で書き換えました (元に戻す履歴はリセットされました)";
+                }
+                if (limitedByBudget) {
+                    message += QString(" - メモリ上限内で処理 (ピーク %1)")
+                        .arg(QString::fromStdString(MemoryMeter::formatBytes(m_memory.peakTotal())));
+                }
+                statusBar()->showMessage(message, 3000);
+            }
+        } else {
+            m_document.discardCurrent();
+        }
+        updateUndoActions();
+        
+    } catch (const std::exception& e) {
+        m_document.discardCurrent();
+        updateUndoActions();
+        QMessageBox::critical(this, "エラー", QString("置換処理中にエラーが発生しました: %1").arg(e.what()));
+    }
+    
+    updateMemoryUsage();
+    
+    // A rejected run leaves the interrupted decoding to finish; text over
+    // the memory budget is not decoded at all
+    if (m_currentFileContent.isEmpty() && textFitsBudget()) {
+        applyEncoding();
+    }
+}
+
+void MainWindow::onRangeKindChanged()
+{
+    const auto kind = static_cast<TextRange::Kind>(m_rangeCombo->currentData().toInt());
+    m_rangeFromEdit->setVisible(kind != TextRange::Kind::Whole);
+    m_rangeToEdit->setVisible(kind != TextRange::Kind::Whole);
+    switch (kind) {
+    case TextRange::Kind::Whole:
+        break;
+    case TextRange::Kind::Bytes:
+        m_rangeFromEdit->setPlaceholderText("開始バイト (0 から)");
+        m_rangeToEdit->setPlaceholderText("終了バイト (含まない)");
+        break;
+    case TextRange::Kind::Lines:
+        m_rangeFromEdit->setPlaceholderText("開始行");
+        m_rangeToEdit->setPlaceholderText("終了行");
+        break;
+    case TextRange::Kind::Markers:
+        m_rangeFromEdit->setPlaceholderText("開始マーカー");
+        m_rangeToEdit->setPlaceholderText("終了マーカー");
+        break;
+    }
+}
+
+bool MainWindow::selectedRange(TextRange *range)
+{
+    const auto kind = static_cast<TextRange::Kind>(m_rangeCombo->currentData().toInt());
+    if (kind == TextRange::Kind::Whole) {
+        *range = TextRange();
+        return true;
+    }
+    
+    if (kind == TextRange::Kind::Markers) {
+        // Markers are matched as bytes in the file's encoding
+        std::string beginMarker;
+        std::string endMarker;
+        if (m_rangeFromEdit->text().isEmpty() || m_rangeToEdit->text().isEmpty()) {
+            QMessageBox::warning(this, "エラー", "開始マーカーと終了マーカーを入力してください。");
+            return false;
+        }
+        if (!TextCodec::fromQString(m_rangeFromEdit->text(), m_currentEncoding, beginMarker)
+            || !TextCodec::fromQString(m_rangeToEdit->text(), m_currentEncoding, endMarker)) {
+            QMessageBox::warning(this, "エラー", QString("マーカーが %1 で表せない文字を含んでいます。")
+                .arg(TextCodec::name(m_currentEncoding)));
+            return false;
+        }
+        *range = TextRange::markers(beginMarker, endMarker);
+        return true;
+    }
+    
+    bool fromOk = false;
+    bool toOk = false;
+    const qulonglong from = m_rangeFromEdit->text().trimmed().toULongLong(&fromOk);
+    const qulonglong to = m_rangeToEdit->text().trimmed().toULongLong(&toOk);
+    if (!fromOk || !toOk) {
+        QMessageBox::warning(this, "エラー", "範囲には数値を入力してください。");
+        return false;
+    }
+    if (kind == TextRange::Kind::Lines) {
+        if (from < 1 || to < from) {
+            QMessageBox::warning(this, "エラー", "行範囲は 1 以上で、終了行が開始行以降になるよう指定してください。");
+            return false;
+        }
+        *range = TextRange::lines(static_cast<size_t>(from), static_cast<size_t>(to));
+    } else {
+        if (to <= from) {
+            QMessageBox::warning(this, "エラー", "終了バイトは開始バイトより後ろを指定してください。");
+            return false;
+        }
+        *range = TextRange::bytes(static_cast<size_t>(from), static_cast<size_t>(to));
+    }
+    return true;
+}
+
+void MainWindow::executeInRange(const TextRange& range)
+{
+    TRACE_SCOPE("executeInRange");
+    
+    // Resolving reads the document up to the end of the range at most
+    TextRange::Span span;
+    switch (range.resolve(m_document, m_currentEncoding, &span)) {
+    case TextRange::Failure::None:
+        break;
+    case TextRange::Failure::Empty:
+        QMessageBox::warning(this, "エラー", "指定した範囲は空です。");
+        return;
+    case TextRange::Failure::PastEnd:
+        QMessageBox::warning(this, "エラー", "指定した範囲はファイルの末尾より後ろにあります。");
         return;
+    case TextRange::Failure::NoBeginMarker:
+        QMessageBox::warning(this, "エラー", "開始マーカーが見つかりません。");
+        return;
+    case TextRange::Failure::NoEndMarker:
+        QMessageBox::warning(this, "エラー", "開始マーカーの後ろに終了マーカーが見つかりません。");
+        return;
+    }
+    
+    // Pre-scan the range only; its bytes are kept for the preview
+    QByteArray before;
+    before.reserve(static_cast<qsizetype>(span.end - span.begin));
+    m_document.materializeRange(span.begin, span.end, before);
+    if (!m_pipeline.containsMatch(before.constData(), static_cast<size_t>(before.size()))) {
+        QMessageBox::information(this, "完了", "選択範囲に一致する箇所はありません。ファイルは変更されません。");
+        return;
+    }
+    
+    if (m_loader->isRunning()) {
+        m_loader->stop();
+        finishLoading();
     }
     
     try {
-        // Perform replacement
-        std::string originalContent = m_currentFileContent.toStdString();
-        std::string modifiedContent = multiReplace(originalContent, replacements);
-        QString modifiedQString = QString::fromStdString(modifiedContent);
+        // The pieces before and after the range are carried over untouched
+        m_memory.beginPhase("replace");
+        m_lastRuleStats.reset(m_pipeline.ruleCount());
+        m_lastLineBatches = 0;
+        m_lastRunCached = false;
+        const size_t oldLength = m_document.length();
+        m_document.applyPipelineRange(m_pipeline, span.begin, span.end, &m_lastRuleStats);
+        const size_t rangeEnd = span.end + m_document.length() - oldLength;
+        updateMemoryUsage();
         
-        // Show confirmation dialog
-        bool confirmed = ConfirmationDialog::showConfirmation(this, m_currentFileContent, modifiedQString);
+        // The preview compares the range alone
+        m_memory.beginPhase("preview");
+        QByteArray after;
+        after.reserve(static_cast<qsizetype>(rangeEnd - span.begin));
+        m_document.materializeRange(span.begin, rangeEnd, after);
+        const QString beforeText = TextCodec::toQString(before.constData(), before.size(), m_currentEncoding);
+        const QString afterText = TextCodec::toQString(after.constData(), after.size(), m_currentEncoding);
+        MemoryHold previewHold(&m_memory, MemoryMeter::Category::Preview);
+        previewHold.resize(2 * static_cast<size_t>(beforeText.size() + afterText.size()) * sizeof(QChar));
+        const bool confirmed = confirmationDialog()->confirm(beforeText, afterText);
         
+        // A same-length run patches the range in the file; otherwise the
+        // document is saved, the unchanged pieces copied from the file
+        m_memory.beginPhase("save");
+        bool patchedInPlace = false;
+        bool saved = false;
         if (confirmed) {
-            // Save the file
-            saveFile(m_currentFilePath, modifiedQString);
+            patchedInPlace = canPatchInPlace() && m_sourceFile.isOpen() && patchFileInPlace(m_pipeline, &span);
+            saved = patchedInPlace || saveDocument(m_currentFilePath);
+        }
+        
+        if (saved) {
+            if (patchedInPlace) {
+                m_document.reset(m_currentFileBytes.constData(), static_cast<size_t>(m_currentFileBytes.size()));
+                m_hasOriginalHash = false;
+            }
+            // The displayed text is decoded again from the new version
+            m_currentFileContent.clear();
+            m_previewText.clear();
             QMessageBox::information(this, "完了", "置換が完了しました。");
-            statusBar()->showMessage("置換が完了しました", 3000);
+            if (Tracer::isEnabled()) {
+                statusBar()->showMessage(QString::fromStdString(Tracer::summary(m_traceMark)));
+            } else {
+                QString message = QString("置換が完了しました (%1 件) - 範囲 %2–%3 バイトのみ処理")
+                    .arg(m_lastRuleStats.totalHits()).arg(span.begin).arg(span.end);
+                if (patchedInPlace) {
+                    message += " - その場で書き換えました (元に戻す履歴はリセットされました)";
+                }
+                statusBar()->showMessage(message, 3000);
+            }
+        } else {
+            m_document.discardCurrent();
         }
+        updateUndoActions();
         
     } catch (const std::exception& e) {
+        m_document.discardCurrent();
+        updateUndoActions();
         QMessageBox::critical(this, "エラー", QString("置換処理中にエラーが発生しました: %1").arg(e.what()));
     }
+    
+    updateMemoryUsage();
+    if (m_currentFileContent.isEmpty() && textFitsBudget()) {
+        applyEncoding();
+    }
+}
+
+void MainWindow::onDryRunClicked()
+{
+    if (m_currentFilePath.isEmpty()) {
+        QMessageBox::warning(this, "エラー", "ファイルが読み込まれていません。");
+        return;
+    }
+    if (!prepareRules()) {
+        return;
+    }
+    
+    // Count over the document's pieces; no output is built
+    m_lastRuleStats.reset(m_pipeline.ruleCount());
+    const MatchSummary summary = m_pipeline.countMatches(
+        [this](const StreamReplacer::Writer& feed) { m_document.feed(feed); }, &m_lastRuleStats);
+    
+    const qint64 before = static_cast<qint64>(m_document.length());
+    QMessageBox::information(this, "ドライラン",
+        QString("一致: %1 件\nサイズ: %2 → %3 バイト (%4%5)")
+            .arg(summary.matches)
+            .arg(before)
+            .arg(before + summary.sizeDelta)
+            .arg(summary.sizeDelta >= 0 ? "+" : "")
+            .arg(summary.sizeDelta));
+    statusBar()->showMessage(QString("ドライラン: %1 件").arg(summary.matches), 3000);
+}
+
+void MainWindow::onPrescanFilesClicked()
+{
+    QStringList files = QFileDialog::getOpenFileNames(
+        this,
+        "事前確認するファイルを選択",
+        QString(),
+        "テキストファイル (*.txt);;すべてのファイル (*.*)"
+    );
+    if (files.isEmpty()) {
+        return;
+    }
+    
+    // Rules are matched in each file's own encoding, compiled once per encoding
+    std::array<RulePipeline, 3> pipelines;
+    std::array<int, 3> state{};  // 0 = not compiled, 1 = ready, -1 = unencodable
+    const int selected = m_encodingCombo->currentData().toInt();
+    
+    int matchedFiles = 0;
+    int skippedFiles = 0;
+    uint64_t totalMatches = 0;
+    int64_t totalDelta = 0;
+    QStringList details;
+    for (const QString& path : files) {
+        const QString name = QFileInfo(path).fileName();
+        QFile file(path);
+        if (!file.open(QIODevice::ReadOnly)) {
+            details << QString("%1: 開けません (%2)").arg(name, file.errorString());
+            continue;
+        }
+        
+        // Scan the mapping; only files that cannot be mapped are read
+        QByteArray bytes;
+        const qint64 size = file.size();
+        uchar *mapped = size > 0 ? file.map(0, size) : nullptr;
+        if (mapped) {
+            bytes = QByteArray::fromRawData(reinterpret_cast<const char *>(mapped), size);
+        } else {
+            bytes = file.readAll();
+        }
+        const Compression compression = CompressedIO::detect(bytes.constData(), static_cast<size_t>(bytes.size()));
+        if (compression != Compression::None) {
+            QByteArray plain;
+            if (!CompressedIO::decompress(compression, bytes.constData(), static_cast<size_t>(bytes.size()), plain)) {
+                details << QString("%1: 展開できません").arg(name);
+                continue;
+            }
+            bytes = plain;
+        }
+        
+        const TextEncoding encoding = selected < 0
+            ? TextCodec::detect(bytes.constData(), static_cast<size_t>(bytes.size()))
+            : static_cast<TextEncoding>(selected);
+        const int index = static_cast<int>(encoding);
+        if (state[index] == 0) {
+            QStringList unencodable;
+            collectReplacements(pipelines[index], encoding, &unencodable);
+            pipelines[index].compile(encoding);
+            state[index] = unencodable.isEmpty() && !pipelines[index].isEmpty() ? 1 : -1;
+        }
+        if (state[index] < 0) {
+            details << QString("%1: ルールを %2 で表せません").arg(name, TextCodec::name(encoding));
+            continue;
+        }
+        
+        const RulePipeline& pipeline = pipelines[index];
+        if (!pipeline.containsMatch(bytes.constData(), static_cast<size_t>(bytes.size()))) {
+            ++skippedFiles;
+            continue;
+        }
+        const MatchSummary summary = pipeline.countMatches(bytes.constData(), static_cast<size_t>(bytes.size()));
+        ++matchedFiles;
+        totalMatches += summary.matches;
+        totalDelta += summary.sizeDelta;
+        details << QString("%1: %2 件, %3%4 バイト").arg(name).arg(summary.matches)
+            .arg(summary.sizeDelta >= 0 ? "+" : "").arg(summary.sizeDelta);
+    }
+    
+    QMessageBox box(QMessageBox::Information, "事前確認",
+        QString("一致のあるファイル: %1 / %2 (一致なし %3)\n一致: %4 件, サイズの変化: %5%6 バイト")
+            .arg(matchedFiles).arg(files.size()).arg(skippedFiles)
+            .arg(totalMatches).arg(totalDelta >= 0 ? "+" : "").arg(totalDelta),
+        QMessageBox::Ok, this);
+    if (!details.isEmpty()) {
+        box.setDetailedText(details.join("\n"));
+    }
+    box.exec();
+}
+
+void MainWindow::onUndoClicked()
+{
+    if (m_document.undo()) {
+        showDocumentVersion("置換を元に戻しました (未保存)");
+    }
+    updateUndoActions();
+}
+
+void MainWindow::onRedoClicked()
+{
+    if (m_document.redo()) {
+        showDocumentVersion("置換をやり直しました (未保存)");
+    }
+    updateUndoActions();
+}
+
+void MainWindow::onWatchToggled(bool checked)
+{
+    if (!checked) {
+        if (m_watchSession) {
+            m_watchSession->stop();
+            statusBar()->showMessage("監視を終了しました", 3000);
+        }
+        return;
+    }
+    
+    if (m_currentFilePath.isEmpty()) {
+        QMessageBox::warning(this, "エラー", "ファイルが読み込まれていません。");
+        m_watchAction->setChecked(false);
+        return;
+    }
+    
+    // The session patches the raw file, which would be the compressed bytes
+    if (m_compression != Compression::None) {
+        QMessageBox::warning(this, "エラー", "圧縮されたファイルは監視できません。");
+        m_watchAction->setChecked(false);
+        return;
+    }
+    
+    if (!m_watchSession) {
+        m_watchSession = new FileWatchSession(this);
+        connect(m_watchSession, &FileWatchSession::updated, this, &MainWindow::onWatchUpdated);
+        connect(m_watchSession, &FileWatchSession::failed, this, &MainWindow::onWatchFailed);
+    }
+    
+    // The session compiles its own copy of the current rules, so editing
+    // the rows does not change what is being applied
+    QStringList unencodable;
+    collectReplacements(m_watchSession->pipeline(), m_currentEncoding, &unencodable);
+    if (!unencodable.isEmpty() || m_watchSession->pipeline().isEmpty()) {
+        QMessageBox::warning(this, "エラー", "監視に使える置換ルールがありません。");
+        m_watchAction->setChecked(false);
+        return;
+    }
+    if (!m_watchSession->start(m_currentFilePath, m_currentEncoding)) {
+        QMessageBox::warning(this, "エラー", "ファイルを監視できません。");
+        m_watchAction->setChecked(false);
+    }
+}
+
+void MainWindow::onWatchUpdated(const QByteArray& content, quint64 matches, quint64 scannedBytes)
+{
+    // The file changed on disk, by the session or by someone else. The
+    // window takes over the session's content instead of loading the file
+    // again: no second read, mapping or encoding detection.
+    m_loader->stop();
+    finishLoading();
+    m_currentFileBytes = content;
+    m_document.reset(m_currentFileBytes.constData(), static_cast<size_t>(m_currentFileBytes.size()));
+    m_sourceFile.close();
+    m_hasOriginalHash = false;
+    m_previewText.clear();
+    m_currentFileContent.clear();
+    // The document no longer maps the file, so it cannot be patched in place
+    m_savedSinceLoad = true;
+    m_versionUnsaved = false;
+    m_loadedSize = content.size();
+    m_loadedModified = QFileInfo(m_currentFilePath).lastModified();
+    if (textFitsBudget()) {
+        m_currentFileContent = TextCodec::toQString(content.constData(), content.size(), m_currentEncoding);
+    }
+    m_lastRuleStats.reset(0);
+    updateMemoryUsage();
+    updateUndoActions();
+    updateExecuteButtonState();
+    
+    statusBar()->showMessage(QString("監視: %1 (%2 件, %3 KB を再走査)")
+        .arg(QFileInfo(m_currentFilePath).fileName()).arg(matches).arg((scannedBytes + 1023) / 1024));
+}
+
+void MainWindow::onWatchFailed(const QString& message)
+{
+    statusBar()->showMessage(QString("監視: %1").arg(message));
+}
+
+void MainWindow::showDocumentVersion(const QString& message)
+{
+    // Only the version switches; the file is written when it is saved.
+    // Text over the memory budget is not decoded.
+    m_versionUnsaved = true;
+    m_loader->stop();
+    finishLoading();
+    m_currentFileContent.clear();
+    m_previewText.clear();
+    if (textFitsBudget()) {
+        const QByteArray bytes = documentBytes();
+        m_currentFileContent = TextCodec::toQString(bytes.constData(), bytes.size(), m_currentEncoding);
+    }
+    updateMemoryUsage();
+    
+    // The stats belong to the run that was just undone or redone
+    m_lastRuleStats.reset(0);
+    statusBar()->showMessage(message, 3000);
+}
+
+ConfirmationDialog *MainWindow::confirmationDialog()
+{
+    // Startup does not pay for a dialog that may never be shown
+    if (!m_confirmationDialog) {
+        m_confirmationDialog = new ConfirmationDialog(this);
+    }
+    return m_confirmationDialog;
+}
+
+void MainWindow::reportStartupTime(qint64 micros)
+{
+    statusBar()->showMessage(QString("ファイルを選択してください (起動 %1 ms)").arg(micros / 1000.0, 0, 'f', 1));
+}
+
+void MainWindow::updateUndoActions()
+{
+    if (m_undoAction) {
+        m_undoAction->setEnabled(m_document.canUndo());
+        m_redoAction->setEnabled(m_document.canRedo());
+        m_saveAction->setEnabled(m_versionUnsaved);
+    }
+}
+
+void MainWindow::onExportTraceClicked()
+{
+    QString fileName = QFileDialog::getSaveFileName(
+        this,
+        "トレースを書き出す",
+        QString::fromStdString(Tracer::defaultOutputPath()),
+        "Chrome トレース (*.json)"
+    );
+    
+    if (fileName.isEmpty()) {
+        return;
+    }
+    
+    if (!Tracer::writeChromeTrace(fileName.toStdString())) {
+        QMessageBox::critical(this, "エラー", QString("トレースを書き出せません: %1").arg(fileName));
+        return;
+    }
+    statusBar()->showMessage(QString("トレースを書き出しました: %1").arg(QFileInfo(fileName).fileName()), 3000);
+}
+
+void MainWindow::onRuleStatsClicked()
+{
+    if (m_lastRuleStats.ruleCount() == 0) {
+        QMessageBox::information(this, "ルール統計", "置換を実行すると統計が表示されます。");
+        return;
+    }
+    
+    if (RuleStatsDialog::showStats(this, m_pipeline, m_lastRuleStats)) {
+        pruneUnusedRules();
+    }
+}
+
+void MainWindow::onMemoryUsageClicked()
+{
+    static const char *const categoryNames[MemoryMeter::kCategoryCount] = {
+        "入力", "ルール", "オートマトン", "文書 (ピーステーブル)", "出力バッファ", "プレビュー"
+    };
+    static const std::pair<const char *, const char *> phaseNames[] = {
+        {"load", "読み込み"}, {"compile", "ルールのコンパイル"}, {"replace", "置換"},
+        {"preview", "プレビュー"}, {"save", "保存"}
+    };
+    
+    updateMemoryUsage();
+    QString text = QString("合計: %1 (ピーク %2)\n")
+        .arg(QString::fromStdString(MemoryMeter::formatBytes(m_memory.total())))
+        .arg(QString::fromStdString(MemoryMeter::formatBytes(m_memory.peakTotal())));
+    text += m_memory.budget() > 0
+        ? QString("上限: %1\n").arg(QString::fromStdString(MemoryMeter::formatBytes(m_memory.budget())))
+        : QString("上限: なし\n");
+    
+    text += "\n構造ごと (現在 / ピーク):\n";
+    for (size_t i = 0; i < MemoryMeter::kCategoryCount; ++i) {
+        const auto category = static_cast<MemoryMeter::Category>(i);
+        text += QString("  %1: %2 / %3\n").arg(categoryNames[i])
+            .arg(QString::fromStdString(MemoryMeter::formatBytes(m_memory.current(category))))
+            .arg(QString::fromStdString(MemoryMeter::formatBytes(m_memory.peak(category))));
+    }
+    
+    const std::vector<MemoryMeter::PhasePeak> phases = m_memory.phasePeaks();
+    if (!phases.empty()) {
+        text += "\n処理段階ごとのピーク:\n";
+        for (const MemoryMeter::PhasePeak& phase : phases) {
+            QString name = phase.name;
+            for (const auto& [key, label] : phaseNames) {
+                if (std::strcmp(phase.name, key) == 0) {
+                    name = label;
+                }
+            }
+            text += QString("  %1: %2\n").arg(name, QString::fromStdString(MemoryMeter::formatBytes(phase.peak)));
+        }
+    }
+    QMessageBox::information(this, "メモリ使用量", text);
+}
+
+void MainWindow::onMemoryBudgetClicked()
+{
+    bool ok = false;
+    const int megabytes = QInputDialog::getInt(this, "メモリ上限を設定",
+        "プレビューや出力に使うメモリの上限 (MB, 0 で無制限)。\n"
+        "超える場合はプレビューを行単位に切り替え、結果をファイルへ直接書き出します。",
+        static_cast<int>(m_memory.budget() / (1024 * 1024)), 0, 1024 * 1024, 64, &ok);
+    if (!ok) {
+        return;
+    }
+    m_memory.setBudget(static_cast<size_t>(megabytes) * 1024 * 1024);
+    statusBar()->showMessage(megabytes > 0 ? QString("メモリ上限: %1 MB").arg(megabytes) : QString("メモリ上限なし"), 3000);
+}
+
+void MainWindow::pruneUnusedRules()
+{
+    // Collect the patterns that never fired in the last run
+    std::vector<uint32_t> unused = m_lastRuleStats.unusedRules();
+    QSet<QString> unusedPatterns;
+    for (uint32_t rule : unused) {
+        const std::string_view pattern = m_pipeline.pattern(rule);
+        unusedPatterns.insert(TextCodec::toQString(pattern.data(), pattern.size(), m_pipeline.encoding()));
+    }
+    
+    int removed = 0;
+    const QList<ReplacementRowWidget*> rows = m_replacementRows;
+    for (auto* row : rows) {
+        if (row && row->isValid() && unusedPatterns.contains(row->getBeforeText().trimmed())) {
+            m_scrollLayout->removeWidget(row);
+            m_replacementRows.removeAll(row);
+            row->deleteLater();
+            ++removed;
+        }
+    }
+    
+    if (m_replacementRows.isEmpty()) {
+        addReplacementRow();
+    }
+    
+    // The stats no longer describe the remaining rules
+    m_lastRuleStats.reset(0);
+    updateExecuteButtonState();
+    statusBar()->showMessage(QString("未使用のルールを %1 件削除しました").arg(removed), 3000);
 }
 
 void MainWindow::onRowContentChanged()
@@ -438,7 +1213,8 @@ void MainWindow::onRowContentChanged()
 
 void MainWindow::updateExecuteButtonState()
 {
-    bool hasFile = !m_currentFileContent.isEmpty();
+    // Replacing needs the engine's bytes only, not the decoded text
+    bool hasFile = !m_currentFilePath.isEmpty() && m_document.length() > 0;
     bool hasValidRules = false;
     
     for (const auto* row : m_replacementRows) {
@@ -453,104 +1229,576 @@ void MainWindow::updateExecuteButtonState()
 
 void MainWindow::loadFile(const QString& filePath)
 {
-    QFile file(filePath);
-    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
-        QMessageBox::critical(this, "エラー", QString("ファイルを開けません: %1").arg(file.errorString()));
+    TRACE_SCOPE("loadFile");
+    
+    // Watching follows the loaded file
+    if (m_watchAction && m_watchAction->isChecked() && m_watchSession && m_watchSession->filePath() != filePath) {
+        m_watchAction->setChecked(false);
+    }
+    
+    // Stop a load in progress and release the previous document before
+    // their mapping goes away
+    m_loader->stop();
+    clearLoadedFile();
+    m_memory.resetPeaks();
+    m_memory.beginPhase("load");
+    
+    // Raw bytes; the encoding is detected instead of assumed
+    m_sourceFile.setFileName(filePath);
+    if (!m_sourceFile.open(QIODevice::ReadOnly)) {
+        finishLoading();
+        QMessageBox::critical(this, "エラー", QString("ファイルを開けません: %1").arg(m_sourceFile.errorString()));
         return;
     }
     
-    QTextStream in(&file);
-    in.setEncoding(QStringConverter::Utf8);
+    // Map the original so the document's pieces point straight into it.
+    // Saves replace the file by rename, which leaves the mapped inode intact;
+    // Windows cannot replace a mapped file, so there it is read instead.
+    // Mapping reads nothing; reading, decompressing and decoding happen on
+    // the loader's thread.
+    const qint64 size = m_sourceFile.size();
+    uchar *mapped = nullptr;
+#ifndef Q_OS_WIN
+    if (size > 0) {
+        mapped = m_sourceFile.map(0, size);
+    }
+#endif
+    QByteArray mappedBytes;
+    if (mapped) {
+        mappedBytes = QByteArray::fromRawData(reinterpret_cast<const char *>(mapped), size);
+    } else {
+        m_sourceFile.close();
+    }
+    m_loadedSize = size;
+    m_loadedModified = QFileInfo(filePath).lastModified();
     
-    m_currentFileContent = in.readAll();
-    m_currentFilePath = filePath;
+    m_loader->load(filePath, mappedBytes, m_encodingCombo->currentData().toInt());
+    showLoadProgress();
+    statusBar()->showMessage(QString("読み込み中: %1").arg(QFileInfo(filePath).fileName()));
+}
+
+void MainWindow::clearLoadedFile()
+{
+    m_document.reset(nullptr, 0);
+    m_hasOriginalHash = false;
+    m_previewText.clear();
+    m_currentFileBytes.clear();
+    m_currentFileContent.clear();
+    m_currentFilePath.clear();
+    m_sourceFile.close();
+    updateMemoryUsage();
+    updateUndoActions();
+    updateExecuteButtonState();
+}
+
+void MainWindow::showLoadProgress()
+{
+    m_loadProgress->setValue(0);
+    m_loadProgress->show();
+    m_cancelLoadAction->setEnabled(true);
+}
+
+void MainWindow::finishLoading()
+{
+    m_loadProgress->hide();
+    m_cancelLoadAction->setEnabled(false);
+}
+
+void MainWindow::onLoadProgress(int phase, qint64 done, qint64 total)
+{
+    m_loadProgress->setValue(total > 0 ? static_cast<int>(done * 1000 / total) : 1000);
     
-    file.close();
+    QString label;
+    switch (static_cast<FileLoader::Phase>(phase)) {
+    case FileLoader::Phase::Reading:
+        label = "読み込み中";
+        break;
+    case FileLoader::Phase::Decompressing:
+        label = "展開中";
+        break;
+    case FileLoader::Phase::Decoding:
+        label = "文字に変換中 (置換は実行できます)";
+        break;
+    }
+    statusBar()->showMessage(QString("%1: %2 / %3 MB").arg(label)
+        .arg(done / (1024.0 * 1024.0), 0, 'f', 1).arg(total / (1024.0 * 1024.0), 0, 'f', 1));
+}
+
+void MainWindow::onLoadBytesReady()
+{
+    // The engine's input is complete, so replacing can start while the
+    // text for display is still being decoded
+    m_compression = m_loader->compression();
+    m_currentFileBytes = m_loader->bytes();
+    if (m_compression != Compression::None) {
+        // The decompressed copy replaces the mapping
+        m_sourceFile.close();
+    }
+    m_document.reset(m_currentFileBytes.constData(), static_cast<size_t>(m_currentFileBytes.size()));
+    m_originalHash = m_loader->contentHash();
+    m_hasOriginalHash = true;
+    m_previewText.clear();
+    m_currentFilePath = m_loader->filePath();
+    m_currentEncoding = m_loader->encoding();
+    m_savedSinceLoad = false;
+    m_versionUnsaved = false;
+    updateMemoryUsage();
     
-    statusBar()->showMessage(QString("ファイルを読み込みました: %1 (%2 文字)").arg(
-        QFileInfo(filePath).fileName()).arg(m_currentFileContent.length()));
+    // Text that would not fit the memory budget is not decoded; replacing
+    // works on the bytes and previews only a window of lines
+    if (!textFitsBudget()) {
+        m_loader->stop();
+        finishLoading();
+        statusBar()->showMessage(QString("ファイルを読み込みました: %1 - メモリ上限 (%2) のため文字への変換を省略しました")
+            .arg(QFileInfo(m_currentFilePath).fileName())
+            .arg(QString::fromStdString(MemoryMeter::formatBytes(m_memory.budget()))));
+    }
+    updateUndoActions();
+    updateExecuteButtonState();
+}
+
+void MainWindow::onLoadTextReady()
+{
+    finishLoading();
+    m_currentFileContent = m_loader->takeText();
+    updateMemoryUsage();
+    
+    QString message = QString("ファイルを読み込みました: %1 (%2 文字, %3)").arg(
+        QFileInfo(m_currentFilePath).fileName()).arg(m_currentFileContent.length()).arg(TextCodec::name(m_currentEncoding));
+    if (m_compression != Compression::None) {
+        message += QString(" - %1 圧縮").arg(CompressedIO::name(m_compression));
+    }
+    if (m_loader->decodeErrors() > 0) {
+        message += QString(" - 不正なバイト列 %1 箇所").arg(m_loader->decodeErrors());
+    }
+    statusBar()->showMessage(message);
     
     updateExecuteButtonState();
 }
 
-void MainWindow::saveFile(const QString& filePath, const QString& content)
+void MainWindow::onLoadCancelled()
 {
-    QFile file(filePath);
-    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
-        QMessageBox::critical(this, "エラー", QString("ファイルを保存できません: %1").arg(file.errorString()));
+    finishLoading();
+    if (m_currentFilePath.isEmpty()) {
+        // Stopped before the bytes were complete: nothing is loaded
+        clearLoadedFile();
+        statusBar()->showMessage("読み込みを中止しました", 3000);
+    } else {
+        statusBar()->showMessage("文字への変換を中止しました (置換は実行できます)", 3000);
+    }
+}
+
+void MainWindow::onLoadFailed(const QString& message)
+{
+    finishLoading();
+    clearLoadedFile();
+    QMessageBox::critical(this, "エラー", message);
+}
+
+void MainWindow::applyEncoding()
+{
+    if (m_currentFilePath.isEmpty()) {
+        // A file whose bytes are still loading restarts with the new choice
+        if (m_loader->isRunning()) {
+            const QString filePath = m_loader->filePath();
+            loadFile(filePath);
+        }
         return;
     }
     
-    QTextStream out(&file);
-    out.setEncoding(QStringConverter::Utf8);
-    out << content;
+    int selected = m_encodingCombo->currentData().toInt();
+    if (selected < 0) {
+        TRACE_SCOPE("detectEncoding");
+        const QByteArray bytes = documentBytes();
+        m_currentEncoding = TextCodec::detect(bytes.constData(), bytes.size());
+    } else {
+        m_currentEncoding = static_cast<TextEncoding>(selected);
+    }
     
+    // The text is decoded in the background; replacing works on the bytes
+    m_currentFileContent.clear();
+    updateMemoryUsage();
+    if (!textFitsBudget()) {
+        updateExecuteButtonState();
+        return;
+    }
+    m_loader->decode(documentBytes(), m_currentEncoding, selected >= 0);
+    showLoadProgress();
+    updateExecuteButtonState();
+}
+
+bool MainWindow::saveFile(const QString& filePath, const QByteArray& content)
+{
+    TRACE_SCOPE("saveFile");
+    
+    // Write a temporary file and rename it over the original, so the
+    // mapped original that the document still refers to is never truncated
+    QSaveFile file(filePath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        QMessageBox::critical(this, "エラー", QString("ファイルを保存できません: %1").arg(file.errorString()));
+        return false;
+    }
+    
+    if (m_compression != Compression::None) {
+        // Keep the file's codec
+        QByteArray packed;
+        std::string error;
+        if (!CompressedIO::compress(m_compression, content.constData(), static_cast<size_t>(content.size()), packed, &error)) {
+            file.cancelWriting();
+            QMessageBox::critical(this, "エラー", QString("ファイルを圧縮できません: %1").arg(QString::fromStdString(error)));
+            return false;
+        }
+        file.write(packed);
+    } else {
+        file.write(content);
+    }
+    
+    if (!file.commit()) {
+        QMessageBox::critical(this, "エラー", QString("ファイルを保存できません: %1").arg(file.errorString()));
+        return false;
+    }
+    m_savedSinceLoad = true;
+    m_versionUnsaved = false;
+    return true;
+}
+
+bool MainWindow::saveDocument(const QString& filePath)
+{
+    TRACE_SCOPE("saveDocument");
+    
+    // The current version is written piece by piece, so the result never
+    // exists as one buffer; compressed files are encoded as they go
+    QSaveFile file(filePath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        QMessageBox::critical(this, "エラー", QString("ファイルを保存できません: %1").arg(file.errorString()));
+        return false;
+    }
+    
+    bool writeFailed = false;
+    auto write = [&](const char *data, size_t length) {
+        writeFailed = writeFailed || file.write(data, static_cast<qint64>(length)) != static_cast<qint64>(length);
+    };
+    if (m_compression != Compression::None) {
+        ChunkEncoder encoder(m_compression, write);
+        bool ok = true;
+        m_document.feed([&](const char *data, size_t length) { ok = ok && encoder.write(data, length); });
+        if (!ok || !encoder.finish()) {
+            file.cancelWriting();
+            QMessageBox::critical(this, "エラー", QString("ファイルを圧縮できません: %1").arg(QString::fromStdString(encoder.error())));
+            return false;
+        }
+    } else if (m_sourceFile.isOpen()) {
+        // Pieces of the mapped original are copied file to file, which
+        // file systems with reflinks share instead of copying
+        for (const PieceTable::Piece& piece : m_document.pieces()) {
+            qint64 copied = 0;
+            if (piece.source == PieceTable::Source::Original && !writeFailed) {
+                copied = copyFromSource(file, static_cast<qint64>(piece.offset), static_cast<qint64>(piece.length));
+            }
+            write(m_document.pieceData(piece) + copied, piece.length - static_cast<size_t>(copied));
+        }
+    } else {
+        m_document.feed(write);
+    }
+    
+    if (writeFailed || !file.commit()) {
+        file.cancelWriting();
+        QMessageBox::critical(this, "エラー", QString("ファイルを保存できません: %1").arg(file.errorString()));
+        return false;
+    }
+    m_savedSinceLoad = true;
+    m_versionUnsaved = false;
+    return true;
+}
+
+qint64 MainWindow::copyFromSource(QFileDevice& file, qint64 offset, qint64 length)
+{
+    // Bytes copied in the kernel; the caller writes whatever is left
+    qint64 copied = 0;
+#ifdef Q_OS_LINUX
+    if (!file.flush()) {
+        return 0;
+    }
+    loff_t in = offset;
+    loff_t out = file.pos();
+    while (copied < length) {
+        const ssize_t n = ::copy_file_range(m_sourceFile.handle(), &in, file.handle(), &out,
+                                            static_cast<size_t>(length - copied), 0);
+        if (n <= 0) {
+            break;
+        }
+        copied += n;
+    }
+    file.seek(out);
+#else
+    Q_UNUSED(file);
+    Q_UNUSED(offset);
+    Q_UNUSED(length);
+#endif
+    return copied;
+}
+
+bool MainWindow::canPatchInPlace() const
+{
+    // Only the first run over the loaded original can be patched into the
+    // file: the document must not hold other versions that refer to its bytes
+    return m_inPlaceAction && m_inPlaceAction->isChecked()
+        && !m_savedSinceLoad
+        && m_compression == Compression::None
+        && m_document.currentVersion() == 1
+        && m_pipeline.isLengthPreserving();
+}
+
+bool MainWindow::patchFileInPlace(const RulePipeline& pipeline, const TextRange::Span *span)
+{
+    TRACE_SCOPE("patchFileInPlace");
+    
+    // Patching is only correct when the file still holds the bytes the
+    // preview was computed from; otherwise the regular save rewrites it
+    const QFileInfo info(m_currentFilePath);
+    if (info.size() != m_loadedSize || info.lastModified() != m_loadedModified || m_loadedSize == 0) {
+        return false;
+    }
+    
+    QFile file(m_currentFilePath);
+    if (!file.open(QIODevice::ReadWrite | QIODevice::Unbuffered)) {
+        return false;
+    }
+    
+    // Only the bytes of the range, if one is given, are scanned and written
+    const size_t begin = span ? span->begin : 0;
+    const size_t end = span ? span->end : static_cast<size_t>(m_loadedSize);
+    
+    // A writable shared mapping: only pages with matches become dirty, and
+    // the read-only mapping of the document sees the new bytes as well
+    uchar *mapped = file.map(0, m_loadedSize);
+    if (mapped) {
+        pipeline.replaceInPlace(reinterpret_cast<char *>(mapped) + begin, end - begin);
+        file.unmap(mapped);
+    } else {
+        // Positioned writes at the match offsets. Later passes would have
+        // to see the earlier passes' writes, so only one pass can go this way.
+        if (pipeline.passCount() != 1) {
+            return false;
+        }
+        const ReplaceEngine& engine = pipeline.pass(0);
+        const QByteArray original = m_currentFileBytes;
+        bool ok = true;
+        engine.scan(original.constData() + begin, end - begin, [&](const ReplaceMatch& m) {
+            const std::string_view replacement = engine.replacement(m.rule);
+            if (!ok || std::memcmp(original.constData() + begin + m.offset, replacement.data(), m.length) == 0) {
+                return;
+            }
+            ok = file.seek(static_cast<qint64>(begin + m.offset))
+                && file.write(replacement.data(), m.length) == static_cast<qint64>(m.length);
+        });
+        if (!ok) {
+            // A partial patch is overwritten by the regular save
+            return false;
+        }
+    }
     file.close();
+    
+    // The file on disk is still the document's original
+    m_loadedModified = QFileInfo(m_currentFilePath).lastModified();
+    return true;
 }
 
-std::map<std::string, std::string> MainWindow::collectReplacements() const
+bool MainWindow::prepareRules()
 {
-    std::map<std::string, std::string> replacements;
+    QStringList unencodable;
+    RuleAnalyzer analysis;
+    QList<ReplacementRowWidget*> analyzedRows;
+    {
+        TRACE_SCOPE("collectReplacements");
+        collectReplacements(m_pipeline, m_currentEncoding, &unencodable, &analysis, &analyzedRows);
+    }
+    showRuleFindings(analysis, analyzedRows);
     
-    for (const auto* row : m_replacementRows) {
+    if (!unencodable.isEmpty()) {
+        QMessageBox::warning(this, "エラー", QString("次のルールは %1 で表せない文字を含んでいます:\n%2")
+            .arg(TextCodec::name(m_currentEncoding), unencodable.join("\n")));
+        return false;
+    }
+    
+    if (m_pipeline.isEmpty()) {
+        QMessageBox::warning(this, "エラー", "有効な置換ルールがありません。");
+        return false;
+    }
+    
+    // Stages are fused into as few passes as is safe; every pass's kernel
+    // is tuned on a sample of the loaded file (see the rule statistics)
+    const std::string sample = EngineTuner::sample(m_currentFileBytes.constData(),
+                                                   static_cast<size_t>(m_currentFileBytes.size()));
+    m_pipeline.compile(m_currentEncoding, sample.data(), sample.size());
+    return true;
+}
+
+void MainWindow::collectReplacements(RulePipeline& pipeline, TextEncoding encoding, QStringList *unencodable,
+                                     RuleAnalyzer *analysis, QList<ReplacementRowWidget*> *analyzedRows) const
+{
+    // Rows go through the analyzer, which fills the stages with the rules
+    // that can change the text; the encode buffers are reused per row
+    RuleAnalyzer local;
+    RuleAnalyzer& analyzer = analysis ? *analysis : local;
+    analyzer.clear();
+    if (analyzedRows) {
+        analyzedRows->clear();
+    }
+    std::string before;
+    std::string after;
+    
+    for (auto* row : m_replacementRows) {
         if (row && row->isValid()) {
             QString beforeText = row->getBeforeText().trimmed();
             QString afterText = row->getAfterText();
             
             if (!beforeText.isEmpty()) {
-                replacements[beforeText.toStdString()] = afterText.toStdString();
+                // Rules are matched in the file's encoding
+                if (!TextCodec::fromQString(beforeText, encoding, before)
+                    || !TextCodec::fromQString(afterText, encoding, after)) {
+                    if (unencodable) {
+                        unencodable->append(beforeText + " → " + afterText);
+                    }
+                    continue;
+                }
+                analyzer.add(row->getStageName().toStdString(), before, after);
+                if (analyzedRows) {
+                    analyzedRows->append(row);
+                }
             }
         }
     }
-    
-    return replacements;
+    analyzer.build(pipeline, encoding);
 }
 
-std::string MainWindow::multiReplace(const std::string& source, const std::map<std::string, std::string>& replacements) const
+void MainWindow::showRuleFindings(const RuleAnalyzer& analysis, const QList<ReplacementRowWidget*>& analyzedRows)
 {
-    if (source.empty() || replacements.empty()) {
-        return source;
+    for (auto* row : m_replacementRows) {
+        row->setIssue(QString());
     }
     
-    // Create a vector of replacement pairs sorted by pattern length (descending)
-    std::vector<std::pair<std::string, std::string>> sortedReplacements;
-    for (const auto& [find_str, replace_str] : replacements) {
-        if (!find_str.empty()) {
-            sortedReplacements.emplace_back(find_str, replace_str);
+    // Rows are referred to by their position in the list
+    auto rowNumber = [&](size_t entry) { return m_replacementRows.indexOf(analyzedRows[static_cast<qsizetype>(entry)]) + 1; };
+    int duplicates = 0;
+    int noOps = 0;
+    int unreachable = 0;
+    for (size_t entry = 0; entry < analysis.entryCount(); ++entry) {
+        const RuleAnalyzer::Result& result = analysis.result(entry);
+        QString message;
+        switch (result.finding) {
+        case RuleAnalyzer::Finding::None:
+            continue;
+        case RuleAnalyzer::Finding::Duplicate:
+            message = QString("%1 行目に同じ段階・同じ置換前テキストのルールがあり、そちらが使われます").arg(rowNumber(result.other));
+            ++duplicates;
+            break;
+        case RuleAnalyzer::Finding::NoOp:
+            message = "置換前と置換後が同じため、実行から除外しました";
+            ++noOps;
+            break;
+        case RuleAnalyzer::Finding::GuardNoOp:
+            message = QString("置換前と置換後が同じですが、%1 行目のルールの一致を妨げるため残しています").arg(rowNumber(result.other));
+            break;
+        case RuleAnalyzer::Finding::Unreachable:
+            message = QString("前の段階の %1 行目がこの置換前テキストの文字をすべて置き換えるため、一致しません").arg(rowNumber(result.other));
+            ++unreachable;
+            break;
         }
+        analyzedRows[static_cast<qsizetype>(entry)]->setIssue(message);
     }
     
-    // Sort by length (descending), so longer patterns are checked first
-    std::sort(sortedReplacements.begin(), sortedReplacements.end(),
-              [](const auto& a, const auto& b) {
-                  return a.first.length() > b.first.length();
-              });
+    if (duplicates + noOps + unreachable > 0) {
+        statusBar()->showMessage(QString("ルール解析: %1 件を除外しました (重複 %2, 変化なし %3, 到達不能 %4)")
+            .arg(duplicates + noOps + unreachable).arg(duplicates).arg(noOps).arg(unreachable), 5000);
+    }
+}
+
+void MainWindow::multiReplace(const RulePipeline& pipeline)
+{
+    TRACE_SCOPE("multiReplace");
     
-    std::stringstream result;
-    size_t pos = 0;
+    m_lastRuleStats.reset(pipeline.ruleCount());
+    m_lastLineBatches = 0;
+    m_lastRunCached = false;
     
-    while (pos < source.length()) {
-        bool found = false;
-        
-        // Check patterns in order of length (longest first)
-        for (const auto& [find_str, replace_str] : sortedReplacements) {
-            if (pos + find_str.length() <= source.length()) {
-                if (source.substr(pos, find_str.length()) == find_str) {
-                    // Found a match, apply replacement
-                    result << replace_str;
-                    pos += find_str.length();
-                    found = true;
-                    break; // Stop checking other patterns
-                }
-            }
-        }
-        
-        if (!found) {
-            // No replacement found, copy the original character
-            result << source[pos];
-            pos++;
-        }
+    if (m_lineModeAction && m_lineModeAction->isChecked() && LineBatchReplacer::isLineLocal(pipeline)) {
+        m_document.applyOutput([&](const char *data, size_t length, const StreamReplacer::Writer& sink) {
+            LineIndex lines;
+            lines.build(data, length);
+            const LineBatchReplacer::Result result = LineBatchReplacer::run(
+                pipeline, data, length, lines, sink, &m_lastRuleStats,
+                static_cast<unsigned>(QThread::idealThreadCount()));
+            m_lastLineBatches = result.batches;
+            return result.matches;
+        });
+        return;
     }
     
-    return result.str();
-}
\ No newline at end of file
+    // The same rules over the same content again, e.g. after a rejected
+    // preview, are rebuilt from the matches recorded by the first run
+    const ResultCache::Key key = documentKey(pipeline);
+    const std::shared_ptr<const ResultCache::Entry> cached = m_resultCache.find(key);
+    if (cached && ResultCache::hasUsableIndex(*cached, pipeline)) {
+        m_document.applyMatchIndex(pipeline.pass(0), cached->index, &m_lastRuleStats);
+        m_lastRunCached = true;
+        return;
+    }
+    
+    // All stages become one new document version; only the bytes for the
+    // preview and the save are materialized
+    ResultCache::Entry entry;
+    entry.hasIndex = pipeline.passCount() == 1;
+    const size_t before = m_document.length();
+    entry.matches = m_document.applyPipeline(pipeline, &m_lastRuleStats, entry.hasIndex ? &entry.index : nullptr);
+    entry.sizeDelta = static_cast<int64_t>(m_document.length()) - static_cast<int64_t>(before);
+    m_resultCache.insert(key, std::move(entry));
+}
+
+ResultCache::Key MainWindow::documentKey(const RulePipeline& pipeline)
+{
+    // The loader hashes the original while reading it; later versions, and
+    // an original taken over from a save or a watch session, are hashed
+    // here piece by piece
+    if (m_document.isOriginal() && m_hasOriginalHash) {
+        return ResultCache::key(pipeline, m_originalHash, m_document.length());
+    }
+    TRACE_SCOPE("hashContent");
+    ContentHash hash;
+    m_document.feed([&hash](const char *data, size_t length) { hash.update(data, length); });
+    if (m_document.isOriginal()) {
+        m_originalHash = hash.digest();
+        m_hasOriginalHash = true;
+    }
+    return ResultCache::key(pipeline, hash.digest(), m_document.length());
+}
+
+void MainWindow::updateMemoryUsage()
+{
+    // A mapped original is paged in from the file and not counted
+    const bool mapped = m_sourceFile.isOpen() && m_compression == Compression::None;
+    m_memory.set(MemoryMeter::Category::Input, mapped ? 0 : static_cast<size_t>(m_currentFileBytes.size()));
+    m_memory.set(MemoryMeter::Category::Rules, m_pipeline.ruleMemoryBytes());
+    m_memory.set(MemoryMeter::Category::Automaton, m_pipeline.engineMemoryBytes());
+    m_memory.set(MemoryMeter::Category::Document, m_document.memoryBytes());
+    m_memory.set(MemoryMeter::Category::Preview,
+                 static_cast<size_t>(m_currentFileContent.capacity() + m_previewText.capacity()) * sizeof(QChar));
+}
+
+bool MainWindow::textFitsBudget() const
+{
+    // Decoded text takes at most one QChar per byte
+    return m_memory.fits(m_document.length() * sizeof(QChar));
+}
+
+QByteArray MainWindow::documentBytes() const
+{
+    // The unmodified original is shared, not copied
+    if (m_document.isOriginal()) {
+        return m_currentFileBytes;
+    }
+    QByteArray bytes;
+    bytes.reserve(static_cast<qsizetype>(m_document.length()));
+    m_document.materialize(bytes);
+    return bytes;
+}
@@ -18,9 +18,26 @@
 #include <QSplitter>
 #include <QString>
 #include <QList>
+#include <QStringList>
 #include <QTimer>
-#include <map>
+#include <QFile>
+#include <QAction>
+#include <QDateTime>
+#include <QProgressBar>
+#include <QCloseEvent>
 #include "translations.h"
+#include "replaceengine.h"
+#include "rulepipeline.h"
+#include "ruleanalyzer.h"
+#include "piecetable.h"
+#include "filewatchsession.h"
+#include "fileloader.h"
+#include "textcodec.h"
+#include "compressedio.h"
+#include "lineindex.h"
+#include "memorymeter.h"
+#include "resultcache.h"
+#include "textrange.h"
 
 #include "replacementrow.h"
 #include "confirmationdialog.h"
@@ -36,13 +53,37 @@ class MainWindow : public QMainWindow
 public:
     explicit MainWindow(QWidget *parent = nullptr);
     ~MainWindow();
+    
+    // Show how long the application took to its first paint
+    void reportStartupTime(qint64 micros);
+
+protected:
+    void closeEvent(QCloseEvent *event) override;
 
 private slots:
     void onBrowseClicked();
+    void onSaveClicked();
     void onAddRowClicked();
     void onDeleteRowRequested();
     void onExecuteClicked();
+    void onExportTraceClicked();
+    void onRuleStatsClicked();
+    void onDryRunClicked();
+    void onPrescanFilesClicked();
+    void onUndoClicked();
+    void onRedoClicked();
+    void onWatchToggled(bool checked);
+    void onWatchUpdated(const QByteArray& content, quint64 matches, quint64 scannedBytes);
+    void onWatchFailed(const QString& message);
+    void onLoadProgress(int phase, qint64 done, qint64 total);
+    void onLoadBytesReady();
+    void onLoadTextReady();
+    void onLoadCancelled();
+    void onLoadFailed(const QString& message);
+    void onMemoryUsageClicked();
+    void onMemoryBudgetClicked();
     void onRowContentChanged();
+    void onRangeKindChanged();
 
 private:
     void setupUI();
@@ -52,9 +93,31 @@ private:
     void addReplacementRow();
     void updateExecuteButtonState();
     void loadFile(const QString& filePath);
-    void saveFile(const QString& filePath, const QString& content);
-    std::map<std::string, std::string> collectReplacements() const;
-    std::string multiReplace(const std::string& source, const std::map<std::string, std::string>& replacements) const;
+    void applyEncoding();
+    void showLoadProgress();
+    void finishLoading();
+    void clearLoadedFile();
+    bool saveFile(const QString& filePath, const QByteArray& content);
+    bool saveDocument(const QString& filePath);
+    bool canPatchInPlace() const;
+    bool patchFileInPlace(const RulePipeline& pipeline, const TextRange::Span *span = nullptr);
+    qint64 copyFromSource(QFileDevice& file, qint64 offset, qint64 length);
+    void collectReplacements(RulePipeline& pipeline, TextEncoding encoding, QStringList *unencodable = nullptr,
+                             RuleAnalyzer *analysis = nullptr, QList<ReplacementRowWidget*> *analyzedRows = nullptr) const;
+    void showRuleFindings(const RuleAnalyzer& analysis, const QList<ReplacementRowWidget*>& analyzedRows);
+    bool prepareRules();
+    void multiReplace(const RulePipeline& pipeline);
+    bool selectedRange(TextRange *range);
+    void executeInRange(const TextRange& range);
+    ResultCache::Key documentKey(const RulePipeline& pipeline);
+    QByteArray documentBytes() const;
+    void updateMemoryUsage();
+    bool textFitsBudget() const;
+    void showDocumentVersion(const QString& message);
+    bool confirmUnsavedVersion();
+    void updateUndoActions();
+    ConfirmationDialog *confirmationDialog();
+    void pruneUnusedRules();
     
     // UI components - File selection section
     QWidget *m_centralWidget;
@@ -80,13 +143,58 @@ private:
     QFrame *m_controlFrame;
     QHBoxLayout *m_controlLayout;
     QPushButton *m_addRowButton;
+    QComboBox *m_rangeCombo;        // part of the file the rules apply to
+    QLineEdit *m_rangeFromEdit;
+    QLineEdit *m_rangeToEdit;
     QPushButton *m_executeButton;
     QComboBox *m_langCombo;
+    QComboBox *m_encodingCombo;
+    
+    // File menu actions
+    QAction *m_cancelLoadAction;
+    
+    // Tools menu options
+    QAction *m_inPlaceAction;
+    QAction *m_watchAction;
+    QAction *m_lineModeAction;
+    
+    // Edit menu actions
+    QAction *m_saveAction;
+    QAction *m_undoAction;
+    QAction *m_redoAction;
+    
+    // Status bar
+    QProgressBar *m_loadProgress;
+    
+    // Dialogs, built on first use
+    ConfirmationDialog *m_confirmationDialog;
     
     // Data
     QList<ReplacementRowWidget*> m_replacementRows;
     QString m_currentFilePath;
     QString m_currentFileContent;
+    QFile m_sourceFile;           // kept open while its content is mapped
+    QByteArray m_currentFileBytes;  // original bytes; wraps the mapping when there is one
+    PieceTable m_document;          // versions produced by replacement runs
+    qint64 m_loadedSize;            // file size and time when the mapped original was loaded
+    QDateTime m_loadedModified;
+    bool m_savedSinceLoad;          // the file was replaced, so it is no longer the mapped original
+    bool m_versionUnsaved;          // undo or redo left the file holding another version
+    Compression m_compression;      // codec of the file; the document holds the decompressed bytes
+    TextEncoding m_currentEncoding;
+    RulePipeline m_pipeline;
+    RuleStats m_lastRuleStats;
+    size_t m_lastLineBatches;       // batches of the last line mode run, 0 when it was not one
+    uint64_t m_traceMark;           // Tracer::mark() when the current Execute started
+    FileWatchSession *m_watchSession;  // re-applies the rules while the file changes
+    FileLoader *m_loader;              // reads and decodes files in the background
+    MemoryMeter m_memory;              // accounting of the current file's structures and the budget
+    ResultCache m_resultCache;         // runs over earlier content, keyed by content and rule set
+    quint64 m_originalHash;            // ContentHash of the document's original, from the loader or once computed
+    bool m_hasOriginalHash;
+    bool m_lastRunCached;              // the last run was rebuilt from a cached match index
+    ResultCache::Key m_previewKey;     // run whose decoded result m_previewText holds
+    QString m_previewText;
     
     // Constants
     static const int WINDOW_WIDTH = 1280;
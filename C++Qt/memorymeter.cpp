@@ -0,0 +1,191 @@
+#include "memorymeter.h"
+#include <algorithm>
+#include <cstdio>
+
+namespace {
+
+// Raise peak to at least value
+void raise(std::atomic<size_t>& peak, size_t value)
+{
+    size_t seen = peak.load(std::memory_order_relaxed);
+    while (seen < value && !peak.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {
+    }
+}
+
+} // namespace
+
+MemoryMeter::MemoryMeter()
+    : m_budget(0)
+    , m_total(0)
+    , m_peakTotal(0)
+    , m_phasePeak(0)
+{
+    for (size_t i = 0; i < kCategoryCount; ++i) {
+        m_current[i].store(0, std::memory_order_relaxed);
+        m_peak[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void MemoryMeter::beginPhase(const char *name)
+{
+    std::lock_guard<std::mutex> lock(m_phaseMutex);
+    const size_t now = total();
+    if (!m_phases.empty()) {
+        m_phases.back().peak = std::max(m_phases.back().peak, m_phasePeak.exchange(now));
+    } else {
+        m_phasePeak.store(now, std::memory_order_relaxed);
+    }
+    m_phases.push_back({name, now});
+}
+
+void MemoryMeter::set(Category category, size_t bytes)
+{
+    const size_t index = static_cast<size_t>(category);
+    const size_t previous = m_current[index].exchange(bytes, std::memory_order_relaxed);
+    // Unsigned wrap-around makes this a subtraction when the structure shrank
+    const size_t totalBytes = m_total.fetch_add(bytes - previous, std::memory_order_relaxed) + (bytes - previous);
+    updatePeaks(category, bytes, totalBytes);
+}
+
+void MemoryMeter::add(Category category, size_t bytes)
+{
+    grow(category, bytes);
+}
+
+void MemoryMeter::release(Category category, size_t bytes)
+{
+    m_current[static_cast<size_t>(category)].fetch_sub(bytes, std::memory_order_relaxed);
+    m_total.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+bool MemoryMeter::fits(size_t bytes) const
+{
+    const size_t limit = budget();
+    return limit == 0 || (bytes <= limit && total() <= limit - bytes);
+}
+
+bool MemoryMeter::tryAdd(Category category, size_t bytes)
+{
+    const size_t limit = budget();
+    if (limit == 0) {
+        grow(category, bytes);
+        return true;
+    }
+    size_t seen = m_total.load(std::memory_order_relaxed);
+    do {
+        if (bytes > limit || seen > limit - bytes) {
+            return false;
+        }
+    } while (!m_total.compare_exchange_weak(seen, seen + bytes, std::memory_order_relaxed));
+    const size_t index = static_cast<size_t>(category);
+    const size_t categoryBytes = m_current[index].fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    updatePeaks(category, categoryBytes, seen + bytes);
+    return true;
+}
+
+void MemoryMeter::grow(Category category, size_t bytes)
+{
+    const size_t index = static_cast<size_t>(category);
+    const size_t categoryBytes = m_current[index].fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    const size_t totalBytes = m_total.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    updatePeaks(category, categoryBytes, totalBytes);
+}
+
+void MemoryMeter::updatePeaks(Category category, size_t categoryBytes, size_t totalBytes)
+{
+    raise(m_peak[static_cast<size_t>(category)], categoryBytes);
+    raise(m_peakTotal, totalBytes);
+    raise(m_phasePeak, totalBytes);
+}
+
+size_t MemoryMeter::current(Category category) const
+{
+    return m_current[static_cast<size_t>(category)].load(std::memory_order_relaxed);
+}
+
+size_t MemoryMeter::peak(Category category) const
+{
+    return m_peak[static_cast<size_t>(category)].load(std::memory_order_relaxed);
+}
+
+std::vector<MemoryMeter::PhasePeak> MemoryMeter::phasePeaks() const
+{
+    std::lock_guard<std::mutex> lock(m_phaseMutex);
+    std::vector<PhasePeak> phases = m_phases;
+    if (!phases.empty()) {
+        phases.back().peak = std::max(phases.back().peak, m_phasePeak.load(std::memory_order_relaxed));
+    }
+    return phases;
+}
+
+void MemoryMeter::resetPeaks()
+{
+    std::lock_guard<std::mutex> lock(m_phaseMutex);
+    for (size_t i = 0; i < kCategoryCount; ++i) {
+        m_peak[i].store(m_current[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+    m_peakTotal.store(total(), std::memory_order_relaxed);
+    m_phasePeak.store(total(), std::memory_order_relaxed);
+    m_phases.clear();
+}
+
+std::string MemoryMeter::summary() const
+{
+    std::string text = "peak " + formatBytes(peakTotal());
+    if (budget() > 0) {
+        text += " (budget " + formatBytes(budget()) + ")";
+    }
+    for (size_t i = 0; i < kCategoryCount; ++i) {
+        const size_t bytes = m_peak[i].load(std::memory_order_relaxed);
+        if (bytes > 0) {
+            text += " | ";
+            text += name(static_cast<Category>(i));
+            text += ' ';
+            text += formatBytes(bytes);
+        }
+    }
+    for (const PhasePeak& phase : phasePeaks()) {
+        text += " | ";
+        text += phase.name;
+        text += ' ';
+        text += formatBytes(phase.peak);
+    }
+    return text;
+}
+
+const char *MemoryMeter::name(Category category)
+{
+    switch (category) {
+    case Category::Input:
+        return "input";
+    case Category::Rules:
+        return "rules";
+    case Category::Automaton:
+        return "automaton";
+    case Category::Document:
+        return "document";
+    case Category::Output:
+        return "output";
+    case Category::Preview:
+        return "preview";
+    }
+    return "";
+}
+
+std::string MemoryMeter::formatBytes(size_t bytes)
+{
+    static const char *const units[] = {"B", "KB", "MB", "GB", "TB"};
+    double value = static_cast<double>(bytes);
+    size_t unit = 0;
+    while (value >= 1024.0 && unit + 1 < sizeof(units) / sizeof(units[0])) {
+        value /= 1024.0;
+        ++unit;
+    }
+    char buffer[32];
+    if (unit == 0) {
+        std::snprintf(buffer, sizeof(buffer), "%zu B", bytes);
+    } else {
+        std::snprintf(buffer, sizeof(buffer), "%.1f %s", value, units[unit]);
+    }
+    return buffer;
+}
@@ -0,0 +1,143 @@
+#ifndef MEMORYMETER_H
+#define MEMORYMETER_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * MemoryMeter accounts the bytes held by the large structures of a job, by
+ * category, and the peak of their sum in each phase of the job (load,
+ * compile, replace, preview, save). Structures are measured where they are
+ * built, from their own memoryBytes() or buffer sizes; allocations of the
+ * toolkit or the allocator's overhead are not seen.
+ *
+ * An optional budget caps the total. Code paths that would materialize a
+ * whole file ask fits() or tryAdd() first and take a streaming or mapped
+ * path instead when the answer is no, so a large input degrades to a
+ * slower path rather than running out of memory.
+ *
+ * Counters are atomic, so worker threads of a batch account into one meter.
+ */
+class MemoryMeter
+{
+public:
+    enum class Category { Input, Rules, Automaton, Document, Output, Preview };
+    static constexpr size_t kCategoryCount = 6;
+
+    struct PhasePeak {
+        const char *name;
+        size_t peak;
+    };
+
+    MemoryMeter();
+
+    // Cap on the accounted total; 0 for none
+    void setBudget(size_t bytes) { m_budget.store(bytes, std::memory_order_relaxed); }
+    size_t budget() const { return m_budget.load(std::memory_order_relaxed); }
+
+    // Attribute peaks from now on to a new phase; name must be a string literal
+    void beginPhase(const char *name);
+
+    // Record the size of a structure measured as a whole
+    void set(Category category, size_t bytes);
+    void add(Category category, size_t bytes);
+    void release(Category category, size_t bytes);
+
+    // True when bytes more stay within the budget
+    bool fits(size_t bytes) const;
+
+    // add() only when the total stays within the budget; atomic with
+    // respect to other tryAdd() calls
+    bool tryAdd(Category category, size_t bytes);
+
+    size_t current(Category category) const;
+    size_t peak(Category category) const;
+    size_t total() const { return m_total.load(std::memory_order_relaxed); }
+    size_t peakTotal() const { return m_peakTotal.load(std::memory_order_relaxed); }
+
+    // Phases in order with the peak total seen in each
+    std::vector<PhasePeak> phasePeaks() const;
+
+    // Forget peaks and phases, e.g. before the next run; current sizes and
+    // the budget stay
+    void resetPeaks();
+
+    // e.g. "peak 48.2 MB (budget 64.0 MB) | rules 1.1 KB | automaton 9.8 KB | ... | replace 40.1 MB"
+    std::string summary() const;
+
+    static const char *name(Category category);
+    static std::string formatBytes(size_t bytes);
+
+private:
+    void grow(Category category, size_t bytes);
+    void updatePeaks(Category category, size_t categoryBytes, size_t totalBytes);
+
+    std::atomic<size_t> m_budget;
+    std::array<std::atomic<size_t>, kCategoryCount> m_current;
+    std::array<std::atomic<size_t>, kCategoryCount> m_peak;
+    std::atomic<size_t> m_total;
+    std::atomic<size_t> m_peakTotal;
+    std::atomic<size_t> m_phasePeak;   // peak total of the running phase
+
+    mutable std::mutex m_phaseMutex;
+    std::vector<PhasePeak> m_phases;   // finished phases, then the running one
+};
+
+/**
+ * MemoryHold accounts a buffer for its lifetime. A null meter makes it a
+ * no-op, so callers without accounting pass nullptr.
+ */
+class MemoryHold
+{
+public:
+    MemoryHold(MemoryMeter *meter, MemoryMeter::Category category, size_t bytes = 0)
+        : m_meter(meter)
+        , m_category(category)
+        , m_bytes(0)
+    {
+        resize(bytes);
+    }
+
+    ~MemoryHold() { resize(0); }
+
+    // Grow to bytes only when the meter's budget allows it
+    bool tryResize(size_t bytes)
+    {
+        if (m_meter && bytes > m_bytes) {
+            if (!m_meter->tryAdd(m_category, bytes - m_bytes)) {
+                return false;
+            }
+            m_bytes = bytes;
+            return true;
+        }
+        resize(bytes);
+        return true;
+    }
+
+    // The buffer now holds bytes
+    void resize(size_t bytes)
+    {
+        if (m_meter && bytes != m_bytes) {
+            if (bytes > m_bytes) {
+                m_meter->add(m_category, bytes - m_bytes);
+            } else {
+                m_meter->release(m_category, m_bytes - bytes);
+            }
+        }
+        m_bytes = bytes;
+    }
+
+    MemoryHold(const MemoryHold&) = delete;
+    MemoryHold& operator=(const MemoryHold&) = delete;
+
+private:
+    MemoryMeter *m_meter;
+    MemoryMeter::Category m_category;
+    size_t m_bytes;
+};
+
+#endif // MEMORYMETER_H
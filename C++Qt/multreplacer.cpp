@@ -0,0 +1,277 @@
+#include "multreplacer.h"
+#include "ruleanalyzer.h"
+#include "rulepipeline.h"
+#include <cstring>
+#include <memory>
+#include <new>
+#include <vector>
+
+// The handle only wraps a compiled pipeline; nothing in it changes after
+// mr_ruleset_compile(), which is what makes sharing it across threads safe
+struct mr_ruleset {
+    RulePipeline pipeline;
+    std::vector<uint32_t> ruleEntries;   // caller's rule index, by pipeline rule
+};
+
+namespace {
+
+// Thrown through the engine when the write callback asks to stop
+struct Aborted {};
+
+// Writes into the caller's buffer; past its end only the size is counted
+class BufferOutput
+{
+public:
+    BufferOutput(char *data, size_t capacity)
+        : m_data(data)
+        , m_capacity(capacity)
+        , m_size(0)
+    {
+    }
+
+    void append(const char *data, size_t length)
+    {
+        if (length > 0 && m_size <= m_capacity && length <= m_capacity - m_size) {
+            std::memcpy(m_data + m_size, data, length);
+        }
+        m_size += length;
+    }
+
+    size_t size() const { return m_size; }
+    bool overflowed() const { return m_size > m_capacity; }
+
+private:
+    char *m_data;
+    size_t m_capacity;
+    size_t m_size;
+};
+
+// Passes output to the caller's callback
+class CallbackOutput
+{
+public:
+    CallbackOutput(mr_write_fn write, void *context)
+        : m_write(write)
+        , m_context(context)
+    {
+    }
+
+    void append(const char *data, size_t length)
+    {
+        if (length > 0 && m_write(m_context, data, length) != 0) {
+            throw Aborted();
+        }
+    }
+
+private:
+    mr_write_fn m_write;
+    void *m_context;
+};
+
+// Run all passes over the input in place, appending to out. A single pass
+// is one scan of the caller's buffer; more passes are chained by the
+// pipeline's stream, which only buffers chunks between passes.
+template <typename Output>
+uint64_t run(const RulePipeline& pipeline, const char *data, size_t length, Output& out)
+{
+    if (pipeline.passCount() == 1) {
+        const ReplaceEngine& engine = pipeline.pass(0);
+        uint64_t matches = 0;
+        size_t copied = 0;
+        engine.scan(data, length, [&](const ReplaceMatch& m) {
+            out.append(data + copied, m.offset - copied);
+            const std::string_view replacement = engine.replacement(m.rule);
+            out.append(replacement.data(), replacement.size());
+            copied = m.offset + m.length;
+            ++matches;
+        });
+        out.append(data + copied, length - copied);
+        return matches;
+    }
+    auto source = [data, length](const StreamReplacer::Writer& feed) { feed(data, length); };
+    auto sink = [&out](const char *bytes, size_t size) { out.append(bytes, size); };
+    return pipeline.stream(source, sink);
+}
+
+// Every entry point returns through this, so no exception crosses the ABI
+template <typename Body>
+mr_status guarded(Body body)
+{
+    try {
+        return body();
+    } catch (const Aborted&) {
+        return MR_ERROR_ABORTED;
+    } catch (const std::bad_alloc&) {
+        return MR_ERROR_OUT_OF_MEMORY;
+    } catch (...) {
+        return MR_ERROR_INTERNAL;
+    }
+}
+
+bool isValidInput(const mr_ruleset *ruleset, const char *input, size_t length)
+{
+    return ruleset && (input || length == 0);
+}
+
+} // namespace
+
+uint32_t mr_abi_version(void)
+{
+    return MR_ABI_VERSION;
+}
+
+const char *mr_status_string(mr_status status)
+{
+    switch (status) {
+    case MR_OK:
+        return "ok";
+    case MR_ERROR_INVALID_ARGUMENT:
+        return "invalid argument";
+    case MR_ERROR_NO_RULES:
+        return "no rules";
+    case MR_ERROR_BUFFER_TOO_SMALL:
+        return "buffer too small";
+    case MR_ERROR_ABORTED:
+        return "aborted by the write callback";
+    case MR_ERROR_UNSUPPORTED:
+        return "unsupported for this rule set";
+    case MR_ERROR_OUT_OF_MEMORY:
+        return "out of memory";
+    case MR_ERROR_INTERNAL:
+        break;
+    }
+    return "internal error";
+}
+
+mr_status mr_ruleset_compile(const mr_rule *rules, size_t count, mr_encoding encoding,
+                             mr_ruleset **ruleset)
+{
+    if (!ruleset || (!rules && count > 0) || count > UINT32_MAX) {
+        return MR_ERROR_INVALID_ARGUMENT;
+    }
+    *ruleset = nullptr;
+    if (encoding != MR_ENCODING_UTF8 && encoding != MR_ENCODING_SHIFT_JIS && encoding != MR_ENCODING_EUC_JP) {
+        return MR_ERROR_INVALID_ARGUMENT;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        const mr_rule& rule = rules[i];
+        if (!rule.pattern || rule.pattern_length == 0 || (!rule.replacement && rule.replacement_length > 0)) {
+            return MR_ERROR_INVALID_ARGUMENT;
+        }
+    }
+
+    return guarded([&]() {
+        // The same analysis and compile as a replacement in the application
+        RuleAnalyzer analyzer;
+        for (size_t i = 0; i < count; ++i) {
+            const mr_rule& rule = rules[i];
+            analyzer.add(rule.stage ? std::string_view(rule.stage) : std::string_view(),
+                         std::string_view(rule.pattern, rule.pattern_length),
+                         std::string_view(rule.replacement ? rule.replacement : "", rule.replacement_length));
+        }
+        std::unique_ptr<mr_ruleset> compiled(new mr_ruleset);
+        const TextEncoding textEncoding = static_cast<TextEncoding>(encoding);
+        analyzer.build(compiled->pipeline, textEncoding);
+        if (compiled->pipeline.isEmpty()) {
+            return MR_ERROR_NO_RULES;
+        }
+        compiled->ruleEntries.reserve(compiled->pipeline.ruleCount());
+        for (size_t r = 0; r < compiled->pipeline.ruleCount(); ++r) {
+            compiled->ruleEntries.push_back(static_cast<uint32_t>(analyzer.ruleEntry(r)));
+        }
+        compiled->pipeline.compile(textEncoding);
+        *ruleset = compiled.release();
+        return MR_OK;
+    });
+}
+
+void mr_ruleset_free(mr_ruleset *ruleset)
+{
+    delete ruleset;
+}
+
+size_t mr_ruleset_rule_count(const mr_ruleset *ruleset)
+{
+    return ruleset ? ruleset->ruleEntries.size() : 0;
+}
+
+size_t mr_ruleset_pass_count(const mr_ruleset *ruleset)
+{
+    return ruleset ? ruleset->pipeline.passCount() : 0;
+}
+
+mr_status mr_replace_into(const mr_ruleset *ruleset, const char *input, size_t length,
+                          char *output, size_t capacity, size_t *output_length,
+                          uint64_t *match_count)
+{
+    if (!isValidInput(ruleset, input, length) || !output_length || (!output && capacity > 0)) {
+        return MR_ERROR_INVALID_ARGUMENT;
+    }
+    return guarded([&]() {
+        BufferOutput out(output, capacity);
+        const uint64_t matches = run(ruleset->pipeline, input, length, out);
+        *output_length = out.size();
+        if (match_count) {
+            *match_count = matches;
+        }
+        return out.overflowed() ? MR_ERROR_BUFFER_TOO_SMALL : MR_OK;
+    });
+}
+
+mr_status mr_replace_stream(const mr_ruleset *ruleset, const char *input, size_t length,
+                            mr_write_fn write, void *context, uint64_t *match_count)
+{
+    if (!isValidInput(ruleset, input, length) || !write) {
+        return MR_ERROR_INVALID_ARGUMENT;
+    }
+    return guarded([&]() {
+        CallbackOutput out(write, context);
+        const uint64_t matches = run(ruleset->pipeline, input, length, out);
+        if (match_count) {
+            *match_count = matches;
+        }
+        return MR_OK;
+    });
+}
+
+mr_status mr_count_matches(const mr_ruleset *ruleset, const char *input, size_t length,
+                           uint64_t *match_count, int64_t *size_delta)
+{
+    if (!isValidInput(ruleset, input, length)) {
+        return MR_ERROR_INVALID_ARGUMENT;
+    }
+    return guarded([&]() {
+        const MatchSummary summary = ruleset->pipeline.countMatches(input, length);
+        if (match_count) {
+            *match_count = summary.matches;
+        }
+        if (size_delta) {
+            *size_delta = summary.sizeDelta;
+        }
+        return MR_OK;
+    });
+}
+
+mr_status mr_find_matches(const mr_ruleset *ruleset, const char *input, size_t length,
+                          mr_match *matches, size_t capacity, size_t *match_count)
+{
+    if (!isValidInput(ruleset, input, length) || !match_count || (!matches && capacity > 0)) {
+        return MR_ERROR_INVALID_ARGUMENT;
+    }
+    // Matches of later passes are in text the earlier passes wrote
+    if (ruleset->pipeline.passCount() != 1) {
+        return MR_ERROR_UNSUPPORTED;
+    }
+    return guarded([&]() {
+        const size_t firstRule = ruleset->pipeline.passFirstRule(0);
+        size_t found = 0;
+        ruleset->pipeline.pass(0).scan(input, length, [&](const ReplaceMatch& m) {
+            if (found < capacity) {
+                matches[found] = {m.offset, m.length, ruleset->ruleEntries[firstRule + m.rule]};
+            }
+            ++found;
+        });
+        *match_count = found;
+        return found > capacity ? MR_ERROR_BUFFER_TOO_SMALL : MR_OK;
+    });
+}
@@ -0,0 +1,124 @@
+#ifndef MULTREPLACER_H
+#define MULTREPLACER_H
+
+/*
+ * C interface to the replacement engine, for services that link the engine
+ * directly instead of running the application. It is the same engine the
+ * application uses (RulePipeline): rules are grouped into stages that run
+ * in order, each stage replacing leftmost-longest, non-overlapping matches.
+ *
+ * A rule set is compiled once into an opaque handle. A compiled handle is
+ * immutable, so any number of threads may use it at the same time; only
+ * mr_ruleset_free() must not race with other calls on the same handle.
+ * Input is read in place and never copied. No function throws or aborts:
+ * every failure is reported as an mr_status code.
+ *
+ * All lengths are in bytes; patterns, replacements and input are bytes in
+ * the rule set's encoding and need not be NUL-terminated.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32)
+#  if defined(MULTREPLACER_BUILDING)
+#    define MR_API __declspec(dllexport)
+#  else
+#    define MR_API __declspec(dllimport)
+#  endif
+#else
+#  define MR_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Incremented whenever a declaration in this header changes incompatibly */
+#define MR_ABI_VERSION 1
+
+typedef enum mr_status {
+    MR_OK = 0,
+    MR_ERROR_INVALID_ARGUMENT = 1,  /* null handle or pointer, unknown encoding */
+    MR_ERROR_NO_RULES = 2,          /* no rule can change the input */
+    MR_ERROR_BUFFER_TOO_SMALL = 3,  /* the required size was stored; retry with it */
+    MR_ERROR_ABORTED = 4,           /* the write callback asked to stop */
+    MR_ERROR_UNSUPPORTED = 5,       /* e.g. match offsets of a multi-pass rule set */
+    MR_ERROR_OUT_OF_MEMORY = 6,
+    MR_ERROR_INTERNAL = 7
+} mr_status;
+
+typedef enum mr_encoding {
+    MR_ENCODING_UTF8 = 0,
+    MR_ENCODING_SHIFT_JIS = 1,
+    MR_ENCODING_EUC_JP = 2
+} mr_encoding;
+
+typedef struct mr_rule {
+    const char *pattern;        /* must not be empty */
+    size_t pattern_length;
+    const char *replacement;    /* may be NULL when replacement_length is 0 */
+    size_t replacement_length;
+    const char *stage;          /* NUL-terminated stage name; NULL for the default stage */
+} mr_rule;
+
+typedef struct mr_match {
+    uint64_t offset;   /* into the input */
+    uint32_t length;
+    uint32_t rule;     /* index into the rules passed to mr_ruleset_compile() */
+} mr_match;
+
+typedef struct mr_ruleset mr_ruleset;
+
+/* Receives output in order; return 0 to continue, anything else to stop */
+typedef int (*mr_write_fn)(void *context, const char *data, size_t length);
+
+MR_API uint32_t mr_abi_version(void);
+MR_API const char *mr_status_string(mr_status status);
+
+/*
+ * Compile count rules. Within a stage a later rule with the same pattern
+ * replaces an earlier one; rules that cannot change any input are left
+ * out of the compiled matcher.
+ */
+MR_API mr_status mr_ruleset_compile(const mr_rule *rules, size_t count, mr_encoding encoding,
+                                    mr_ruleset **ruleset);
+MR_API void mr_ruleset_free(mr_ruleset *ruleset);
+
+/* Rules kept in the compiled matcher, and stage passes it runs */
+MR_API size_t mr_ruleset_rule_count(const mr_ruleset *ruleset);
+MR_API size_t mr_ruleset_pass_count(const mr_ruleset *ruleset);
+
+/*
+ * Replace into output, which holds capacity bytes. The output size is
+ * stored in output_length; when it exceeds capacity, MR_ERROR_BUFFER_TOO_SMALL
+ * is returned with the required size stored and the buffer contents
+ * unspecified. match_count may be NULL.
+ */
+MR_API mr_status mr_replace_into(const mr_ruleset *ruleset, const char *input, size_t length,
+                                 char *output, size_t capacity, size_t *output_length,
+                                 uint64_t *match_count);
+
+/* Replace, passing the output to write in spans as it is produced */
+MR_API mr_status mr_replace_stream(const mr_ruleset *ruleset, const char *input, size_t length,
+                                   mr_write_fn write, void *context, uint64_t *match_count);
+
+/* Size change the rules would make, without producing output */
+MR_API mr_status mr_count_matches(const mr_ruleset *ruleset, const char *input, size_t length,
+                                  uint64_t *match_count, int64_t *size_delta);
+
+/*
+ * Store the matches in input, in order, into matches (capacity entries).
+ * The total is stored in match_count; when it exceeds capacity, the first
+ * capacity matches are stored and MR_ERROR_BUFFER_TOO_SMALL is returned.
+ * Only rule sets that compile into one pass (mr_ruleset_pass_count() == 1)
+ * have offsets into the input; others return MR_ERROR_UNSUPPORTED.
+ */
+MR_API mr_status mr_find_matches(const mr_ruleset *ruleset, const char *input, size_t length,
+                                 mr_match *matches, size_t capacity, size_t *match_count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MULTREPLACER_H */
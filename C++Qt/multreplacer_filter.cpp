@@ -0,0 +1,196 @@
+/**
+ * Engine-only filter
+ * The app's --filter mode for builds without Qt: stdin goes to stdout
+ * through a rule set in bounded memory (see PipeFilter). The rules are a
+ * plain text file instead of the app's JSON, one rule per line:
+ *
+ *     find<TAB>replace[<TAB>stage]
+ *
+ * with \t, \n, \r and \\ escaped. Empty lines and lines starting with '#'
+ * are skipped. Patterns and replacements are taken as bytes in the rule
+ * set's encoding, the encoding of the stream. Duplicate, no-op and
+ * unreachable rules are left out as in the app (see RuleAnalyzer).
+ *
+ * Usage: multreplacer_filter [--encoding name] [--engine name]
+ *            [--flush throughput|latency] [--buffer-size kb] [--verbose] rules
+ */
+
+#include "pipefilter.h"
+#include "ruleanalyzer.h"
+#include "enginetuner.h"
+#include "textcodec.h"
+#include "tracer.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+namespace {
+
+std::string unescape(const std::string& field)
+{
+    std::string bytes;
+    bytes.reserve(field.size());
+    for (size_t i = 0; i < field.size(); ++i) {
+        if (field[i] != '\\' || i + 1 == field.size()) {
+            bytes += field[i];
+            continue;
+        }
+        const char c = field[++i];
+        bytes += c == 't' ? '\t' : c == 'n' ? '\n' : c == 'r' ? '\r' : c;
+    }
+    return bytes;
+}
+
+// Add the rules of path to analyzer; false with a message for files that
+// cannot be read or hold a malformed line
+bool readRules(const char *path, RuleAnalyzer& analyzer, std::string *error)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        *error = std::string("cannot open ") + path;
+        return false;
+    }
+    const std::string contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    size_t lineNumber = 0;
+    for (size_t start = 0; start < contents.size();) {
+        size_t end = contents.find('\n', start);
+        if (end == std::string::npos) {
+            end = contents.size();
+        }
+        std::string line = contents.substr(start, end - start);
+        start = end + 1;
+        ++lineNumber;
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        std::vector<std::string> fields;
+        for (size_t from = 0;;) {
+            const size_t tab = line.find('\t', from);
+            fields.push_back(line.substr(from, tab == std::string::npos ? std::string::npos : tab - from));
+            if (tab == std::string::npos) {
+                break;
+            }
+            from = tab + 1;
+        }
+        if (fields.size() < 2 || fields.size() > 3 || fields[0].empty()) {
+            *error = "line " + std::to_string(lineNumber) + ": expected find<TAB>replace[<TAB>stage]";
+            return false;
+        }
+        analyzer.add(fields.size() == 3 ? unescape(fields[2]) : std::string(), unescape(fields[0]),
+                     unescape(fields[1]));
+    }
+    return true;
+}
+
+int usage()
+{
+    std::fprintf(stderr, "usage: multreplacer_filter [--encoding name] [--engine name] "
+                         "[--flush throughput|latency] [--buffer-size kb] [--verbose] rules\n");
+    return 2;
+}
+
+int run(int argc, char **argv)
+{
+    const char *rulesPath = nullptr;
+    const char *encodingName = "UTF-8";
+    const char *engineName = nullptr;
+    const char *flushName = "throughput";
+    size_t bufferBytes = 0;
+    bool verbose = false;
+    for (int i = 1; i < argc; ++i) {
+        const bool hasValue = i + 1 < argc;
+        if (std::strcmp(argv[i], "--encoding") == 0 && hasValue) {
+            encodingName = argv[++i];
+        } else if (std::strcmp(argv[i], "--engine") == 0 && hasValue) {
+            engineName = argv[++i];
+        } else if (std::strcmp(argv[i], "--flush") == 0 && hasValue) {
+            flushName = argv[++i];
+        } else if (std::strcmp(argv[i], "--buffer-size") == 0 && hasValue) {
+            bufferBytes = static_cast<size_t>(std::strtoull(argv[++i], nullptr, 10)) * 1024;
+        } else if (std::strcmp(argv[i], "--verbose") == 0) {
+            verbose = true;
+        } else if (argv[i][0] != '-' && !rulesPath) {
+            rulesPath = argv[i];
+        } else {
+            return usage();
+        }
+    }
+    if (!rulesPath) {
+        return usage();
+    }
+
+    TextEncoding encoding;
+    if (!TextCodec::fromName(encodingName, encoding)) {
+        std::fprintf(stderr, "unknown encoding: %s\n", encodingName);
+        return 2;
+    }
+    if (engineName) {
+        EngineStrategy strategy;
+        if (!ReplaceEngine::parseStrategy(engineName, &strategy)) {
+            std::fprintf(stderr, "unknown engine: %s\n", engineName);
+            return 2;
+        }
+        EngineTuner::setForcedStrategy(strategy);
+    }
+    PipeFilter::Options options;
+    if (!PipeFilter::parseFlush(flushName, &options.flush)) {
+        std::fprintf(stderr, "unknown flush policy: %s\n", flushName);
+        return 2;
+    }
+    if (bufferBytes > 0) {
+        options.readSize = bufferBytes;
+        options.outputSize = bufferBytes;
+    }
+
+    RuleAnalyzer analyzer;
+    std::string error;
+    if (!readRules(rulesPath, analyzer, &error)) {
+        std::fprintf(stderr, "invalid rules: %s\n", error.c_str());
+        return 2;
+    }
+    RulePipeline pipeline;
+    const size_t dropped = analyzer.build(pipeline, encoding);
+    if (pipeline.isEmpty()) {
+        std::fprintf(stderr, "invalid rules: %s\n", dropped > 0 ? "no rule changes the text" : "no rules");
+        return 2;
+    }
+    if (dropped > 0) {
+        std::fprintf(stderr, "%zu duplicate, no-op or unreachable rules left out\n", dropped);
+    }
+    pipeline.compile(encoding);
+
+    PipeFilter filter(pipeline, options);
+    const PipeFilter::Result result = filter.run(0, 1);
+    if (!result.ok) {
+        std::fprintf(stderr, "filter failed: %s\n", result.error.c_str());
+        return 1;
+    }
+    if (verbose) {
+        std::fprintf(stderr, "%llu bytes in, %llu bytes out, %llu matches, %llu reads, %llu writes\n",
+                     static_cast<unsigned long long>(result.bytesIn), static_cast<unsigned long long>(result.bytesOut),
+                     static_cast<unsigned long long>(result.matches), static_cast<unsigned long long>(result.reads),
+                     static_cast<unsigned long long>(result.writes));
+    }
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Tracer::initFromEnvironment();
+    const int status = run(argc, argv);
+    if (Tracer::isEnabled() && !Tracer::defaultOutputPath().empty()) {
+        Tracer::writeChromeTrace(Tracer::defaultOutputPath());
+    }
+    return status;
+}
@@ -0,0 +1,314 @@
+#include "piecetable.h"
+#include "rulepipeline.h"
+#include "tracer.h"
+#include <algorithm>
+
+PieceTable::PieceTable()
+    : m_original(nullptr)
+    , m_current(0)
+{
+    reset(nullptr, 0);
+}
+
+void PieceTable::reset(const char *original, size_t length)
+{
+    m_original = original;
+    m_added.clear();
+    m_versions.resize(1);
+    m_versions[0].pieces.clear();
+    m_versions[0].length = length;
+    m_versions[0].addedEnd = 0;
+    appendPiece(m_versions[0].pieces, Source::Original, 0, length);
+    m_current = 0;
+}
+
+void PieceTable::appendPiece(std::vector<Piece>& pieces, Source source, size_t offset, size_t length)
+{
+    if (length == 0) {
+        return;
+    }
+    if (!pieces.empty()) {
+        Piece& last = pieces.back();
+        if (last.source == source && last.offset + last.length == offset) {
+            last.length += length;
+            return;
+        }
+    }
+    pieces.push_back({source, offset, length});
+}
+
+template <typename ForEachMatch>
+size_t PieceTable::buildVersion(const Version& sourceVersion, const ReplaceEngine& engine, ForEachMatch&& forEachMatch,
+                                RuleStats *stats, Version& next)
+{
+    const std::vector<Piece>& source = sourceVersion.pieces;
+    const size_t length = sourceVersion.length;
+
+    next.pieces.clear();
+    next.pieces.reserve(source.size() + 1);
+    m_replacementOffsets.assign(engine.ruleCount(), -1);
+    m_pending.clear();
+
+    // Unmatched spans map back onto the source pieces; spans arrive in
+    // order, so one cursor walks the pieces once
+    size_t cursor = 0;
+    size_t cursorStart = 0;
+    auto copySpan = [&](size_t from, size_t to) {
+        while (from < to) {
+            while (cursorStart + source[cursor].length <= from) {
+                cursorStart += source[cursor].length;
+                ++cursor;
+            }
+            const Piece& piece = source[cursor];
+            const size_t inPiece = from - cursorStart;
+            const size_t take = std::min(piece.length - inPiece, to - from);
+            appendPiece(next.pieces, piece.source, piece.offset + inPiece, take);
+            from += take;
+        }
+    };
+
+    size_t matches = 0;
+    size_t copied = 0;
+    size_t newLength = 0;
+    forEachMatch([&](const ReplaceMatch& m) {
+        copySpan(copied, m.offset);
+        newLength += m.offset - copied;
+
+        const std::string_view replacement = engine.replacement(m.rule);
+        if (!replacement.empty()) {
+            int64_t& offset = m_replacementOffsets[m.rule];
+            if (offset < 0) {
+                offset = static_cast<int64_t>(m_added.size() + m_pending.size());
+                m_pending.append(replacement.data(), replacement.size());
+            }
+            appendPiece(next.pieces, Source::Added, static_cast<size_t>(offset), replacement.size());
+            newLength += replacement.size();
+        }
+        if (stats) {
+            stats->recordHit(m.rule, m.length, replacement.size());
+        }
+        copied = m.offset + m.length;
+        ++matches;
+    });
+    copySpan(copied, length);
+    newLength += length - copied;
+
+    m_added.append(m_pending);
+    next.length = newLength;
+    next.addedEnd = m_added.size();
+    return matches;
+}
+
+template <typename OnMatch>
+void PieceTable::scanVersion(const Version& version, const ReplaceEngine& engine, size_t begin, size_t end,
+                             OnMatch&& onMatch) const
+{
+    if (end <= begin || engine.isEmpty()) {
+        return;
+    }
+
+    // A range within one piece is scanned where it lies
+    size_t pieceStart = 0;
+    for (const Piece& piece : version.pieces) {
+        const size_t pieceEnd = pieceStart + piece.length;
+        if (pieceEnd > begin) {
+            if (pieceEnd >= end) {
+                engine.scan(pieceData(piece) + (begin - pieceStart), end - begin, [&](const ReplaceMatch& m) {
+                    onMatch(ReplaceMatch{m.offset + begin, m.length, m.rule});
+                });
+                return;
+            }
+            break;
+        }
+        pieceStart = pieceEnd;
+    }
+
+    // Otherwise the pieces stream through the engine, which carries only
+    // the bytes a match may still need across piece boundaries
+    StreamReplacer stream(engine, nullptr);
+    stream.setMatchSink([&](const ReplaceMatch& m) { onMatch(ReplaceMatch{m.offset + begin, m.length, m.rule}); });
+    auto feed = [&stream](const char *data, size_t length) { stream.write(data, length); };
+    feedPieces(version.pieces, begin, end, feed);
+    stream.finish();
+}
+
+void PieceTable::pushVersion(Version&& version)
+{
+    m_versions.push_back(std::move(version));
+    m_current = m_versions.size() - 1;
+}
+
+size_t PieceTable::applyReplacement(const ReplaceEngine& engine, RuleStats *stats, std::vector<ReplaceMatch> *index)
+{
+    TRACE_SCOPE("applyReplacement");
+
+    truncateHistory();
+    if (index) {
+        index->clear();
+    }
+    const Version& current = m_versions[m_current];
+    Version next;
+    const size_t matches = buildVersion(current, engine, [&](auto&& onMatch) {
+        scanVersion(current, engine, 0, current.length, [&](const ReplaceMatch& m) {
+            if (index) {
+                index->push_back(m);
+            }
+            onMatch(m);
+        });
+    }, stats, next);
+    pushVersion(std::move(next));
+    return matches;
+}
+
+size_t PieceTable::applyMatchIndex(const ReplaceEngine& engine, const std::vector<ReplaceMatch>& index,
+                                   RuleStats *stats)
+{
+    TRACE_SCOPE("applyMatchIndex");
+
+    truncateHistory();
+    Version next;
+    const size_t matches = buildVersion(m_versions[m_current], engine, [&index](auto&& onMatch) {
+        for (const ReplaceMatch& m : index) {
+            onMatch(m);
+        }
+    }, stats, next);
+    pushVersion(std::move(next));
+    return matches;
+}
+
+size_t PieceTable::applyPipeline(const RulePipeline& pipeline, RuleStats *stats, std::vector<ReplaceMatch> *index)
+{
+    if (pipeline.passCount() == 1) {
+        return applyReplacement(pipeline.pass(0), stats, index);
+    }
+    TRACE_SCOPE("applyPipeline");
+    return applyPasses(pipeline, 0, length(), stats);
+}
+
+size_t PieceTable::applyPipelineRange(const RulePipeline& pipeline, size_t begin, size_t end, RuleStats *stats)
+{
+    TRACE_SCOPE("applyPipelineRange");
+
+    end = std::min(end, length());
+    begin = std::min(begin, end);
+    return applyPasses(pipeline, begin, end, stats);
+}
+
+size_t PieceTable::applyPasses(const RulePipeline& pipeline, size_t begin, size_t end, RuleStats *stats)
+{
+    truncateHistory();
+
+    // Every pass maps its matches onto the pieces of the pass before; the
+    // results in between never enter the history. Without passes, every
+    // Execute still yields one version.
+    Version version = m_versions[m_current];
+    Version next;
+    RuleStats passStats;
+    size_t matches = 0;
+    for (size_t i = 0; i < pipeline.passCount(); ++i) {
+        const ReplaceEngine& engine = pipeline.pass(i);
+        passStats.reset(engine.ruleCount());
+        matches += buildVersion(version, engine, [&](auto&& onMatch) {
+            scanVersion(version, engine, begin, end, onMatch);
+        }, stats ? &passStats : nullptr, next);
+        // The range keeps its start and moves its end with the replacements
+        end = end + next.length - version.length;
+        std::swap(version, next);
+        if (stats) {
+            stats->merge(passStats, pipeline.passFirstRule(i));
+        }
+    }
+    version.addedEnd = m_added.size();
+    pushVersion(std::move(version));
+    return matches;
+}
+
+size_t PieceTable::applyOutput(const Run& run)
+{
+    TRACE_SCOPE("applyOutput");
+    truncateHistory();
+
+    // The input may be m_scratch or lie in m_added, so the output goes
+    // to a buffer of its own
+    const size_t length = this->length();
+    const char *text = contiguousData();
+    std::string output;
+    output.reserve(length);
+    size_t matches = static_cast<size_t>(run(text ? text : "", length,
+        [&output](const char *data, size_t size) { output.append(data, size); }));
+
+    pushOutput(output);
+    return matches;
+}
+
+const char *PieceTable::contiguousData()
+{
+    const std::vector<Piece>& source = pieces();
+    if (source.size() == 1) {
+        return pieceData(source[0]);
+    }
+    if (source.empty()) {
+        return nullptr;
+    }
+    // Anything else goes through the scratch copy
+    m_scratch.clear();
+    m_scratch.reserve(length());
+    materialize(m_scratch);
+    return m_scratch.data();
+}
+
+void PieceTable::pushOutput(const std::string& output)
+{
+    Version next;
+    appendPiece(next.pieces, Source::Added, m_added.size(), output.size());
+    m_added.append(output);
+    next.length = output.size();
+    next.addedEnd = m_added.size();
+    pushVersion(std::move(next));
+}
+
+void PieceTable::truncateHistory()
+{
+    // A new run replaces the redo history, and with it the bytes it added
+    m_versions.resize(m_current + 1);
+    m_added.resize(m_versions[m_current].addedEnd);
+}
+
+size_t PieceTable::memoryBytes() const
+{
+    size_t bytes = m_added.capacity() + m_scratch.capacity() + m_pending.capacity()
+        + m_replacementOffsets.capacity() * sizeof(int64_t)
+        + m_versions.capacity() * sizeof(Version);
+    for (const Version& version : m_versions) {
+        bytes += version.pieces.capacity() * sizeof(Piece);
+    }
+    return bytes;
+}
+
+bool PieceTable::undo()
+{
+    if (!canUndo()) {
+        return false;
+    }
+    --m_current;
+    return true;
+}
+
+bool PieceTable::redo()
+{
+    if (!canRedo()) {
+        return false;
+    }
+    ++m_current;
+    return true;
+}
+
+void PieceTable::discardCurrent()
+{
+    if (!canUndo()) {
+        return;
+    }
+    --m_current;
+    m_versions.resize(m_current + 1);
+    m_added.resize(m_versions[m_current].addedEnd);
+}
@@ -0,0 +1,203 @@
+#ifndef PIECETABLE_H
+#define PIECETABLE_H
+
+#include <cstddef>
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include "replaceengine.h"
+#include "streamreplacer.h"
+
+class RulePipeline;
+
+/**
+ * PieceTable represents a document as a list of pieces over two buffers:
+ * the original file content, which is borrowed (typically a read-only
+ * mapping) and never copied, and an append-only buffer of inserted bytes.
+ *
+ * Each replacement run builds a new version from the engine's matches:
+ * unmatched spans become pieces of the previous version and every
+ * replacement a piece of the add buffer, where a rule's replacement bytes
+ * are stored once per run. A version of several pieces is scanned piece by
+ * piece through a StreamReplacer, and every pass of a pipeline builds its
+ * pieces over the previous pass's, so a run adds only replacement bytes,
+ * never a copy of the text. Versions are kept in a stack, so undo and redo
+ * only switch the current version; nothing is materialized until
+ * materialize() is called, e.g. for saving.
+ */
+class PieceTable
+{
+public:
+    enum class Source : uint8_t { Original, Added };
+
+    struct Piece {
+        Source source;
+        size_t offset;
+        size_t length;
+    };
+
+    PieceTable();
+
+    // Start a new document over original, which must outlive the table
+    void reset(const char *original, size_t length);
+
+    size_t length() const { return m_versions[m_current].length; }
+    const std::vector<Piece>& pieces() const { return m_versions[m_current].pieces; }
+    const char *pieceData(const Piece& piece) const
+    {
+        return (piece.source == Source::Original ? m_original : m_added.data()) + piece.offset;
+    }
+
+    // True while no run has been applied (or all have been undone)
+    bool isOriginal() const { return m_current == 0; }
+
+    // Apply one replacement run as a new version, dropping any redo
+    // history. Returns the number of matches. Stats, if given, must be
+    // reset() for the engine. The matches are stored in index, if given.
+    size_t applyReplacement(const ReplaceEngine& engine, RuleStats *stats = nullptr,
+                            std::vector<ReplaceMatch> *index = nullptr);
+
+    // Apply all stages of a compiled pipeline as one new version. A fused
+    // pipeline is a single run as above; in a multi-pass one every pass
+    // maps its matches onto the pieces left by the pass before, and index
+    // is left untouched.
+    size_t applyPipeline(const RulePipeline& pipeline, RuleStats *stats = nullptr,
+                         std::vector<ReplaceMatch> *index = nullptr);
+
+    // Apply a run of engine over the current version from its recorded
+    // matches (see ResultCache) instead of scanning; the version's bytes
+    // are not read at all
+    size_t applyMatchIndex(const ReplaceEngine& engine, const std::vector<ReplaceMatch>& index,
+                           RuleStats *stats = nullptr);
+
+    // Apply all stages of a pipeline to the bytes [begin, end) of the
+    // current version only, as one new version. Matches lie within the
+    // range. The pieces before and after it are taken over as they are,
+    // so the cost follows the range, not the document. The range must
+    // start on a character boundary for legacy encodings.
+    size_t applyPipelineRange(const RulePipeline& pipeline, size_t begin, size_t end, RuleStats *stats = nullptr);
+
+    // Apply a run computed outside the table, e.g. in parallel batches:
+    // run gets the current version as contiguous bytes and writes the new
+    // content to its sink, returning the number of matches. This is the
+    // one kind of run that copies: a version of several pieces is
+    // flattened for it, and its output becomes a single added piece.
+    using Run = std::function<uint64_t(const char *data, size_t length, const StreamReplacer::Writer& sink)>;
+    size_t applyOutput(const Run& run);
+
+    bool canUndo() const { return m_current > 0; }
+    bool canRedo() const { return m_current + 1 < m_versions.size(); }
+    bool undo();
+    bool redo();
+
+    // Undo the current version and forget it, e.g. after a rejected preview
+    void discardCurrent();
+
+    size_t versionCount() const { return m_versions.size(); }
+    size_t currentVersion() const { return m_current; }
+
+    // Bytes allocated by the table for all versions; the borrowed original
+    // is not counted
+    size_t memoryBytes() const;
+
+    // Pass the current version's pieces to feed in order
+    template <typename Feed>
+    void feed(Feed&& feed) const
+    {
+        for (const Piece& piece : pieces()) {
+            feed(pieceData(piece), piece.length);
+        }
+    }
+
+    // Append the current version to out (std::string, QByteArray, ...)
+    template <typename Output>
+    void materialize(Output& out) const
+    {
+        for (const Piece& piece : pieces()) {
+            out.append(pieceData(piece), piece.length);
+        }
+    }
+
+    // Pass the bytes [begin, end) of the current version to feed in order
+    template <typename Feed>
+    void feedRange(size_t begin, size_t end, Feed&& feed) const
+    {
+        feedPieces(pieces(), begin, end, feed);
+    }
+
+    // Append the bytes [begin, end) of the current version to out
+    template <typename Output>
+    void materializeRange(size_t begin, size_t end, Output& out) const
+    {
+        feedRange(begin, end, [&out](const char *data, size_t length) { out.append(data, length); });
+    }
+
+private:
+    struct Version {
+        std::vector<Piece> pieces;
+        size_t length = 0;
+        size_t addedEnd = 0;  // size of m_added when the version was made
+    };
+
+    template <typename Feed>
+    void feedPieces(const std::vector<Piece>& source, size_t begin, size_t end, Feed& feed) const
+    {
+        size_t pieceStart = 0;
+        for (const Piece& piece : source) {
+            const size_t pieceEnd = pieceStart + piece.length;
+            if (pieceEnd > begin && pieceStart < end) {
+                const size_t from = std::max(begin, pieceStart);
+                feed(pieceData(piece) + (from - pieceStart), std::min(end, pieceEnd) - from);
+            }
+            if (pieceEnd >= end) {
+                break;
+            }
+            pieceStart = pieceEnd;
+        }
+    }
+
+    // Drop the redo history before a new version is pushed
+    void truncateHistory();
+    void pushVersion(Version&& version);
+
+    // Build in next the version of source made by the matches forEachMatch
+    // passes to its sink
+    template <typename ForEachMatch>
+    size_t buildVersion(const Version& source, const ReplaceEngine& engine, ForEachMatch&& forEachMatch,
+                        RuleStats *stats, Version& next);
+
+    // Pass the engine's matches in [begin, end) of version to onMatch, at
+    // offsets into the version
+    template <typename OnMatch>
+    void scanVersion(const Version& version, const ReplaceEngine& engine, size_t begin, size_t end,
+                     OnMatch&& onMatch) const;
+
+    // Apply the passes of pipeline to [begin, end) as one new version
+    size_t applyPasses(const RulePipeline& pipeline, size_t begin, size_t end, RuleStats *stats);
+
+    // The current version as one buffer: a single piece in place, anything
+    // else flattened into m_scratch. Null for an empty document.
+    const char *contiguousData();
+
+    // Push a version consisting of the bytes in output
+    void pushOutput(const std::string& output);
+
+    // Append a piece, extending the last one when the bytes are contiguous
+    static void appendPiece(std::vector<Piece>& pieces, Source source, size_t offset, size_t length);
+
+    const char *m_original;
+    std::string m_added;
+    std::vector<Version> m_versions;
+    size_t m_current;
+
+    // Flattened copy of a multi-piece version for applyOutput()
+    std::string m_scratch;
+    // Replacement bytes of the version being built; the scan may read
+    // m_added, so they are only appended once it is done
+    std::string m_pending;
+    std::vector<int64_t> m_replacementOffsets;
+};
+
+#endif // PIECETABLE_H
@@ -0,0 +1,186 @@
+#include "pipefilter.h"
+#include "tracer.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+#ifdef __linux__
+// Grow a pipe towards size so fewer, larger transfers cross it; the
+// kernel caps unprivileged pipes at /proc/sys/fs/pipe-max-size
+void growPipe(int fd, size_t size)
+{
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISFIFO(info.st_mode)) {
+        return;
+    }
+    const int current = fcntl(fd, F_GETPIPE_SZ);
+    for (size_t request = size; current >= 0 && request > static_cast<size_t>(current); request /= 2) {
+        if (fcntl(fd, F_SETPIPE_SZ, static_cast<int>(request)) >= 0) {
+            return;
+        }
+    }
+}
+#endif
+
+} // namespace
+
+PipeFilter::PipeFilter(const RulePipeline& pipeline)
+    : PipeFilter(pipeline, Options())
+{
+}
+
+PipeFilter::PipeFilter(const RulePipeline& pipeline, const Options& options)
+    : m_pipeline(pipeline)
+    , m_options(options)
+{
+    m_options.readSize = std::max<size_t>(m_options.readSize, 4096);
+    m_options.outputSize = std::max<size_t>(m_options.outputSize, 4096);
+}
+
+bool PipeFilter::parseFlush(const char *name, Flush *flush)
+{
+    if (std::strcmp(name, "throughput") == 0) {
+        *flush = Flush::Throughput;
+    } else if (std::strcmp(name, "latency") == 0) {
+        *flush = Flush::Latency;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+size_t PipeFilter::memoryBytes() const
+{
+    return m_options.readSize + m_options.outputSize;
+}
+
+PipeFilter::Result PipeFilter::run(int inFd, int outFd, RuleStats *stats)
+{
+    TRACE_SCOPE("pipeFilter");
+
+    m_result = Result();
+    m_input.resize(m_options.readSize);
+    m_output.clear();
+    m_output.reserve(m_options.outputSize);
+#ifdef _WIN32
+    _setmode(inFd, _O_BINARY);
+    _setmode(outFd, _O_BINARY);
+#endif
+#ifdef __linux__
+    growPipe(inFd, m_options.readSize);
+    growPipe(outFd, m_options.readSize);
+#endif
+
+    const bool latency = m_options.flush == Flush::Latency;
+    auto source = [&](const StreamReplacer::Writer& feed) {
+        for (;;) {
+            // Throughput waits for a full buffer; latency takes what the
+            // producer has written so far
+            size_t filled = 0;
+            long long got = 0;
+            do {
+                got = readSome(inFd, m_input.data() + filled, m_input.size() - filled);
+                filled += got > 0 ? static_cast<size_t>(got) : 0;
+            } while (!latency && got > 0 && filled < m_input.size());
+            if (filled > 0) {
+                m_result.bytesIn += filled;
+                feed(m_input.data(), filled);
+                if (latency) {
+                    flushOutput(outFd);
+                }
+            }
+            if (got <= 0 || !m_result.ok) {
+                return;
+            }
+        }
+    };
+    auto sink = [&](const char *data, size_t length) {
+        if (!m_result.ok) {
+            return;
+        }
+        if (m_output.size() + length > m_options.outputSize) {
+            flushOutput(outFd);
+            // Spans beyond the buffer go out as they are, without a copy
+            if (length >= m_options.outputSize) {
+                writeAll(outFd, data, length);
+                return;
+            }
+        }
+        m_output.append(data, length);
+    };
+    m_result.matches = m_pipeline.stream(source, sink, stats);
+    flushOutput(outFd);
+
+    m_input = std::vector<char>();
+    m_output = std::string();
+    return m_result;
+}
+
+long long PipeFilter::readSome(int fd, char *data, size_t length)
+{
+    for (;;) {
+#ifdef _WIN32
+        const long long got = _read(fd, data, static_cast<unsigned>(std::min<size_t>(length, 1u << 30)));
+#else
+        const long long got = read(fd, data, length);
+#endif
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        ++m_result.reads;
+        if (got < 0) {
+            fail("read");
+        }
+        return got;
+    }
+}
+
+bool PipeFilter::writeAll(int fd, const char *data, size_t length)
+{
+    while (length > 0 && m_result.ok) {
+#ifdef _WIN32
+        const long long put = _write(fd, data, static_cast<unsigned>(std::min<size_t>(length, 1u << 30)));
+#else
+        const long long put = write(fd, data, length);
+#endif
+        if (put < 0 && errno == EINTR) {
+            continue;
+        }
+        ++m_result.writes;
+        if (put <= 0) {
+            fail("write");
+            return false;
+        }
+        data += put;
+        length -= static_cast<size_t>(put);
+        m_result.bytesOut += static_cast<uint64_t>(put);
+    }
+    return m_result.ok;
+}
+
+void PipeFilter::flushOutput(int fd)
+{
+    if (!m_output.empty()) {
+        writeAll(fd, m_output.data(), m_output.size());
+        m_output.clear();
+    }
+}
+
+void PipeFilter::fail(const char *operation)
+{
+    if (m_result.ok) {
+        m_result.ok = false;
+        m_result.error = std::string(operation) + ": " + std::strerror(errno);
+    }
+}
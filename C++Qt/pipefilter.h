@@ -0,0 +1,79 @@
+#ifndef PIPEFILTER_H
+#define PIPEFILTER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "rulepipeline.h"
+
+/**
+ * PipeFilter runs a compiled pipeline as a Unix filter: it reads a file
+ * descriptor (stdin) as the input arrives and writes the replaced text to
+ * another (stdout), so the engine fits into shell pipelines without
+ * temporary files. The output is exactly what replaceInto() gives for the
+ * whole input.
+ *
+ * Memory is bounded by the read buffer, the output buffer and the chunk
+ * buffers of the passes, however long the stream runs. The flush policy
+ * trades latency for syscalls: Throughput fills the read buffer and holds
+ * output until the output buffer is full, Latency hands every read to the
+ * pipeline at once and writes what it decided right away. Either way the
+ * last maxPatternLength() - 1 bytes of a pass stay back until more input
+ * or the end of the stream decides whether a match starts in them.
+ *
+ * On Linux, pipes at both ends are grown to the read size (up to the
+ * system's pipe-max-size) so producer and consumer switch less often.
+ */
+class PipeFilter
+{
+public:
+    enum class Flush { Throughput, Latency };
+
+    struct Options {
+        Flush flush = Flush::Throughput;
+        size_t readSize = kDefaultReadSize;
+        size_t outputSize = kDefaultOutputSize;   // output held before a write, Throughput only
+    };
+
+    struct Result {
+        bool ok = true;
+        std::string error;    // failed operation and its errno text
+        uint64_t bytesIn = 0;
+        uint64_t bytesOut = 0;
+        uint64_t matches = 0;
+        uint64_t reads = 0;
+        uint64_t writes = 0;
+    };
+
+    explicit PipeFilter(const RulePipeline& pipeline);
+    PipeFilter(const RulePipeline& pipeline, const Options& options);
+
+    // Filter inFd to outFd until the end of the input or an error. Stats,
+    // if given, must be reset(pipeline.ruleCount()).
+    Result run(int inFd, int outFd, RuleStats *stats = nullptr);
+
+    // Buffers the filter holds while running
+    size_t memoryBytes() const;
+
+    // "throughput" or "latency"
+    static bool parseFlush(const char *name, Flush *flush);
+
+    static constexpr size_t kDefaultReadSize = 1024 * 1024;
+    static constexpr size_t kDefaultOutputSize = 1024 * 1024;
+
+private:
+    // Read up to length bytes; 0 at the end of the input, -1 on error
+    long long readSome(int fd, char *data, size_t length);
+    bool writeAll(int fd, const char *data, size_t length);
+    void flushOutput(int fd);
+    void fail(const char *operation);
+
+    const RulePipeline& m_pipeline;
+    Options m_options;
+    std::vector<char> m_input;
+    std::string m_output;
+    Result m_result;
+};
+
+#endif // PIPEFILTER_H
@@ -0,0 +1,266 @@
+#include "replacedaemon.h"
+#include "batchjob.h"
+#include "tracer.h"
+#include <QJsonDocument>
+#include <QJsonArray>
+#include <QElapsedTimer>
+#include <cstring>
+
+ReplaceDaemon::ReplaceDaemon(QObject *parent)
+    : QObject(parent)
+    , m_jobs(0)
+    , m_bytesProcessed(0)
+{
+    connect(&m_server, &QLocalServer::newConnection, this, &ReplaceDaemon::onNewConnection);
+}
+
+ReplaceDaemon::~ReplaceDaemon()
+{
+    qDeleteAll(m_outputs);
+}
+
+QString ReplaceDaemon::defaultServerName()
+{
+    return "multreplacer";
+}
+
+bool ReplaceDaemon::listen(const QString& name, QString *error)
+{
+    // A socket left behind by a crashed daemon would block the name
+    QLocalServer::removeServer(name);
+    m_server.setSocketOptions(QLocalServer::UserAccessOption);
+    if (!m_server.listen(name)) {
+        *error = m_server.errorString();
+        return false;
+    }
+    return true;
+}
+
+void ReplaceDaemon::onNewConnection()
+{
+    while (QLocalSocket *socket = m_server.nextPendingConnection()) {
+        connect(socket, &QLocalSocket::readyRead, this, &ReplaceDaemon::onReadyRead);
+        connect(socket, &QLocalSocket::disconnected, this, &ReplaceDaemon::onDisconnected);
+    }
+}
+
+void ReplaceDaemon::onDisconnected()
+{
+    QLocalSocket *socket = qobject_cast<QLocalSocket*>(sender());
+    releaseOutput(socket);
+    socket->deleteLater();
+}
+
+void ReplaceDaemon::onReadyRead()
+{
+    QLocalSocket *socket = qobject_cast<QLocalSocket*>(sender());
+    while (socket->canReadLine()) {
+        const QByteArray line = socket->readLine();
+        QJsonParseError parseError;
+        const QJsonDocument document = QJsonDocument::fromJson(line, &parseError);
+
+        QJsonObject reply;
+        if (!document.isObject()) {
+            reply = errorReply(QString("invalid request: %1").arg(parseError.errorString()));
+        } else {
+            const QJsonObject request = document.object();
+            reply = handleRequest(socket, request);
+            if (request.contains("id")) {
+                reply["id"] = request.value("id");
+            }
+        }
+        socket->write(QJsonDocument(reply).toJson(QJsonDocument::Compact));
+        socket->write("\n");
+    }
+}
+
+QJsonObject ReplaceDaemon::errorReply(const QString& message)
+{
+    QJsonObject reply;
+    reply["ok"] = false;
+    reply["error"] = message;
+    return reply;
+}
+
+QJsonObject ReplaceDaemon::handleRequest(QLocalSocket *socket, const QJsonObject& request)
+{
+    // An output segment lives until the client's next request
+    releaseOutput(socket);
+
+    const QString op = request.value("op").toString();
+    if (op == "define") {
+        return defineRules(request, nullptr);
+    }
+    if (op == "replace") {
+        return replace(socket, request);
+    }
+    if (op == "stats") {
+        return statistics();
+    }
+    if (op == "quit") {
+        emit quitRequested();
+        QJsonObject reply;
+        reply["ok"] = true;
+        return reply;
+    }
+    return errorReply(QString("unknown op: %1").arg(op));
+}
+
+QJsonObject ReplaceDaemon::defineRules(const QJsonObject& request, std::shared_ptr<const RulePipeline> *pipeline)
+{
+    auto rules = std::make_shared<RulePipeline>();
+    TextEncoding encoding;
+    QString error;
+    size_t dropped = 0;
+    if (!BatchJob::parseRules(request, *rules, encoding, &error, &dropped)) {
+        return errorReply(error);
+    }
+
+    const uint64_t missesBefore = m_cache.misses();
+    uint64_t id = 0;
+    std::shared_ptr<const RulePipeline> compiled = m_cache.insert(std::move(rules), encoding, &id);
+    if (pipeline) {
+        *pipeline = compiled;
+    }
+
+    QJsonObject reply;
+    reply["ok"] = true;
+    reply["ruleset"] = QString::number(id, 16).rightJustified(16, '0');
+    reply["rules"] = static_cast<qint64>(compiled->ruleCount());
+    reply["passes"] = static_cast<qint64>(compiled->passCount());
+    reply["dropped"] = static_cast<qint64>(dropped);
+    reply["cached"] = m_cache.misses() == missesBefore;
+    return reply;
+}
+
+QJsonObject ReplaceDaemon::replace(QLocalSocket *socket, const QJsonObject& request)
+{
+    TRACE_SCOPE("daemonJob");
+    QElapsedTimer timer;
+    timer.start();
+
+    // The rule set is either cached already or defined inline
+    std::shared_ptr<const RulePipeline> pipeline;
+    QString rulesetId;
+    if (request.contains("ruleset")) {
+        bool ok = false;
+        const uint64_t id = request.value("ruleset").toString().toULongLong(&ok, 16);
+        pipeline = ok ? m_cache.find(id) : nullptr;
+        if (!pipeline) {
+            return errorReply("unknown ruleset");
+        }
+        rulesetId = request.value("ruleset").toString();
+    } else {
+        const QJsonObject defined = defineRules(request, &pipeline);
+        if (!defined.value("ok").toBool()) {
+            return defined;
+        }
+        rulesetId = defined.value("ruleset").toString();
+    }
+
+    RuleStats stats;
+    stats.reset(pipeline->ruleCount());
+    QJsonObject reply;
+    if (request.contains("path")) {
+        const BatchResult result = BatchJob::replaceFile(*pipeline, request.value("path").toString(),
+                                                         request.value("output").toString(), &stats);
+        if (!result.ok) {
+            return errorReply(result.error);
+        }
+        reply = result.toJson();
+    } else if (request.contains("text")) {
+        std::string input;
+        if (!TextCodec::fromQString(request.value("text").toString(), pipeline->encoding(), input)) {
+            return errorReply(QString("text not representable in %1").arg(TextCodec::name(pipeline->encoding())));
+        }
+        std::string output;
+        output.reserve(input.size());
+        pipeline->replaceInto(input.data(), input.size(), output, &stats);
+        reply["text"] = TextCodec::toQString(output.data(), output.size(), pipeline->encoding());
+        reply["bytesIn"] = static_cast<qint64>(input.size());
+        reply["bytesOut"] = static_cast<qint64>(output.size());
+    } else if (request.contains("shm")) {
+        reply = replaceShared(socket, *pipeline, request, stats);
+        if (!reply.value("ok").toBool()) {
+            return reply;
+        }
+    } else {
+        return errorReply("replace needs path, text or shm");
+    }
+
+    QJsonArray hits;
+    for (size_t r = 0; r < stats.ruleCount(); ++r) {
+        hits.append(static_cast<qint64>(stats.counter(r).hits));
+    }
+    reply["ok"] = true;
+    reply["ruleset"] = rulesetId;
+    reply["matches"] = static_cast<qint64>(stats.totalHits());
+    reply["sizeDelta"] = static_cast<qint64>(stats.sizeDelta());
+    reply["hits"] = hits;
+    reply["micros"] = static_cast<qint64>(timer.nsecsElapsed() / 1000);
+
+    ++m_jobs;
+    m_bytesProcessed += static_cast<quint64>(reply.value("bytesIn").toInteger());
+    return reply;
+}
+
+QJsonObject ReplaceDaemon::replaceShared(QLocalSocket *socket, const RulePipeline& pipeline,
+                                         const QJsonObject& request, RuleStats& stats)
+{
+    const QString key = request.value("shm").toString();
+    QSharedMemory input(key);
+    if (!input.attach()) {
+        return errorReply(QString("cannot attach %1: %2").arg(key, input.errorString()));
+    }
+    const qint64 length = request.value("length").toInteger(-1);
+    if (length < 0 || length > input.size()) {
+        return errorReply("length does not fit the segment");
+    }
+
+    // The input is scanned where it is; only the result is built here
+    input.lock();
+    QByteArray output;
+    output.reserve(length);
+    pipeline.replaceInto(static_cast<const char *>(input.constData()), static_cast<size_t>(length), output, &stats);
+
+    QJsonObject reply;
+    if (output.size() <= input.size()) {
+        std::memcpy(input.data(), output.constData(), static_cast<size_t>(output.size()));
+        input.unlock();
+        reply["shm"] = key;
+    } else {
+        input.unlock();
+        QSharedMemory *result = new QSharedMemory(key + ".out");
+        if (!result->create(output.size())) {
+            const QString message = result->errorString();
+            delete result;
+            return errorReply(QString("cannot create %1.out: %2").arg(key, message));
+        }
+        result->lock();
+        std::memcpy(result->data(), output.constData(), static_cast<size_t>(output.size()));
+        result->unlock();
+        m_outputs.insert(socket, result);
+        reply["shm"] = result->key();
+    }
+    reply["ok"] = true;
+    reply["bytesIn"] = length;
+    reply["bytesOut"] = static_cast<qint64>(output.size());
+    return reply;
+}
+
+QJsonObject ReplaceDaemon::statistics() const
+{
+    QJsonObject reply;
+    reply["ok"] = true;
+    reply["jobs"] = static_cast<qint64>(m_jobs);
+    reply["bytes"] = static_cast<qint64>(m_bytesProcessed);
+    reply["rulesets"] = static_cast<qint64>(m_cache.size());
+    reply["cacheHits"] = static_cast<qint64>(m_cache.hits());
+    reply["cacheMisses"] = static_cast<qint64>(m_cache.misses());
+    return reply;
+}
+
+void ReplaceDaemon::releaseOutput(QLocalSocket *socket)
+{
+    delete m_outputs.take(socket);
+}
@@ -0,0 +1,74 @@
+#ifndef REPLACEDAEMON_H
+#define REPLACEDAEMON_H
+
+#include <QObject>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QSharedMemory>
+#include <QJsonObject>
+#include <QHash>
+#include <memory>
+#include "rulesetcache.h"
+
+/**
+ * ReplaceDaemon is the headless resident mode (--daemon): it listens on a
+ * local socket and runs replace jobs with rule sets that stay compiled
+ * between jobs, so short jobs pay neither process startup nor rule
+ * compilation.
+ *
+ * The protocol is one JSON object per line in each direction; every reply
+ * has "ok" (and "error" when false) and echoes the request's "id".
+ *
+ *   {"op": "define", "encoding": ..., "rules": [...]}
+ *       -> {"ruleset": "<hex id>", "rules": n, "passes": n, "dropped": n, "cached": bool}
+ *   {"op": "replace", "ruleset": "<hex id>" | rules inline, and one of
+ *       "path" (+ "output"), "text", or "shm" + "length"}
+ *       -> {"matches", "sizeDelta", "bytesIn", "bytesOut", "hits": [...]}
+ *   {"op": "stats"}, {"op": "quit"}
+ *
+ * Large buffers go through shared memory: the client puts the input in a
+ * QSharedMemory segment and passes its key. The result is written back
+ * into that segment when it fits, otherwise into a new segment "<key>.out"
+ * that the daemon keeps until the connection's next request or disconnect.
+ */
+class ReplaceDaemon : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ReplaceDaemon(QObject *parent = nullptr);
+    ~ReplaceDaemon();
+
+    bool listen(const QString& name, QString *error);
+
+    static QString defaultServerName();
+
+signals:
+    void quitRequested();
+
+private slots:
+    void onNewConnection();
+    void onReadyRead();
+    void onDisconnected();
+
+private:
+    QJsonObject handleRequest(QLocalSocket *socket, const QJsonObject& request);
+    QJsonObject defineRules(const QJsonObject& request, std::shared_ptr<const RulePipeline> *pipeline);
+    QJsonObject replace(QLocalSocket *socket, const QJsonObject& request);
+    QJsonObject replaceShared(QLocalSocket *socket, const RulePipeline& pipeline, const QJsonObject& request,
+                              RuleStats& stats);
+    QJsonObject statistics() const;
+
+    // Drop the output segment the connection may still hold
+    void releaseOutput(QLocalSocket *socket);
+
+    static QJsonObject errorReply(const QString& message);
+
+    QLocalServer m_server;
+    RuleSetCache m_cache;
+    QHash<QLocalSocket*, QSharedMemory*> m_outputs;
+    quint64 m_jobs;
+    quint64 m_bytesProcessed;
+};
+
+#endif // REPLACEDAEMON_H
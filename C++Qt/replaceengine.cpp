@@ -0,0 +1,371 @@
+#include "replaceengine.h"
+#include "tracer.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+void RuleStats::reset(size_t ruleCount)
+{
+    m_counters.assign(ruleCount, Counter());
+}
+
+void RuleStats::merge(const RuleStats& other, size_t firstRule)
+{
+    if (m_counters.size() < firstRule + other.m_counters.size()) {
+        m_counters.resize(firstRule + other.m_counters.size());
+    }
+    for (size_t i = 0; i < other.m_counters.size(); ++i) {
+        Counter& c = m_counters[firstRule + i];
+        c.hits += other.m_counters[i].hits;
+        c.bytesRemoved += other.m_counters[i].bytesRemoved;
+        c.bytesAdded += other.m_counters[i].bytesAdded;
+    }
+}
+
+uint64_t RuleStats::totalHits() const
+{
+    uint64_t total = 0;
+    for (const Counter& c : m_counters) {
+        total += c.hits;
+    }
+    return total;
+}
+
+int64_t RuleStats::sizeDelta() const
+{
+    int64_t delta = 0;
+    for (const Counter& c : m_counters) {
+        delta += static_cast<int64_t>(c.bytesAdded) - static_cast<int64_t>(c.bytesRemoved);
+    }
+    return delta;
+}
+
+std::vector<uint32_t> RuleStats::unusedRules() const
+{
+    std::vector<uint32_t> unused;
+    for (size_t i = 0; i < m_counters.size(); ++i) {
+        if (m_counters[i].hits == 0) {
+            unused.push_back(static_cast<uint32_t>(i));
+        }
+    }
+    return unused;
+}
+
+std::string RuleStats::toText(const ReplaceEngine& engine) const
+{
+    std::string text = "hits\tremoved\tadded\tpattern\n";
+    char buffer[96];
+    for (size_t i = 0; i < m_counters.size() && i < engine.ruleCount(); ++i) {
+        const Counter& c = m_counters[i];
+        std::snprintf(buffer, sizeof(buffer), "%llu\t%llu\t%llu\t",
+                      static_cast<unsigned long long>(c.hits),
+                      static_cast<unsigned long long>(c.bytesRemoved),
+                      static_cast<unsigned long long>(c.bytesAdded));
+        text += buffer;
+        text += engine.pattern(i);
+        text += '\n';
+    }
+    return text;
+}
+
+ReplaceEngine::ReplaceEngine()
+    : m_maxPatternLength(0)
+    , m_encoding(TextEncoding::Utf8)
+    , m_strategy(EngineStrategy::Trie)
+{
+    m_rootNext.fill(-1);
+}
+
+const char *ReplaceEngine::strategyName(EngineStrategy strategy)
+{
+    switch (strategy) {
+    case EngineStrategy::Auto: return "auto";
+    case EngineStrategy::Trie: return "trie";
+    case EngineStrategy::SinglePattern: return "single";
+    case EngineStrategy::ShiftOr: return "shift-or";
+    case EngineStrategy::RollingHash: return "rolling-hash";
+    }
+    return "trie";
+}
+
+bool ReplaceEngine::parseStrategy(const char *name, EngineStrategy *strategy)
+{
+    for (EngineStrategy candidate : {EngineStrategy::Auto, EngineStrategy::Trie, EngineStrategy::SinglePattern,
+                                     EngineStrategy::ShiftOr, EngineStrategy::RollingHash}) {
+        if (std::strcmp(name, strategyName(candidate)) == 0) {
+            *strategy = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ReplaceEngine::compile(const std::map<std::string, std::string>& rules, TextEncoding encoding,
+                            EngineStrategy strategy)
+{
+    RuleStore store;
+    for (const auto& [find_str, replace_str] : rules) {
+        store.set(find_str, replace_str);
+    }
+    compile(store, encoding, strategy);
+}
+
+void ReplaceEngine::compile(const RuleStore& rules, TextEncoding encoding, EngineStrategy strategy)
+{
+    TRACE_SCOPE("compileRules");
+
+    m_encoding = encoding;
+    m_rules = rules;
+    m_maxPatternLength = 0;
+    for (size_t r = 0; r < m_rules.size(); ++r) {
+        m_maxPatternLength = std::max(m_maxPatternLength, m_rules.pattern(r).size());
+    }
+
+    buildTrie();
+    selectStrategy(strategy);
+}
+
+void ReplaceEngine::buildTrie()
+{
+    // Sort the rules by pattern; every trie node is then a contiguous range of
+    // rules sharing a prefix, and its children are the runs of equal bytes at
+    // the next depth. Nodes are laid out breadth-first straight into the
+    // flattened arrays, so no per-node edge lists are ever allocated.
+    m_sortedRules.resize(m_rules.size());
+    for (size_t r = 0; r < m_sortedRules.size(); ++r) {
+        m_sortedRules[r] = static_cast<uint32_t>(r);
+    }
+    std::sort(m_sortedRules.begin(), m_sortedRules.end(), [this](uint32_t a, uint32_t b) {
+        return m_rules.pattern(a) < m_rules.pattern(b);
+    });
+
+    m_nodes.assign(1, Node());
+    m_edgeBytes.clear();
+    m_edgeTargets.clear();
+    m_pending.clear();
+    m_pending.push_back({0, static_cast<uint32_t>(m_sortedRules.size()), 0});
+
+    // Node n is described by m_pending[n]
+    for (size_t n = 0; n < m_pending.size(); ++n) {
+        PendingNode pending = m_pending[n];
+        uint32_t first = pending.first;
+
+        // Patterns are unique, so at most one ends here and it sorts first
+        if (first < pending.last && m_rules.pattern(m_sortedRules[first]).size() == pending.depth) {
+            m_nodes[n].rule = static_cast<int32_t>(m_sortedRules[first]);
+            ++first;
+        }
+
+        m_nodes[n].firstEdge = static_cast<uint32_t>(m_edgeBytes.size());
+        while (first < pending.last) {
+            const char byte = m_rules.pattern(m_sortedRules[first])[pending.depth];
+            uint32_t end = first + 1;
+            while (end < pending.last && m_rules.pattern(m_sortedRules[end])[pending.depth] == byte) {
+                ++end;
+            }
+            m_edgeBytes.push_back(static_cast<unsigned char>(byte));
+            m_edgeTargets.push_back(static_cast<uint32_t>(m_nodes.size()));
+            m_nodes.emplace_back();
+            m_pending.push_back({first, end, pending.depth + 1});
+            first = end;
+        }
+        m_nodes[n].edgeCount = static_cast<uint32_t>(m_edgeBytes.size()) - m_nodes[n].firstEdge;
+    }
+
+    m_rootNext.fill(-1);
+    m_startBytes.clear();
+    for (uint32_t e = 0; e < m_nodes[0].edgeCount; ++e) {
+        m_rootNext[m_edgeBytes[e]] = static_cast<int32_t>(m_edgeTargets[e]);
+        m_startBytes.insert(m_edgeBytes[e]);
+    }
+}
+
+void ReplaceEngine::selectStrategy(EngineStrategy requested)
+{
+    m_strategy = EngineStrategy::Trie;
+
+    // The kernels step one code unit at a time, which is only character
+    // aligned in UTF-8; legacy encodings keep the aligned trie scan
+    if (isEmpty() || !TextCodec::isSelfSynchronizing(m_encoding)) {
+        return;
+    }
+
+    std::vector<KernelPattern<char>>& patterns = m_kernelPatterns;
+    patterns.clear();
+    for (size_t r = 0; r < m_rules.size(); ++r) {
+        const std::string_view pattern = m_rules.pattern(r);
+        patterns.push_back({pattern.data(), static_cast<uint32_t>(pattern.size()), static_cast<uint32_t>(r)});
+    }
+
+    auto trySingle = [&]() {
+        if (patterns.size() != 1) return false;
+        m_singleKernel.build(patterns[0]);
+        return true;
+    };
+    auto tryShiftOr = [&]() { return m_shiftOrKernel.build(patterns); };
+    auto tryRollingHash = [&]() { return patterns.size() > 1 && m_rollingHashKernel.build(patterns); };
+
+    switch (requested) {
+    case EngineStrategy::Trie:
+        return;
+    case EngineStrategy::SinglePattern:
+        if (trySingle()) m_strategy = EngineStrategy::SinglePattern;
+        return;
+    case EngineStrategy::ShiftOr:
+        if (tryShiftOr()) m_strategy = EngineStrategy::ShiftOr;
+        return;
+    case EngineStrategy::RollingHash:
+        if (tryRollingHash()) m_strategy = EngineStrategy::RollingHash;
+        return;
+    case EngineStrategy::Auto:
+        break;
+    }
+
+    // The trie's vector skip beats Shift-And when few bytes can start a
+    // pattern, so Shift-And is only preferred for wide start-byte sets
+    size_t startByteCount = 0;
+    for (bool b : m_startBytes.contains) {
+        startByteCount += b ? 1 : 0;
+    }
+    if (trySingle()) {
+        m_strategy = EngineStrategy::SinglePattern;
+    } else if (startByteCount > kShiftOrMinStartBytes && tryShiftOr()) {
+        m_strategy = EngineStrategy::ShiftOr;
+    } else if (startByteCount > kShiftOrMinStartBytes && tryRollingHash()) {
+        m_strategy = EngineStrategy::RollingHash;
+    }
+}
+
+int ReplaceEngine::matchAt(const char *data, size_t length, size_t pos, uint32_t *matchLength) const
+{
+    int32_t next = m_rootNext[static_cast<unsigned char>(data[pos])];
+    if (next < 0) {
+        return -1;
+    }
+
+    int bestRule = -1;
+    uint32_t node = static_cast<uint32_t>(next);
+    size_t i = pos + 1;
+    for (;;) {
+        if (m_nodes[node].rule >= 0) {
+            bestRule = m_nodes[node].rule;
+            *matchLength = static_cast<uint32_t>(i - pos);
+        }
+        if (i >= length || m_nodes[node].edgeCount == 0) {
+            break;
+        }
+        const unsigned char byte = static_cast<unsigned char>(data[i]);
+        const unsigned char *first = m_edgeBytes.data() + m_nodes[node].firstEdge;
+        const unsigned char *last = first + m_nodes[node].edgeCount;
+        const unsigned char *edge = std::lower_bound(first, last, byte);
+        if (edge == last || *edge != byte) {
+            break;
+        }
+        node = m_edgeTargets[edge - m_edgeBytes.data()];
+        ++i;
+    }
+    return bestRule;
+}
+
+size_t ReplaceEngine::memoryBytes() const
+{
+    // The kernels' fixed tables are part of the object itself
+    return sizeof(*this) + m_rules.memoryBytes()
+        + m_nodes.capacity() * sizeof(Node)
+        + m_edgeBytes.capacity() + m_edgeTargets.capacity() * sizeof(uint32_t)
+        + m_sortedRules.capacity() * sizeof(uint32_t) + m_pending.capacity() * sizeof(PendingNode)
+        + m_kernelPatterns.capacity() * sizeof(KernelPattern<char>)
+        + m_rollingHashKernel.heapBytes();
+}
+
+std::string ReplaceEngine::replace(const std::string& source, RuleStats *stats) const
+{
+    if (source.empty() || isEmpty()) {
+        return source;
+    }
+
+    std::string result;
+    result.reserve(source.size());
+    replaceInto(source.data(), source.size(), result, stats);
+    return result;
+}
+
+bool ReplaceEngine::isLengthPreserving() const
+{
+    for (size_t r = 0; r < m_rules.size(); ++r) {
+        if (m_rules.pattern(r).size() != m_rules.replacement(r).size()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint64_t ReplaceEngine::replaceInPlace(char *data, size_t length, RuleStats *stats) const
+{
+    TRACE_SCOPE("replaceInPlace");
+
+    // Overwriting a match is safe while scanning: every kernel resumes
+    // after the match and never reads its bytes again
+    uint64_t matches = 0;
+    scan(data, length, [&](const ReplaceMatch& m) {
+        const std::string_view replacement = m_rules.replacement(m.rule);
+        if (std::memcmp(data + m.offset, replacement.data(), m.length) != 0) {
+            std::memcpy(data + m.offset, replacement.data(), m.length);
+        }
+        ++matches;
+        if (stats) {
+            stats->recordHit(m.rule, m.length, m.length);
+        }
+    });
+    return matches;
+}
+
+MatchSummary ReplaceEngine::countMatches(const char *data, size_t length, RuleStats *stats) const
+{
+    TRACE_SCOPE("countMatches");
+
+    MatchSummary summary;
+    if (isEmpty()) {
+        return summary;
+    }
+    scan(data, length, [&](const ReplaceMatch& m) {
+        const size_t replacementLength = m_rules.replacement(m.rule).size();
+        ++summary.matches;
+        summary.sizeDelta += static_cast<int64_t>(replacementLength) - static_cast<int64_t>(m.length);
+        if (stats) {
+            stats->recordHit(m.rule, m.length, replacementLength);
+        }
+    });
+    return summary;
+}
+
+bool ReplaceEngine::containsMatch(const char *data, size_t length) const
+{
+    TRACE_SCOPE("containsMatch");
+
+    if (isEmpty()) {
+        return false;
+    }
+
+    // Block starts need to be character boundaries in legacy encodings,
+    // which only a scan from the start knows
+    if (!TextCodec::isSelfSynchronizing(m_encoding)) {
+        return countMatches(data, length).matches > 0;
+    }
+
+    // Any occurrence means the full scan reports at least one match, so
+    // blocks only overlap by enough for an occurrence to span the seam
+    const size_t overlap = m_maxPatternLength - 1;
+    for (size_t start = 0; start < length; start += kPrescanBlockSize) {
+        const size_t end = std::min(length, start + kPrescanBlockSize + overlap);
+        bool found = false;
+        scan(data + start, end - start, [&found](const ReplaceMatch&) { found = true; });
+        if (found) {
+            return true;
+        }
+        if (end == length) {
+            break;
+        }
+    }
+    return false;
+}
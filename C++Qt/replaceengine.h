@@ -0,0 +1,290 @@
+#ifndef REPLACEENGINE_H
+#define REPLACEENGINE_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "rulestore.h"
+#include "textcodec.h"
+#include "cpudispatch.h"
+#include "smallkernels.h"
+
+class ReplaceEngine;
+
+// Matching strategy of a compiled engine. Auto picks the cheapest kernel
+// that fits the rule set; forcing one that does not fit falls back to Trie.
+enum class EngineStrategy { Auto, Trie, SinglePattern, ShiftOr, RollingHash };
+
+/**
+ * A single match reported by the engine: the pattern of rule `rule`
+ * occupies source bytes [offset, offset + length).
+ */
+struct ReplaceMatch {
+    size_t offset;
+    uint32_t length;
+    uint32_t rule;
+};
+
+// Result of a dry run: what a replacement would do, without its output
+struct MatchSummary {
+    uint64_t matches = 0;
+    int64_t sizeDelta = 0;  // output size minus input size
+};
+
+/**
+ * RuleStats keeps per-rule hit counters for one replacement run.
+ * Counters are plain integers: every worker thread owns its own RuleStats
+ * and the results are combined with merge() once the workers are done,
+ * so parallel runs never contend on shared counters.
+ */
+class RuleStats
+{
+public:
+    struct Counter {
+        uint64_t hits = 0;
+        uint64_t bytesRemoved = 0;
+        uint64_t bytesAdded = 0;
+    };
+
+    // Size the counters for a compiled rule set and zero them
+    void reset(size_t ruleCount);
+
+    void recordHit(uint32_t rule, size_t patternLength, size_t replacementLength)
+    {
+        Counter& c = m_counters[rule];
+        ++c.hits;
+        c.bytesRemoved += patternLength;
+        c.bytesAdded += replacementLength;
+    }
+
+    // Add the counters of another run over the same rule set, or over the
+    // rules numbered from firstRule on in a larger set (see RulePipeline)
+    void merge(const RuleStats& other, size_t firstRule = 0);
+
+    size_t ruleCount() const { return m_counters.size(); }
+    const Counter& counter(size_t rule) const { return m_counters[rule]; }
+    uint64_t totalHits() const;
+
+    // Output size minus input size over all rules
+    int64_t sizeDelta() const;
+
+    // Indexes of rules that never fired
+    std::vector<uint32_t> unusedRules() const;
+
+    // Tab separated report, one line per rule: hits, removed, added, pattern
+    std::string toText(const ReplaceEngine& engine) const;
+
+private:
+    std::vector<Counter> m_counters;
+};
+
+/**
+ * ReplaceEngine compiles a set of {find: replace} rules into a byte trie and
+ * applies them in a single leftmost-longest pass, exactly like the original
+ * sorted-vector implementation but without rescanning every rule at every
+ * position. A compiled engine is immutable and may be shared between threads.
+ */
+class ReplaceEngine
+{
+public:
+    ReplaceEngine();
+
+    // The kernels point into the engine's own rule storage, so a compiled
+    // engine stays where it was built
+    ReplaceEngine(const ReplaceEngine&) = delete;
+    ReplaceEngine& operator=(const ReplaceEngine&) = delete;
+
+    // Build the matcher. Patterns and input are bytes in the given encoding;
+    // in Shift_JIS and EUC-JP matches are only attempted at character
+    // boundaries so a trail byte never starts a match. Rule indexes follow
+    // the store's order. Recompiling reuses all buffers of the previous build.
+    void compile(const RuleStore& rules,
+                 TextEncoding encoding = TextEncoding::Utf8,
+                 EngineStrategy strategy = EngineStrategy::Auto);
+
+    // Convenience overload; empty patterns are ignored
+    void compile(const std::map<std::string, std::string>& rules,
+                 TextEncoding encoding = TextEncoding::Utf8,
+                 EngineStrategy strategy = EngineStrategy::Auto);
+
+    bool isEmpty() const { return m_rules.empty(); }
+    size_t ruleCount() const { return m_rules.size(); }
+    size_t maxPatternLength() const { return m_maxPatternLength; }
+    TextEncoding encoding() const { return m_encoding; }
+    EngineStrategy strategy() const { return m_strategy; }
+    static const char *strategyName(EngineStrategy strategy);
+    static bool parseStrategy(const char *name, EngineStrategy *strategy);
+    std::string_view pattern(size_t rule) const { return m_rules.pattern(rule); }
+    std::string_view replacement(size_t rule) const { return m_rules.replacement(rule); }
+    const RuleStore& rules() const { return m_rules; }
+
+    // Switch the matching strategy without rebuilding the trie, e.g. to
+    // the one EngineTuner chose; falls back to Trie as compile() does
+    void setStrategy(EngineStrategy strategy) { selectStrategy(strategy); }
+
+    // Bytes that can start a pattern
+    const ByteSet& startBytes() const { return m_startBytes; }
+
+    // Longest rule whose pattern starts at data[pos], or -1
+    int matchAt(const char *data, size_t length, size_t pos, uint32_t *matchLength) const;
+
+    // Report all leftmost-longest, non-overlapping matches in order
+    template <typename Sink>
+    void scan(const char *data, size_t length, Sink&& onMatch) const
+    {
+        if (!TextCodec::isSelfSynchronizing(m_encoding)) {
+            scanAligned(data, length, onMatch);
+            return;
+        }
+        
+        // Small rule sets run on their specialized kernels
+        if (m_strategy != EngineStrategy::Trie) {
+            auto forward = [&onMatch](size_t offset, uint32_t matchLength, uint32_t rule) {
+                onMatch(ReplaceMatch{offset, matchLength, rule});
+            };
+            switch (m_strategy) {
+            case EngineStrategy::SinglePattern:
+                m_singleKernel.scan(data, length, forward);
+                return;
+            case EngineStrategy::ShiftOr:
+                m_shiftOrKernel.scan(data, length, forward);
+                return;
+            case EngineStrategy::RollingHash:
+                m_rollingHashKernel.scan(data, length, forward);
+                return;
+            default:
+                break;
+            }
+        }
+        
+        const CpuDispatch::Kernels& kernels = CpuDispatch::kernels();
+        const unsigned char *bytes = reinterpret_cast<const unsigned char *>(data);
+        size_t pos = 0;
+        while (pos < length) {
+            // Skip straight to the next byte that can start a pattern
+            pos += kernels.findInSet(bytes + pos, length - pos, m_startBytes);
+            if (pos >= length) {
+                break;
+            }
+            uint32_t matchLength = 0;
+            int rule = matchAt(data, length, pos, &matchLength);
+            if (rule >= 0) {
+                onMatch(ReplaceMatch{pos, matchLength, static_cast<uint32_t>(rule)});
+                pos += matchLength;
+            } else {
+                ++pos;
+            }
+        }
+    }
+
+    // Apply all rules to source, appending the result to out. Out is any
+    // byte container with append(const char *, size) (std::string, QByteArray).
+    // Stats, if given, must be reset() for this engine.
+    template <typename Output>
+    void replaceInto(const char *data, size_t length, Output& out, RuleStats *stats = nullptr) const
+    {
+        size_t copied = 0;
+        scan(data, length, [&](const ReplaceMatch& m) {
+            // Unmatched bytes are copied as one span instead of byte by byte
+            out.append(data + copied, m.offset - copied);
+            const std::string_view replacement = m_rules.replacement(m.rule);
+            out.append(replacement.data(), replacement.size());
+            copied = m.offset + m.length;
+            if (stats) {
+                stats->recordHit(m.rule, m.length, replacement.size());
+            }
+        });
+        out.append(data + copied, length - copied);
+    }
+
+    std::string replace(const std::string& source, RuleStats *stats = nullptr) const;
+
+    // Bytes allocated for the compiled engine: its rule copy, the trie and
+    // the kernel tables, including spare capacity
+    size_t memoryBytes() const;
+
+    // True when every replacement has its pattern's byte length, so a run
+    // can patch its input in place
+    bool isLengthPreserving() const;
+
+    // Apply all rules by overwriting matches in data; requires
+    // isLengthPreserving(). Matches whose replacement equals the pattern
+    // are not written, so untouched pages of a mapping stay clean.
+    // Returns the number of matches.
+    uint64_t replaceInPlace(char *data, size_t length, RuleStats *stats = nullptr) const;
+
+    // Dry run: count matches and the size change without building output;
+    // nothing is allocated. Stats, if given, must be reset() for this engine.
+    MatchSummary countMatches(const char *data, size_t length, RuleStats *stats = nullptr) const;
+
+    // Pre-scan: true when at least one rule matches. Stops at the first
+    // block with a match instead of scanning the whole input.
+    bool containsMatch(const char *data, size_t length) const;
+
+private:
+    // Scan for legacy multi-byte encodings, stepping one character at a time
+    template <typename Sink>
+    void scanAligned(const char *data, size_t length, Sink& onMatch) const
+    {
+        size_t pos = 0;
+        while (pos < length) {
+            uint32_t matchLength = 0;
+            int rule = matchAt(data, length, pos, &matchLength);
+            if (rule >= 0) {
+                onMatch(ReplaceMatch{pos, matchLength, static_cast<uint32_t>(rule)});
+                pos += matchLength;
+            } else {
+                pos += TextCodec::charLength(m_encoding, static_cast<unsigned char>(data[pos]));
+            }
+        }
+    }
+
+    void buildTrie();
+    void selectStrategy(EngineStrategy requested);
+
+    // Block size of the containsMatch() early exit
+    static constexpr size_t kPrescanBlockSize = 64 * 1024;
+
+    // Distinct start bytes above which Auto prefers the small kernels to the trie
+    static constexpr size_t kShiftOrMinStartBytes = 3;
+
+    struct Node {
+        int32_t rule = -1;       // rule ending at this node
+        uint32_t firstEdge = 0;  // index into m_edgeBytes/m_edgeTargets
+        uint32_t edgeCount = 0;
+    };
+
+    // Private copy of the rules; copy-assignment reuses its arena on recompile
+    RuleStore m_rules;
+    size_t m_maxPatternLength;
+    TextEncoding m_encoding;
+    EngineStrategy m_strategy;
+
+    // Trie with edges stored contiguously per node, sorted by byte
+    std::vector<Node> m_nodes;
+    std::vector<unsigned char> m_edgeBytes;
+    std::vector<uint32_t> m_edgeTargets;
+    std::array<int32_t, 256> m_rootNext;
+    ByteSet m_startBytes;
+
+    // Scratch space for building the trie, kept to avoid reallocating
+    struct PendingNode {
+        uint32_t first;  // range of m_sortedRules sharing this node's prefix
+        uint32_t last;
+        uint32_t depth;
+    };
+    std::vector<uint32_t> m_sortedRules;
+    std::vector<PendingNode> m_pending;
+    std::vector<KernelPattern<char>> m_kernelPatterns;
+
+    // Specialized kernels; only the one matching m_strategy is built
+    SinglePatternKernel<char> m_singleKernel;
+    ShiftOrKernel<char> m_shiftOrKernel;
+    RollingHashKernel<char> m_rollingHashKernel;
+};
+
+#endif // REPLACEENGINE_H
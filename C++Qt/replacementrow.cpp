@@ -1,10 +1,12 @@
 #include "replacementrow.h"
 #include "translations.h"
+#include <QStyle>
 
 ReplacementRowWidget::ReplacementRowWidget(QWidget *parent)
     : QWidget(parent)
     , m_layout(nullptr)
     , m_deleteButton(nullptr)
+    , m_stageInput(nullptr)
     , m_beforeInput(nullptr)
     , m_arrowLabel(nullptr)
     , m_afterInput(nullptr)
@@ -21,42 +23,35 @@ void ReplacementRowWidget::setupUI()
     m_layout->setSpacing(10);
     
     // Create delete button
-    m_deleteButton = new QPushButton(Translations::tr("delete"), this);
+    m_deleteButton = new QPushButton(Translations::tr(TrKey::Delete), this);
     m_deleteButton->setFixedSize(60, 30);
-    m_deleteButton->setStyleSheet(
-        "QPushButton {"
-        "    background-color: #e74c3c;"
-        "    color: white;"
-        "    border: none;"
-        "    border-radius: 4px;"
-        "    font-weight: bold;"
-        "}"
-        "QPushButton:hover {"
-        "    background-color: #c0392b;"
-        "}"
-        "QPushButton:pressed {"
-        "    background-color: #a93226;"
-        "}"
-    );
+    m_deleteButton->setProperty("role", "danger");
+    
+    // Create stage input field; rules run stage by stage in order of first use
+    m_stageInput = new QLineEdit(this);
+    m_stageInput->setPlaceholderText(Translations::tr(TrKey::StagePlaceholder));
+    m_stageInput->setMinimumHeight(30);
+    m_stageInput->setFixedWidth(120);
     
     // Create "before" input field
     m_beforeInput = new QLineEdit(this);
-    m_beforeInput->setPlaceholderText(Translations::tr("before_placeholder"));
+    m_beforeInput->setPlaceholderText(Translations::tr(TrKey::BeforePlaceholder));
     m_beforeInput->setMinimumHeight(30);
     
     // Create arrow label
     m_arrowLabel = new QLabel("→", this);
     m_arrowLabel->setAlignment(Qt::AlignCenter);
-    m_arrowLabel->setStyleSheet("font-weight: bold; font-size: 14px; color: #7f8c8d;");
+    m_arrowLabel->setProperty("role", "arrow");
     m_arrowLabel->setFixedWidth(20);
     
     // Create "after" input field
     m_afterInput = new QLineEdit(this);
-    m_afterInput->setPlaceholderText(Translations::tr("after_placeholder"));
+    m_afterInput->setPlaceholderText(Translations::tr(TrKey::AfterPlaceholder));
     m_afterInput->setMinimumHeight(30);
     
     // Add widgets to layout
     m_layout->addWidget(m_deleteButton);
+    m_layout->addWidget(m_stageInput);
     m_layout->addWidget(m_beforeInput, 1); // stretch factor 1
     m_layout->addWidget(m_arrowLabel);
     m_layout->addWidget(m_afterInput, 1); // stretch factor 1
@@ -64,24 +59,8 @@ void ReplacementRowWidget::setupUI()
     // Set the layout
     setLayout(m_layout);
     
-    // Style the widget
-    setStyleSheet(
-        "ReplacementRowWidget {"
-        "    background-color: white;"
-        "    border: 1px solid #ecf0f1;"
-        "    border-radius: 4px;"
-        "    margin: 2px;"
-        "}"
-        "QLineEdit {"
-        "    border: 1px solid #bdc3c7;"
-        "    border-radius: 4px;"
-        "    padding: 5px;"
-        "    font-size: 12px;"
-        "}"
-        "QLineEdit:focus {"
-        "    border: 2px solid #3498db;"
-        "}"
-    );
+    // Background and border come from the application stylesheet (AppStyle)
+    setAttribute(Qt::WA_StyledBackground, true);
 }
 
 void ReplacementRowWidget::setupConnections()
@@ -89,6 +68,7 @@ void ReplacementRowWidget::setupConnections()
     connect(m_deleteButton, &QPushButton::clicked, this, &ReplacementRowWidget::onDeleteClicked);
     connect(m_beforeInput, &QLineEdit::textChanged, this, &ReplacementRowWidget::onTextChanged);
     connect(m_afterInput, &QLineEdit::textChanged, this, &ReplacementRowWidget::onTextChanged);
+    connect(m_stageInput, &QLineEdit::textChanged, this, &ReplacementRowWidget::onTextChanged);
 }
 
 QString ReplacementRowWidget::getBeforeText() const
@@ -101,6 +81,11 @@ QString ReplacementRowWidget::getAfterText() const
     return m_afterInput->text();
 }
 
+QString ReplacementRowWidget::getStageName() const
+{
+    return m_stageInput->text().trimmed();
+}
+
 void ReplacementRowWidget::setBeforeText(const QString& text)
 {
     m_beforeInput->setText(text);
@@ -111,6 +96,11 @@ void ReplacementRowWidget::setAfterText(const QString& text)
     m_afterInput->setText(text);
 }
 
+void ReplacementRowWidget::setStageName(const QString& name)
+{
+    m_stageInput->setText(name);
+}
+
 bool ReplacementRowWidget::isValid() const
 {
     return !m_beforeInput->text().trimmed().isEmpty();
@@ -118,6 +108,7 @@ bool ReplacementRowWidget::isValid() const
 
 void ReplacementRowWidget::clear()
 {
+    m_stageInput->clear();
     m_beforeInput->clear();
     m_afterInput->clear();
 }
@@ -127,11 +118,26 @@ void ReplacementRowWidget::focusBeforeInput()
     m_beforeInput->setFocus();
 }
 
+void ReplacementRowWidget::setIssue(const QString& message)
+{
+    const bool hasIssue = !message.isEmpty();
+    if (property("issue").toBool() == hasIssue && toolTip() == message) {
+        return;
+    }
+    setToolTip(message);
+    setProperty("issue", hasIssue);
+    
+    // Dynamic properties take effect in the stylesheet after a re-polish
+    style()->unpolish(this);
+    style()->polish(this);
+}
+
 void ReplacementRowWidget::updateTexts()
 {
-    m_deleteButton->setText(Translations::tr("delete"));
-    m_beforeInput->setPlaceholderText(Translations::tr("before_placeholder"));
-    m_afterInput->setPlaceholderText(Translations::tr("after_placeholder"));
+    m_deleteButton->setText(Translations::tr(TrKey::Delete));
+    m_stageInput->setPlaceholderText(Translations::tr(TrKey::StagePlaceholder));
+    m_beforeInput->setPlaceholderText(Translations::tr(TrKey::BeforePlaceholder));
+    m_afterInput->setPlaceholderText(Translations::tr(TrKey::AfterPlaceholder));
 }
 
 void ReplacementRowWidget::onDeleteClicked()
@@ -141,5 +147,6 @@ void ReplacementRowWidget::onDeleteClicked()
 
 void ReplacementRowWidget::onTextChanged()
 {
+    setIssue(QString());
     emit contentChanged();
 }
\ No newline at end of file
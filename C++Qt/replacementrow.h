@@ -23,9 +23,13 @@ public:
     QString getBeforeText() const;
     QString getAfterText() const;
     
+    // Name of the stage the rule belongs to; empty for the default stage
+    QString getStageName() const;
+    
     // Setters for the replacement rule
     void setBeforeText(const QString& text);
     void setAfterText(const QString& text);
+    void setStageName(const QString& name);
     
     // Check if the rule is valid (has non-empty before text)
     bool isValid() const;
@@ -35,6 +39,10 @@ public:
     
     // Focus on the "before" input field
     void focusBeforeInput();
+    
+    // Highlight the row with a finding of the rule analysis, shown as its
+    // tooltip; an empty message clears it. Editing the row clears it too.
+    void setIssue(const QString& message);
 
     void updateTexts();
 
@@ -56,6 +64,7 @@ private:
     // UI components
     QHBoxLayout *m_layout;
     QPushButton *m_deleteButton;
+    QLineEdit *m_stageInput;
     QLineEdit *m_beforeInput;
     QLabel *m_arrowLabel;
     QLineEdit *m_afterInput;
@@ -0,0 +1,266 @@
+#include "resultcache.h"
+#include "contenthash.h"
+#include "rulepipeline.h"
+#include "tracer.h"
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+// File layout, in the machine's byte order: magic, version, entry count,
+// then per entry its key, matches, size change and index
+const char kMagic[4] = {'M', 'R', 'R', 'C'};
+const uint32_t kFormatVersion = 1;
+
+template <typename T>
+bool writeValue(std::FILE *file, const T& value)
+{
+    return std::fwrite(&value, sizeof(value), 1, file) == 1;
+}
+
+template <typename T>
+bool readValue(std::FILE *file, T& value)
+{
+    return std::fread(&value, sizeof(value), 1, file) == 1;
+}
+
+} // namespace
+
+ResultCache::ResultCache(size_t capacityBytes)
+    : m_capacity(capacityBytes)
+    , m_bytes(0)
+    , m_hits(0)
+    , m_misses(0)
+{
+}
+
+ResultCache::Key ResultCache::key(const RulePipeline& pipeline, const char *data, size_t length)
+{
+    TRACE_SCOPE("hashContent");
+
+    return key(pipeline, ContentHash::hash64(data, length), length);
+}
+
+ResultCache::Key ResultCache::key(const RulePipeline& pipeline, uint64_t contentHash, size_t length)
+{
+    Key key;
+    key.content = contentHash;
+    key.length = length;
+    key.ruleSet = pipeline.ruleSetHash(pipeline.encoding());
+    return key;
+}
+
+std::shared_ptr<const ResultCache::Entry> ResultCache::find(const Key& key)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_slots.find(key);
+    if (it == m_slots.end()) {
+        ++m_misses;
+        return nullptr;
+    }
+    ++m_hits;
+    m_uses.splice(m_uses.begin(), m_uses, it->second.use);
+    return it->second.entry;
+}
+
+void ResultCache::insert(const Key& key, Entry entry)
+{
+    limitIndex(entry);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    insertLocked(key, std::make_shared<const Entry>(std::move(entry)));
+}
+
+void ResultCache::limitIndex(Entry& entry) const
+{
+    // The counts still let unchanged content without matches skip the scan
+    if (entry.hasIndex && entryBytes(entry) > m_capacity / 8) {
+        entry.hasIndex = false;
+        entry.index = std::vector<ReplaceMatch>();
+    }
+}
+
+void ResultCache::insertLocked(const Key& key, std::shared_ptr<const Entry> entry)
+{
+    auto [it, added] = m_slots.try_emplace(key);
+    Slot& slot = it->second;
+    if (added) {
+        m_uses.push_front(key);
+        slot.use = m_uses.begin();
+    } else {
+        m_bytes -= entryBytes(*slot.entry);
+        m_uses.splice(m_uses.begin(), m_uses, slot.use);
+    }
+    m_bytes += entryBytes(*entry);
+    slot.entry = std::move(entry);
+    while (m_bytes > m_capacity && m_slots.size() > 1) {
+        evictOldest();
+    }
+}
+
+void ResultCache::evictOldest()
+{
+    auto oldest = m_slots.find(m_uses.back());
+    m_bytes -= entryBytes(*oldest->second.entry);
+    m_slots.erase(oldest);
+    m_uses.pop_back();
+}
+
+void ResultCache::clear()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_slots.clear();
+    m_uses.clear();
+    m_bytes = 0;
+}
+
+size_t ResultCache::entryBytes(const Entry& entry)
+{
+    return sizeof(Key) + sizeof(Entry) + entry.index.capacity() * sizeof(ReplaceMatch);
+}
+
+ResultCache::Entry ResultCache::scan(const RulePipeline& pipeline, const char *data, size_t length, RuleStats *stats)
+{
+    TRACE_SCOPE("scanToIndex");
+
+    const ReplaceEngine& engine = pipeline.pass(0);
+    Entry entry;
+    entry.hasIndex = true;
+    engine.scan(data, length, [&](const ReplaceMatch& m) {
+        const size_t replacementLength = engine.replacement(m.rule).size();
+        entry.index.push_back(m);
+        entry.sizeDelta += static_cast<int64_t>(replacementLength) - static_cast<int64_t>(m.length);
+        if (stats) {
+            stats->recordHit(pipeline.passFirstRule(0) + m.rule, m.length, replacementLength);
+        }
+    });
+    entry.matches = entry.index.size();
+    return entry;
+}
+
+bool ResultCache::hasUsableIndex(const Entry& entry, const RulePipeline& pipeline)
+{
+    if (!entry.hasIndex || pipeline.passCount() != 1) {
+        return false;
+    }
+    const size_t ruleCount = pipeline.pass(0).ruleCount();
+    for (const ReplaceMatch& m : entry.index) {
+        if (m.rule >= ruleCount) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ResultCache::save(const std::string& path) const
+{
+    TRACE_SCOPE("saveResultCache");
+
+    const std::string temporary = path + ".tmp";
+    std::FILE *file = std::fopen(temporary.c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+
+    bool ok = true;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ok = std::fwrite(kMagic, sizeof(kMagic), 1, file) == 1
+            && writeValue(file, kFormatVersion)
+            && writeValue(file, static_cast<uint64_t>(m_slots.size()));
+        // Least recently used first, so loading restores the order
+        for (auto it = m_uses.rbegin(); ok && it != m_uses.rend(); ++it) {
+            const Key& key = *it;
+            const Entry& entry = *m_slots.at(key).entry;
+            const uint8_t hasIndex = entry.hasIndex ? 1 : 0;
+            ok = writeValue(file, key.content) && writeValue(file, key.length) && writeValue(file, key.ruleSet)
+                && writeValue(file, entry.matches) && writeValue(file, entry.sizeDelta)
+                && writeValue(file, hasIndex) && writeValue(file, static_cast<uint64_t>(entry.index.size()));
+            for (size_t i = 0; ok && i < entry.index.size(); ++i) {
+                const ReplaceMatch& m = entry.index[i];
+                ok = writeValue(file, static_cast<uint64_t>(m.offset)) && writeValue(file, m.length)
+                    && writeValue(file, m.rule);
+            }
+        }
+    }
+    ok = std::fclose(file) == 0 && ok;
+    if (!ok || std::rename(temporary.c_str(), path.c_str()) != 0) {
+        std::remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool ResultCache::load(const std::string& path)
+{
+    TRACE_SCOPE("loadResultCache");
+
+    std::FILE *file = std::fopen(path.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+
+    char magic[sizeof(kMagic)];
+    uint32_t version = 0;
+    uint64_t count = 0;
+    bool ok = std::fread(magic, sizeof(magic), 1, file) == 1
+        && std::memcmp(magic, kMagic, sizeof(kMagic)) == 0
+        && readValue(file, version) && version == kFormatVersion
+        && readValue(file, count);
+
+    // A truncated file keeps the entries read before the damage
+    for (uint64_t n = 0; ok && n < count; ++n) {
+        Key key;
+        Entry entry;
+        uint8_t hasIndex = 0;
+        uint64_t indexSize = 0;
+        ok = readValue(file, key.content) && readValue(file, key.length) && readValue(file, key.ruleSet)
+            && readValue(file, entry.matches) && readValue(file, entry.sizeDelta)
+            && readValue(file, hasIndex) && readValue(file, indexSize)
+            && indexSize <= key.length;
+        entry.hasIndex = hasIndex != 0;
+
+        // Matches must be in order and apart to be applied; the index
+        // grows as it is read, so a damaged size cannot allocate much
+        uint64_t end = 0;
+        for (uint64_t i = 0; ok && i < indexSize; ++i) {
+            uint64_t offset = 0;
+            ReplaceMatch m;
+            ok = readValue(file, offset) && readValue(file, m.length) && readValue(file, m.rule)
+                && offset >= end && offset + m.length <= key.length;
+            m.offset = static_cast<size_t>(offset);
+            end = offset + m.length;
+            entry.index.push_back(m);
+        }
+        if (ok) {
+            limitIndex(entry);
+            std::lock_guard<std::mutex> lock(m_mutex);
+            insertLocked(key, std::make_shared<const Entry>(std::move(entry)));
+        }
+    }
+    std::fclose(file);
+    return ok;
+}
+
+size_t ResultCache::size() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_slots.size();
+}
+
+size_t ResultCache::bytes() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_bytes;
+}
+
+uint64_t ResultCache::hits() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_hits;
+}
+
+uint64_t ResultCache::misses() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_misses;
+}
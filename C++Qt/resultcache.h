@@ -0,0 +1,125 @@
+#ifndef RESULTCACHE_H
+#define RESULTCACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "replaceengine.h"
+
+class RulePipeline;
+
+/**
+ * ResultCache remembers what a rule set did to some content, keyed by the
+ * content's ContentHash and length and the pipeline's ruleSetHash(), so
+ * running the same rules over unchanged content skips the scan.
+ *
+ * An entry holds the number of matches and the size change. For pipelines
+ * that compile into one pass it also holds the match index, every match's
+ * offset, length and rule, from which the output (or a document version)
+ * is rebuilt by copying spans. Content without matches is recognized from
+ * the entry alone.
+ *
+ * Entries live in memory, the least recently used dropped first once the
+ * cache exceeds its byte capacity, and can be saved to and loaded from a
+ * file so batch runs reuse the results of earlier runs. All members are
+ * thread-safe.
+ */
+class ResultCache
+{
+public:
+    struct Key {
+        uint64_t content = 0;   // ContentHash of the input
+        uint64_t length = 0;
+        uint64_t ruleSet = 0;   // RulePipeline::ruleSetHash()
+
+        bool operator==(const Key& other) const
+        {
+            return content == other.content && length == other.length && ruleSet == other.ruleSet;
+        }
+    };
+
+    struct Entry {
+        uint64_t matches = 0;
+        int64_t sizeDelta = 0;
+        bool hasIndex = false;
+        std::vector<ReplaceMatch> index;   // single-pass pipelines only
+    };
+
+    explicit ResultCache(size_t capacityBytes = 64 * 1024 * 1024);
+
+    static Key key(const RulePipeline& pipeline, const char *data, size_t length);
+    // Key for content whose ContentHash is already known, e.g. fed in pieces
+    static Key key(const RulePipeline& pipeline, uint64_t contentHash, size_t length);
+
+    // Entry for key, or null
+    std::shared_ptr<const Entry> find(const Key& key);
+    void insert(const Key& key, Entry entry);
+    void clear();
+
+    // Scan data with a single-pass pipeline and return its entry with the
+    // match index. Stats, if given, must be reset(pipeline.ruleCount()).
+    static Entry scan(const RulePipeline& pipeline, const char *data, size_t length, RuleStats *stats = nullptr);
+
+    // True when entry has an index that pipeline can rebuild the output
+    // from: one pass, and every rule of the index within it
+    static bool hasUsableIndex(const Entry& entry, const RulePipeline& pipeline);
+
+    // Append the output for data described by an entry with an index to
+    // out (std::string, QByteArray, ...); engine is the pipeline's pass(0)
+    template <typename Output>
+    static void apply(const ReplaceEngine& engine, const Entry& entry, const char *data, size_t length, Output& out)
+    {
+        size_t copied = 0;
+        for (const ReplaceMatch& m : entry.index) {
+            out.append(data + copied, m.offset - copied);
+            const std::string_view replacement = engine.replacement(m.rule);
+            out.append(replacement.data(), replacement.size());
+            copied = m.offset + m.length;
+        }
+        out.append(data + copied, length - copied);
+    }
+
+    // Persist all entries; save() replaces path through a temporary file.
+    // load() adds the entries of path and ignores files of another format.
+    bool save(const std::string& path) const;
+    bool load(const std::string& path);
+
+    size_t size() const;
+    size_t bytes() const;
+    uint64_t hits() const;
+    uint64_t misses() const;
+
+private:
+    struct KeyHash {
+        size_t operator()(const Key& key) const
+        {
+            return static_cast<size_t>(key.content ^ (key.ruleSet * 0x9E3779B97F4A7C15ull) ^ key.length);
+        }
+    };
+
+    struct Slot {
+        std::shared_ptr<const Entry> entry;
+        std::list<Key>::iterator use;   // position in m_uses
+    };
+
+    static size_t entryBytes(const Entry& entry);
+    // Drop an index that would crowd out most other entries
+    void limitIndex(Entry& entry) const;
+    void insertLocked(const Key& key, std::shared_ptr<const Entry> entry);
+    void evictOldest();
+
+    mutable std::mutex m_mutex;
+    size_t m_capacity;
+    size_t m_bytes;
+    std::unordered_map<Key, Slot, KeyHash> m_slots;
+    std::list<Key> m_uses;   // keys of m_slots, most recently used first
+    uint64_t m_hits;
+    uint64_t m_misses;
+};
+
+#endif // RESULTCACHE_H
@@ -0,0 +1,165 @@
+#include "ruleanalyzer.h"
+#include "tracer.h"
+#include <algorithm>
+#include <array>
+#include <unordered_map>
+
+namespace {
+
+const size_t kNone = static_cast<size_t>(-1);
+
+} // namespace
+
+void RuleAnalyzer::clear()
+{
+    m_entries.clear();
+    m_results.clear();
+    m_ruleEntries.clear();
+}
+
+void RuleAnalyzer::add(std::string_view stage, std::string_view pattern, std::string_view replacement)
+{
+    m_entries.push_back({std::string(stage), std::string(pattern), std::string(replacement)});
+}
+
+bool RuleAnalyzer::canOverlap(std::string_view a, std::string_view b)
+{
+    if (a.find(b) != std::string_view::npos || b.find(a) != std::string_view::npos) {
+        return true;
+    }
+    // A proper suffix of one that is a prefix of the other
+    const size_t shorter = std::min(a.size(), b.size());
+    for (size_t length = 1; length < shorter; ++length) {
+        if (a.substr(a.size() - length) == b.substr(0, length)
+            || b.substr(b.size() - length) == a.substr(0, length)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool RuleAnalyzer::canBeTrailByte(TextEncoding encoding, unsigned char byte)
+{
+    switch (encoding) {
+    case TextEncoding::ShiftJis:
+        return byte >= 0x40 && byte <= 0xFC && byte != 0x7F;
+    case TextEncoding::EucJp:
+        return byte >= 0xA1 && byte != 0xFF;
+    case TextEncoding::Utf8:
+        break;
+    }
+    return byte >= 0x80 && byte <= 0xBF;
+}
+
+size_t RuleAnalyzer::build(RulePipeline& pipeline, TextEncoding encoding)
+{
+    TRACE_SCOPE("analyzeRules");
+
+    m_results.assign(m_entries.size(), Result());
+
+    // Stages in order of first use, as RulePipeline::stage() creates them
+    std::vector<std::string_view> stageNames;
+    std::vector<std::vector<size_t>> stageEntries;
+    {
+        std::unordered_map<std::string_view, size_t> stageIndex;
+        for (size_t i = 0; i < m_entries.size(); ++i) {
+            auto inserted = stageIndex.emplace(m_entries[i].stage, stageNames.size());
+            if (inserted.second) {
+                stageNames.push_back(m_entries[i].stage);
+                stageEntries.emplace_back();
+            }
+            stageEntries[inserted.first->second].push_back(i);
+        }
+    }
+
+    // The byte each earlier one-byte rule removes, by the removing entry
+    std::array<size_t, 256> removedBy;
+    removedBy.fill(kNone);
+
+    std::vector<size_t> live;
+    for (const std::vector<size_t>& entries : stageEntries) {
+        // The last entry of a pattern wins
+        std::unordered_map<std::string_view, size_t> lastOf;
+        for (size_t i : entries) {
+            lastOf[m_entries[i].pattern] = i;
+        }
+        live.clear();
+        for (size_t i : entries) {
+            const size_t last = lastOf[m_entries[i].pattern];
+            if (last != i) {
+                m_results[i] = {Finding::Duplicate, last};
+            } else {
+                live.push_back(i);
+            }
+        }
+
+        // Patterns containing a removed byte never match
+        for (size_t i : live) {
+            for (unsigned char byte : m_entries[i].pattern) {
+                if (removedBy[byte] != kNone) {
+                    m_results[i] = {Finding::Unreachable, removedBy[byte]};
+                    break;
+                }
+            }
+        }
+
+        // A rule that rewrites its match unchanged only matters where it
+        // keeps another rule from matching
+        for (size_t i : live) {
+            const Entry& entry = m_entries[i];
+            if (m_results[i].finding != Finding::None || entry.pattern != entry.replacement) {
+                continue;
+            }
+            m_results[i].finding = Finding::NoOp;
+            for (size_t j : live) {
+                if (j != i && m_results[j].finding != Finding::Unreachable
+                    && canOverlap(entry.pattern, m_entries[j].pattern)) {
+                    m_results[i] = {Finding::GuardNoOp, j};
+                    break;
+                }
+            }
+        }
+
+        // Bytes written by this stage are present again; a one-byte rule
+        // whose byte no rule of the stage writes removes it from the text
+        std::array<bool, 256> written{};
+        for (size_t i : live) {
+            if (m_results[i].finding != Finding::Unreachable) {
+                for (unsigned char byte : m_entries[i].replacement) {
+                    written[byte] = true;
+                    removedBy[byte] = kNone;
+                }
+            }
+        }
+        for (size_t i : live) {
+            const std::string& pattern = m_entries[i].pattern;
+            if (m_results[i].finding != Finding::None || pattern.size() != 1) {
+                continue;
+            }
+            const unsigned char byte = static_cast<unsigned char>(pattern[0]);
+            if (!written[byte] && !canBeTrailByte(encoding, byte)) {
+                removedBy[byte] = i;
+            }
+        }
+    }
+
+    // Stages keep their order even when their first entries were dropped.
+    // Duplicates are gone, so every kept entry becomes one rule.
+    pipeline.clear();
+    m_ruleEntries.clear();
+    size_t dropped = 0;
+    for (size_t s = 0; s < stageNames.size(); ++s) {
+        for (size_t i : stageEntries[s]) {
+            if (isDropped(m_results[i].finding)) {
+                ++dropped;
+                continue;
+            }
+            if (m_entries[i].pattern.empty()) {
+                continue;  // ignored by RuleStore
+            }
+            pipeline.stage(std::string(stageNames[s])).set(m_entries[i].pattern, m_entries[i].replacement);
+            m_ruleEntries.push_back(i);
+        }
+    }
+    return dropped;
+}
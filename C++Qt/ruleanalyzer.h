@@ -0,0 +1,78 @@
+#ifndef RULEANALYZER_H
+#define RULEANALYZER_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "rulepipeline.h"
+
+/**
+ * RuleAnalyzer checks rules as they were entered, before they are
+ * compiled, for rules that cannot change the output:
+ *
+ * - Duplicate: a later rule of the same stage has the same pattern and
+ *   wins, as assignment into a RuleStore does.
+ * - NoOp: the replacement equals the pattern. It is dropped only when no
+ *   other pattern of its stage can overlap it; otherwise its matches keep
+ *   the other rules from matching there, so it stays (GuardNoOp).
+ * - Unreachable: the pattern contains a byte that an earlier stage removes
+ *   everywhere (a one-byte rule whose stage writes that byte nowhere) and
+ *   that no stage in between writes again, so it can never match. In
+ *   Shift_JIS only bytes that are never trail bytes count as removed.
+ *
+ * build() fills a pipeline with the remaining rules, so the compiled
+ * matchers only hold rules that can fire, and result() tells the caller
+ * which entries were affected and by which other entry.
+ */
+class RuleAnalyzer
+{
+public:
+    enum class Finding { None, Duplicate, NoOp, GuardNoOp, Unreachable };
+
+    struct Result {
+        Finding finding = Finding::None;
+        size_t other = 0;   // winning duplicate, guarded rule or removing rule
+    };
+
+    void clear();
+
+    // Add a rule in entry order; stage is the stage's name
+    void add(std::string_view stage, std::string_view pattern, std::string_view replacement);
+
+    // Analyze the entries and fill pipeline (cleared first) with the rules
+    // that can change the output, in their stages' order. Returns the
+    // number of dropped entries.
+    size_t build(RulePipeline& pipeline, TextEncoding encoding);
+
+    size_t entryCount() const { return m_entries.size(); }
+    const Result& result(size_t entry) const { return m_results[entry]; }
+    std::string_view pattern(size_t entry) const { return m_entries[entry].pattern; }
+    std::string_view stage(size_t entry) const { return m_entries[entry].stage; }
+
+    // Entry of a rule of the built pipeline, by pipeline rule number
+    size_t ruleEntry(size_t rule) const { return m_ruleEntries[rule]; }
+
+    // True when the finding removes the entry from the pipeline
+    static bool isDropped(Finding finding) { return finding != Finding::None && finding != Finding::GuardNoOp; }
+
+private:
+    struct Entry {
+        std::string stage;
+        std::string pattern;
+        std::string replacement;
+    };
+
+    // True when an occurrence of a can overlap an occurrence of b in some text
+    static bool canOverlap(std::string_view a, std::string_view b);
+
+    // True when byte can be the second byte of a character, where a
+    // one-byte rule does not see it
+    static bool canBeTrailByte(TextEncoding encoding, unsigned char byte);
+
+    std::vector<Entry> m_entries;
+    std::vector<Result> m_results;
+    std::vector<size_t> m_ruleEntries;
+};
+
+#endif // RULEANALYZER_H
@@ -0,0 +1,310 @@
+#include "rulepipeline.h"
+#include "tracer.h"
+#include "contenthash.h"
+#include <array>
+#include <memory>
+
+RulePipeline::RulePipeline()
+    : m_stageCount(0)
+    , m_passCount(0)
+    , m_encoding(TextEncoding::Utf8)
+{
+}
+
+void RulePipeline::clear()
+{
+    for (size_t i = 0; i < m_stageCount; ++i) {
+        m_stages[i].rules.clear();
+    }
+    m_stageCount = 0;
+    m_passCount = 0;
+}
+
+RuleStore& RulePipeline::stage(const std::string& name)
+{
+    for (size_t i = 0; i < m_stageCount; ++i) {
+        if (m_stages[i].name == name) {
+            return m_stages[i].rules;
+        }
+    }
+    if (m_stageCount == m_stages.size()) {
+        m_stages.emplace_back();
+    }
+    Stage& stage = m_stages[m_stageCount++];
+    stage.name = name;
+    stage.rules.clear();
+    return stage.rules;
+}
+
+size_t RulePipeline::ruleCount() const
+{
+    size_t count = 0;
+    for (size_t i = 0; i < m_stageCount; ++i) {
+        count += m_stages[i].rules.size();
+    }
+    return count;
+}
+
+std::string_view RulePipeline::pattern(size_t rule) const
+{
+    size_t stage = 0;
+    while (rule >= m_stages[stage].rules.size()) {
+        rule -= m_stages[stage++].rules.size();
+    }
+    return m_stages[stage].rules.pattern(rule);
+}
+
+std::string_view RulePipeline::replacement(size_t rule) const
+{
+    size_t stage = 0;
+    while (rule >= m_stages[stage].rules.size()) {
+        rule -= m_stages[stage++].rules.size();
+    }
+    return m_stages[stage].rules.replacement(rule);
+}
+
+size_t RulePipeline::ruleMemoryBytes() const
+{
+    size_t bytes = m_fused.memoryBytes();
+    for (const Stage& stage : m_stages) {
+        bytes += stage.name.capacity() + stage.rules.memoryBytes();
+    }
+    return bytes;
+}
+
+size_t RulePipeline::engineMemoryBytes() const
+{
+    // Engines of unused passes keep their buffers for the next compile
+    size_t bytes = 0;
+    for (const Pass& pass : m_passes) {
+        bytes += pass.engine.memoryBytes();
+    }
+    return bytes;
+}
+
+uint64_t RulePipeline::ruleSetHash(TextEncoding encoding) const
+{
+    // Length-prefixed fields, so no two rule sets serialize alike
+    ContentHash hash;
+    auto field = [&hash](std::string_view bytes) {
+        const uint64_t length = bytes.size();
+        hash.update(&length, sizeof(length));
+        hash.update(bytes.data(), bytes.size());
+    };
+    const uint32_t encodingId = static_cast<uint32_t>(encoding);
+    hash.update(&encodingId, sizeof(encodingId));
+    for (size_t s = 0; s < m_stageCount; ++s) {
+        const RuleStore& rules = m_stages[s].rules;
+        field(m_stages[s].name);
+        const uint64_t count = rules.size();
+        hash.update(&count, sizeof(count));
+        for (size_t r = 0; r < rules.size(); ++r) {
+            field(rules.pattern(r));
+            field(rules.replacement(r));
+        }
+    }
+    return hash.digest();
+}
+
+void RulePipeline::compile(TextEncoding encoding, const char *sample, size_t sampleLength)
+{
+    TRACE_SCOPE("compilePipeline");
+
+    m_encoding = encoding;
+    m_passCount = 0;
+
+    // Bytes the current pass may read or write, and whether it deletes text
+    std::array<bool, 256> touched{};
+    bool deletes = false;
+    size_t rule = 0;
+    size_t passFirstRule = 0;
+    m_fused.clear();
+
+    auto flush = [&]() {
+        if (m_fused.empty()) {
+            return;
+        }
+        if (m_passCount == m_passes.size()) {
+            m_passes.emplace_back();
+        }
+        Pass& pass = m_passes[m_passCount++];
+        pass.engine.compile(m_fused, encoding);
+        pass.decision = EngineTuner::choose(pass.engine, sample, sampleLength);
+        if (pass.decision.strategy != pass.engine.strategy()) {
+            pass.engine.setStrategy(pass.decision.strategy);
+            pass.decision.strategy = pass.engine.strategy();
+        }
+        pass.firstRule = passFirstRule;
+        m_fused.clear();
+        touched.fill(false);
+        deletes = false;
+    };
+
+    for (size_t s = 0; s < m_stageCount; ++s) {
+        const RuleStore& rules = m_stages[s].rules;
+        if (rules.empty()) {
+            continue;
+        }
+
+        // Deleting text can join bytes on both sides of a match into a new
+        // match of a later stage, unless its patterns are single bytes
+        bool fusable = true;
+        for (size_t r = 0; r < rules.size() && fusable; ++r) {
+            if (deletes && rules.pattern(r).size() > 1) {
+                fusable = false;
+                break;
+            }
+            for (unsigned char byte : rules.pattern(r)) {
+                if (touched[byte]) {
+                    fusable = false;
+                    break;
+                }
+            }
+        }
+        if (!fusable) {
+            flush();
+            passFirstRule = rule;
+        }
+
+        for (size_t r = 0; r < rules.size(); ++r) {
+            m_fused.set(rules.pattern(r), rules.replacement(r));
+            for (unsigned char byte : rules.pattern(r)) {
+                touched[byte] = true;
+            }
+            for (unsigned char byte : rules.replacement(r)) {
+                touched[byte] = true;
+            }
+            deletes = deletes || rules.replacement(r).empty();
+        }
+        rule += rules.size();
+    }
+    flush();
+}
+
+std::string RulePipeline::tuningReport() const
+{
+    std::string report;
+    for (size_t i = 0; i < m_passCount; ++i) {
+        report += "pass " + std::to_string(i + 1) + ": " + m_passes[i].decision.toText() + "\n";
+    }
+    return report;
+}
+
+uint64_t RulePipeline::stream(const std::function<void(const StreamReplacer::Writer& feed)>& source,
+                              const StreamReplacer::Writer& sink, RuleStats *stats) const
+{
+    TRACE_SCOPE("runPipeline");
+
+    if (m_passCount == 0) {
+        source(sink);
+        return 0;
+    }
+
+    // Every pass counts into its own stats, merged at the pipeline's numbering
+    std::vector<RuleStats> passStats(stats ? m_passCount : 0);
+    for (RuleStats& s : passStats) {
+        s.reset(0);
+    }
+
+    // Build the chain back to front so each replacer writes into the next
+    std::vector<std::unique_ptr<StreamReplacer>> chain(m_passCount);
+    for (size_t i = m_passCount; i-- > 0;) {
+        StreamReplacer::Writer writer = sink;
+        if (i + 1 < m_passCount) {
+            StreamReplacer *next = chain[i + 1].get();
+            writer = [next](const char *data, size_t length) { next->write(data, length); };
+        }
+        RuleStats *counters = nullptr;
+        if (stats) {
+            passStats[i].reset(m_passes[i].engine.ruleCount());
+            counters = &passStats[i];
+        }
+        chain[i] = std::make_unique<StreamReplacer>(m_passes[i].engine, writer, counters);
+    }
+
+    StreamReplacer& first = *chain[0];
+    source([&first](const char *data, size_t length) {
+        while (length > 0) {
+            const size_t take = std::min(length, kStreamChunkSize);
+            first.write(data, take);
+            data += take;
+            length -= take;
+        }
+    });
+
+    uint64_t matches = 0;
+    for (size_t i = 0; i < m_passCount; ++i) {
+        chain[i]->finish();
+        matches += chain[i]->matchCount();
+        if (stats) {
+            stats->merge(passStats[i], m_passes[i].firstRule);
+        }
+    }
+    return matches;
+}
+
+MatchSummary RulePipeline::countMatches(const char *data, size_t length, RuleStats *stats) const
+{
+    if (m_passCount == 1) {
+        return m_passes[0].engine.countMatches(data, length, stats);
+    }
+    return countMatches([data, length](const StreamReplacer::Writer& feed) { feed(data, length); }, stats);
+}
+
+MatchSummary RulePipeline::countMatches(const std::function<void(const StreamReplacer::Writer& feed)>& source,
+                                        RuleStats *stats) const
+{
+    TRACE_SCOPE("countPipeline");
+
+    // Later passes need the earlier passes' output, so it is streamed and
+    // only measured at the end
+    uint64_t inputBytes = 0;
+    uint64_t outputBytes = 0;
+    MatchSummary summary;
+    summary.matches = stream(
+        [&](const StreamReplacer::Writer& feed) {
+            source([&](const char *data, size_t length) {
+                inputBytes += length;
+                feed(data, length);
+            });
+        },
+        [&outputBytes](const char *, size_t length) { outputBytes += length; },
+        stats);
+    summary.sizeDelta = static_cast<int64_t>(outputBytes) - static_cast<int64_t>(inputBytes);
+    return summary;
+}
+
+bool RulePipeline::containsMatch(const char *data, size_t length) const
+{
+    for (size_t i = 0; i < m_passCount; ++i) {
+        if (m_passes[i].engine.containsMatch(data, length)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool RulePipeline::isLengthPreserving() const
+{
+    for (size_t i = 0; i < m_passCount; ++i) {
+        if (!m_passes[i].engine.isLengthPreserving()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint64_t RulePipeline::replaceInPlace(char *data, size_t length, RuleStats *stats) const
+{
+    uint64_t matches = 0;
+    RuleStats passStats;
+    for (size_t i = 0; i < m_passCount; ++i) {
+        const ReplaceEngine& engine = m_passes[i].engine;
+        passStats.reset(stats ? engine.ruleCount() : 0);
+        matches += engine.replaceInPlace(data, length, stats ? &passStats : nullptr);
+        if (stats) {
+            stats->merge(passStats, m_passes[i].firstRule);
+        }
+    }
+    return matches;
+}
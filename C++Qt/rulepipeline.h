@@ -0,0 +1,143 @@
+#ifndef RULEPIPELINE_H
+#define RULEPIPELINE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "replaceengine.h"
+#include "enginetuner.h"
+#include "rulestore.h"
+#include "streamreplacer.h"
+
+/**
+ * RulePipeline runs named rule stages in order within one job, each stage
+ * seeing the output of the previous one.
+ *
+ * compile() fuses consecutive stages into a single engine pass whenever that
+ * cannot change the result: a stage is fused into the pass before it when no
+ * byte of its patterns occurs in any pattern or replacement of that pass,
+ * and, if that pass deletes text, all its patterns are single bytes. Its
+ * matches can then neither overlap an earlier match nor touch or straddle
+ * what an earlier stage wrote, so one leftmost-longest scan over the union
+ * of the rules equals running the stages one after the other. Stages that fail the
+ * test start a new pass, and passes are chained through StreamReplacers
+ * without materializing intermediate outputs.
+ *
+ * Rules are numbered across stages in stage order, so one RuleStats of
+ * ruleCount() counters covers the whole pipeline.
+ */
+class RulePipeline
+{
+public:
+    RulePipeline();
+
+    // Remove all stages, keeping their buffers for the next job
+    void clear();
+
+    // Rules of the named stage, appended after the existing stages when new
+    RuleStore& stage(const std::string& name);
+
+    size_t stageCount() const { return m_stageCount; }
+    const std::string& stageName(size_t stage) const { return m_stages[stage].name; }
+    const RuleStore& stageRules(size_t stage) const { return m_stages[stage].rules; }
+
+    // Rule numbering across stages; valid before compile()
+    size_t ruleCount() const;
+    bool isEmpty() const { return ruleCount() == 0; }
+    std::string_view pattern(size_t rule) const;
+    std::string_view replacement(size_t rule) const;
+
+    // Sample, if given, is input the pipeline will see (see
+    // EngineTuner::sample()); every pass's kernel is chosen from it
+    void compile(TextEncoding encoding = TextEncoding::Utf8, const char *sample = nullptr,
+                 size_t sampleLength = 0);
+
+    // Identity of the rule set: equal for pipelines with the same stages
+    // and rules in the same order, for the same encoding. Used as the key
+    // of compiled-pipeline and result caches.
+    uint64_t ruleSetHash(TextEncoding encoding) const;
+
+    // Bytes allocated for the stages' rules and for the compiled passes
+    size_t ruleMemoryBytes() const;
+    size_t engineMemoryBytes() const;
+
+    TextEncoding encoding() const { return m_encoding; }
+    size_t passCount() const { return m_passCount; }
+    const ReplaceEngine& pass(size_t index) const { return m_passes[index].engine; }
+    // Pipeline rule number of the pass's rule 0
+    size_t passFirstRule(size_t index) const { return m_passes[index].firstRule; }
+    // Why the pass runs on its kernel
+    const EngineTuner::Decision& passDecision(size_t index) const { return m_passes[index].decision; }
+    // One line per pass, "pass 1: shift-or: ..."
+    std::string tuningReport() const;
+
+    // Apply all stages to data, appending to out (std::string, QByteArray, ...).
+    // Stats, if given, must be reset(ruleCount()).
+    template <typename Output>
+    void replaceInto(const char *data, size_t length, Output& out, RuleStats *stats = nullptr) const
+    {
+        // A fully fused pipeline is a plain engine run
+        if (m_passCount == 1) {
+            m_passes[0].engine.replaceInto(data, length, out, stats);
+            return;
+        }
+        auto source = [data, length](const StreamReplacer::Writer& feed) { feed(data, length); };
+        auto sink = [&out](const char *bytes, size_t size) { out.append(bytes, size); };
+        stream(source, sink, stats);
+    }
+
+    // Stream input through all passes: source is called once with a feed
+    // function and passes the input to it in order, in spans of any size.
+    // Returns the number of matches over all passes.
+    uint64_t stream(const std::function<void(const StreamReplacer::Writer& feed)>& source,
+                    const StreamReplacer::Writer& sink, RuleStats *stats = nullptr) const;
+
+    // True when every pass keeps lengths, so the whole pipeline can patch
+    // its input in place
+    bool isLengthPreserving() const;
+
+    // Run the passes one after the other over data in place; requires
+    // isLengthPreserving(). Returns the number of matches.
+    uint64_t replaceInPlace(char *data, size_t length, RuleStats *stats = nullptr) const;
+
+    // Dry run over all stages; only the chunk buffers of multi-pass runs
+    // are allocated, never anything proportional to the input.
+    // Stats, if given, must be reset(ruleCount()).
+    MatchSummary countMatches(const char *data, size_t length, RuleStats *stats = nullptr) const;
+    MatchSummary countMatches(const std::function<void(const StreamReplacer::Writer& feed)>& source,
+                              RuleStats *stats = nullptr) const;
+
+    // Pre-scan: true when any stage would change data. A pass without
+    // matches leaves the text as it is, so it suffices to test every pass
+    // on the input itself.
+    bool containsMatch(const char *data, size_t length) const;
+
+private:
+    struct Stage {
+        std::string name;
+        RuleStore rules;
+    };
+
+    struct Pass {
+        ReplaceEngine engine;
+        size_t firstRule = 0;
+        EngineTuner::Decision decision;
+    };
+
+    // Spans larger than this are fed to the first pass in pieces so the
+    // intermediate buffers of later passes stay small
+    static constexpr size_t kStreamChunkSize = 256 * 1024;
+
+    std::vector<Stage> m_stages;   // first m_stageCount are in use
+    size_t m_stageCount;
+    std::deque<Pass> m_passes;     // first m_passCount are in use; engines never move
+    size_t m_passCount;
+    TextEncoding m_encoding;
+    RuleStore m_fused;
+};
+
+#endif // RULEPIPELINE_H
@@ -0,0 +1,53 @@
+#include "rulesetcache.h"
+
+RuleSetCache::RuleSetCache(size_t capacity)
+    : m_capacity(capacity > 0 ? capacity : 1)
+    , m_clock(0)
+    , m_hits(0)
+    , m_misses(0)
+{
+}
+
+std::shared_ptr<const RulePipeline> RuleSetCache::find(uint64_t id)
+{
+    auto it = m_entries.find(id);
+    if (it == m_entries.end()) {
+        ++m_misses;
+        return nullptr;
+    }
+    ++m_hits;
+    it->second.lastUse = ++m_clock;
+    return it->second.pipeline;
+}
+
+std::shared_ptr<const RulePipeline> RuleSetCache::insert(std::shared_ptr<RulePipeline> rules, TextEncoding encoding,
+                                                         uint64_t *id)
+{
+    const uint64_t key = rules->ruleSetHash(encoding);
+    *id = key;
+    if (std::shared_ptr<const RulePipeline> cached = find(key)) {
+        return cached;
+    }
+
+    rules->compile(encoding);
+    if (m_entries.size() >= m_capacity) {
+        evictOldest();
+    }
+    Entry& entry = m_entries[key];
+    entry.pipeline = std::move(rules);
+    entry.lastUse = ++m_clock;
+    return entry.pipeline;
+}
+
+void RuleSetCache::evictOldest()
+{
+    auto oldest = m_entries.begin();
+    for (auto it = m_entries.begin(); it != m_entries.end(); ++it) {
+        if (it->second.lastUse < oldest->second.lastUse) {
+            oldest = it;
+        }
+    }
+    if (oldest != m_entries.end()) {
+        m_entries.erase(oldest);
+    }
+}
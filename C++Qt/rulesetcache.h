@@ -0,0 +1,49 @@
+#ifndef RULESETCACHE_H
+#define RULESETCACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include "rulepipeline.h"
+
+/**
+ * RuleSetCache keeps compiled pipelines by RulePipeline::ruleSetHash(), so
+ * a long-running process compiles every rule set once however many jobs
+ * use it. The least recently used set is dropped when the cache is full.
+ * Pipelines are handed out as shared pointers and stay valid for jobs
+ * still running after they were evicted.
+ */
+class RuleSetCache
+{
+public:
+    explicit RuleSetCache(size_t capacity = 64);
+
+    // Compiled pipeline with the given id, or null
+    std::shared_ptr<const RulePipeline> find(uint64_t id);
+
+    // Compile rules for encoding unless the same set is cached already, and
+    // return the cached pipeline; *id receives its ruleSetHash()
+    std::shared_ptr<const RulePipeline> insert(std::shared_ptr<RulePipeline> rules, TextEncoding encoding,
+                                               uint64_t *id);
+
+    size_t size() const { return m_entries.size(); }
+    uint64_t hits() const { return m_hits; }
+    uint64_t misses() const { return m_misses; }
+
+private:
+    struct Entry {
+        std::shared_ptr<const RulePipeline> pipeline;
+        uint64_t lastUse = 0;
+    };
+
+    void evictOldest();
+
+    size_t m_capacity;
+    std::unordered_map<uint64_t, Entry> m_entries;
+    uint64_t m_clock;
+    uint64_t m_hits;
+    uint64_t m_misses;
+};
+
+#endif // RULESETCACHE_H
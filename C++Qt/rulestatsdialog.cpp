@@ -0,0 +1,130 @@
+#include "rulestatsdialog.h"
+#include "rulepipeline.h"
+#include <QHeaderView>
+#include <algorithm>
+
+RuleStatsDialog::RuleStatsDialog(QWidget *parent)
+    : QDialog(parent)
+    , m_mainLayout(nullptr)
+    , m_summaryLabel(nullptr)
+    , m_engineLabel(nullptr)
+    , m_table(nullptr)
+    , m_buttonLayout(nullptr)
+    , m_pruneButton(nullptr)
+    , m_closeButton(nullptr)
+    , m_pruneRequested(false)
+{
+    setupUI();
+    setupConnections();
+    resize(720, 480);
+}
+
+void RuleStatsDialog::setupUI()
+{
+    setWindowTitle("ルール統計");
+    setModal(true);
+    
+    m_mainLayout = new QVBoxLayout(this);
+    m_mainLayout->setContentsMargins(20, 20, 20, 20);
+    m_mainLayout->setSpacing(15);
+    
+    m_summaryLabel = new QLabel(this);
+    m_summaryLabel->setProperty("role", "summary");
+    
+    m_engineLabel = new QLabel(this);
+    m_engineLabel->setProperty("role", "hint");
+    m_engineLabel->setWordWrap(true);
+    m_engineLabel->setTextInteractionFlags(Qt::TextSelectableByMouse);
+    
+    // Rule table
+    m_table = new QTableWidget(0, 4, this);
+    m_table->setHorizontalHeaderLabels({"置換前", "回数", "削除バイト", "追加バイト"});
+    m_table->horizontalHeader()->setSectionResizeMode(0, QHeaderView::Stretch);
+    m_table->verticalHeader()->setVisible(false);
+    m_table->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    m_table->setSelectionBehavior(QAbstractItemView::SelectRows);
+    
+    // Buttons
+    m_buttonLayout = new QHBoxLayout();
+    m_buttonLayout->setSpacing(10);
+    
+    m_pruneButton = new QPushButton("未使用のルールを削除", this);
+    m_pruneButton->setMinimumSize(160, 35);
+    m_pruneButton->setProperty("role", "danger");
+    
+    m_closeButton = new QPushButton("閉じる", this);
+    m_closeButton->setMinimumSize(100, 35);
+    
+    m_buttonLayout->addWidget(m_pruneButton);
+    m_buttonLayout->addStretch();
+    m_buttonLayout->addWidget(m_closeButton);
+    
+    m_mainLayout->addWidget(m_summaryLabel);
+    m_mainLayout->addWidget(m_engineLabel);
+    m_mainLayout->addWidget(m_table, 1);
+    m_mainLayout->addLayout(m_buttonLayout);
+    
+    setLayout(m_mainLayout);
+}
+
+void RuleStatsDialog::setupConnections()
+{
+    connect(m_pruneButton, &QPushButton::clicked, this, &RuleStatsDialog::onPruneClicked);
+    connect(m_closeButton, &QPushButton::clicked, this, &QDialog::reject);
+}
+
+void RuleStatsDialog::setStats(const RulePipeline& pipeline, const RuleStats& stats)
+{
+    const int rows = static_cast<int>(std::min(pipeline.ruleCount(), stats.ruleCount()));
+    m_table->setSortingEnabled(false);
+    m_table->setRowCount(rows);
+    
+    int unused = 0;
+    for (int i = 0; i < rows; ++i) {
+        const RuleStats::Counter& c = stats.counter(i);
+        if (c.hits == 0) {
+            ++unused;
+        }
+        
+        // Numeric columns use DisplayRole numbers so sorting is numeric
+        auto numberItem = [](quint64 value) {
+            QTableWidgetItem *item = new QTableWidgetItem();
+            item->setData(Qt::DisplayRole, value);
+            return item;
+        };
+        const std::string_view pattern = pipeline.pattern(i);
+        m_table->setItem(i, 0, new QTableWidgetItem(TextCodec::toQString(pattern.data(), pattern.size(), pipeline.encoding())));
+        m_table->setItem(i, 1, numberItem(c.hits));
+        m_table->setItem(i, 2, numberItem(c.bytesRemoved));
+        m_table->setItem(i, 3, numberItem(c.bytesAdded));
+    }
+    m_table->setSortingEnabled(true);
+    m_table->sortByColumn(1, Qt::DescendingOrder);
+    
+    m_summaryLabel->setText(QString("ルール数: %1   置換回数: %2   サイズ変化: %3 バイト   未使用: %4")
+        .arg(rows)
+        .arg(stats.totalHits())
+        .arg(stats.sizeDelta())
+        .arg(unused));
+    m_pruneButton->setEnabled(unused > 0);
+    m_engineLabel->setText("エンジン:\n" + QString::fromStdString(pipeline.tuningReport()).trimmed());
+}
+
+bool RuleStatsDialog::pruneRequested() const
+{
+    return m_pruneRequested;
+}
+
+bool RuleStatsDialog::showStats(QWidget *parent, const RulePipeline& pipeline, const RuleStats& stats)
+{
+    RuleStatsDialog dialog(parent);
+    dialog.setStats(pipeline, stats);
+    dialog.exec();
+    return dialog.pruneRequested();
+}
+
+void RuleStatsDialog::onPruneClicked()
+{
+    m_pruneRequested = true;
+    accept();
+}
@@ -0,0 +1,54 @@
+#ifndef RULESTATSDIALOG_H
+#define RULESTATSDIALOG_H
+
+#include <QDialog>
+#include <QTableWidget>
+#include <QVBoxLayout>
+#include <QHBoxLayout>
+#include <QLabel>
+#include <QPushButton>
+
+class RulePipeline;
+class RuleStats;
+
+/**
+ * RuleStatsDialog lists how often each rule fired in the last run and how
+ * many bytes it removed and added. Rules that never fired can be pruned.
+ */
+class RuleStatsDialog : public QDialog
+{
+    Q_OBJECT
+
+public:
+    explicit RuleStatsDialog(QWidget *parent = nullptr);
+    
+    // Fill the table from a compiled pipeline and the stats of its last run
+    void setStats(const RulePipeline& pipeline, const RuleStats& stats);
+    
+    // True when the user asked to remove the rules that never fired
+    bool pruneRequested() const;
+    
+    // Static convenience method; returns pruneRequested()
+    static bool showStats(QWidget *parent, const RulePipeline& pipeline, const RuleStats& stats);
+
+private slots:
+    void onPruneClicked();
+
+private:
+    void setupUI();
+    void setupConnections();
+    
+    // UI components
+    QVBoxLayout *m_mainLayout;
+    QLabel *m_summaryLabel;
+    QLabel *m_engineLabel;      // kernel of every pass and why EngineTuner chose it
+    QTableWidget *m_table;
+    QHBoxLayout *m_buttonLayout;
+    QPushButton *m_pruneButton;
+    QPushButton *m_closeButton;
+    
+    // State
+    bool m_pruneRequested;
+};
+
+#endif // RULESTATSDIALOG_H
@@ -0,0 +1,148 @@
+#include "rulestore.h"
+#include <algorithm>
+#include <functional>
+
+namespace {
+
+const size_t kInitialIndexSize = 64;
+
+} // namespace
+
+RuleStore::RuleStore()
+    : m_patternIndex(kInitialIndexSize, 0)
+    , m_replacementIndex(kInitialIndexSize, 0)
+{
+}
+
+void RuleStore::clear()
+{
+    m_arena.clear();
+    m_rules.clear();
+    std::fill(m_patternIndex.begin(), m_patternIndex.end(), 0);
+    std::fill(m_replacementIndex.begin(), m_replacementIndex.end(), 0);
+}
+
+void RuleStore::reserve(size_t ruleCount, size_t byteCount)
+{
+    m_arena.reserve(byteCount);
+    m_rules.reserve(ruleCount);
+    size_t slots = m_patternIndex.size();
+    while (slots < ruleCount * 2) {
+        slots *= 2;
+    }
+    if (slots != m_patternIndex.size()) {
+        m_patternIndex.resize(slots);
+        m_replacementIndex.resize(slots);
+        growIndexes();
+    }
+}
+
+uint64_t RuleStore::hashBytes(std::string_view bytes)
+{
+    // FNV-1a
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (unsigned char c : bytes) {
+        h ^= c;
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+template <typename View>
+size_t RuleStore::findSlot(const std::vector<uint32_t>& table, std::string_view bytes, View view) const
+{
+    const size_t mask = table.size() - 1;
+    size_t slot = static_cast<size_t>(hashBytes(bytes)) & mask;
+    while (table[slot] != 0 && view(table[slot] - 1) != bytes) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+void RuleStore::growIndexes()
+{
+    // Rehash into the (already resized) tables
+    std::fill(m_patternIndex.begin(), m_patternIndex.end(), 0);
+    std::fill(m_replacementIndex.begin(), m_replacementIndex.end(), 0);
+    for (size_t i = 0; i < m_rules.size(); ++i) {
+        const uint32_t entry = static_cast<uint32_t>(i + 1);
+        m_patternIndex[findSlot(m_patternIndex, pattern(i), [this](size_t r) { return pattern(r); })] = entry;
+        size_t slot = findSlot(m_replacementIndex, replacement(i), [this](size_t r) { return replacement(r); });
+        if (m_replacementIndex[slot] == 0) {
+            m_replacementIndex[slot] = entry;
+        }
+    }
+}
+
+size_t RuleStore::memoryBytes() const
+{
+    return m_arena.capacity() + m_rules.capacity() * sizeof(Rule)
+        + (m_patternIndex.capacity() + m_replacementIndex.capacity()) * sizeof(uint32_t);
+}
+
+int RuleStore::find(std::string_view pattern) const
+{
+    size_t slot = findSlot(m_patternIndex, pattern, [this](size_t r) { return this->pattern(r); });
+    return static_cast<int>(m_patternIndex[slot]) - 1;
+}
+
+uint32_t RuleStore::internReplacement(std::string_view replacement)
+{
+    size_t slot = findSlot(m_replacementIndex, replacement, [this](size_t r) { return this->replacement(r); });
+    if (m_replacementIndex[slot] != 0) {
+        return m_rules[m_replacementIndex[slot] - 1].replacementOffset;
+    }
+    const uint32_t offset = static_cast<uint32_t>(m_arena.size());
+    m_arena.append(replacement.data(), replacement.size());
+    return offset;
+}
+
+void RuleStore::set(std::string_view pattern, std::string_view replacement)
+{
+    if (pattern.empty()) {
+        return;
+    }
+
+    // Keep both indexes at most half full
+    if ((m_rules.size() + 1) * 2 > m_patternIndex.size()) {
+        m_patternIndex.resize(m_patternIndex.size() * 2);
+        m_replacementIndex.resize(m_replacementIndex.size() * 2);
+        growIndexes();
+    }
+
+    // The views may point into this store's arena, which interning the
+    // replacement can reallocate: look the pattern up first and keep a
+    // pattern from the arena as an offset until it is appended
+    const int existing = find(pattern);
+    const char *arena = m_arena.data();
+    const bool patternInArena = std::less_equal<const char *>()(arena, pattern.data())
+        && std::less<const char *>()(pattern.data(), arena + m_arena.size());
+    const size_t patternArenaOffset = patternInArena ? static_cast<size_t>(pattern.data() - arena) : 0;
+
+    const uint32_t replacementOffset = internReplacement(replacement);
+    const uint32_t replacementLength = static_cast<uint32_t>(replacement.size());
+    if (patternInArena) {
+        pattern = std::string_view(m_arena.data() + patternArenaOffset, pattern.size());
+    }
+
+    if (existing >= 0) {
+        m_rules[existing].replacementOffset = replacementOffset;
+        m_rules[existing].replacementLength = replacementLength;
+    } else {
+        const uint32_t patternOffset = static_cast<uint32_t>(m_arena.size());
+        m_arena.append(pattern.data(), pattern.size());
+        m_rules.push_back({patternOffset, static_cast<uint32_t>(pattern.size()),
+                           replacementOffset, replacementLength});
+        size_t slot = findSlot(m_patternIndex, this->pattern(m_rules.size() - 1),
+                               [this](size_t r) { return this->pattern(r); });
+        m_patternIndex[slot] = static_cast<uint32_t>(m_rules.size());
+    }
+
+    // A rule whose replacement is new becomes the owner of those bytes
+    const uint32_t owner = static_cast<uint32_t>(existing >= 0 ? existing : m_rules.size() - 1);
+    size_t slot = findSlot(m_replacementIndex, this->replacement(owner),
+                           [this](size_t r) { return this->replacement(r); });
+    if (m_replacementIndex[slot] == 0) {
+        m_replacementIndex[slot] = owner + 1;
+    }
+}
@@ -0,0 +1,79 @@
+#ifndef RULESTORE_H
+#define RULESTORE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * RuleStore holds a rule set in one contiguous byte arena: every pattern and
+ * replacement is a (offset, length) slice of the same buffer, patterns are
+ * interned through an open-addressing index and identical replacements share
+ * their bytes. clear() keeps all capacity, so rebuilding the rules on every
+ * Execute performs no allocation once the buffers have grown to size.
+ *
+ * Like assignment into std::map, setting an existing pattern replaces its
+ * replacement (last wins); unlike std::map, rules keep insertion order.
+ */
+class RuleStore
+{
+public:
+    RuleStore();
+
+    // Remove all rules, keeping the arena and index capacity
+    void clear();
+
+    // Pre-size for the given number of rules and arena bytes
+    void reserve(size_t ruleCount, size_t byteCount);
+
+    // Add a rule or replace the replacement of an existing pattern.
+    // Empty patterns are ignored.
+    void set(std::string_view pattern, std::string_view replacement);
+
+    size_t size() const { return m_rules.size(); }
+    bool empty() const { return m_rules.empty(); }
+
+    // Views stay valid until the store is next modified
+    std::string_view pattern(size_t rule) const
+    {
+        return std::string_view(m_arena.data() + m_rules[rule].patternOffset, m_rules[rule].patternLength);
+    }
+    std::string_view replacement(size_t rule) const
+    {
+        return std::string_view(m_arena.data() + m_rules[rule].replacementOffset, m_rules[rule].replacementLength);
+    }
+
+    // Rule index of pattern, or -1
+    int find(std::string_view pattern) const;
+
+    // Bytes held by the arena and the index
+    size_t arenaBytes() const { return m_arena.size(); }
+
+    // Bytes allocated for the store, including spare capacity
+    size_t memoryBytes() const;
+
+private:
+    struct Rule {
+        uint32_t patternOffset;
+        uint32_t patternLength;
+        uint32_t replacementOffset;
+        uint32_t replacementLength;
+    };
+
+    static uint64_t hashBytes(std::string_view bytes);
+
+    // Slot for bytes in table (empty slot when absent); view(i) reads entry i - 1
+    template <typename View>
+    size_t findSlot(const std::vector<uint32_t>& table, std::string_view bytes, View view) const;
+    void growIndexes();
+    uint32_t internReplacement(std::string_view replacement);
+
+    std::string m_arena;
+    std::vector<Rule> m_rules;
+    std::vector<uint32_t> m_patternIndex;      // rule + 1, 0 = empty slot
+    std::vector<uint32_t> m_replacementIndex;  // rule + 1 whose replacement bytes are shared
+};
+
+#endif // RULESTORE_H
@@ -0,0 +1,303 @@
+#ifndef SMALLKERNELS_H
+#define SMALLKERNELS_H
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * Specialized matchers for the small rule sets of typical interactive runs.
+ * Each kernel is a template on the code-unit type (char for the engine's
+ * native bytes, char16_t for UTF-16 text) and reports matches with exactly
+ * the leftmost-longest, non-overlapping semantics of the general trie, so
+ * ReplaceEngine can swap them in transparently.
+ *
+ * Sinks are called as onMatch(offset, length, rule).
+ */
+
+template <typename CharT>
+struct KernelPattern {
+    const CharT *data;
+    uint32_t length;
+    uint32_t rule;
+};
+
+/**
+ * One pattern: memmem (two-way on glibc) for bytes, Boyer-Moore-Horspool
+ * for wider code units.
+ */
+template <typename CharT>
+class SinglePatternKernel
+{
+public:
+    void build(const KernelPattern<CharT>& pattern)
+    {
+        m_pattern = pattern;
+    }
+
+    template <typename Sink>
+    void scan(const CharT *data, size_t length, Sink& onMatch) const
+    {
+        const size_t patternLength = m_pattern.length;
+        size_t pos = 0;
+        while (pos + patternLength <= length) {
+            const CharT *found = find(data + pos, length - pos);
+            if (!found) {
+                return;
+            }
+            size_t offset = static_cast<size_t>(found - data);
+            onMatch(offset, m_pattern.length, m_pattern.rule);
+            pos = offset + patternLength;
+        }
+    }
+
+private:
+    const CharT *find(const CharT *data, size_t length) const
+    {
+        if constexpr (sizeof(CharT) == 1) {
+#if defined(__GLIBC__) || defined(__APPLE__) || defined(__FreeBSD__)
+            return static_cast<const CharT *>(memmem(data, length, m_pattern.data, m_pattern.length));
+#endif
+        }
+        const CharT *end = data + length;
+        const CharT *found = std::search(data, end,
+            std::boyer_moore_horspool_searcher<const CharT *>(m_pattern.data, m_pattern.data + m_pattern.length));
+        return found == end ? nullptr : found;
+    }
+
+    KernelPattern<CharT> m_pattern{nullptr, 0, 0};
+};
+
+/**
+ * Up to MaxPatterns patterns whose lengths add up to at most 64 units,
+ * matched with bit-parallel Shift-And over one 64-bit state word.
+ * The state only finds where the earliest match ends; the leftmost start is
+ * then at most maxLength - 1 units earlier and is resolved by comparing the
+ * few patterns directly, longest first.
+ * Wide code units index the mask table by their low byte, which can only
+ * add false candidates that the verification step rejects.
+ */
+template <typename CharT, size_t MaxPatterns = 64>
+class ShiftOrKernel
+{
+public:
+    static constexpr size_t kMaxTotalLength = 64;
+
+    // False when the patterns do not fit in one state word
+    bool build(const std::vector<KernelPattern<CharT>>& patterns)
+    {
+        size_t total = 0;
+        for (const auto& p : patterns) {
+            total += p.length;
+        }
+        if (patterns.empty() || patterns.size() > MaxPatterns || total > kMaxTotalLength) {
+            return false;
+        }
+
+        m_count = patterns.size();
+        std::copy(patterns.begin(), patterns.end(), m_patterns.begin());
+        std::stable_sort(m_patterns.begin(), m_patterns.begin() + m_count,
+                         [](const auto& a, const auto& b) { return a.length > b.length; });
+        m_maxLength = m_patterns[0].length;
+
+        m_masks.fill(0);
+        m_startMask = 0;
+        m_endMask = 0;
+        unsigned bit = 0;
+        for (size_t i = 0; i < m_count; ++i) {
+            const auto& p = m_patterns[i];
+            m_startMask |= uint64_t(1) << bit;
+            for (uint32_t k = 0; k < p.length; ++k) {
+                m_masks[index(p.data[k])] |= uint64_t(1) << (bit + k);
+            }
+            bit += p.length;
+            m_endMask |= uint64_t(1) << (bit - 1);
+        }
+        return true;
+    }
+
+    template <typename Sink>
+    void scan(const CharT *data, size_t length, Sink& onMatch) const
+    {
+        size_t pos = 0;
+        uint64_t state = 0;
+        size_t j = 0;
+        while (j < length) {
+            state = ((state << 1) | m_startMask) & m_masks[index(data[j])];
+            if (!(state & m_endMask)) {
+                ++j;
+                continue;
+            }
+
+            // A pattern ends at j and none ended earlier, so the leftmost
+            // match starts in [j - maxLength + 1, j]
+            size_t first = j + 1 >= pos + m_maxLength ? j + 1 - m_maxLength : pos;
+            bool matched = false;
+            for (size_t t = first; t <= j; ++t) {
+                int longest = longestAt(data, length, t);
+                if (longest >= 0) {
+                    const auto& p = m_patterns[longest];
+                    onMatch(t, p.length, p.rule);
+                    pos = t + p.length;
+                    matched = true;
+                    break;
+                }
+            }
+            if (matched) {
+                // Restart the automaton after the match
+                state = 0;
+                j = pos;
+            } else {
+                ++j;
+            }
+        }
+    }
+
+private:
+    static size_t index(CharT c)
+    {
+        return static_cast<std::make_unsigned_t<CharT>>(c) & 0xFF;
+    }
+
+    // Longest pattern starting at data[t] (patterns are sorted longest first)
+    int longestAt(const CharT *data, size_t length, size_t t) const
+    {
+        for (size_t i = 0; i < m_count; ++i) {
+            const auto& p = m_patterns[i];
+            if (t + p.length <= length
+                && std::char_traits<CharT>::compare(data + t, p.data, p.length) == 0) {
+                return static_cast<int>(i);
+            }
+        }
+        return -1;
+    }
+
+    std::array<KernelPattern<CharT>, MaxPatterns> m_patterns{};
+    size_t m_count = 0;
+    uint32_t m_maxLength = 0;
+    std::array<uint64_t, 256> m_masks{};
+    uint64_t m_startMask = 0;
+    uint64_t m_endMask = 0;
+};
+
+/**
+ * Patterns that all have the same length, matched with a Rabin-Karp rolling
+ * hash. With equal lengths the first window that verifies is the
+ * leftmost-longest match. A 4096-bit filter on the mixed hash rejects most
+ * windows before the sorted hash table is searched.
+ */
+template <typename CharT>
+class RollingHashKernel
+{
+public:
+    // False unless all patterns share one non-zero length
+    bool build(const std::vector<KernelPattern<CharT>>& patterns)
+    {
+        if (patterns.empty() || patterns[0].length == 0) {
+            return false;
+        }
+        m_length = patterns[0].length;
+        for (const auto& p : patterns) {
+            if (p.length != m_length) {
+                return false;
+            }
+        }
+
+        m_power = 1;
+        for (uint32_t i = 1; i < m_length; ++i) {
+            m_power *= kBase;
+        }
+        m_patterns = patterns;
+        m_hashes.clear();
+        m_filter.fill(0);
+        for (size_t i = 0; i < m_patterns.size(); ++i) {
+            uint64_t h = hash(m_patterns[i].data);
+            m_hashes.emplace_back(h, static_cast<uint32_t>(i));
+            m_filter[filterIndex(h) >> 6] |= uint64_t(1) << (filterIndex(h) & 63);
+        }
+        std::sort(m_hashes.begin(), m_hashes.end());
+        return true;
+    }
+
+    // Bytes allocated outside the kernel object
+    size_t heapBytes() const
+    {
+        return m_patterns.capacity() * sizeof(KernelPattern<CharT>) + m_hashes.capacity() * sizeof(m_hashes[0]);
+    }
+
+    template <typename Sink>
+    void scan(const CharT *data, size_t length, Sink& onMatch) const
+    {
+        if (length < m_length) {
+            return;
+        }
+        size_t t = 0;
+        uint64_t h = hash(data);
+        for (;;) {
+            int found = (m_filter[filterIndex(h) >> 6] >> (filterIndex(h) & 63)) & 1
+                ? lookup(h, data + t) : -1;
+            if (found >= 0) {
+                onMatch(t, m_length, m_patterns[found].rule);
+                t += m_length;
+                if (t + m_length > length) {
+                    return;
+                }
+                h = hash(data + t);
+                continue;
+            }
+            if (t + m_length >= length) {
+                return;
+            }
+            h = (h - unit(data[t]) * m_power) * kBase + unit(data[t + m_length]);
+            ++t;
+        }
+    }
+
+private:
+    static constexpr uint64_t kBase = 0x100000001B3ull;
+
+    static uint64_t unit(CharT c)
+    {
+        return static_cast<uint64_t>(static_cast<std::make_unsigned_t<CharT>>(c)) + 1;
+    }
+
+    // Top bits after a multiplicative mix; the raw top bits mostly reflect the first unit
+    static size_t filterIndex(uint64_t h) { return static_cast<size_t>((h * 0x9E3779B97F4A7C15ull) >> 52); }
+
+    uint64_t hash(const CharT *p) const
+    {
+        uint64_t h = 0;
+        for (uint32_t i = 0; i < m_length; ++i) {
+            h = h * kBase + unit(p[i]);
+        }
+        return h;
+    }
+
+    int lookup(uint64_t h, const CharT *window) const
+    {
+        auto range = std::equal_range(m_hashes.begin(), m_hashes.end(), std::make_pair(h, uint32_t(0)),
+                                      [](const auto& a, const auto& b) { return a.first < b.first; });
+        for (auto it = range.first; it != range.second; ++it) {
+            const auto& p = m_patterns[it->second];
+            if (std::char_traits<CharT>::compare(window, p.data, m_length) == 0) {
+                return static_cast<int>(it->second);
+            }
+        }
+        return -1;
+    }
+
+    uint32_t m_length = 0;
+    uint64_t m_power = 1;
+    std::vector<KernelPattern<CharT>> m_patterns;
+    std::vector<std::pair<uint64_t, uint32_t>> m_hashes;
+    std::array<uint64_t, 64> m_filter{};
+};
+
+#endif // SMALLKERNELS_H
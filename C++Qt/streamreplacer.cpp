@@ -0,0 +1,95 @@
+#include "streamreplacer.h"
+#include <algorithm>
+#include <utility>
+
+StreamReplacer::StreamReplacer(const ReplaceEngine& engine, Writer writer, RuleStats *stats)
+    : m_engine(engine)
+    , m_writer(std::move(writer))
+    , m_stats(stats)
+    , m_matches(0)
+    , m_bytesWritten(0)
+    , m_consumed(0)
+{
+}
+
+void StreamReplacer::write(const char *data, size_t length)
+{
+    if (length == 0) {
+        return;
+    }
+
+    // Scan large writes in place; only the undecided tail is copied
+    if (m_carry.empty()) {
+        size_t tail = process(data, length, false);
+        m_carry.assign(data + tail, length - tail);
+        m_consumed += tail;
+        return;
+    }
+
+    m_carry.append(data, length);
+    size_t tail = process(m_carry.data(), m_carry.size(), false);
+    m_carry.erase(0, tail);
+    m_consumed += tail;
+}
+
+void StreamReplacer::finish()
+{
+    process(m_carry.data(), m_carry.size(), true);
+    m_carry.clear();
+}
+
+size_t StreamReplacer::process(const char *data, size_t length, bool final)
+{
+    // Positions before `decided` have all the bytes their match depends on
+    const size_t lookahead = m_engine.maxPatternLength() > 0 ? m_engine.maxPatternLength() - 1 : 0;
+    if (!final && length <= lookahead) {
+        return 0;
+    }
+    const size_t decided = final ? length : length - lookahead;
+
+    m_output.clear();
+    size_t copied = 0;
+    if (!m_engine.isEmpty()) {
+        m_engine.scan(data, length, [&](const ReplaceMatch& m) {
+            // Later matches may change once more input arrives
+            if (m.offset < decided) {
+                const std::string_view replacement = m_engine.replacement(m.rule);
+                if (m_onMatch) {
+                    m_onMatch({m_consumed + m.offset, m.length, m.rule});
+                } else {
+                    m_output.append(data + copied, m.offset - copied);
+                    m_output.append(replacement.data(), replacement.size());
+                }
+                copied = m.offset + m.length;
+                ++m_matches;
+                if (m_stats) {
+                    m_stats->recordHit(m.rule, m.length, replacement.size());
+                }
+            }
+        });
+    }
+
+    // The carried tail must start on a character boundary for the aligned
+    // scan of legacy encodings; walk from the last match end to find one
+    size_t tail = final ? length : std::max(copied, decided);
+    if (!final && !TextCodec::isSelfSynchronizing(m_engine.encoding())) {
+        size_t pos = copied;
+        while (pos < decided) {
+            const size_t step = TextCodec::charLength(m_engine.encoding(), static_cast<unsigned char>(data[pos]));
+            if (pos + step > length) {
+                break;
+            }
+            pos += step;
+        }
+        tail = pos;
+    }
+
+    if (!m_onMatch) {
+        m_output.append(data + copied, tail - copied);
+    }
+    if (!m_output.empty()) {
+        m_bytesWritten += m_output.size();
+        m_writer(m_output.data(), m_output.size());
+    }
+    return tail;
+}
@@ -0,0 +1,60 @@
+#ifndef STREAMREPLACER_H
+#define STREAMREPLACER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include "replaceengine.h"
+
+/**
+ * StreamReplacer applies a compiled engine to input that arrives in chunks,
+ * with exactly the result of one pass over the concatenated input.
+ *
+ * Whether a match starts at a position depends only on the next
+ * maxPatternLength() bytes, so after each chunk everything up to the last
+ * maxPatternLength() - 1 bytes is decided and written; only that tail (or
+ * the rest of a match that runs past it) is carried into the next chunk.
+ * Memory use is therefore bounded by the chunk size, not the input size.
+ *
+ * With a match sink set, the replacer only reports the matches, with their
+ * offsets in the whole input, and builds no output; PieceTable uses this
+ * to scan a document piece by piece.
+ */
+class StreamReplacer
+{
+public:
+    using Writer = std::function<void(const char *data, size_t length)>;
+    using MatchSink = std::function<void(const ReplaceMatch& match)>;
+
+    // Stats, if given, must be reset() for the engine; both must outlive this
+    StreamReplacer(const ReplaceEngine& engine, Writer writer, RuleStats *stats = nullptr);
+
+    // Report matches to onMatch instead of writing output; the writer may
+    // then be null. Set before the first write().
+    void setMatchSink(MatchSink onMatch) { m_onMatch = std::move(onMatch); }
+
+    void write(const char *data, size_t length);
+
+    // Flush the carried tail; call once after the last write()
+    void finish();
+
+    uint64_t matchCount() const { return m_matches; }
+    uint64_t bytesWritten() const { return m_bytesWritten; }
+
+private:
+    // Replace in data[0, length) and return where the undecided tail starts
+    size_t process(const char *data, size_t length, bool final);
+
+    const ReplaceEngine& m_engine;
+    Writer m_writer;
+    MatchSink m_onMatch;
+    RuleStats *m_stats;
+    std::string m_carry;
+    std::string m_output;
+    uint64_t m_matches;
+    uint64_t m_bytesWritten;
+    uint64_t m_consumed;    // input offset of the carried tail
+};
+
+#endif // STREAMREPLACER_H
@@ -0,0 +1,294 @@
+#include "textcodec.h"
+#include "jistables.h"
+#include "cpudispatch.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+
+const char16_t kReplacementChar = 0xFFFD;
+
+// Bytes of the input inspected when guessing between Shift_JIS and EUC-JP
+const size_t kDetectSampleSize = 64 * 1024;
+
+// Length of the leading run of ASCII bytes starting at data
+inline size_t asciiPrefixLength(const unsigned char *data, size_t length)
+{
+    return CpuDispatch::kernels().asciiPrefix(data, length);
+}
+
+int cp932LeadIndex(unsigned char lead)
+{
+    if (lead >= 0x81 && lead <= 0x9F) return lead - 0x81;
+    if (lead >= 0xE0 && lead <= 0xFC) return lead - 0xE0 + 31;
+    return -1;
+}
+
+unsigned char cp932LeadByte(int index)
+{
+    return static_cast<unsigned char>(index < 31 ? 0x81 + index : 0xE0 + index - 31);
+}
+
+// UTF-16 -> CP932 bytes (single byte codes < 0x100), 0 when unmapped
+const std::vector<uint16_t>& cp932EncodeTable()
+{
+    static const std::vector<uint16_t> table = [] {
+        std::vector<uint16_t> t(0x10000, 0);
+        for (int b = 1; b < 0x100; ++b) {
+            uint16_t u = kCp932SingleByte[b];
+            if (u && !t[u]) t[u] = static_cast<uint16_t>(b);
+        }
+        // NEC-selected IBM extensions (0xED, 0xEE) duplicate the IBM rows at
+        // 0xFA-0xFC; visit them last so the IBM codes win, as Windows does
+        auto addLead = [&t](int index) {
+            const uint16_t *row = kCp932DoubleByte + index * kCp932TrailCount;
+            for (int trail = 0; trail < kCp932TrailCount; ++trail) {
+                uint16_t u = row[trail];
+                if (u && !t[u]) {
+                    t[u] = static_cast<uint16_t>((cp932LeadByte(index) << 8) | (trail + 0x40));
+                }
+            }
+        };
+        for (int index = 0; index < 60; ++index) {
+            unsigned char lead = cp932LeadByte(index);
+            if (lead != 0xED && lead != 0xEE) addLead(index);
+        }
+        addLead(cp932LeadIndex(0xED));
+        addLead(cp932LeadIndex(0xEE));
+        return t;
+    }();
+    return table;
+}
+
+// UTF-16 -> EUC-JP. JIS X 0208 codes are stored as-is (both bytes >= 0xA1),
+// half-width kana as 0x8Exx and JIS X 0212 codes with the high bits cleared
+// (0x2121-0x7E7E) to mark the 0x8F prefix. 0 when unmapped.
+const std::vector<uint16_t>& eucJpEncodeTable()
+{
+    static const std::vector<uint16_t> table = [] {
+        std::vector<uint16_t> t(0x10000, 0);
+        for (int b = 1; b < 0x80; ++b) {
+            t[b] = static_cast<uint16_t>(b);
+        }
+        for (int k = 0; k < 63; ++k) {
+            t[0xFF61 + k] = static_cast<uint16_t>(0x8E00 | (0xA1 + k));
+        }
+        for (int i = 0; i < kJisRowCount * kJisRowCount; ++i) {
+            uint16_t u = kEucJp0208[i];
+            if (u && !t[u]) {
+                t[u] = static_cast<uint16_t>(((0xA1 + i / kJisRowCount) << 8) | (0xA1 + i % kJisRowCount));
+            }
+        }
+        for (int i = 0; i < kJisRowCount * kJisRowCount; ++i) {
+            uint16_t u = kEucJp0212[i];
+            if (u && !t[u]) {
+                t[u] = static_cast<uint16_t>(((0x21 + i / kJisRowCount) << 8) | (0x21 + i % kJisRowCount));
+            }
+        }
+        return t;
+    }();
+    return table;
+}
+
+// Decode one Shift_JIS character at data[i]; returns bytes consumed, *error set on failure
+size_t decodeShiftJisChar(const unsigned char *data, size_t length, size_t i, char16_t *out, bool *error)
+{
+    unsigned char b = data[i];
+    int leadIndex = cp932LeadIndex(b);
+    if (leadIndex < 0) {
+        uint16_t u = kCp932SingleByte[b];
+        *error = (u == 0);
+        *out = *error ? kReplacementChar : static_cast<char16_t>(u);
+        return 1;
+    }
+    if (i + 1 < length) {
+        unsigned char trail = data[i + 1];
+        if (trail >= 0x40 && trail <= 0xFC && trail != 0x7F) {
+            uint16_t u = kCp932DoubleByte[leadIndex * kCp932TrailCount + (trail - 0x40)];
+            *error = (u == 0);
+            *out = *error ? kReplacementChar : static_cast<char16_t>(u);
+            return 2;
+        }
+    }
+    *error = true;
+    *out = kReplacementChar;
+    return 1;
+}
+
+size_t decodeEucJpChar(const unsigned char *data, size_t length, size_t i, char16_t *out, bool *error)
+{
+    unsigned char b = data[i];
+    auto inRow = [](unsigned char c) { return c >= 0xA1 && c <= 0xFE; };
+    *error = true;
+    *out = kReplacementChar;
+
+    if (b == 0x8E) {
+        if (i + 1 < length && data[i + 1] >= 0xA1 && data[i + 1] <= 0xDF) {
+            *error = false;
+            *out = static_cast<char16_t>(0xFF61 + (data[i + 1] - 0xA1));
+            return 2;
+        }
+    } else if (b == 0x8F) {
+        if (i + 2 < length && inRow(data[i + 1]) && inRow(data[i + 2])) {
+            uint16_t u = kEucJp0212[(data[i + 1] - 0xA1) * kJisRowCount + (data[i + 2] - 0xA1)];
+            if (u) {
+                *error = false;
+                *out = static_cast<char16_t>(u);
+            }
+            return 3;
+        }
+    } else if (inRow(b)) {
+        if (i + 1 < length && inRow(data[i + 1])) {
+            uint16_t u = kEucJp0208[(b - 0xA1) * kJisRowCount + (data[i + 1] - 0xA1)];
+            if (u) {
+                *error = false;
+                *out = static_cast<char16_t>(u);
+            }
+            return 2;
+        }
+    }
+    return 1;
+}
+
+} // namespace
+
+const char *TextCodec::name(TextEncoding encoding)
+{
+    switch (encoding) {
+    case TextEncoding::Utf8: return "UTF-8";
+    case TextEncoding::ShiftJis: return "Shift_JIS";
+    case TextEncoding::EucJp: return "EUC-JP";
+    }
+    return "UTF-8";
+}
+
+bool TextCodec::fromName(const char *name, TextEncoding& encoding)
+{
+    std::string key;
+    for (const char *c = name; *c; ++c) {
+        if (*c != '-' && *c != '_') {
+            key += static_cast<char>(std::tolower(static_cast<unsigned char>(*c)));
+        }
+    }
+    if (key == "utf8") {
+        encoding = TextEncoding::Utf8;
+    } else if (key == "shiftjis" || key == "sjis") {
+        encoding = TextEncoding::ShiftJis;
+    } else if (key == "eucjp") {
+        encoding = TextEncoding::EucJp;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool TextCodec::isValidUtf8(const char *text, size_t length)
+{
+    return CpuDispatch::kernels().validUtf8(reinterpret_cast<const unsigned char *>(text), length);
+}
+
+size_t TextCodec::countErrors(const char *text, size_t length, TextEncoding encoding)
+{
+    const unsigned char *data = reinterpret_cast<const unsigned char *>(text);
+    if (encoding == TextEncoding::Utf8) {
+        return isValidUtf8(text, length) ? 0 : 1;
+    }
+
+    size_t errors = 0;
+    size_t i = 0;
+    while (i < length) {
+        i += asciiPrefixLength(data + i, length - i);
+        if (i >= length) {
+            break;
+        }
+        char16_t unit;
+        bool error = false;
+        i += (encoding == TextEncoding::ShiftJis)
+            ? decodeShiftJisChar(data, length, i, &unit, &error)
+            : decodeEucJpChar(data, length, i, &unit, &error);
+        if (error) {
+            ++errors;
+        }
+    }
+    return errors;
+}
+
+TextEncoding TextCodec::detect(const char *data, size_t length)
+{
+    if (isValidUtf8(data, length)) {
+        return TextEncoding::Utf8;
+    }
+
+    // Shift_JIS text almost always contains 0x81-0x9F lead bytes (kana and
+    // punctuation), which are invalid in EUC-JP, while EUC-JP text mostly
+    // decodes cleanly as Shift_JIS. So an error-free EUC-JP read wins ties.
+    size_t sample = std::min(length, kDetectSampleSize);
+    size_t eucErrors = countErrors(data, sample, TextEncoding::EucJp);
+    if (eucErrors == 0) {
+        return TextEncoding::EucJp;
+    }
+    size_t sjisErrors = countErrors(data, sample, TextEncoding::ShiftJis);
+    return sjisErrors <= eucErrors ? TextEncoding::ShiftJis : TextEncoding::EucJp;
+}
+
+size_t TextCodec::decodeLegacy(const char *text, size_t length, TextEncoding encoding, char16_t *out)
+{
+    const unsigned char *data = reinterpret_cast<const unsigned char *>(text);
+    size_t written = 0;
+    size_t i = 0;
+    while (i < length) {
+        // ASCII is identical in both encodings; widen whole runs at once
+        size_t run = asciiPrefixLength(data + i, length - i);
+        for (size_t k = 0; k < run; ++k) {
+            out[written++] = data[i + k];
+        }
+        i += run;
+        if (i >= length) {
+            break;
+        }
+        bool error = false;
+        i += (encoding == TextEncoding::ShiftJis)
+            ? decodeShiftJisChar(data, length, i, out + written, &error)
+            : decodeEucJpChar(data, length, i, out + written, &error);
+        ++written;
+    }
+    return written;
+}
+
+bool TextCodec::encodeLegacy(const char16_t *text, size_t length, TextEncoding encoding, std::string& out)
+{
+    if (encoding == TextEncoding::Utf8) {
+        return false;
+    }
+
+    const std::vector<uint16_t>& table = (encoding == TextEncoding::ShiftJis)
+        ? cp932EncodeTable()
+        : eucJpEncodeTable();
+    out.clear();
+    out.reserve(length * 2);
+    for (size_t i = 0; i < length; ++i) {
+        char16_t u = text[i];
+        if (u < 0x80) {
+            out += static_cast<char>(u);
+            continue;
+        }
+        uint16_t code = table[u];
+        if (code == 0) {
+            return false;
+        }
+        if (code < 0x100) {
+            out += static_cast<char>(code);
+        } else if (encoding == TextEncoding::EucJp && (code >> 8) < 0x80) {
+            out += static_cast<char>(0x8F);
+            out += static_cast<char>((code >> 8) | 0x80);
+            out += static_cast<char>((code & 0xFF) | 0x80);
+        } else {
+            out += static_cast<char>(code >> 8);
+            out += static_cast<char>(code & 0xFF);
+        }
+    }
+    return true;
+}
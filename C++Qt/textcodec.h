@@ -0,0 +1,95 @@
+#ifndef TEXTCODEC_H
+#define TEXTCODEC_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#ifdef QT_CORE_LIB
+#include <QString>
+#endif
+
+enum class TextEncoding { Utf8, ShiftJis, EucJp };
+
+/**
+ * TextCodec detects and converts the encodings the replacer works in.
+ * UTF-8 is validated 16, 32 or 64 bytes at a time by the CpuDispatch kernels;
+ * Shift_JIS (CP932) and EUC-JP are converted through the tables in
+ * jistables.cpp, so no ICU or iconv is needed. The engine itself runs on the file's own bytes;
+ * decoding is only needed for the preview.
+ */
+class TextCodec
+{
+public:
+    static const char *name(TextEncoding encoding);
+
+    // Parse a name as returned by name(), case-insensitively and ignoring
+    // '-' and '_' ("utf8", "sjis" and "eucjp" also work); false if unknown
+    static bool fromName(const char *name, TextEncoding& encoding);
+
+    // True when data is well-formed UTF-8 (no overlongs, surrogates or values above U+10FFFF)
+    static bool isValidUtf8(const char *data, size_t length);
+
+    // Guess the encoding of raw file content; valid UTF-8 always wins
+    static TextEncoding detect(const char *data, size_t length);
+
+    // Number of malformed or unmapped sequences when data is read as encoding
+    static size_t countErrors(const char *data, size_t length, TextEncoding encoding);
+
+    // Length of the character whose first byte is lead. Used by the engine to
+    // keep matches on character boundaries in multi-byte legacy encodings.
+    static int charLength(TextEncoding encoding, unsigned char lead)
+    {
+        switch (encoding) {
+        case TextEncoding::ShiftJis:
+            return ((lead >= 0x81 && lead <= 0x9F) || (lead >= 0xE0 && lead <= 0xFC)) ? 2 : 1;
+        case TextEncoding::EucJp:
+            if (lead == 0x8F) return 3;
+            return (lead == 0x8E || lead >= 0xA1) && lead != 0xFF ? 2 : 1;
+        case TextEncoding::Utf8:
+            break;
+        }
+        return 1;
+    }
+
+    // True when every byte of a pattern in this encoding starts a character;
+    // UTF-8 is self-synchronizing so byte-wise matching is already aligned
+    static bool isSelfSynchronizing(TextEncoding encoding) { return encoding == TextEncoding::Utf8; }
+
+    // Decode Shift_JIS or EUC-JP into out, which must hold at least length
+    // code units. Malformed input becomes U+FFFD. Returns the units written.
+    static size_t decodeLegacy(const char *data, size_t length, TextEncoding encoding, char16_t *out);
+
+    // Encode UTF-16 text as Shift_JIS or EUC-JP. Returns false when a
+    // character has no mapping in the target encoding.
+    static bool encodeLegacy(const char16_t *text, size_t length, TextEncoding encoding, std::string& out);
+
+#ifdef QT_CORE_LIB
+    // Decode raw bytes in the given encoding for display
+    static QString toQString(const char *data, size_t length, TextEncoding encoding)
+    {
+        if (encoding == TextEncoding::Utf8) {
+            return QString::fromUtf8(data, static_cast<qsizetype>(length));
+        }
+        QString text(static_cast<qsizetype>(length), Qt::Uninitialized);
+        size_t written = decodeLegacy(data, length, encoding, reinterpret_cast<char16_t *>(text.data()));
+        text.truncate(static_cast<qsizetype>(written));
+        return text;
+    }
+
+    // Encode text into the given encoding; false when a character is unmappable
+    static bool fromQString(const QString& text, TextEncoding encoding, std::string& out)
+    {
+        if (encoding == TextEncoding::Utf8) {
+            // assign() keeps out's capacity when it is reused across calls
+            const QByteArray utf8 = text.toUtf8();
+            out.assign(utf8.constData(), static_cast<size_t>(utf8.size()));
+            return true;
+        }
+        return encodeLegacy(reinterpret_cast<const char16_t *>(text.utf16()),
+                            static_cast<size_t>(text.size()), encoding, out);
+    }
+#endif
+};
+
+#endif // TEXTCODEC_H
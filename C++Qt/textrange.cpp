@@ -0,0 +1,230 @@
+#include "textrange.h"
+#include "tracer.h"
+#include <algorithm>
+#include <cstring>
+#include <string_view>
+
+namespace {
+
+constexpr size_t kNotFound = static_cast<size_t>(-1);
+
+// Searches over the current version's pieces, each a single walk from the
+// start of the document to where it stops
+class DocumentBytes
+{
+public:
+    explicit DocumentBytes(const PieceTable& document)
+        : m_document(document)
+    {
+    }
+
+    // Position after the count-th c at or after from, or kNotFound
+    size_t afterNth(char c, size_t count, size_t from) const
+    {
+        if (count == 0) {
+            return from;
+        }
+        size_t pieceStart = 0;
+        for (const PieceTable::Piece& piece : m_document.pieces()) {
+            const size_t pieceEnd = pieceStart + piece.length;
+            if (pieceEnd > from) {
+                const char *data = m_document.pieceData(piece);
+                size_t at = from > pieceStart ? from - pieceStart : 0;
+                while (at < piece.length) {
+                    const void *hit = std::memchr(data + at, c, piece.length - at);
+                    if (!hit) {
+                        break;
+                    }
+                    at = static_cast<size_t>(static_cast<const char *>(hit) - data) + 1;
+                    if (--count == 0) {
+                        return pieceStart + at;
+                    }
+                }
+            }
+            pieceStart = pieceEnd;
+        }
+        return kNotFound;
+    }
+
+    // Start of the line holding offset
+    size_t lineStart(size_t offset) const
+    {
+        const std::vector<PieceTable::Piece>& pieces = m_document.pieces();
+        size_t index = 0;
+        size_t pieceStart = 0;
+        while (index < pieces.size() && pieceStart + pieces[index].length < offset) {
+            pieceStart += pieces[index].length;
+            ++index;
+        }
+        for (; index < pieces.size(); --index) {
+            const char *data = m_document.pieceData(pieces[index]);
+            for (size_t at = std::min(offset - pieceStart, pieces[index].length); at > 0; --at) {
+                if (data[at - 1] == '\n') {
+                    return pieceStart + at;
+                }
+            }
+            if (index == 0) {
+                break;
+            }
+            pieceStart -= pieces[index - 1].length;
+        }
+        return 0;
+    }
+
+    // First occurrence of needle at or after from, or kNotFound. Matches
+    // across piece boundaries are found through the last bytes carried
+    // over from the pieces before.
+    size_t find(std::string_view needle, size_t from) const
+    {
+        if (needle.empty()) {
+            return from;
+        }
+        std::string carry;
+        size_t carryStart = 0;
+        size_t pieceStart = 0;
+        for (const PieceTable::Piece& piece : m_document.pieces()) {
+            const size_t pieceEnd = pieceStart + piece.length;
+            if (pieceEnd <= from) {
+                pieceStart = pieceEnd;
+                continue;
+            }
+            const size_t skip = from > pieceStart ? from - pieceStart : 0;
+            const std::string_view data(m_document.pieceData(piece) + skip, piece.length - skip);
+
+            // A match that starts in the carried bytes and ends here
+            if (!carry.empty()) {
+                std::string window = carry;
+                window.append(data.data(), std::min(data.size(), needle.size() - 1));
+                const size_t hit = window.find(needle);
+                if (hit != std::string::npos && hit < carry.size()) {
+                    return carryStart + hit;
+                }
+            }
+            const size_t hit = data.find(needle);
+            if (hit != std::string_view::npos) {
+                return pieceStart + skip + hit;
+            }
+
+            // Keep the last needle.size() - 1 bytes seen
+            carry.append(data.data(), data.size());
+            const size_t keep = std::min(carry.size(), needle.size() - 1);
+            carry.erase(0, carry.size() - keep);
+            carryStart = pieceEnd - keep;
+            pieceStart = pieceEnd;
+        }
+        return kNotFound;
+    }
+
+private:
+    const PieceTable& m_document;
+};
+
+// True when offset starts a character; legacy encodings are decoded from
+// the start of the line, the nearest known boundary
+bool isCharacterStart(const PieceTable& document, const DocumentBytes& bytes, TextEncoding encoding, size_t offset)
+{
+    if (TextCodec::isSelfSynchronizing(encoding)) {
+        return true;
+    }
+    std::string line;
+    document.materializeRange(bytes.lineStart(offset), offset, line);
+    size_t at = 0;
+    while (at < line.size()) {
+        at += TextCodec::charLength(encoding, static_cast<unsigned char>(line[at]));
+    }
+    return at == line.size();
+}
+
+// First marker that starts a character at or after from
+size_t findMarker(const PieceTable& document, const DocumentBytes& bytes, TextEncoding encoding,
+                  const std::string& marker, size_t from)
+{
+    size_t hit = bytes.find(marker, from);
+    while (hit != kNotFound && !isCharacterStart(document, bytes, encoding, hit)) {
+        hit = bytes.find(marker, hit + 1);
+    }
+    return hit;
+}
+
+} // namespace
+
+TextRange::TextRange()
+    : m_kind(Kind::Whole)
+    , m_first(0)
+    , m_last(0)
+{
+}
+
+TextRange TextRange::bytes(size_t begin, size_t end)
+{
+    TextRange range;
+    range.m_kind = Kind::Bytes;
+    range.m_first = begin;
+    range.m_last = end;
+    return range;
+}
+
+TextRange TextRange::lines(size_t first, size_t last)
+{
+    TextRange range;
+    range.m_kind = Kind::Lines;
+    range.m_first = std::max<size_t>(first, 1);
+    range.m_last = last;
+    return range;
+}
+
+TextRange TextRange::markers(const std::string& beginMarker, const std::string& endMarker)
+{
+    TextRange range;
+    range.m_kind = Kind::Markers;
+    range.m_beginMarker = beginMarker;
+    range.m_endMarker = endMarker;
+    return range;
+}
+
+TextRange::Failure TextRange::resolve(const PieceTable& document, TextEncoding encoding, Span *span) const
+{
+    TRACE_SCOPE("resolveRange");
+
+    const size_t length = document.length();
+    const DocumentBytes bytes(document);
+    switch (m_kind) {
+    case Kind::Whole:
+        span->begin = 0;
+        span->end = length;
+        break;
+    case Kind::Bytes:
+        if (m_first >= length) {
+            return Failure::PastEnd;
+        }
+        span->begin = m_first;
+        span->end = std::min(m_last, length);
+        if (!TextCodec::isSelfSynchronizing(encoding) && span->end > span->begin) {
+            span->begin = bytes.lineStart(span->begin);
+            span->end = std::min(bytes.afterNth('\n', 1, span->end - 1), length);
+        }
+        break;
+    case Kind::Lines: {
+        span->begin = bytes.afterNth('\n', m_first - 1, 0);
+        if (span->begin == kNotFound) {
+            return Failure::PastEnd;
+        }
+        const size_t count = m_last >= m_first ? m_last - m_first + 1 : 0;
+        span->end = std::min(bytes.afterNth('\n', count, span->begin), length);
+        break;
+    }
+    case Kind::Markers: {
+        const size_t found = findMarker(document, bytes, encoding, m_beginMarker, 0);
+        if (m_beginMarker.empty() || found == kNotFound) {
+            return Failure::NoBeginMarker;
+        }
+        span->begin = found + m_beginMarker.size();
+        span->end = m_endMarker.empty() ? kNotFound : findMarker(document, bytes, encoding, m_endMarker, span->begin);
+        if (span->end == kNotFound) {
+            return Failure::NoEndMarker;
+        }
+        break;
+    }
+    }
+    return span->end > span->begin ? Failure::None : Failure::Empty;
+}
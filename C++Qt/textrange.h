@@ -0,0 +1,67 @@
+#ifndef TEXTRANGE_H
+#define TEXTRANGE_H
+
+#include <cstddef>
+#include <string>
+#include "piecetable.h"
+#include "textcodec.h"
+
+/**
+ * TextRange selects the part of a document a replacement run is limited
+ * to: a byte range, a line range or the text between two markers. It is
+ * resolved against the document's current version to a byte span, which
+ * PieceTable::applyPipelineRange() then scans alone.
+ *
+ * Resolving reads no more than it must: a byte range reads nothing, a line
+ * range counts '\n' up to its last line and a marker range searches up to
+ * its end marker, at memchr speed and piece by piece, never copying the
+ * document. The markers themselves stay outside the range.
+ *
+ * Shift_JIS and EUC-JP can only be entered at a known character boundary.
+ * Line starts always are one, so byte ranges in these encodings are
+ * widened to whole lines and marker hits that fall inside a character are
+ * passed over.
+ */
+class TextRange
+{
+public:
+    enum class Kind { Whole, Bytes, Lines, Markers };
+
+    enum class Failure {
+        None,
+        Empty,            // the range holds no bytes
+        PastEnd,          // it starts beyond the end of the document
+        NoBeginMarker,
+        NoEndMarker
+    };
+
+    struct Span {
+        size_t begin = 0;
+        size_t end = 0;
+    };
+
+    // The whole document
+    TextRange();
+
+    // Bytes [begin, end)
+    static TextRange bytes(size_t begin, size_t end);
+    // Lines first to last, 1-based and inclusive; the last line's '\n' is part of the range
+    static TextRange lines(size_t first, size_t last);
+    // The text after the first beginMarker and before the next endMarker,
+    // both in the document's encoding
+    static TextRange markers(const std::string& beginMarker, const std::string& endMarker);
+
+    Kind kind() const { return m_kind; }
+    bool isWhole() const { return m_kind == Kind::Whole; }
+
+    Failure resolve(const PieceTable& document, TextEncoding encoding, Span *span) const;
+
+private:
+    Kind m_kind;
+    size_t m_first;
+    size_t m_last;
+    std::string m_beginMarker;
+    std::string m_endMarker;
+};
+
+#endif // TEXTRANGE_H
@@ -0,0 +1,158 @@
+#include "tracer.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <thread>
+
+std::atomic<bool> Tracer::s_enabled{false};
+std::mutex Tracer::s_mutex;
+std::vector<Tracer::Event> Tracer::s_events;
+uint64_t Tracer::s_recorded = 0;
+uint64_t Tracer::s_cleared = 0;
+std::string Tracer::s_outputPath;
+
+namespace {
+
+uint32_t currentThreadId()
+{
+    return static_cast<uint32_t>(std::hash<std::thread::id>()(std::this_thread::get_id()));
+}
+
+void writeJsonString(std::ostream& out, const char *text)
+{
+    out << '"';
+    for (const char *p = text; *p; ++p) {
+        if (*p == '"' || *p == '\\') {
+            out << '\\';
+        }
+        out << *p;
+    }
+    out << '"';
+}
+
+} // namespace
+
+void Tracer::setEnabled(bool enabled)
+{
+    s_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+void Tracer::initFromEnvironment()
+{
+    const char *path = std::getenv("MULTREPLACER_TRACE");
+    if (path && *path) {
+        s_outputPath = path;
+        setEnabled(true);
+    }
+}
+
+const std::string& Tracer::defaultOutputPath()
+{
+    return s_outputPath;
+}
+
+void Tracer::record(const char *name, int64_t startMicros, int64_t durationMicros)
+{
+    const Event event = {name, startMicros, durationMicros, currentThreadId()};
+    std::lock_guard<std::mutex> lock(s_mutex);
+    if (s_events.size() < kMaxEvents) {
+        s_events.push_back(event);
+    } else {
+        s_events[(s_recorded - s_cleared) % kMaxEvents] = event;
+    }
+    ++s_recorded;
+}
+
+void Tracer::clear()
+{
+    std::lock_guard<std::mutex> lock(s_mutex);
+    s_events.clear();
+    s_cleared = s_recorded;
+}
+
+uint64_t Tracer::mark()
+{
+    std::lock_guard<std::mutex> lock(s_mutex);
+    return s_recorded;
+}
+
+std::vector<Tracer::Event> Tracer::events(uint64_t since)
+{
+    std::lock_guard<std::mutex> lock(s_mutex);
+    // The kept events are the last s_events.size() recorded; event i is
+    // at (i - s_cleared) % kMaxEvents
+    const uint64_t first = std::max(s_recorded - s_events.size(), std::min(since, s_recorded));
+    std::vector<Event> result;
+    result.reserve(static_cast<size_t>(s_recorded - first));
+    for (uint64_t i = first; i < s_recorded; ++i) {
+        result.push_back(s_events[static_cast<size_t>((i - s_cleared) % kMaxEvents)]);
+    }
+    return result;
+}
+
+bool Tracer::writeChromeTrace(const std::string& path)
+{
+    std::vector<Event> snapshot = events();
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        return false;
+    }
+
+    // Complete events ("ph": "X") carry their own duration, so no begin/end pairing is needed
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    for (size_t i = 0; i < snapshot.size(); ++i) {
+        const Event& e = snapshot[i];
+        if (i > 0) {
+            out << ',';
+        }
+        out << "\n{\"name\":";
+        writeJsonString(out, e.name);
+        out << ",\"cat\":\"multreplacer\",\"ph\":\"X\",\"pid\":1"
+            << ",\"tid\":" << e.threadId
+            << ",\"ts\":" << e.startMicros
+            << ",\"dur\":" << e.durationMicros << '}';
+    }
+    out << "\n]}\n";
+    return static_cast<bool>(out);
+}
+
+std::string Tracer::summary(uint64_t since)
+{
+    std::vector<Event> snapshot = events(since);
+
+    // Aggregate per phase, keeping the order in which phases first appeared
+    std::vector<std::pair<std::string, int64_t>> totals;
+    for (const Event& e : snapshot) {
+        auto it = totals.begin();
+        while (it != totals.end() && it->first != e.name) {
+            ++it;
+        }
+        if (it == totals.end()) {
+            totals.emplace_back(e.name, e.durationMicros);
+        } else {
+            it->second += e.durationMicros;
+        }
+    }
+
+    std::string text;
+    char buffer[64];
+    for (const auto& [name, micros] : totals) {
+        if (!text.empty()) {
+            text += " | ";
+        }
+        std::snprintf(buffer, sizeof(buffer), " %.1fms", micros / 1000.0);
+        text += name;
+        text += buffer;
+    }
+    return text;
+}
+
+int64_t Tracer::nowMicros()
+{
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
@@ -0,0 +1,104 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Tracer collects scoped timing events for the phases of a replacement run
+ * (load, rule collection, engine, conversion, preview, save).
+ * Recording is disabled by default; when disabled a TraceScope costs a single
+ * relaxed atomic load. Events can be exported in the Chrome trace_event JSON
+ * format (chrome://tracing, Perfetto) or condensed into a one-line summary.
+ * At most kMaxEvents are kept; beyond that the oldest are overwritten, so a
+ * long-running daemon or batch keeps a bounded window of recent events.
+ */
+class Tracer
+{
+public:
+    struct Event {
+        const char *name;
+        int64_t startMicros;
+        int64_t durationMicros;
+        uint32_t threadId;
+    };
+
+    // Enable or disable recording
+    static void setEnabled(bool enabled);
+    static bool isEnabled() { return s_enabled.load(std::memory_order_relaxed); }
+
+    // Enable recording from the MULTREPLACER_TRACE environment variable.
+    // Its value is used as the default export path.
+    static void initFromEnvironment();
+    static const std::string& defaultOutputPath();
+
+    // Record a finished event; name must point to a string literal
+    static void record(const char *name, int64_t startMicros, int64_t durationMicros);
+
+    // Drop all recorded events
+    static void clear();
+
+    // Position after the events recorded so far, to pass as since below,
+    // e.g. at the start of a run
+    static uint64_t mark();
+
+    // Copy of the kept events recorded since mark, oldest first
+    static std::vector<Event> events(uint64_t since = 0);
+
+    // Write the kept events as Chrome trace_event JSON
+    static bool writeChromeTrace(const std::string& path);
+
+    // Total time per phase of the events since mark in first-seen order,
+    // e.g. "loadFile 12.4ms | multiReplace 3.1ms"
+    static std::string summary(uint64_t since = 0);
+
+    // Monotonic clock in microseconds
+    static int64_t nowMicros();
+
+    static constexpr size_t kMaxEvents = 64 * 1024;
+
+private:
+    static std::atomic<bool> s_enabled;
+    static std::mutex s_mutex;
+    static std::vector<Event> s_events;   // ring of the last kMaxEvents
+    static uint64_t s_recorded;           // events recorded since startup
+    static uint64_t s_cleared;            // s_recorded when the ring was last emptied
+    static std::string s_outputPath;
+};
+
+/**
+ * TraceScope records the time between its construction and destruction
+ * as one event when tracing is enabled.
+ */
+class TraceScope
+{
+public:
+    explicit TraceScope(const char *name)
+        : m_name(name)
+        , m_start(Tracer::isEnabled() ? Tracer::nowMicros() : -1)
+    {
+    }
+
+    ~TraceScope()
+    {
+        if (m_start >= 0) {
+            Tracer::record(m_name, m_start, Tracer::nowMicros() - m_start);
+        }
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char *m_name;
+    int64_t m_start;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope_, __LINE__)(name)
+
+#endif // TRACER_H
@@ -1,29 +1,59 @@
 #include "translations.h"
-#include <QFile>
-#include <QCoreApplication>
-#include <QJsonDocument>
-#include <QJsonObject>
+#include <iterator>
+
+namespace {
+
+const QString kJapanese[] = {
+    QStringLiteral("置き換え君 Qt版 v1.0"),
+    QStringLiteral("参照"),
+    QStringLiteral("パス:"),
+    QStringLiteral("注意：英数変換キーなどを押すと、一文字としてカウントされることがあります！！"),
+    QStringLiteral("追加"),
+    QStringLiteral("実行"),
+    QStringLiteral("削除"),
+    QStringLiteral("置換前のテキスト"),
+    QStringLiteral("段階 (任意)"),
+    QStringLiteral("置換後のテキスト"),
+    QStringLiteral("確認"),
+    QStringLiteral("以下の変更内容を確認してください。元のファイルは変更されません。"),
+    QStringLiteral("キャンセル"),
+    QStringLiteral("実行"),
+    QStringLiteral("行へ移動:"),
+};
+
+const QString kEnglish[] = {
+    QStringLiteral("Multi Replacer Qt v1.0"),
+    QStringLiteral("Browse"),
+    QStringLiteral("Path:"),
+    QStringLiteral("Caution: Using IME convert keys may count as a single character!"),
+    QStringLiteral("Add"),
+    QStringLiteral("Execute"),
+    QStringLiteral("Delete"),
+    QStringLiteral("Text before replacement"),
+    QStringLiteral("Stage (optional)"),
+    QStringLiteral("Text after replacement"),
+    QStringLiteral("Confirmation"),
+    QStringLiteral("Review the changes below. Original file will not be modified."),
+    QStringLiteral("Cancel"),
+    QStringLiteral("Execute"),
+    QStringLiteral("Go to line:"),
+};
+
+static_assert(std::size(kJapanese) == static_cast<size_t>(TrKey::Count), "Japanese table does not match TrKey");
+static_assert(std::size(kEnglish) == static_cast<size_t>(TrKey::Count), "English table does not match TrKey");
+
+} // namespace
 
 Language Translations::currentLang = Language::JA;
-QMap<QString, QString> Translations::strings;
+const QString *Translations::strings = kJapanese;
 
 void Translations::load(Language lang)
 {
     currentLang = lang;
-    QString code = (lang == Language::JA) ? "ja" : "en";
-    QString filePath = QCoreApplication::applicationDirPath() + "/lang/" + code + ".json";
-    QFile file(filePath);
-    if (file.open(QIODevice::ReadOnly)) {
-        QJsonDocument doc = QJsonDocument::fromJson(file.readAll());
-        QJsonObject obj = doc.object();
-        strings.clear();
-        for (const QString& k : obj.keys()) {
-            strings[k] = obj[k].toString();
-        }
-    }
+    strings = (lang == Language::JA) ? kJapanese : kEnglish;
 }
 
-QString Translations::tr(const QString& key)
+const QString& Translations::tr(TrKey key)
 {
-    return strings.value(key, key);
+    return strings[static_cast<int>(key)];
 }
@@ -1,17 +1,41 @@
 #ifndef TRANSLATIONS_H
 #define TRANSLATIONS_H
 #include <QString>
-#include <QMap>
 
 enum class Language { JA, EN };
 
+// Keys of the translated UI strings; tables in translations.cpp follow this order
+enum class TrKey {
+    Title,
+    Browse,
+    PathLabel,
+    Caution,
+    Add,
+    Execute,
+    Delete,
+    BeforePlaceholder,
+    StagePlaceholder,
+    AfterPlaceholder,
+    Confirm,
+    ConfirmMessage,
+    Cancel,
+    ExecuteSave,
+    GoToLine,
+    Count
+};
+
+/**
+ * Translations are compiled into the binary as one table per language,
+ * indexed by TrKey. Switching the language only selects a table; strings
+ * are QStringLiterals, so nothing is read, parsed or allocated.
+ */
 class Translations {
 public:
     static void load(Language lang);
-    static QString tr(const QString& key);
+    static const QString& tr(TrKey key);
     static Language currentLang;
 private:
-    static QMap<QString, QString> strings;
+    static const QString *strings;
 };
 
 #endif // TRANSLATIONS_H
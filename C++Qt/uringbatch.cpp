@@ -0,0 +1,588 @@
+#include "uringbatch.h"
+#include "tracer.h"
+#include <vector>
+
+#ifdef MULTREPLACER_HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+// Operations of a file's chains, in the low bits of their user_data
+enum Op : uint64_t { OpStat, OpOpen, OpRead, OpClose, OpCreate, OpWrite, OpSync, OpCloseTemporary, OpRename };
+constexpr unsigned kOpBits = 4;
+constexpr unsigned kWriteChainOps = 5;  // open, write, fdatasync, close, rename
+
+const uint8_t kRequiredOps[] = {IORING_OP_OPENAT, IORING_OP_READ_FIXED, IORING_OP_WRITE_FIXED, IORING_OP_WRITE,
+                                IORING_OP_CLOSE, IORING_OP_STATX, IORING_OP_FSYNC, IORING_OP_RENAMEAT};
+
+std::atomic<uint64_t> s_temporaryCounter{0};
+
+int ringSetup(unsigned entries, io_uring_params *params)
+{
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int ringEnter(int fd, unsigned submit, unsigned wait)
+{
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, submit, wait, IORING_ENTER_GETEVENTS, nullptr, 0));
+}
+
+int ringRegister(int fd, unsigned opcode, const void *arg, unsigned count)
+{
+    return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, count));
+}
+
+// The process umask without changing it, which would race with other threads
+mode_t currentUmask()
+{
+    static const mode_t mask = [] {
+        mode_t value = 022;
+        if (std::FILE *status = std::fopen("/proc/self/status", "r")) {
+            char line[256];
+            while (std::fgets(line, sizeof(line), status)) {
+                unsigned parsed = 0;
+                if (std::sscanf(line, "Umask: %o", &parsed) == 1) {
+                    value = static_cast<mode_t>(parsed);
+                    break;
+                }
+            }
+            std::fclose(status);
+        }
+        return value;
+    }();
+    return mask;
+}
+
+} // namespace
+
+struct UringBatch::Ring {
+    struct Slot {
+        size_t index = 0;
+        std::string path;
+        std::string temporary;
+        std::string output;
+        struct statx stat;
+        unsigned pending = 0;
+        int error = 0;
+        size_t bytesRead = 0;
+        bool writing = false;
+        Result result;
+    };
+
+    ~Ring();
+    bool init(unsigned depth, size_t bufferSize, std::string *error);
+
+    char *inputBuffer(unsigned slot) { return buffers.data() + (2 * slot) * bufferSize; }
+    char *outputBuffer(unsigned slot) { return buffers.data() + (2 * slot + 1) * bufferSize; }
+
+    io_uring_sqe *nextSqe(unsigned slot, Op op, uint8_t flags);
+    void startRead(unsigned slot, size_t index, std::string&& path);
+    void startWrite(unsigned slot);
+    bool submitAndWait(uint64_t *enterCalls);
+    bool drain(uint64_t *enterCalls);
+    void reap();
+    void complete(uint64_t userData, int result);
+
+    int fd = -1;
+    void *sqRing = MAP_FAILED;
+    void *cqRing = MAP_FAILED;
+    size_t sqRingSize = 0;
+    size_t cqRingSize = 0;
+    io_uring_sqe *sqes = static_cast<io_uring_sqe *>(MAP_FAILED);
+    size_t sqesSize = 0;
+
+    unsigned *sqHead = nullptr;
+    unsigned *sqTail = nullptr;
+    unsigned *sqArray = nullptr;
+    unsigned sqMask = 0;
+    unsigned sqEntries = 0;
+    unsigned sqLocalTail = 0;
+    unsigned toSubmit = 0;
+    unsigned *cqHead = nullptr;
+    unsigned *cqTail = nullptr;
+    unsigned cqMask = 0;
+    io_uring_cqe *cqes = nullptr;
+
+    // Input and output buffer of every slot, registered in that order
+    size_t bufferSize = 0;
+    std::vector<char> buffers;
+    std::vector<Slot> slots;
+    std::vector<unsigned> finished;   // slots whose chain completed in the last reap
+    bool broken = false;              // stop taking files, see complete()
+};
+
+UringBatch::Ring::~Ring()
+{
+    if (sqes != MAP_FAILED) {
+        munmap(sqes, sqesSize);
+    }
+    if (cqRing != MAP_FAILED && cqRing != sqRing) {
+        munmap(cqRing, cqRingSize);
+    }
+    if (sqRing != MAP_FAILED) {
+        munmap(sqRing, sqRingSize);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+bool UringBatch::Ring::init(unsigned depth, size_t size, std::string *error)
+{
+    // Room for every slot's longest chain between two submissions
+    unsigned entries = 1;
+    while (entries < depth * kWriteChainOps) {
+        entries *= 2;
+    }
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    fd = ringSetup(entries, &params);
+    if (fd < 0) {
+        *error = std::string("io_uring_setup: ") + std::strerror(errno);
+        return false;
+    }
+
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single) {
+        sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+    }
+    sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    cqRing = single ? sqRing
+                    : mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    sqes = static_cast<io_uring_sqe *>(
+        mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+    if (sqRing == MAP_FAILED || cqRing == MAP_FAILED || sqes == MAP_FAILED) {
+        *error = std::string("io_uring mmap: ") + std::strerror(errno);
+        return false;
+    }
+    char *sq = static_cast<char *>(sqRing);
+    char *cq = static_cast<char *>(cqRing);
+    sqHead = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    sqMask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    sqEntries = params.sq_entries;
+    sqLocalTail = *sqTail;
+    cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    cqMask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+
+    // Every operation of the chains must be known to the kernel
+    std::vector<char> probeMemory(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op), 0);
+    io_uring_probe *probe = reinterpret_cast<io_uring_probe *>(probeMemory.data());
+    if (ringRegister(fd, IORING_REGISTER_PROBE, probe, 256) < 0) {
+        *error = std::string("io_uring probe: ") + std::strerror(errno);
+        return false;
+    }
+    for (uint8_t op : kRequiredOps) {
+        if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+            *error = "io_uring lacks operation " + std::to_string(op);
+            return false;
+        }
+    }
+
+    bufferSize = size;
+    buffers.resize(2 * depth * bufferSize);
+    std::vector<iovec> vectors(2 * depth);
+    for (size_t i = 0; i < vectors.size(); ++i) {
+        vectors[i].iov_base = buffers.data() + i * bufferSize;
+        vectors[i].iov_len = bufferSize;
+    }
+    if (ringRegister(fd, IORING_REGISTER_BUFFERS, vectors.data(), static_cast<unsigned>(vectors.size())) < 0) {
+        *error = std::string("io_uring buffers: ") + std::strerror(errno);
+        return false;
+    }
+    const std::vector<int> files(depth, -1);
+    if (ringRegister(fd, IORING_REGISTER_FILES, files.data(), depth) < 0) {
+        *error = std::string("io_uring files: ") + std::strerror(errno);
+        return false;
+    }
+    slots.resize(depth);
+    return true;
+}
+
+io_uring_sqe *UringBatch::Ring::nextSqe(unsigned slot, Op op, uint8_t flags)
+{
+    // The ring holds every slot's longest chain, so it is never full here
+    const unsigned index = sqLocalTail & sqMask;
+    io_uring_sqe *sqe = &sqes[index];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqe->flags = flags;
+    sqe->user_data = (static_cast<uint64_t>(slot) << kOpBits) | op;
+    sqArray[index] = index;
+    ++sqLocalTail;
+    ++toSubmit;
+    ++slots[slot].pending;
+    return sqe;
+}
+
+void UringBatch::Ring::startRead(unsigned slot, size_t index, std::string&& path)
+{
+    Slot& s = slots[slot];
+    s.index = index;
+    s.path = std::move(path);
+    s.pending = 0;
+    s.error = 0;
+    s.bytesRead = 0;
+    s.writing = false;
+    s.result = Result();
+
+    io_uring_sqe *sqe = nextSqe(slot, OpStat, 0);
+    sqe->opcode = IORING_OP_STATX;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = reinterpret_cast<uint64_t>(s.path.c_str());
+    sqe->len = STATX_TYPE | STATX_MODE;
+    sqe->off = reinterpret_cast<uint64_t>(&s.stat);
+    // The link itself: renaming over it would replace the link, not its target
+    sqe->statx_flags = AT_SYMLINK_NOFOLLOW;
+
+    // Open into the slot's registered file, read one byte more than the
+    // limit to tell larger files, close whatever the read did
+    sqe = nextSqe(slot, OpOpen, IOSQE_IO_LINK);
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = reinterpret_cast<uint64_t>(s.path.c_str());
+    sqe->open_flags = O_RDONLY;
+    sqe->file_index = slot + 1;
+
+    sqe = nextSqe(slot, OpRead, IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK);
+    sqe->opcode = IORING_OP_READ_FIXED;
+    sqe->fd = static_cast<int>(slot);
+    sqe->addr = reinterpret_cast<uint64_t>(inputBuffer(slot));
+    sqe->len = static_cast<uint32_t>(bufferSize);
+    sqe->buf_index = static_cast<uint16_t>(2 * slot);
+
+    sqe = nextSqe(slot, OpClose, 0);
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->file_index = slot + 1;
+}
+
+void UringBatch::Ring::startWrite(unsigned slot)
+{
+    Slot& s = slots[slot];
+    s.pending = 0;
+    s.writing = true;
+    s.temporary = s.path + ".multreplacer-" + std::to_string(getpid()) + "-"
+        + std::to_string(s_temporaryCounter.fetch_add(1, std::memory_order_relaxed));
+
+    // Every step is linked, so a failure cancels the rest and the rename
+    // only runs once the content is synced
+    io_uring_sqe *sqe = nextSqe(slot, OpCreate, IOSQE_IO_LINK);
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = reinterpret_cast<uint64_t>(s.temporary.c_str());
+    sqe->len = s.stat.stx_mode & 07777;
+    sqe->open_flags = O_WRONLY | O_CREAT | O_EXCL;
+    sqe->file_index = slot + 1;
+
+    sqe = nextSqe(slot, OpWrite, IOSQE_FIXED_FILE | IOSQE_IO_LINK);
+    sqe->fd = static_cast<int>(slot);
+    sqe->len = static_cast<uint32_t>(s.output.size());
+    if (s.output.size() <= bufferSize) {
+        std::memcpy(outputBuffer(slot), s.output.data(), s.output.size());
+        sqe->opcode = IORING_OP_WRITE_FIXED;
+        sqe->addr = reinterpret_cast<uint64_t>(outputBuffer(slot));
+        sqe->buf_index = static_cast<uint16_t>(2 * slot + 1);
+    } else {
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->addr = reinterpret_cast<uint64_t>(s.output.data());
+    }
+
+    sqe = nextSqe(slot, OpSync, IOSQE_FIXED_FILE | IOSQE_IO_LINK);
+    sqe->opcode = IORING_OP_FSYNC;
+    sqe->fd = static_cast<int>(slot);
+    sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+
+    sqe = nextSqe(slot, OpCloseTemporary, IOSQE_IO_LINK);
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->file_index = slot + 1;
+
+    sqe = nextSqe(slot, OpRename, 0);
+    sqe->opcode = IORING_OP_RENAMEAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = reinterpret_cast<uint64_t>(s.temporary.c_str());
+    sqe->len = static_cast<uint32_t>(AT_FDCWD);
+    sqe->addr2 = reinterpret_cast<uint64_t>(s.path.c_str());
+}
+
+bool UringBatch::Ring::submitAndWait(uint64_t *enterCalls)
+{
+    __atomic_store_n(sqTail, sqLocalTail, __ATOMIC_RELEASE);
+    for (;;) {
+        ++*enterCalls;
+        const int submitted = ringEnter(fd, toSubmit, 1);
+        if (submitted >= 0) {
+            toSubmit -= static_cast<unsigned>(submitted);
+            if (toSubmit == 0) {
+                break;
+            }
+            continue;
+        }
+        // Out of resources for now: completions free them
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            return false;
+        }
+        if (errno != EINTR && ringEnter(fd, 0, 1) < 0 && errno != EINTR) {
+            return false;
+        }
+    }
+
+    finished.clear();
+    reap();
+    return true;
+}
+
+bool UringBatch::Ring::drain(uint64_t *enterCalls)
+{
+    // Take back the entries the kernel has not consumed; a chain cut short
+    // counts as failed
+    for (unsigned i = sqLocalTail - toSubmit; i != sqLocalTail; ++i) {
+        Slot& s = slots[sqes[i & sqMask].user_data >> kOpBits];
+        --s.pending;
+        if (s.error == 0) {
+            s.error = ECANCELED;
+        }
+    }
+    sqLocalTail -= toSubmit;
+    toSubmit = 0;
+    __atomic_store_n(sqTail, sqLocalTail, __ATOMIC_RELEASE);
+
+    // Wait for the completions of the rest
+    auto inFlight = [this] {
+        return std::any_of(slots.begin(), slots.end(), [](const Slot& s) { return s.pending > 0; });
+    };
+    finished.clear();
+    reap();
+    while (inFlight()) {
+        ++*enterCalls;
+        if (ringEnter(fd, 0, 1) < 0 && errno != EINTR) {
+            return false;
+        }
+        reap();
+    }
+    return true;
+}
+
+void UringBatch::Ring::reap()
+{
+    unsigned head = *cqHead;
+    const unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+        const io_uring_cqe& cqe = cqes[head & cqMask];
+        complete(cqe.user_data, cqe.res);
+    }
+    __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+}
+
+void UringBatch::Ring::complete(uint64_t userData, int result)
+{
+    const unsigned slot = static_cast<unsigned>(userData >> kOpBits);
+    const Op op = static_cast<Op>(userData & ((1u << kOpBits) - 1));
+    Slot& s = slots[slot];
+
+    // The first failure of a chain is its cause; the rest are cancelled
+    if (result < 0 && s.error == 0) {
+        s.error = -result;
+        // Kernels before 5.15 cannot open into a registered file slot
+        if (op == OpOpen && result == -EINVAL) {
+            broken = true;
+        }
+    }
+    if (op == OpRead && result >= 0) {
+        s.bytesRead = static_cast<size_t>(result);
+    }
+    if (op == OpWrite && result >= 0 && static_cast<size_t>(result) != s.output.size() && s.error == 0) {
+        s.error = EIO;
+    }
+    if (--s.pending == 0) {
+        finished.push_back(slot);
+    }
+}
+
+UringBatch::UringBatch(unsigned depth, size_t fileLimit)
+    : m_ring(new Ring)
+    , m_depth(depth)
+    , m_fileLimit(fileLimit)
+    , m_enterCalls(0)
+{
+    if (!m_ring->init(depth, fileLimit + 1, &m_error)) {
+        m_ring.reset();
+    }
+}
+
+UringBatch::~UringBatch() = default;
+
+bool UringBatch::isReady() const
+{
+    return m_ring && !m_ring->broken;
+}
+
+size_t UringBatch::bufferBytes() const
+{
+    return m_ring ? m_ring->buffers.size() : 0;
+}
+
+void UringBatch::run(const Next& next, const Process& process, const Done& done)
+{
+    TRACE_SCOPE("uringBatch");
+
+    if (!isReady()) {
+        return;
+    }
+    Ring& ring = *m_ring;
+    std::vector<unsigned> freeSlots;
+    for (unsigned slot = m_depth; slot-- > 0;) {
+        freeSlots.push_back(slot);
+    }
+
+    // Returns true when the slot's file is done and the slot is free again
+    auto advance = [&](unsigned slot) {
+        Ring::Slot& s = ring.slots[slot];
+        Result& result = s.result;
+        if (!s.writing) {
+            result.bytesIn = s.bytesRead;
+            if (s.error != 0) {
+                result.status = Status::Failed;
+                result.error = s.error;
+            } else if (s.bytesRead > m_fileLimit || !S_ISREG(s.stat.stx_mode)) {
+                result.status = Status::Declined;
+            } else {
+                s.output.clear();
+                const int64_t matches = process(s.index, ring.inputBuffer(slot), s.bytesRead, s.output);
+                if (matches < 0 || s.output.size() > UINT32_MAX) {
+                    result.status = Status::Declined;
+                } else if (matches == 0) {
+                    result.status = Status::Unchanged;
+                    result.bytesOut = s.bytesRead;
+                } else {
+                    result.matches = static_cast<uint64_t>(matches);
+                    ring.startWrite(slot);
+                    return false;
+                }
+            }
+        } else if (s.error != 0) {
+            unlink(s.temporary.c_str());
+            result.status = Status::Failed;
+            result.error = s.error;
+        } else {
+            // The temporary file was created under the umask
+            const mode_t mode = s.stat.stx_mode & 07777;
+            if ((mode & ~currentUmask()) != mode) {
+                chmod(s.path.c_str(), mode);
+            }
+            result.status = Status::Written;
+            result.bytesOut = s.output.size();
+        }
+        done(s.index, result);
+        if (s.output.capacity() > 4 * ring.bufferSize) {
+            s.output = std::string();
+        }
+        return true;
+    };
+
+    unsigned busy = 0;
+    bool more = true;
+    for (;;) {
+        while (more && !ring.broken && !freeSlots.empty()) {
+            size_t index = 0;
+            std::string path;
+            if (!next(&index, &path)) {
+                more = false;
+                break;
+            }
+            const unsigned slot = freeSlots.back();
+            freeSlots.pop_back();
+            ring.startRead(slot, index, std::move(path));
+            ++busy;
+        }
+        if (busy == 0) {
+            break;
+        }
+        if (!ring.submitAndWait(&m_enterCalls)) {
+            // The ring is unusable. Its chains are taken back or waited for
+            // before their files are reported, so the caller's regular path
+            // never races a write still in flight.
+            m_error = std::string("io_uring_enter: ") + std::strerror(errno);
+            ring.broken = true;
+            const bool drained = ring.drain(&m_enterCalls);
+            std::vector<bool> isFree(m_depth, false);
+            for (unsigned slot : freeSlots) {
+                isFree[slot] = true;
+            }
+            for (unsigned slot = 0; slot < m_depth; ++slot) {
+                Ring::Slot& s = ring.slots[slot];
+                if (isFree[slot]) {
+                    continue;
+                }
+                if (s.writing && s.pending == 0) {
+                    // Finished, failed or cut short: reported as usual
+                    advance(slot);
+                    continue;
+                }
+                s.result.status = s.writing ? Status::Abandoned : Status::Failed;
+                s.result.error = EIO;
+                done(s.index, s.result);
+            }
+            if (!drained) {
+                m_error += ", operations still in flight";
+            }
+            break;
+        }
+        for (unsigned slot : ring.finished) {
+            if (advance(slot)) {
+                freeSlots.push_back(slot);
+                --busy;
+            }
+        }
+    }
+    if (ring.broken && m_error.empty()) {
+        m_error = "io_uring cannot open files into registered slots";
+    }
+}
+
+#else
+
+struct UringBatch::Ring {
+};
+
+UringBatch::UringBatch(unsigned depth, size_t fileLimit)
+    : m_depth(depth)
+    , m_fileLimit(fileLimit)
+    , m_error("io_uring is not available in this build")
+    , m_enterCalls(0)
+{
+}
+
+UringBatch::~UringBatch() = default;
+
+bool UringBatch::isReady() const
+{
+    return false;
+}
+
+size_t UringBatch::bufferBytes() const
+{
+    return 0;
+}
+
+void UringBatch::run(const Next&, const Process&, const Done&)
+{
+    TRACE_SCOPE("uringBatch");
+}
+
+#endif // MULTREPLACER_HAVE_IO_URING
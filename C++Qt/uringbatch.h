@@ -0,0 +1,90 @@
+#ifndef URINGBATCH_H
+#define URINGBATCH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+/**
+ * UringBatch replaces many small files through one io_uring instance, so
+ * a run over a large tree is not bound by one open/read/close/write/rename
+ * syscall after another per file.
+ *
+ * Up to depth files are in flight. Each is read as one linked chain (open
+ * into a registered file slot, read into a registered buffer, close) next
+ * to a statx for its mode; a changed file is written back by a second
+ * chain (open a temporary file, write, fdatasync, close, rename over the
+ * file) that stops at the first failure, so the file is only replaced
+ * once the new content is on disk. All chains of a round go to the kernel
+ * in one submission.
+ *
+ * The ring is built on the raw kernel interface, compiled in on Linux when
+ * the headers have it (MULTREPLACER_HAVE_IO_URING). isReady() is false
+ * when the ring cannot be set up, e.g. on older kernels, without the
+ * needed operations or when io_uring is blocked; callers then take their
+ * thread pool path. Files this backend does not handle, e.g. symbolic
+ * links and other files that are not regular, come back as Declined or
+ * Failed for the caller's regular path to take over.
+ */
+class UringBatch
+{
+public:
+    enum class Status {
+        Unchanged,  // read and left alone
+        Written,    // replaced by the output
+        Declined,   // larger than fileLimit or refused by process; not touched
+        Failed,     // an operation failed, see error; the file is unchanged
+        Abandoned   // the ring failed while its write was in flight and could
+                    // not be waited for; the file may have been replaced
+    };
+
+    struct Result {
+        Status status = Status::Failed;
+        uint64_t matches = 0;
+        size_t bytesIn = 0;
+        size_t bytesOut = 0;
+        int error = 0;  // errno of the first failed operation
+    };
+
+    // Next file to replace and its index; false when there is none
+    using Next = std::function<bool(size_t *index, std::string *path)>;
+    // Output for a file's content: returns its number of matches, 0 to
+    // leave the file alone or -1 to decline it
+    using Process = std::function<int64_t(size_t index, const char *data, size_t length, std::string& output)>;
+    using Done = std::function<void(size_t index, const Result& result)>;
+
+    explicit UringBatch(unsigned depth = kDefaultDepth, size_t fileLimit = kDefaultFileLimit);
+    ~UringBatch();
+
+    UringBatch(const UringBatch&) = delete;
+    UringBatch& operator=(const UringBatch&) = delete;
+
+    // False when io_uring is not available; run() then does nothing
+    bool isReady() const;
+    const std::string& error() const { return m_error; }
+
+    // Registered buffer memory, two buffers per file in flight
+    size_t bufferBytes() const;
+
+    // Replace files taken from next until it returns false or the ring
+    // stops working, calling process and done on this thread
+    void run(const Next& next, const Process& process, const Done& done);
+
+    // Calls into the kernel so far, for comparison with the file count
+    uint64_t enterCalls() const { return m_enterCalls; }
+
+    static constexpr unsigned kDefaultDepth = 32;
+    static constexpr size_t kDefaultFileLimit = 64 * 1024;
+
+private:
+    struct Ring;
+    std::unique_ptr<Ring> m_ring;
+    unsigned m_depth;
+    size_t m_fileLimit;
+    std::string m_error;
+    uint64_t m_enterCalls;
+};
+
+#endif // URINGBATCH_H